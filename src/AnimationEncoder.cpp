@@ -0,0 +1,491 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "AnimationEncoder.h"
+
+#include <wx/mstream.h>
+#include <wx/zstream.h>
+#include <wx/quantize.h>
+#include <wx/progdlg.h>
+#include <wx/filename.h>
+
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+
+AnimationEncoder::AnimationEncoder(Format format, int width, int height, int delay)
+{
+  m_format = format;
+  m_width  = width;
+  m_height = height;
+  if(m_width  < 1) m_width  = 1;
+  if(m_height < 1) m_height = 1;
+  m_delay  = delay;
+  if(m_delay < 10) m_delay = 10;
+  m_apngSequence = 0;
+  m_framesDone = 0;
+  m_cancelled = false;
+}
+
+AnimationEncoder::~AnimationEncoder()
+{
+}
+
+AnimationEncoder::Format AnimationEncoder::FormatFromFileName(wxString filename)
+{
+  wxString ext = wxFileName(filename).GetExt().Lower();
+  if((ext == wxT("png")) || (ext == wxT("apng")))
+    return apng;
+  return gif;
+}
+
+void AnimationEncoder::AddFrame(const wxMemoryBuffer &compressedImage)
+{
+  const unsigned char *data = (const unsigned char *) compressedImage.GetData();
+  m_frames.push_back(std::vector<unsigned char>(data, data + compressedImage.GetDataLen()));
+}
+
+int AnimationEncoder::FramesDone()
+{
+  wxCriticalSectionLocker lock(m_lock);
+  return m_framesDone;
+}
+
+void AnimationEncoder::Cancel()
+{
+  wxCriticalSectionLocker lock(m_lock);
+  m_cancelled = true;
+}
+
+bool AnimationEncoder::IsCancelled()
+{
+  wxCriticalSectionLocker lock(m_lock);
+  return m_cancelled;
+}
+
+bool AnimationEncoder::Write(wxOutputStream &out, wxWindow *parent)
+{
+  EncoderThread *thread = new EncoderThread(this, &out);
+  if((thread->Create() != wxTHREAD_NO_ERROR) || (thread->Run() != wxTHREAD_NO_ERROR))
+  {
+    // No threads available => encode synchronously.
+    delete thread;
+    return Encode(out);
+  }
+
+  {
+    wxProgressDialog progress(_("Exporting animation"),
+                              _("Encoding the frames of the animation..."),
+                              (int) m_frames.size(), parent,
+                              wxPD_APP_MODAL | wxPD_CAN_ABORT |
+                              wxPD_AUTO_HIDE | wxPD_ELAPSED_TIME);
+    while(thread->IsAlive())
+    {
+      int done = FramesDone();
+      if(done > (int) m_frames.size())
+        done = m_frames.size();
+      if(!progress.Update(done))
+        Cancel();
+      wxMilliSleep(50);
+    }
+  }
+
+  bool success = (thread->Wait() == (wxThread::ExitCode) 0);
+  delete thread;
+  return success && !IsCancelled();
+}
+
+AnimationEncoder::EncoderThread::EncoderThread(AnimationEncoder *encoder, wxOutputStream *out) :
+  wxThread(wxTHREAD_JOINABLE)
+{
+  m_encoder = encoder;
+  m_out = out;
+}
+
+wxThread::ExitCode AnimationEncoder::EncoderThread::Entry()
+{
+  if(m_encoder->Encode(*m_out))
+    return (wxThread::ExitCode) 0;
+  else
+    return (wxThread::ExitCode) 1;
+}
+
+bool AnimationEncoder::Encode(wxOutputStream &out)
+{
+  if(m_format == gif)
+    WriteGifHeader(out);
+  else
+    WriteApngHeader(out);
+
+  for(size_t i = 0; i < m_frames.size(); i++)
+  {
+    if(IsCancelled())
+      return false;
+
+    wxImage image = GetFrame(i);
+    bool success;
+    if(m_format == gif)
+      success = WriteGifFrame(out, image);
+    else
+      success = WriteApngFrame(out, image, i);
+    if(!success)
+      return false;
+
+    wxCriticalSectionLocker lock(m_lock);
+    m_framesDone++;
+  }
+
+  if(m_format == gif)
+    out.PutC(0x3B);
+  else
+    WritePngChunk(out, "IEND", NULL, 0);
+
+  return out.IsOk();
+}
+
+wxImage AnimationEncoder::GetFrame(int n)
+{
+  wxImage image;
+  if(m_frames[n].size() > 0)
+  {
+    wxMemoryInputStream istream(&m_frames[n][0], m_frames[n].size());
+    image.LoadFile(istream, wxBITMAP_TYPE_ANY);
+  }
+
+  if(!image.Ok())
+  {
+    // A frame we cannot decode is replaced by a blank one.
+    image.Create(m_width, m_height);
+    image.SetRGB(wxRect(0, 0, m_width, m_height), 255, 255, 255);
+    return image;
+  }
+
+  // Neither our GIF nor our PNG frames know about transparency
+  // => blend transparent pixels against a white background.
+  if(image.HasAlpha())
+  {
+    unsigned char *rgb   = image.GetData();
+    unsigned char *alpha = image.GetAlpha();
+    size_t pixels = image.GetWidth() * image.GetHeight();
+    for(size_t i = 0; i < pixels; i++)
+    {
+      for(int c = 0; c < 3; c++)
+        rgb[3 * i + c] = (rgb[3 * i + c] * alpha[i] + 255 * (255 - alpha[i])) / 255;
+    }
+    image.ClearAlpha();
+  }
+
+  if((image.GetWidth() != m_width) || (image.GetHeight() != m_height))
+    image.Resize(wxSize(m_width, m_height),
+                 wxPoint((m_width  - image.GetWidth())  / 2,
+                         (m_height - image.GetHeight()) / 2),
+                 255, 255, 255);
+  return image;
+}
+
+void AnimationEncoder::PutLE16(wxOutputStream &out, int value)
+{
+  out.PutC(value & 0xFF);
+  out.PutC((value >> 8) & 0xFF);
+}
+
+void AnimationEncoder::PutBE32(unsigned char *buf, wxUint32 value)
+{
+  buf[0] = (value >> 24) & 0xFF;
+  buf[1] = (value >> 16) & 0xFF;
+  buf[2] = (value >>  8) & 0xFF;
+  buf[3] = value & 0xFF;
+}
+
+void AnimationEncoder::WriteGifHeader(wxOutputStream &out)
+{
+  out.Write("GIF89a", 6);
+
+  // The logical screen descriptor: No global color table, since every
+  // frame comes with a palette of its own.
+  PutLE16(out, m_width);
+  PutLE16(out, m_height);
+  out.PutC(0x00);
+  out.PutC(0x00);
+  out.PutC(0x00);
+
+  // The NETSCAPE2.0 application extension: Loop forever.
+  out.PutC(0x21);
+  out.PutC(0xFF);
+  out.PutC(0x0B);
+  out.Write("NETSCAPE2.0", 11);
+  out.PutC(0x03);
+  out.PutC(0x01);
+  PutLE16(out, 0);
+  out.PutC(0x00);
+}
+
+bool AnimationEncoder::WriteGifFrame(wxOutputStream &out, const wxImage &image)
+{
+  wxImage quantized;
+  unsigned char *indices = NULL;
+
+  // We don't ask wxQuantize for a wxPalette: That is a GDI object and
+  // therefore nothing we want to create outside the GUI thread.
+  if(!wxQuantize::Quantize(image, quantized, NULL, 256, &indices,
+                           wxQUANTIZE_FILL_DESTINATION_IMAGE | wxQUANTIZE_RETURN_8BIT_DATA) ||
+     (indices == NULL))
+    return false;
+
+  // Recover the palette from the pixels the quantizer has filled in.
+  unsigned char palette[256 * 3];
+  memset(palette, 0, sizeof(palette));
+  const unsigned char *rgb = quantized.GetData();
+  size_t pixels = m_width * m_height;
+  for(size_t i = 0; i < pixels; i++)
+  {
+    palette[3 * indices[i]    ] = rgb[3 * i];
+    palette[3 * indices[i] + 1] = rgb[3 * i + 1];
+    palette[3 * indices[i] + 2] = rgb[3 * i + 2];
+  }
+
+  // The graphic control extension: The frame delay [in 1/100s]
+  out.PutC(0x21);
+  out.PutC(0xF9);
+  out.PutC(0x04);
+  out.PutC(0x04); // Disposal method 1: Leave the frame in place.
+  PutLE16(out, m_delay / 10);
+  out.PutC(0x00);
+  out.PutC(0x00);
+
+  // The image descriptor with a local 256-color table
+  out.PutC(0x2C);
+  PutLE16(out, 0);
+  PutLE16(out, 0);
+  PutLE16(out, m_width);
+  PutLE16(out, m_height);
+  out.PutC(0x87);
+  out.Write(palette, sizeof(palette));
+
+  WriteGifLZW(out, indices, pixels);
+  delete [] indices;
+  return out.IsOk();
+}
+
+//! Packs the variable-length LZW codes into 255-byte GIF data sub-blocks.
+class GifBitWriter
+{
+public:
+  GifBitWriter(wxOutputStream &out) : m_out(out)
+  {
+    m_bits = 0;
+    m_bitCount = 0;
+    m_chunkLen = 0;
+  }
+  void WriteCode(unsigned int code, int length)
+  {
+    m_bits |= code << m_bitCount;
+    m_bitCount += length;
+    while(m_bitCount >= 8)
+    {
+      PutByte(m_bits & 0xFF);
+      m_bits >>= 8;
+      m_bitCount -= 8;
+    }
+  }
+  void Flush()
+  {
+    if(m_bitCount > 0)
+      PutByte(m_bits & 0xFF);
+    m_bits = 0;
+    m_bitCount = 0;
+    FlushChunk();
+  }
+private:
+  void PutByte(unsigned char byte)
+  {
+    m_chunk[m_chunkLen++] = byte;
+    if(m_chunkLen == 255)
+      FlushChunk();
+  }
+  void FlushChunk()
+  {
+    if(m_chunkLen == 0)
+      return;
+    m_out.PutC(m_chunkLen);
+    m_out.Write(m_chunk, m_chunkLen);
+    m_chunkLen = 0;
+  }
+  wxOutputStream &m_out;
+  wxUint32 m_bits;
+  int m_bitCount;
+  unsigned char m_chunk[255];
+  int m_chunkLen;
+};
+
+void AnimationEncoder::WriteGifLZW(wxOutputStream &out, const unsigned char *data, size_t len)
+{
+  const int minCodeSize = 8;
+  const unsigned int clearCode = 1 << minCodeSize;
+  const unsigned int maxDictionarySize = 4096;
+
+  out.PutC(minCodeSize);
+  GifBitWriter writer(out);
+
+  // The dictionary as a tree: codeTree[code * 256 + byte] is the code that
+  // extends "code" by "byte" or 0 if there isn't one yet.
+  std::vector<wxUint16> codeTree(maxDictionarySize * 256, 0);
+
+  int codeSize = minCodeSize + 1;
+  unsigned int maxCode = clearCode + 1;
+  writer.WriteCode(clearCode, codeSize);
+
+  if(len == 0)
+  {
+    writer.WriteCode(clearCode + 1, codeSize);
+    writer.Flush();
+    out.PutC(0x00);
+    return;
+  }
+
+  unsigned int curCode = data[0];
+  for(size_t i = 1; i < len; i++)
+  {
+    unsigned int next = data[i];
+    wxUint16 extended = codeTree[curCode * 256 + next];
+    if(extended != 0)
+    {
+      curCode = extended;
+      continue;
+    }
+
+    writer.WriteCode(curCode, codeSize);
+    codeTree[curCode * 256 + next] = ++maxCode;
+    if(maxCode >= (1U << codeSize))
+      codeSize++;
+
+    // The dictionary is full => start over.
+    if(maxCode == maxDictionarySize - 1)
+    {
+      writer.WriteCode(clearCode, codeSize);
+      std::fill(codeTree.begin(), codeTree.end(), 0);
+      codeSize = minCodeSize + 1;
+      maxCode = clearCode + 1;
+    }
+    curCode = next;
+  }
+
+  writer.WriteCode(curCode, codeSize);
+  // The decoder adds a dictionary entry for this code, too, and widens its
+  // codes if this entry reaches the next power of 2.
+  if((maxCode + 1 >= (1U << codeSize)) && (codeSize < 12))
+    codeSize++;
+  writer.WriteCode(clearCode, codeSize);
+  writer.WriteCode(clearCode + 1, minCodeSize + 1);
+  writer.Flush();
+  // The block terminator
+  out.PutC(0x00);
+}
+
+void AnimationEncoder::WritePngChunk(wxOutputStream &out, const char *type,
+                                     const unsigned char *data, size_t len)
+{
+  unsigned char buf[4];
+  PutBE32(buf, len);
+  out.Write(buf, 4);
+  out.Write(type, 4);
+  if(len > 0)
+    out.Write(data, len);
+
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, (const Bytef *) type, 4);
+  if(len > 0)
+    crc = crc32(crc, data, len);
+  PutBE32(buf, crc);
+  out.Write(buf, 4);
+}
+
+void AnimationEncoder::WriteApngHeader(wxOutputStream &out)
+{
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+  out.Write(signature, 8);
+
+  unsigned char ihdr[13];
+  PutBE32(ihdr, m_width);
+  PutBE32(ihdr + 4, m_height);
+  ihdr[8]  = 8; // Bit depth
+  ihdr[9]  = 2; // Color type: RGB
+  ihdr[10] = 0; // Compression method: deflate
+  ihdr[11] = 0; // Filter method: adaptive
+  ihdr[12] = 0; // No interlacing
+  WritePngChunk(out, "IHDR", ihdr, 13);
+
+  unsigned char actl[8];
+  PutBE32(actl, m_frames.size());
+  PutBE32(actl + 4, 0); // Loop forever
+  WritePngChunk(out, "acTL", actl, 8);
+}
+
+bool AnimationEncoder::WriteApngFrame(wxOutputStream &out, const wxImage &image, int n)
+{
+  unsigned char fctl[26];
+  PutBE32(fctl, m_apngSequence++);
+  PutBE32(fctl + 4, m_width);
+  PutBE32(fctl + 8, m_height);
+  PutBE32(fctl + 12, 0);
+  PutBE32(fctl + 16, 0);
+  fctl[20] = (m_delay >> 8) & 0xFF;
+  fctl[21] = m_delay & 0xFF;
+  fctl[22] = 1000 >> 8;
+  fctl[23] = 1000 & 0xFF;
+  fctl[24] = 0; // dispose_op: none
+  fctl[25] = 0; // blend_op: source
+  WritePngChunk(out, "fcTL", fctl, 26);
+
+  // Compress the scanlines using the "sub" filter.
+  // The first 4 bytes are reserved for the sequence number fdAT chunks need.
+  wxMemoryOutputStream compressed;
+  {
+    wxZlibOutputStream zlib(compressed, wxZ_BEST_COMPRESSION, wxZLIB_ZLIB);
+    const unsigned char *rgb = image.GetData();
+    size_t rowLen = 3 * m_width;
+    std::vector<unsigned char> row(rowLen + 1);
+    row[0] = 1;
+    for(int y = 0; y < m_height; y++)
+    {
+      const unsigned char *line = rgb + y * rowLen;
+      for(size_t x = 0; x < rowLen; x++)
+        row[x + 1] = (x < 3) ? line[x] : (unsigned char)(line[x] - line[x - 3]);
+      zlib.Write(&row[0], row.size());
+    }
+    if(!zlib.Close())
+      return false;
+  }
+
+  size_t compressedLen = compressed.GetSize();
+  std::vector<unsigned char> data(compressedLen + 4);
+  compressed.CopyTo(&data[4], compressedLen);
+
+  // The first frame doubles as the default image for viewers that don't
+  // know about APNG.
+  if(n == 0)
+    WritePngChunk(out, "IDAT", &data[4], data.size() - 4);
+  else
+  {
+    PutBE32(&data[0], m_apngSequence++);
+    WritePngChunk(out, "fdAT", &data[0], data.size());
+  }
+  return out.IsOk();
+}
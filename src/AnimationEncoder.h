@@ -0,0 +1,140 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  The in-process encoder for animated GIF and APNG files.
+ */
+
+#ifndef ANIMATIONENCODER_H
+#define ANIMATIONENCODER_H
+
+#include <wx/wx.h>
+#include <wx/image.h>
+#include <wx/stream.h>
+#include <wx/buffer.h>
+#include <wx/thread.h>
+
+#include <vector>
+
+/*! Encodes a list of images into an animated GIF or an animated PNG
+
+  The frames are handed over in their compressed form (the way Image stores
+  them). Decoding, palette quantisation, LZW/deflate compression and writing
+  the result to the output stream all happen on a worker thread so the only
+  thing the GUI thread has to do is to show a progress dialog that allows
+  the user to cancel the export.
+
+  All frames are centered on a canvas of the size passed to the constructor.
+ */
+class AnimationEncoder
+{
+public:
+  enum Format
+  {
+    gif,
+    apng
+  };
+
+  /*! The constructor
+
+    \param format The file format to generate
+    \param width  The width of the animation's canvas
+    \param height The height of the animation's canvas
+    \param delay  The time each frame is displayed [in milliseconds]
+   */
+  AnimationEncoder(Format format, int width, int height, int delay);
+  ~AnimationEncoder();
+
+  //! Guesses the right file format from a file name
+  static Format FormatFromFileName(wxString filename);
+
+  //! Adds a frame in compressed form (png, jpeg,...) to the animation
+  void AddFrame(const wxMemoryBuffer &compressedImage);
+
+  /*! Writes the animation to a stream
+
+    Blocks until the worker thread has finished, but keeps a progress dialog
+    alive in the meantime.
+
+    \param out The stream to write the animation to
+    \param parent The parent window of the progress dialog.
+    \return false if the export failed or has been cancelled by the user.
+   */
+  bool Write(wxOutputStream &out, wxWindow *parent = NULL);
+
+  //! The number of frames that have already been written out
+  int FramesDone();
+
+  //! Asks the worker thread to stop as soon as possible.
+  void Cancel();
+
+  //! Has the encoding been cancelled?
+  bool IsCancelled();
+
+private:
+  //! The worker thread that does the actual encoding
+  class EncoderThread : public wxThread
+  {
+  public:
+    EncoderThread(AnimationEncoder *encoder, wxOutputStream *out);
+    virtual ExitCode Entry();
+  private:
+    AnimationEncoder *m_encoder;
+    wxOutputStream *m_out;
+  };
+
+  //! Encodes all frames into a stream. Runs in the worker thread.
+  bool Encode(wxOutputStream &out);
+  //! Decodes frame n and centers it on the canvas
+  wxImage GetFrame(int n);
+
+  //! Writes the GIF header, the logical screen and the looping extension
+  void WriteGifHeader(wxOutputStream &out);
+  //! Quantises a frame and writes it as a GIF image block
+  bool WriteGifFrame(wxOutputStream &out, const wxImage &image);
+  //! LZW-compresses 8-bit pixel data into GIF data sub-blocks
+  void WriteGifLZW(wxOutputStream &out, const unsigned char *data, size_t len);
+
+  //! Writes the PNG signature, the IHDR and the acTL chunk
+  void WriteApngHeader(wxOutputStream &out);
+  //! Writes a fcTL chunk and the IDAT/fdAT chunk for a frame
+  bool WriteApngFrame(wxOutputStream &out, const wxImage &image, int n);
+  //! Writes a PNG chunk including its length and CRC
+  void WritePngChunk(wxOutputStream &out, const char *type,
+                     const unsigned char *data, size_t len);
+
+  static void PutLE16(wxOutputStream &out, int value);
+  static void PutBE32(unsigned char *buf, wxUint32 value);
+
+  Format m_format;
+  int m_width;
+  int m_height;
+  int m_delay;
+  //! Plain copies of the compressed frames: wxMemoryBuffer isn't thread-safe
+  std::vector<std::vector<unsigned char> > m_frames;
+  //! The sequence number of the next APNG chunk
+  wxUint32 m_apngSequence;
+
+  wxCriticalSection m_lock;
+  int m_framesDone;
+  bool m_cancelled;
+};
+
+#endif // ANIMATIONENCODER_H
@@ -21,6 +21,7 @@
 
 #include "Autocomplete.h"
 #include "Dirstructure.h"
+#include "MappedFile.h"
 
 #include <wx/textfile.h>
 
@@ -40,26 +41,23 @@ bool AutoComplete::LoadSymbols(wxString file)
       m_wordList[i].Clear();
   }
  
-  wxString line;
-  wxString rest, function;
-  wxTextFile index(file);
+  // Only the lines we are interested in are converted to wxStrings.
+  MappedFile index(file);
+  const char *line;
+  size_t length;
 
-  index.Open();
-
-  for(line = index.GetFirstLine(); !index.Eof(); line = index.GetNextLine())
+  while(index.NextLine(line, length))
   {
-    if (line.StartsWith(wxT("FUNCTION: ")) ||
-        line.StartsWith(wxT("OPTION  : ")))
-      m_wordList[command].Add(line.Mid(10));
-    else if (line.StartsWith(wxT("TEMPLATE: ")))
-      m_wordList[tmplte].Add(FixTemplate(line.Mid(10)));
+    if (MappedFile::StartsWith(line, length, "FUNCTION: ") ||
+        MappedFile::StartsWith(line, length, "OPTION  : "))
+      m_wordList[command].Add(MappedFile::ToString(line + 10, length - 10));
+    else if (MappedFile::StartsWith(line, length, "TEMPLATE: "))
+      m_wordList[tmplte].Add(FixTemplate(MappedFile::ToString(line + 10, length - 10)));
       else if
-        (line.StartsWith(wxT("UNIT: ")))
-        m_wordList[unit].Add(FixTemplate(line.Mid(6)));
+        (MappedFile::StartsWith(line, length, "UNIT: "))
+        m_wordList[unit].Add(FixTemplate(MappedFile::ToString(line + 6, length - 6)));
   }
 
-  index.Close();
-
   /// Add wxMaxima functions
   m_wordList[command].Add(wxT("wxanimate_framerate"));
   m_wordList[command].Add(wxT("wxplot_pngcairo"));
@@ -0,0 +1,259 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "BatchRunner.h"
+#include "MathCtrl.h"
+#include "MappedFile.h"
+#include "WXMXLoader.h"
+#include "WXMXSnapshot.h"
+#include "XMLWriter.h"
+
+#include <wx/config.h>
+#include <wx/evtloop.h>
+#include <wx/filename.h>
+#include <wx/mstream.h>
+#include <wx/uri.h>
+
+#include <iostream>
+
+BatchRunner::BatchRunner(wxString file, wxEvtHandler *notify, int notifyId)
+{
+  m_file = file;
+  m_notify = notify;
+  m_notifyId = notifyId;
+  m_ok = false;
+  m_loaded = false;
+  m_tree = NULL;
+  m_zoomFactor = 1.0;
+  m_kernel = new MaximaKernel(m_file, this, kernel_id);
+}
+
+BatchRunner::~BatchRunner()
+{
+  // The kernel must not touch the cells any more once they are gone.
+  wxDELETE(m_kernel);
+  MathCtrl::DestroyTree(m_tree);
+}
+
+void BatchRunner::Start()
+{
+  if (!Load())
+  {
+    Finish();
+    return;
+  }
+  m_loaded = true;
+
+  for (GroupCell *tmp = m_tree; tmp != NULL; tmp = dynamic_cast<GroupCell*>(tmp->m_next))
+    m_kernel->AddToQueue(tmp);
+  m_kernel->Start();
+}
+
+void BatchRunner::OnKernelEvent(wxThreadEvent &event)
+{
+  if (event.GetInt() == MaximaKernel::KERNEL_FINISHED)
+  {
+    m_error = m_kernel->GetError();
+    Finish();
+  }
+}
+
+bool BatchRunner::Load()
+{
+  if (m_file.Lower().EndsWith(wxT(".wxmx")))
+  {
+    // An empty file is an empty worksheet, see wxMaxima::OpenWXMXFile().
+    if (wxFileName::GetSize(m_file) == 0)
+      return true;
+
+    wxXmlDocument xmldoc;
+    WXMXLoader loader(m_file);
+    if (!loader.Load(xmldoc) || (xmldoc.GetRoot() == NULL) ||
+        (xmldoc.GetRoot()->GetName() != wxT("wxMaximaDocument")))
+    {
+      m_error = _("The file could not be read");
+      return false;
+    }
+
+    long zoom = 100;
+    if (!xmldoc.GetRoot()->GetAttribute(wxT("zoom"), wxT("100")).ToLong(&zoom))
+      zoom = 100;
+    m_zoomFactor = double(zoom) / 100.0;
+
+    wxString wxmxURI = wxURI(wxT("file://") + m_file).BuildURI();
+    MathParser mp(wxmxURI, &loader);
+    // The output of all code cells is replaced anyway => There is no need to
+    // parse it.
+    mp.SetLazyOutput(true);
+
+    GroupCell *last = NULL;
+    for (wxXmlNode *node = xmldoc.GetRoot()->GetChildren(); node != NULL; node = node->GetNext())
+    {
+      if (node->GetType() == wxXML_TEXT_NODE)
+        continue;
+      GroupCell *cell = dynamic_cast<GroupCell*>(mp.ParseTag(node, false));
+      if (cell == NULL)
+        continue;
+      if (last == NULL)
+        m_tree = last = cell;
+      else
+      {
+        last->m_next = last->m_nextToDraw = cell;
+        cell->m_previous = cell->m_previousToDraw = last;
+        last = cell;
+      }
+    }
+    return true;
+  }
+
+  if (m_file.Lower().EndsWith(wxT(".wxm")))
+  {
+    MappedFile inputFile(m_file);
+    const char *line;
+    size_t length;
+    if ((!inputFile.IsOk()) || (!inputFile.NextLine(line, length)) ||
+        (MappedFile::ToString(line, length) !=
+         wxT("/* [wxMaxima batch file version 1] [ DO NOT EDIT BY HAND! ]*/")))
+    {
+      m_error = _("The file could not be read");
+      return false;
+    }
+
+    wxArrayString wxmLines;
+    inputFile.Rewind();
+    while (inputFile.NextLine(line, length))
+      wxmLines.Add(MappedFile::ToString(line, length));
+    m_tree = MathCtrl::CreateTreeFromWXMCode(wxmLines);
+    return true;
+  }
+
+  m_error = _("Only .wxm and .wxmx files can be run in batch mode");
+  return false;
+}
+
+void BatchRunner::Finish()
+{
+  // .wxm files only contain the input => There is nothing new to save.
+  // A .wxmx file is saved even if an error has occurred: The output shows
+  // what has gone wrong.
+  if (m_loaded && m_file.Lower().EndsWith(wxT(".wxmx")) && !Save() && m_error.IsEmpty())
+    m_error = _("Saving the file failed");
+
+  m_ok = m_error.IsEmpty();
+  wxQueueEvent(m_notify, new wxThreadEvent(wxEVT_THREAD, m_notifyId));
+}
+
+bool BatchRunner::Save()
+{
+  WXMXSnapshot snapshot(m_file);
+
+  {
+    wxMemoryOutputStream content;
+    XMLWriter xmlWriter(content);
+    MathCtrl::WXMXContent(xmlWriter, m_tree, m_zoomFactor);
+    if (!xmlWriter.Flush())
+      return false;
+    wxStreamBuffer *buffer = content.GetOutputStreamBuffer();
+    snapshot.m_content.assign((const char *) buffer->GetBufferStart(), content.GetSize());
+  }
+
+  bool VcFriendlyWXMX = true;
+  wxConfig::Get()->Read(wxT("OptimizeForVersionControl"), &VcFriendlyWXMX);
+  snapshot.m_compress = !VcFriendlyWXMX;
+
+  // No layout cache is written: Measuring the cells needs a display. The
+  // cells are laid out once the file is opened instead.
+  snapshot.TakeImages();
+  return snapshot.Write();
+}
+
+BEGIN_EVENT_TABLE(BatchRunner, wxEvtHandler)
+  EVT_THREAD(kernel_id, BatchRunner::OnKernelEvent)
+END_EVENT_TABLE()
+
+BatchSession::BatchSession(const wxArrayString &files, int jobs)
+{
+  m_files = files;
+  m_next = 0;
+  m_running = 0;
+  m_failed = 0;
+  if (jobs < 1)
+    jobs = wxThread::GetCPUCount();
+  if (jobs < 1)
+    jobs = 1;
+  m_jobs = jobs;
+}
+
+BatchSession::~BatchSession()
+{
+  for (size_t i = 0; i < m_runners.size(); i++)
+    delete m_runners[i];
+}
+
+void BatchSession::Start()
+{
+  while ((m_running < m_jobs) && (m_next < m_files.GetCount()))
+    StartNext();
+}
+
+void BatchSession::StartNext()
+{
+  // The index of the runner is the id of the event it sends when it is done.
+  BatchRunner *runner = new BatchRunner(m_files[m_next], this, m_runners.size());
+  m_runners.push_back(runner);
+  m_next++;
+  m_running++;
+  runner->Start();
+}
+
+void BatchSession::OnRunnerFinished(wxThreadEvent &event)
+{
+  size_t index = event.GetId();
+  if ((index >= m_runners.size()) || (m_runners[index] == NULL))
+    return;
+
+  BatchRunner *runner = m_runners[index];
+  if (runner->IsOk())
+    std::cout << (const char *) runner->GetFile().utf8_str() << ": OK\n";
+  else
+  {
+    std::cerr << (const char *) runner->GetFile().utf8_str() << ": "
+              << (const char *) runner->GetError().utf8_str() << "\n";
+    m_failed++;
+  }
+
+  delete runner;
+  m_runners[index] = NULL;
+  m_running--;
+
+  if (m_next < m_files.GetCount())
+    StartNext();
+  else if (m_running == 0)
+  {
+    wxEventLoopBase *loop = wxEventLoopBase::GetActive();
+    if (loop)
+      loop->Exit(m_failed > 0 ? 1 : 0);
+  }
+}
+
+BEGIN_EVENT_TABLE(BatchSession, wxEvtHandler)
+  EVT_THREAD(wxID_ANY, BatchSession::OnRunnerFinished)
+END_EVENT_TABLE()
@@ -0,0 +1,145 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  Runs worksheets without a GUI.
+ */
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <wx/wx.h>
+#include <wx/app.h>
+
+#include <vector>
+
+#include "GroupCell.h"
+#include "MaximaKernel.h"
+
+/*! Evaluates a .wxm or .wxmx file and saves the result, without any window
+
+  The runner lets a MaximaKernel of its own evaluate all cells of the
+  worksheet. The cells are never laid out: Laying out needs a display and the
+  .wxmx file contains everything that is needed to do so once the file is
+  opened.
+
+  All runners live in the thread that runs the event loop. This way the
+  statics ImgCell uses while saving don't need to be protected, and several
+  runners can still wait for their maxima processes at the same time.
+ */
+class BatchRunner : public wxEvtHandler
+{
+public:
+  /*! The constructor
+
+    \param file The .wxm or .wxmx file to evaluate
+    \param notify The event handler that is sent a wxThreadEvent with the id
+           notifyId as soon as the runner has finished
+   */
+  BatchRunner(wxString file, wxEvtHandler *notify, int notifyId);
+  ~BatchRunner();
+  //! Loads the file and starts maxima. Sends the notification on failure, too.
+  void Start();
+  //! Has the file been evaluated and saved without errors?
+  bool IsOk() { return m_ok; }
+  //! The file this runner evaluates
+  wxString GetFile() { return m_file; }
+  //! Why the runner has failed
+  wxString GetError() { return m_error; }
+
+private:
+  enum { kernel_id = 1 };
+
+  //! Reads m_file into m_tree
+  bool Load();
+  //! Saves the file if needed and sends the notification
+  void Finish();
+  //! Writes m_tree to m_file
+  bool Save();
+  void OnKernelEvent(wxThreadEvent &event);
+
+  wxString m_file;
+  wxEvtHandler *m_notify;
+  int m_notifyId;
+  bool m_ok;
+  //! Has m_file been read successfully?
+  bool m_loaded;
+  wxString m_error;
+
+  //! The worksheet
+  GroupCell *m_tree;
+  //! The zoom factor the worksheet has been saved with
+  double m_zoomFactor;
+  //! The maxima process that evaluates the worksheet
+  MaximaKernel *m_kernel;
+
+  DECLARE_EVENT_TABLE()
+};
+
+/*! Runs a list of files, several of them in parallel
+
+  Leaves the event loop as soon as all files have been run. The exit code is
+  0 if all of them have been evaluated and saved without errors.
+ */
+class BatchSession : public wxEvtHandler
+{
+public:
+  /*! The constructor
+
+    \param files The files to evaluate
+    \param jobs The number of files to evaluate at the same time. -1 means: One per CPU.
+   */
+  BatchSession(const wxArrayString &files, int jobs = -1);
+  ~BatchSession();
+  //! Starts the first runners
+  void Start();
+
+private:
+  //! Starts the next file, if there is one
+  void StartNext();
+  void OnRunnerFinished(wxThreadEvent &event);
+
+  wxArrayString m_files;
+  std::vector<BatchRunner *> m_runners;
+  size_t m_next;
+  int m_jobs;
+  int m_running;
+  int m_failed;
+
+  DECLARE_EVENT_TABLE()
+};
+
+/*! The application that is used for batch runs
+
+  Is a console application => Initializing it doesn't need a display.
+ */
+class BatchApp : public wxAppConsole
+{
+public:
+  BatchApp() { m_session = NULL; }
+  virtual bool OnInit();
+  virtual int OnExit();
+
+private:
+  BatchSession *m_session;
+};
+
+#endif // BATCHRUNNER_H
@@ -290,6 +290,13 @@ wxSize Bitmap::ToFile(wxString file)
   };
 }
 
+wxImage Bitmap::ToImage(wxSize &size)
+{
+  size.x = GetRealWidth();
+  size.y = GetRealHeight();
+  return m_bmp.ConvertToImage();
+}
+
 bool Bitmap::ToClipboard()
 {
   if (wxTheClipboard->Open())
@@ -35,6 +35,11 @@ public:
     \return The size of the bitmap in millimeters. Sizes <0 indicate that the export has failed.
    */
   wxSize ToFile(wxString file);
+  /*! Converts the bitmap to an image that can be saved by a worker thread
+
+    \param size Is set to the size of the bitmap in the unit ToFile() returns.
+   */
+  wxImage ToImage(wxSize &size);
   bool ToClipboard();
 protected:
   void DestroyTree();
@@ -34,6 +34,7 @@ CellParser::CellParser(wxDC& dc) : m_dc(dc)
   m_indent = MC_GROUP_LEFT_INDENT;
   m_changeAsterisk = false;
   m_outdated = false;
+  m_showEvaluationStats = false;
   m_TeXFonts = false;
 
   if (wxFontEnumerator::IsValidFacename(m_fontCMEX = wxT("jsMath-cmex10")) &&
@@ -62,6 +63,7 @@ CellParser::CellParser(wxDC& dc, double scale) : m_dc(dc)
   m_indent = MC_GROUP_LEFT_INDENT;
   m_changeAsterisk = false;
   m_outdated = false;
+  m_showEvaluationStats = false;
   m_TeXFonts = false;
 
   if (wxFontEnumerator::IsValidFacename(m_fontCMEX = wxT("jsMath-cmex10")) &&
@@ -93,6 +95,29 @@ wxString CellParser::GetFontName(int type)
   return m_fontName;
 }
 
+wxString CellParser::GetFontConfigHash()
+{
+  wxString fonts;
+  wxSize ppi = m_dc.GetPPI();
+  fonts << m_fontName << wxT(";") << m_mathFontName << wxT(";")
+        << m_defaultFontSize << wxT(";") << m_mathFontSize << wxT(";")
+        << int(m_fontEncoding) << wxT(";") << int(m_TeXFonts) << wxT(";")
+        << int(m_keepPercent) << wxT(";") << ppi.x << wxT("x") << ppi.y;
+  for (int i = 0; i < STYLE_NUM; i++)
+    fonts << wxT(";") << m_styles[i].font << wxT(",") << GetFontSize(i) << wxT(",")
+          << int(m_styles[i].bold) << int(m_styles[i].italic) << int(m_styles[i].underlined);
+
+  // FNV-1a: We only need a short string that changes if the fonts do.
+  wxUint32 hash = 2166136261u;
+  wxCharBuffer data = fonts.utf8_str();
+  for (const char *c = data.data(); *c != 0; c++)
+  {
+    hash ^= (unsigned char) *c;
+    hash *= 16777619u;
+  }
+  return wxString::Format(wxT("%08x"), hash);
+}
+
 void CellParser::ReadStyle()
 {
   wxConfigBase* config = wxConfig::Get();
@@ -90,6 +90,9 @@ public:
     return 0;
   }
   void Outdated(bool outdated) { m_outdated = outdated; }
+  //! Shall GroupCells show how long their last evaluation took?
+  void ShowEvaluationStats(bool show) { m_showEvaluationStats = show; }
+  bool ShowEvaluationStats() { return m_showEvaluationStats; }
   bool CheckTeXFonts() { return m_TeXFonts; }
   bool CheckKeepPercent() { return m_keepPercent; }
   wxString GetTeXCMRI() { return m_fontCMRI; }
@@ -97,6 +100,11 @@ public:
   wxString GetTeXCMEX() { return m_fontCMEX; }
   wxString GetTeXCMMI() { return m_fontCMMI; }
   wxString GetTeXCMTI() { return m_fontCMTI; }
+  /*! A hash of everything that affects the size of a cell except the zoom factor
+
+    Cell sizes that have been measured with a different hash cannot be reused.
+   */
+  wxString GetFontConfigHash();
 private:
   int m_indent;
   double m_scale;
@@ -109,6 +117,7 @@ private:
   bool m_forceUpdate;
   bool m_changeAsterisk;
   bool m_outdated;
+  bool m_showEvaluationStats;
   bool m_TeXFonts;
   bool m_keepPercent;
   wxString m_fontCMRI, m_fontCMSY, m_fontCMEX, m_fontCMMI, m_fontCMTI;
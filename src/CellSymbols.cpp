@@ -0,0 +1,193 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "CellSymbols.h"
+
+//! Can c be part of an identifier?
+static bool IsIdentifierChar(wxChar c)
+{
+  return wxIsalnum(c) || (c == wxT('%')) || (c == wxT('_'));
+}
+
+CellSymbols::CellSymbols(const wxString &code)
+{
+  std::vector<Token> tokens;
+  Tokenize(code, tokens);
+
+  // closing[i] is the index of the bracket that closes the one at index i,
+  // or 0 if there is none.
+  std::vector<size_t> closing(tokens.size(), 0);
+  std::vector<size_t> open;
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    if ((tokens[i].m_text == wxT("(")) || (tokens[i].m_text == wxT("[")))
+      open.push_back(i);
+    else if (((tokens[i].m_text == wxT(")")) || (tokens[i].m_text == wxT("]"))) && !open.empty())
+    {
+      closing[open.back()] = i;
+      open.pop_back();
+    }
+  }
+
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    if (tokens[i].m_identifier)
+    {
+      m_uses.insert(tokens[i].m_text);
+
+      // a:..., a::..., f(x):=..., a[i]:..., f[n](x):=...
+      size_t next = i + 1;
+      while ((next < tokens.size()) && (closing[next] > next) &&
+             ((tokens[next].m_text == wxT("(")) || (tokens[next].m_text == wxT("["))))
+        next = closing[next] + 1;
+      if ((next < tokens.size()) && IsAssignment(tokens[next]))
+        m_defines.insert(tokens[i].m_text);
+
+      // define(f(x), ...)
+      if ((tokens[i].m_text == wxT("define")) && (i + 2 < tokens.size()) &&
+          (tokens[i + 1].m_text == wxT("(")) && tokens[i + 2].m_identifier)
+        m_defines.insert(tokens[i + 2].m_text);
+      continue;
+    }
+
+    // [a, b] : [1, 2]
+    if ((tokens[i].m_text == wxT("[")) && (closing[i] > i) &&
+        ((i == 0) || !tokens[i - 1].m_identifier) &&
+        (closing[i] + 1 < tokens.size()) && IsAssignment(tokens[closing[i] + 1]))
+    {
+      for (size_t j = i + 1; j < closing[i]; j++)
+        if (tokens[j].m_identifier)
+          m_defines.insert(tokens[j].m_text);
+    }
+  }
+}
+
+bool CellSymbols::UsesAny(const std::set<wxString> &symbols)
+{
+  for (std::set<wxString>::const_iterator it = m_uses.begin(); it != m_uses.end(); ++it)
+    if (symbols.find(*it) != symbols.end())
+      return true;
+  return false;
+}
+
+bool CellSymbols::IsAssignment(const Token &token)
+{
+  return (token.m_text == wxT(":")) || (token.m_text == wxT("::")) ||
+    (token.m_text == wxT(":=")) || (token.m_text == wxT("::="));
+}
+
+void CellSymbols::Tokenize(const wxString &code, std::vector<Token> &tokens)
+{
+  size_t len = code.Length();
+  size_t i = 0;
+  while (i < len)
+  {
+    wxChar c = code[i];
+
+    if (wxIsspace(c))
+    {
+      i++;
+      continue;
+    }
+
+    // Comments
+    if ((c == wxT('/')) && (i + 1 < len) && (code[i + 1] == wxT('*')))
+    {
+      i += 2;
+      while ((i + 1 < len) && !((code[i] == wxT('*')) && (code[i + 1] == wxT('/'))))
+        i++;
+      i += 2;
+      continue;
+    }
+
+    // Strings don't contain any symbols.
+    if (c == wxT('\"'))
+    {
+      i++;
+      while ((i < len) && (code[i] != wxT('\"')))
+      {
+        if (code[i] == wxT('\\'))
+          i++;
+        i++;
+      }
+      i++;
+      tokens.push_back(Token(wxT("\""), false));
+      continue;
+    }
+
+    // Numbers, including the ones with a decimal point or an exponent
+    if (wxIsdigit(c))
+    {
+      while ((i < len) && (IsIdentifierChar(code[i]) || (code[i] == wxT('.'))))
+        i++;
+      tokens.push_back(Token(wxT("0"), false));
+      continue;
+    }
+
+    // Identifiers. A backslash makes the next character part of the
+    // identifier and a question mark introduces a lisp symbol.
+    if (IsIdentifierChar(c) || (c == wxT('\\')) ||
+        ((c == wxT('?')) && (i + 1 < len) && IsIdentifierChar(code[i + 1])))
+    {
+      size_t start = i;
+      if (c == wxT('?'))
+        i++;
+      while (i < len)
+      {
+        if ((code[i] == wxT('\\')) && (i + 1 < len))
+          i += 2;
+        else if (IsIdentifierChar(code[i]))
+          i++;
+        else
+          break;
+      }
+      // A lone backslash at the end of the code
+      if (i == start)
+      {
+        i++;
+        continue;
+      }
+      tokens.push_back(Token(code.Mid(start, i - start), true));
+      continue;
+    }
+
+    // The assignment operators :, ::, := and ::=
+    if (c == wxT(':'))
+    {
+      wxString op = wxT(":");
+      i++;
+      if ((i < len) && (code[i] == wxT(':')))
+      {
+        op += wxT(":");
+        i++;
+      }
+      if ((i < len) && (code[i] == wxT('=')))
+      {
+        op += wxT("=");
+        i++;
+      }
+      tokens.push_back(Token(op, false));
+      continue;
+    }
+
+    tokens.push_back(Token(wxString(c), false));
+    i++;
+  }
+}
@@ -0,0 +1,73 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  Finds out which symbols a piece of maxima code defines and uses.
+ */
+
+#ifndef CELLSYMBOLS_H
+#define CELLSYMBOLS_H
+
+#include <wx/string.h>
+
+#include <set>
+#include <vector>
+
+/*! The symbols a piece of maxima code defines and the ones it uses
+
+  Is used for finding out which cells have to be evaluated again after a cell
+  has changed. The analysis is purely syntactical and errs on the safe side:
+  Every identifier counts as used and every identifier that is followed by an
+  assignment operator counts as defined, even if it is a local variable.
+
+  Side effects maxima doesn't make visible in the syntax, like the ones of
+  load(), kill() or assume(), aren't detected.
+ */
+class CellSymbols
+{
+public:
+  //! Scans the code
+  CellSymbols(const wxString &code);
+  //! The variables, functions and arrays the code assigns something to
+  const std::set<wxString> &Defines() { return m_defines; }
+  //! All identifiers the code contains
+  const std::set<wxString> &Uses() { return m_uses; }
+  //! Does the code use any of symbols?
+  bool UsesAny(const std::set<wxString> &symbols);
+
+private:
+  //! A token of maxima code
+  struct Token
+  {
+    Token(wxString text, bool identifier) : m_text(text), m_identifier(identifier) {}
+    wxString m_text;
+    bool m_identifier;
+  };
+
+  //! Splits code into tokens, dropping comments, strings and whitespace
+  static void Tokenize(const wxString &code, std::vector<Token> &tokens);
+  //! Is token one of maxima's assignment operators?
+  static bool IsAssignment(const Token &token);
+
+  std::set<wxString> m_defines;
+  std::set<wxString> m_uses;
+};
+
+#endif // CELLSYMBOLS_H
@@ -138,6 +138,8 @@ void ConfigDialogue::SetProperties()
 
   m_showUserDefinedLabels->SetToolTip(_("If a command begins with a label followed by a : wxMaxima will show this label instead of the \%o style label maxima has automatically assigned to the same output cell."));
   m_abortOnError->SetToolTip(_("If multiple cells are evaluated in one go: Abort evaluation if wxMaxima detects that maxima has encountered any error."));
+  m_errorPatterns->SetToolTip(_("Lines of maxima's output that begin with one of these texts (one per line) are treated like maxima's own error messages. Useful for packages that report errors in their own words."));
+  m_pipelineCommands->SetToolTip(_("Send the next commands to maxima while it still works on the current one. Speeds up worksheets with many small commands. If maxima asks a question or enters the lisp debugger the commands that have already been sent might be read as the answer: In this case maxima is restarted."));
   m_pollStdOut->SetToolTip(_("Once the local network link between maxima and wxMaxima has been established maxima has no reason to send any messages using the system's stdout stream so all this stream transport should be a greeting message; The lisp running maxima will send eventual error messages using the system's stderr stream instead. If this box is checked we will nonetheless watch maxima's stdout stream for messages."));
   m_maximaProgram->SetToolTip(_("Enter the path to the Maxima executable."));
   m_additionalParameters->SetToolTip(_("Additional parameters for Maxima"
@@ -189,6 +191,7 @@ void ConfigDialogue::SetProperties()
   // configuration data for this item.
   bool match = true, savePanes = true, UncompressedWXMX=true;
   bool fixedFontTC = true, changeAsterisk = false, usejsmath = true, keepPercent = true, abortOnError = true, pollStdOut = false;
+  bool pipelineCommands = false;
   bool enterEvaluates = false, saveUntitled = true,
     openHCaret = false, AnimateLaTeX = true, TeXExponentsAfterSubscript=false,
     usePartialForDiff = false,
@@ -210,6 +213,7 @@ void ConfigDialogue::SetProperties()
 #ifdef wxUSE_UNICODE
   wxString symbolPaneAdditionalChars=wxT("üØ");
 #endif
+  wxString errorPatterns;
   int autoSaveInterval = 0;
   
 #if defined (__WXMAC__)
@@ -265,6 +269,8 @@ void ConfigDialogue::SetProperties()
   config->Read(wxT("usejsmath"), &usejsmath);
   config->Read(wxT("keepPercent"), &keepPercent);
   config->Read(wxT("abortOnError"), &abortOnError);
+  config->Read(wxT("errorPatterns"), &errorPatterns);
+  config->Read(wxT("pipelineCommands"), &pipelineCommands);
   config->Read(wxT("pollStdOut"), &pollStdOut);
   unsigned int i = 0;
   for (i = 0; i < LANGUAGE_NUMBER; i++)
@@ -333,6 +339,8 @@ void ConfigDialogue::SetProperties()
   m_useJSMath->SetValue(usejsmath);
   m_keepPercentWithSpecials->SetValue(keepPercent);
   m_abortOnError->SetValue(abortOnError);
+  m_errorPatterns->SetValue(errorPatterns);
+  m_pipelineCommands->SetValue(pipelineCommands);
   m_pollStdOut->SetValue(pollStdOut);
   m_defaultFramerate->SetValue(defaultFramerate);
   m_defaultPlotWidth->SetValue(defaultPlotWidth);
@@ -634,6 +642,14 @@ wxPanel* ConfigDialogue::CreateMaximaPanel()
   m_abortOnError = new wxCheckBox(panel, -1, _("Abort evaluation on error"));
   vsizer->Add(m_abortOnError,0,wxALL, 5);
 
+  wxStaticText *ep = new wxStaticText(panel, -1, _("Additional error messages (one per line):"));
+  vsizer->Add(ep, 0, wxALL, 5);
+  m_errorPatterns = new wxTextCtrl(panel, -1, wxEmptyString, wxDefaultPosition, wxSize(600, 60), wxTE_MULTILINE | wxHSCROLL);
+  vsizer->Add(m_errorPatterns, 0, wxALL, 5);
+
+  m_pipelineCommands = new wxCheckBox(panel, -1, _("Send commands ahead of maxima's prompt"));
+  vsizer->Add(m_pipelineCommands,0,wxALL, 5);
+
   m_pollStdOut = new wxCheckBox(panel, -1, _("Debug: Watch maxima's stdout stream"));
   vsizer->Add(m_pollStdOut,0,wxALL, 5);
   panel->SetSizerAndFit(vsizer);
@@ -764,6 +780,8 @@ void ConfigDialogue::WriteSettings()
   wxString maxima = m_maximaProgram->GetValue();
   wxConfig *config = (wxConfig *)wxConfig::Get();
   config->Write(wxT("abortOnError"), m_abortOnError->GetValue());
+  config->Write(wxT("errorPatterns"), m_errorPatterns->GetValue());
+  config->Write(wxT("pipelineCommands"), m_pipelineCommands->GetValue());
   config->Write(wxT("pollStdOut"), m_pollStdOut->GetValue());
   config->Write(wxT("maxima"), m_maximaProgram->GetValue());
   config->Write(wxT("parameters"), m_additionalParameters->GetValue());
@@ -173,6 +173,8 @@ protected:
   wxTextCtrl* m_symbolPaneAdditionalChars;
   wxCheckBox* m_saveSize;
   wxCheckBox* m_abortOnError;
+  wxTextCtrl* m_errorPatterns;
+  wxCheckBox* m_pipelineCommands;
   wxCheckBox* m_pollStdOut;
   wxCheckBox* m_wrapLatexMath;
   wxCheckBox* m_savePanes;
@@ -63,6 +63,8 @@ EditorCell::EditorCell(wxString text) : MathCell()
   m_firstLineOnly = false;
   m_historyPosition = -1;
   m_text = TabExpand(text,0);
+  m_lines.Build(m_text);
+  m_styledType = -1;
 }
 
 EditorCell::~EditorCell()
@@ -117,9 +119,10 @@ MathCell *EditorCell::Copy()
   // We cannot use SetValue() here, since SetValue() sometimes has the task to change
   //  the cell's contents
   tmp->m_text = m_text;
+  tmp->m_lines = m_lines;
+  tmp->m_styledType = m_styledType;
   tmp->m_containsChanges = m_containsChanges;
   CopyData(this, tmp);
-  tmp->m_styledText = m_styledText;
 
   return tmp;
 }
@@ -301,6 +304,11 @@ void EditorCell::RecalculateWidths(CellParser& parser, int fontsize)
   m_isDirty = false;
   if (m_height == -1 || m_width == -1 || fontsize != m_fontSize || parser.ForceUpdate())
   {
+    // Unless the font has changed only the lines that have been edited
+    // since the last call need to be measured again.
+    if ((fontsize != m_fontSize) || parser.ForceUpdate())
+      m_lines.InvalidateWidths();
+
     m_fontSize = fontsize;
     wxDC& dc = parser.GetDC();
     double scale = parser.GetScale();
@@ -308,36 +316,39 @@ void EditorCell::RecalculateWidths(CellParser& parser, int fontsize)
 
     dc.GetTextExtent(wxT("X"), &charWidth, &m_charHeight);
 
-    unsigned int newLinePos = 0, prevNewLinePos = 0;
-    int width = 0, width1, height1;
-
-    m_numberOfLines = 1;
-
-    while (newLinePos < m_text.Length())
+    int width = 0, height1;
+    size_t lineStart = 0;
+    for (size_t line = 0; line < m_lines.LineCount(); line++)
     {
-      while (newLinePos < m_text.Length())
+      int width1 = m_lines.GetWidth(line);
+      if (width1 < 0)
       {
-        if (m_text.GetChar(newLinePos) == '\n')
-          break;
-        newLinePos++;
+        width1 = 0;
+        if (m_lines.ContentLength(line) > 0)
+          dc.GetTextExtent(m_text.Mid(lineStart, m_lines.LineLength(line)), &width1, &height1);
+        m_lines.SetWidth(line, width1);
       }
-
-      dc.GetTextExtent(m_text.SubString(prevNewLinePos, newLinePos), &width1, &height1);
       width = MAX(width, width1);
-
-      while (newLinePos < m_text.Length() && m_text.GetChar(newLinePos) == '\n')
-      {
-        newLinePos++;
-        m_numberOfLines++;
-      }
-
-      prevNewLinePos = newLinePos;
+      lineStart += m_lines.LineLength(line);
     }
 
+    m_numberOfLines = m_lines.LineCount();
+
     // new
     if (m_firstLineOnly)
+    {
       m_numberOfLines = 1;
 
+      // The number of hidden lines is drawn behind the first line.
+      if (m_lines.LineCount() > 1)
+      {
+        int noteWidth, noteHeight;
+        dc.GetTextExtent(wxString::Format(wxT(" ... + %i hidden lines"), (int) m_lines.LineCount() - 1),
+                         &noteWidth, &noteHeight);
+        width = MAX(width, m_lines.GetWidth(0) + noteWidth);
+      }
+    }
+
     if (m_text == wxEmptyString)
       width = charWidth;
 
@@ -356,21 +367,22 @@ wxString EditorCell::ToHTML()
 
   while(tmp != NULL)
   {
-    std::list<StyledText> styledText = tmp->m_styledText;
-    while(!styledText.empty())
+    size_t lineStart = 0;
+    for (size_t line = 0; line < tmp->m_lines.LineCount(); line++)
     {
-      // Grab a portion of text from the list.
-      StyledText TextSnippet = styledText.front();
-      styledText.pop_front();
-
-      wxString text =  PrependNBSP(EscapeHTMLChars(TextSnippet.GetText()));
-/*      wxString tmp = EscapeHTMLChars(TextSnippet.GetText());
-        wxString text = tmp);*/
-      
-      if(TextSnippet.StyleSet())
+      const std::vector<StyledSpan> &spans = tmp->m_lines.GetSpans(line);
+      for (size_t i = 0; i < spans.size(); i++)
       {
-        switch(TextSnippet.GetStyle())
+        wxString snippet = tmp->m_text.Mid(lineStart + spans[i].m_start, spans[i].m_length);
+        if ((tmp->m_type == MC_TYPE_INPUT) && tmp->m_changeAsterisk)
+          snippet.Replace(wxT("*"), wxT("\xB7"));
+        wxString text = PrependNBSP(EscapeHTMLChars(snippet));
+
+        switch(spans[i].m_style)
         {
+        case -1:
+          retval+=text;
+          break;
         case TS_CODE_COMMENT:
           retval+=wxT("<span class=\"code_comment\">")+text+wxT("</span>");
           break;
@@ -394,8 +406,10 @@ wxString EditorCell::ToHTML()
           retval+=wxT("<span class=\"code_endofline\">")+text+wxT("</span>");
           break;
         }
-      } else
-        retval+=text;
+      }
+      if (line + 1 < tmp->m_lines.LineCount())
+        retval += EscapeHTMLChars(wxT("\n"));
+      lineStart += tmp->m_lines.LineLength(line);
     }
     tmp = dynamic_cast<EditorCell*>(tmp->m_next);
   }
@@ -446,9 +460,8 @@ The order this cell is drawn is:
  3. draw all text (wxCOPY)
  4. draw the caret (wxCOPY), TS_CURSOR color
 
- The text is not taken from m_text but from the list of styled text snippets
- StyleText() converts m_text into. This way the decisions needed for styling 
- text are cached for later use.
+ The text is drawn using the styled spans StyleText() has stored for each
+ line. This way the decisions needed for styling text are cached for later use.
 */
 void EditorCell::Draw(CellParser& parser, wxPoint point1, int fontsize)
 {
@@ -529,37 +542,42 @@ void EditorCell::Draw(CellParser& parser, wxPoint point1, int fontsize)
     // TextStartingpoint.x -= SCALE_PX(MC_TEXT_PADDING, scale);
     TextStartingpoint.x += SCALE_PX(2, scale);
     TextStartingpoint.y += SCALE_PX(2, scale);
-    wxPoint TextCurrentPoint = TextStartingpoint;
-    std::list<StyledText> styledText = m_styledText;
     int lastStyle = -1;
-    while(!styledText.empty())
+
+    // Only the lines that are inside the visible part of the worksheet are drawn.
+    size_t firstLine = 0;
+    size_t lastLine = m_lines.LineCount() - 1;
+    if (m_firstLineOnly)
+      lastLine = 0;
+    int top = parser.GetTop();
+    int bottom = parser.GetBottom();
+    if ((top != -1) && (bottom != -1) && (m_charHeight > 0))
     {
-      // Grab a portion of text from the list.
-      StyledText TextSnippet = styledText.front();
-      styledText.pop_front();
-      wxString TextToDraw = TextSnippet.GetText();
-      int width, height;
-      
-      // A newline is a separate token.
-      if(TextToDraw == wxT("\n"))
-      {
-        // A newline =>
-        // set the point to the beginning of the next line.
-        TextCurrentPoint.x = TextStartingpoint.x;
-        TextCurrentPoint.y += m_charHeight;
-      }
-      else
+      int textTop = TextStartingpoint.y - m_center;
+      if (top > textTop)
+        firstLine = (top - textTop) / m_charHeight;
+      if (bottom > textTop)
+        lastLine = MIN(lastLine, (size_t)((bottom - textTop) / m_charHeight));
+    }
+
+    size_t lineStart = m_lines.LineStart(firstLine);
+    for (size_t line = firstLine; (line <= lastLine) && (line < m_lines.LineCount()); line++)
+    {
+      wxPoint TextCurrentPoint = TextStartingpoint;
+      TextCurrentPoint.y += line * m_charHeight;
+      const std::vector<StyledSpan> &spans = m_lines.GetSpans(line);
+      for (size_t i = 0; i < spans.size(); i++)
       {
-        // We need to draw some text.
-        
+        wxString TextToDraw = m_text.Mid(lineStart + spans[i].m_start, spans[i].m_length);
+        int width, height;
+
         // Grab a pen of the right color.
-        if(TextSnippet.StyleSet())
+        if (spans[i].m_style >= 0)
         {
-          wxDC& dc = parser.GetDC();
-          if(lastStyle != TextSnippet.GetStyle())
+          if (lastStyle != spans[i].m_style)
           {
-            dc.SetTextForeground(parser.GetColor(TextSnippet.GetStyle()));
-            lastStyle = TextSnippet.GetStyle();
+            dc.SetTextForeground(parser.GetColor((TextStyle) spans[i].m_style));
+            lastStyle = spans[i].m_style;
           }
         }
         else
@@ -573,19 +591,25 @@ void EditorCell::Draw(CellParser& parser, wxPoint point1, int fontsize)
         if ((m_changeAsterisk = parser.GetChangeAsterisk())!=0)
           TextToDraw.Replace(wxT("*"), wxT("\xB7"));
 #endif
-        
+
         dc.DrawText(TextToDraw,
                     TextCurrentPoint.x,
                     TextCurrentPoint.y - m_center);
-        /*
-        dc.DrawLine(TextCurrentPoint.x + SCALE_PX(2, scale),
-                    TextCurrentPoint.y - m_center,
-                    TextCurrentPoint.x + SCALE_PX(2, scale),
-                    TextCurrentPoint.y); */
-        
+
         dc.GetTextExtent(TextToDraw, &width, &height);
         TextCurrentPoint.x += width;
       }
+
+      // A hidden cell shows its first line followed by the number of lines it hides.
+      if (m_firstLineOnly && (m_lines.LineCount() > 1))
+      {
+        lastStyle = -1;
+        SetForeground(parser);
+        dc.DrawText(wxString::Format(wxT(" ... + %i hidden lines"), (int) m_lines.LineCount() - 1),
+                    TextCurrentPoint.x,
+                    TextCurrentPoint.y - m_center);
+      }
+      lineStart += m_lines.LineLength(line);
     }
     //
     // Draw the caret
@@ -746,26 +770,16 @@ wxString EditorCell::TabExpand(wxString input, size_t posInLine)
 
 size_t EditorCell::BeginningOfLine(size_t pos)
 {
-  if(pos>0)
-    pos--;
-  
-  while(pos > 0)
-  {
-    if(m_text[pos]==wxT('\n'))
-      break;
-    pos--;
-  }
-  if(m_text[pos]==wxT('\n'))
-    pos++;
-  return pos;
+  return m_lines.LineStart(m_lines.LineOf(pos));
 }
 
 size_t EditorCell::EndOfLine(size_t pos)
 {
-  while (pos<m_text.length() && m_text[pos] != wxT('\n'))
-    pos++;
+  if (pos >= m_text.Length())
+    return m_text.Length();
 
-  return pos;
+  size_t line = m_lines.LineOf(pos);
+  return m_lines.LineStart(line) + m_lines.ContentLength(line);
 }
 
 #if defined __WXMAC__
@@ -788,7 +802,7 @@ bool EditorCell::HandleCtrlCommand(wxKeyEvent& ev)
     size_t end = EndOfLine(m_positionOfCaret);
     if (end == m_positionOfCaret)
       end++;
-    m_text = m_text.SubString(0, m_positionOfCaret-1) + m_text.SubString(end, m_text.length());
+    ReplaceText(m_positionOfCaret, end, wxEmptyString);
     m_isDirty = true;
     break;
   }
@@ -1117,8 +1131,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
       SaveValue();
       long start = MIN(m_selectionEnd, m_selectionStart);
       long end = MAX(m_selectionEnd, m_selectionStart);
-      m_text = m_text.SubString(0, start - 1) +
-               m_text.SubString(end, m_text.Length());
+      ReplaceText(start, end, wxEmptyString);
       m_positionOfCaret = start;
       ClearSelection();
     }
@@ -1194,9 +1207,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
         for(int i=0;i<indentChars;i++)
           indentString += wxT(" ");
       
-      m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-        wxT("\n") + indentString +
-        m_text.SubString(m_positionOfCaret, m_text.Length());
+      ReplaceText(m_positionOfCaret, m_positionOfCaret, wxT("\n") + indentString);
       m_positionOfCaret++;
       if(indentChars > 0)
         m_positionOfCaret += indentChars;
@@ -1213,8 +1224,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
       {
         m_isDirty = true;
         m_containsChanges = true;
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-                 m_text.SubString(m_positionOfCaret + 1, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret + 1, wxEmptyString);
       }
     }
     else
@@ -1225,8 +1235,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
       m_saveValue = true;
       long start = MIN(m_selectionEnd, m_selectionStart);
       long end = MAX(m_selectionEnd, m_selectionStart);
-      m_text = m_text.SubString(0, start - 1) +
-               m_text.SubString(end, m_text.Length());
+      ReplaceText(start, end, wxEmptyString);
       m_positionOfCaret = start;
       ClearSelection();
     }
@@ -1241,8 +1250,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
       m_isDirty = true;
       long start = MIN(m_selectionEnd, m_selectionStart);
       long end = MAX(m_selectionEnd, m_selectionStart);
-      m_text = m_text.SubString(0, start - 1) +
-               m_text.SubString(end, m_text.Length());
+      ReplaceText(start, end, wxEmptyString);
       m_positionOfCaret = start;
       ClearSelection();
       break;
@@ -1259,8 +1267,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
           
           if(m_text.SubString(0, m_positionOfCaret - 1).Right(4) == wxT("    ")) 
           {
-            m_text = m_text.SubString(0, m_positionOfCaret - 5) +
-              m_text.SubString(m_positionOfCaret, m_text.Length());
+            ReplaceText(m_positionOfCaret - 4, m_positionOfCaret, wxEmptyString);
             m_positionOfCaret -= 4;
           }
           else
@@ -1273,8 +1280,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
                  (m_text.GetChar(m_positionOfCaret-1) == '{' && m_text.GetChar(m_positionOfCaret) == '}') ||
                  (m_text.GetChar(m_positionOfCaret-1) == '"' && m_text.GetChar(m_positionOfCaret) == '"')))
               right++;
-            m_text = m_text.SubString(0, m_positionOfCaret - 2) +
-              m_text.SubString(right, m_text.Length());
+            ReplaceText(m_positionOfCaret - 1, right, wxEmptyString);
             m_positionOfCaret--;
           }
         }
@@ -1293,23 +1299,20 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
         while((wxIsalnum(m_text[m_positionOfCaret - 1]))&&(m_positionOfCaret>0))
         {
           m_positionOfCaret--;
-          m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-                   m_text.SubString(m_positionOfCaret + 1, m_text.Length());
+          ReplaceText(m_positionOfCaret, m_positionOfCaret + 1, wxEmptyString);
         }            
         // Delete Spaces, Tabs and Newlines until the next printable character
         while((wxIsspace(m_text[m_positionOfCaret - 1]))&&(m_positionOfCaret>0))
         {
           m_positionOfCaret--;
-          m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-                   m_text.SubString(m_positionOfCaret + 1, m_text.Length());
+          ReplaceText(m_positionOfCaret, m_positionOfCaret + 1, wxEmptyString);
         }
         
         // If we didn't delete anything till now delete one single character.
         if(lastpos == m_positionOfCaret)
         {
           m_positionOfCaret--;
-          m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-                   m_text.SubString(m_positionOfCaret + 1, m_text.Length());
+          ReplaceText(m_positionOfCaret, m_positionOfCaret + 1, wxEmptyString);
         }
       }
     }
@@ -1349,18 +1352,13 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
                 for(size_t i=0;i<4;i++)
                   if(m_text[pos]==wxT(' '))
                   {
-                    m_text =
-                      m_text.SubString(0, pos - 1) +
-                      m_text.SubString(pos + 1, m_text.Length());
+                    ReplaceText(pos, pos + 1, wxEmptyString);
                     end--;
                   }
               }
               else
               {
-                m_text =
-                  m_text.SubString(0, pos - 1) +
-                  wxT("    ") +
-                  m_text.SubString(pos, m_text.Length());
+                ReplaceText(pos, pos, wxT("    "));
                 end += 4;
                 pos += 4;
               }
@@ -1373,8 +1371,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
           }
           else
           {
-            m_text = m_text.SubString(0, start - 1) +
-              m_text.SubString(end, m_text.Length());
+            ReplaceText(start, end, wxEmptyString);
             ClearSelection();
           }
           m_positionOfCaret = start;
@@ -1388,9 +1385,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
           ins += wxT(" ");
         } while (col%4 != 0);
 
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-                 ins +
-                 m_text.SubString(m_positionOfCaret, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret, ins);
         m_positionOfCaret += ins.Length();
       }
     }
@@ -1423,8 +1418,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
       if (esccharpos > -1) { // we have a match, check for insertion
         wxString greek = InterpretEscapeString(m_text.SubString(esccharpos + 1, m_positionOfCaret - 1));
         if (greek.Length() > 0 ) {
-          m_text = m_text.SubString(0, esccharpos - 1) + greek +
-                   m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(esccharpos, m_positionOfCaret, greek);
           m_positionOfCaret = esccharpos + greek.Length();
           m_isDirty = true;
           m_containsChanges = true;
@@ -1436,8 +1430,7 @@ bool EditorCell::HandleSpecialKey(wxKeyEvent& event)
         insertescchar = true;
 
       if (insertescchar) {
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) + ESC_CHAR +
-                 m_text.SubString(m_positionOfCaret, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret, ESC_CHAR);
         m_isDirty = true;
         m_containsChanges = true;
         m_positionOfCaret++;
@@ -1511,50 +1504,42 @@ bool EditorCell::HandleOrdinaryKey(wxKeyEvent& event)
     switch (keyCode)
     {
     case '(':
-      m_text = m_text.SubString(0, start - 1) +   wxT("(") +
-        m_text.SubString(start, end - 1) + wxT(")") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT(")"));
+      ReplaceText(start, start, wxT("("));
       m_positionOfCaret = start;  insertLetter = false;
       break;
     case '\"':
-      m_text = m_text.SubString(0, start - 1) +   wxT("\"") +
-        m_text.SubString(start, end - 1) + wxT("\"") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT("\""));
+      ReplaceText(start, start, wxT("\""));
       m_positionOfCaret = start;  insertLetter = false;
       break;
     case '{':
-      m_text = m_text.SubString(0, start - 1) +   wxT("{") +
-        m_text.SubString(start, end - 1) + wxT("}") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT("}"));
+      ReplaceText(start, start, wxT("{"));
       m_positionOfCaret = start;  insertLetter = false;
       break;
     case '[':
-      m_text = m_text.SubString(0, start - 1) +   wxT("[") +
-        m_text.SubString(start, end - 1) + wxT("]") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT("]"));
+      ReplaceText(start, start, wxT("["));
       m_positionOfCaret = start;  insertLetter = false;
       break;
     case ')':
-      m_text = m_text.SubString(0, start - 1) +   wxT("(") +
-        m_text.SubString(start, end - 1) + wxT(")") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT(")"));
+      ReplaceText(start, start, wxT("("));
       m_positionOfCaret = end + 2; insertLetter = false;
       break;
     case '}':
-      m_text = m_text.SubString(0, start - 1) +   wxT("{") +
-        m_text.SubString(start, end - 1) + wxT("}") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT("}"));
+      ReplaceText(start, start, wxT("{"));
       m_positionOfCaret = end + 2; insertLetter = false;
       break;
     case ']':
-      m_text = m_text.SubString(0, start - 1) +   wxT("[") +
-        m_text.SubString(start, end - 1) + wxT("]") +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(end, end, wxT("]"));
+      ReplaceText(start, start, wxT("["));
       m_positionOfCaret = end + 2; insertLetter = false;
       break;
     default: // delete selection
-      m_text = m_text.SubString(0, start - 1) +
-        m_text.SubString(end, m_text.Length());
+      ReplaceText(start, end, wxEmptyString);
       m_positionOfCaret = start;
       break;
     }
@@ -1563,13 +1548,12 @@ bool EditorCell::HandleOrdinaryKey(wxKeyEvent& event)
   
   // insert letter if we didn't insert brackets around selection
   if (insertLetter) {
-    m_text = m_text.SubString(0, m_positionOfCaret - 1) +
 #if wxUSE_UNICODE
-      event.GetUnicodeKey() +
+    ReplaceText(m_positionOfCaret, m_positionOfCaret, wxString(event.GetUnicodeKey()));
 #else
-      wxString::Format(wxT("%c"), ChangeNumpadToChar(event.GetKeyCode())) +
+    ReplaceText(m_positionOfCaret, m_positionOfCaret,
+                wxString::Format(wxT("%c"), ChangeNumpadToChar(event.GetKeyCode())));
 #endif
-      m_text.SubString(m_positionOfCaret, m_text.Length());
     
     m_positionOfCaret++;
       
@@ -1578,46 +1562,35 @@ bool EditorCell::HandleOrdinaryKey(wxKeyEvent& event)
       switch (keyCode)
       {
       case '(':
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-          wxT(")") +
-          m_text.SubString(m_positionOfCaret, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret, wxT(")"));
         break;
       case '[':
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-          wxT("]") +
-          m_text.SubString(m_positionOfCaret, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret, wxT("]"));
         break;
       case '{':
-        m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-          wxT("}") +
-          m_text.SubString(m_positionOfCaret, m_text.Length());
+        ReplaceText(m_positionOfCaret, m_positionOfCaret, wxT("}"));
         break;
       case '"':
         if (m_positionOfCaret < m_text.Length() &&
             m_text.GetChar(m_positionOfCaret) == '"')
-          m_text = m_text.SubString(0, m_positionOfCaret - 2)+
-            m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(m_positionOfCaret - 1, m_positionOfCaret, wxEmptyString);
         else
-          m_text = m_text.SubString(0, m_positionOfCaret - 1) +
-            wxT("\"") + m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(m_positionOfCaret, m_positionOfCaret, wxT("\""));
         break;
       case ')': // jump over ')'
         if (m_positionOfCaret < m_text.Length() &&
             m_text.GetChar(m_positionOfCaret) == ')')
-          m_text = m_text.SubString(0, m_positionOfCaret - 2) +
-            m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(m_positionOfCaret - 1, m_positionOfCaret, wxEmptyString);
         break;
       case ']': // jump over ']'
         if (m_positionOfCaret < m_text.Length() &&
             m_text.GetChar(m_positionOfCaret) == ']')
-          m_text = m_text.SubString(0, m_positionOfCaret - 2) +
-            m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(m_positionOfCaret - 1, m_positionOfCaret, wxEmptyString);
         break;
       case '}': // jump over '}'
         if (m_positionOfCaret < m_text.Length() &&
             m_text.GetChar(m_positionOfCaret) == '}')
-          m_text = m_text.SubString(0, m_positionOfCaret - 2) +
-            m_text.SubString(m_positionOfCaret, m_text.Length());
+          ReplaceText(m_positionOfCaret - 1, m_positionOfCaret, wxEmptyString);
         break;
       case '+':
         // case '-': // this could mean negative.
@@ -1630,8 +1603,7 @@ bool EditorCell::HandleOrdinaryKey(wxKeyEvent& event)
         size_t len = m_text.Length();
         if (m_insertAns && len == 1 && m_positionOfCaret == 1)
         {
-          m_text = m_text.SubString(0, m_positionOfCaret - 2) + wxT("%") +
-            m_text.SubString(m_positionOfCaret - 1, m_text.Length());
+          ReplaceText(m_positionOfCaret - 1, m_positionOfCaret - 1, wxT("%"));
           m_positionOfCaret += 1;
         }
         break;
@@ -2039,9 +2011,11 @@ bool EditorCell::AddEnding()
   if (m_text.Left(5) == wxT(":lisp"))
     return false;
 
-  wxString text = m_text.Trim();
+  wxString text = m_text;
+  text.Trim();
+  ReplaceText(text.Length(), m_text.Length(), wxEmptyString);
   if (text.Right(1) != wxT(";") && text.Right(1) != wxT("$")) {
-    m_text += wxT(";");
+    ReplaceText(m_text.Length(), m_text.Length(), wxT(";"));
     m_paren1 = m_paren2 = m_width = -1;
     StyleText();
     return true;
@@ -2056,45 +2030,27 @@ bool EditorCell::AddEnding()
 //
 void EditorCell::PositionToXY(int position, int* x, int* y)
 {
-  int col = 0, lin = 0;
-  int pos = 0;
-
-  while (pos < position)
-  {
-    if (m_text.GetChar(pos) == '\n')
-    {
-      col = 0,
-      lin++;
-    }
-    else
-      col++;
-    pos++;
-  }
+  if (position < 0)
+    position = 0;
+  if (position > (int)m_text.Length())
+    position = m_text.Length();
 
-  *x = col;
-  *y = lin;
+  size_t line = m_lines.LineOf(position);
+  *x = position - m_lines.LineStart(line);
+  *y = line;
 }
 
 int EditorCell::XYToPosition(int x, int y)
 {
-  int col = 0, lin = 0, pos = 0;
+  if (y >= (int)m_lines.LineCount())
+    return m_text.Length();
+  if (y < 0)
+    y = 0;
+  if (x < 0)
+    x = 0;
 
-  while (pos < (int)m_text.Length() && lin < y)
-  {
-    if (m_text.GetChar(pos) == '\n')
-      lin++;
-    pos++;
-  }
-
-  while (pos < (int)m_text.Length() && col < x)
-  {
-    if (m_text.GetChar(pos) == '\n')
-      break;
-    pos++;
-    col++;
-  }
-
-  return pos;
+  size_t col = MIN((size_t)x, m_lines.ContentLength(y));
+  return m_lines.LineStart(y) + col;
 }
 
 wxPoint EditorCell::PositionToPoint(CellParser& parser, int pos)
@@ -2368,8 +2324,7 @@ bool EditorCell::CutToClipboard()
   m_positionOfCaret = start;
 
   // We cannot use SetValue() here, since SetValue() tends to move the cursor.
-  m_text = m_text.SubString(0, start - 1) +
-           m_text.SubString(end, m_text.Length());
+  ReplaceText(start, end, wxEmptyString);
   StyleText();
 
   ClearSelection();
@@ -2422,44 +2377,22 @@ void EditorCell::PasteFromClipboard(bool primary)
 
 int EditorCell::GetLineWidth(wxDC& dc, int line, int pos)
 {
-  if (pos == 0)
-    return 0;
-
-  int i = 0;
-  
-  std::list<StyledText> styledText = m_styledText;
-
-  while(!styledText.empty() && i<line)
-  {
-    // Grab a portion of text from the list.
-    StyledText textSnippet = styledText.front();
-    styledText.pop_front();
-    wxString text = textSnippet.GetText();
-    if (text.Right(1) == '\n')
-      i++;
-  }
-
-  if (i<line)
+  if ((pos <= 0) || (line < 0) || (line >= (int)m_lines.LineCount()))
     return 0;
 
+  size_t lineStart = m_lines.LineStart(line);
+  const std::vector<StyledSpan> &spans = m_lines.GetSpans(line);
   int width = 0;
-  wxString text;
   int textWidth, textHeight;
-  pos--;
-  while (!styledText.empty() && pos>=0)
+  for (size_t i = 0; (i < spans.size()) && (pos > 0); i++)
   {
-    StyledText textSnippet = styledText.front();
-    styledText.pop_front();
-    text = textSnippet.GetText();
+    size_t length = MIN(spans[i].m_length, (size_t)pos);
+    wxString text = m_text.Mid(lineStart + spans[i].m_start, length);
+    if ((m_type == MC_TYPE_INPUT) && m_changeAsterisk)
+      text.Replace(wxT("*"), wxT("\xB7"));
     dc.GetTextExtent(text, &textWidth, &textHeight);
     width += textWidth;
-    pos -= text.Length();
-  }
-
-  if (pos<0) {
-    width -= textWidth;
-    dc.GetTextExtent(text.SubString(0, text.Length() + pos), &textWidth, &textHeight);
-    width += textWidth;
+    pos -= length;
   }
 
   return width;
@@ -2487,7 +2420,7 @@ void EditorCell::Undo()
     return ;
 
   // We cannot use SetValue() here, since SetValue() tends to move the cursor.
-  m_text = m_textHistory.Item(m_historyPosition);
+  ChangeText(m_textHistory.Item(m_historyPosition));
   StyleText();
   
   m_positionOfCaret = m_positionHistory[m_historyPosition];
@@ -2517,7 +2450,7 @@ void EditorCell::Redo()
     return ;
 
   // We cannot use SetValue() here, since SetValue() tends to move the cursor.
-  m_text = m_textHistory.Item(m_historyPosition);
+  ChangeText(m_textHistory.Item(m_historyPosition));
   StyleText();
   
   m_positionOfCaret = m_positionHistory[m_historyPosition];
@@ -2589,316 +2522,286 @@ bool EditorCell::IsAlphaNum(wxChar ch)
   return false;
 }
 
-wxArrayString EditorCell::StringToTokens(wxString string)
+bool EditorCell::IsOperand(wxChar ch)
+{
+  return wxIsalnum(ch) || (ch == wxT('%')) || (ch == wxT(')')) ||
+    (ch == wxT('}')) || (ch == wxT(']'));
+}
+
+wxChar EditorCell::NextNonSpace(size_t pos)
+{
+  while ((pos < m_text.Length()) && wxIsspace(m_text[pos]))
+    pos++;
+
+  if (pos < m_text.Length())
+    return m_text[pos];
+  else
+    return wxT(' ');
+}
+
+bool EditorCell::IsBlankLine(size_t line)
+{
+  size_t start = m_lines.LineStart(line);
+  size_t end = start + m_lines.ContentLength(line);
+  for (size_t pos = start; pos < end; pos++)
+    if (!wxIsspace(m_text[pos]))
+      return false;
+  return true;
+}
+
+//! Adds a span to a line, merging it with the previous one if it has the same style.
+static void AddSpan(std::vector<StyledSpan> &spans, size_t start, size_t length, int style)
+{
+  if ((!spans.empty()) && (spans.back().m_style == style) &&
+      (spans.back().m_start + spans.back().m_length == start))
+    spans.back().m_length += length;
+  else
+    spans.push_back(StyledSpan(start, length, style));
+}
+
+static const wxChar *keywords[] =
+{
+  wxT("for"), wxT("in"), wxT("then"), wxT("while"), wxT("do"), wxT("thru"),
+  wxT("next"), wxT("step"), wxT("unless"), wxT("from"), wxT("if"), wxT("else"),
+  wxT("elif"), wxT("and"), wxT("or"), wxT("not"), wxT("true"), wxT("false"),
+  NULL
+};
+
+int EditorCell::StyleLine(size_t line, size_t lineStart, int state)
 {
-  size_t size=string.Length();
-  size_t pos=0;
-  wxArrayString retval;
-  wxString token;
+  std::vector<StyledSpan> spans;
+  size_t end = lineStart + m_lines.ContentLength(line);
+  int lexState = state;
 
-  while(pos<size)
+  if (m_type != MC_TYPE_INPUT)
   {
-    wxChar Ch = string.GetChar(pos);
+    if (end > lineStart)
+      spans.push_back(StyledSpan(0, end - lineStart, -1));
+    m_lines.SetStyle(line, lexState, state, spans);
+    return state;
+  }
+
+  size_t pos = lineStart;
+  while (pos < end)
+  {
+    size_t start = pos;
+    wxChar ch = m_text[pos];
 
-    // Check for new line
-    if(Ch==wxT('\n'))
+    // Strings and comments continue until they are closed, even across lines.
+    // A backslash escapes the character that follows it.
+    if (state == lex_string)
     {
-      if(token != wxEmptyString) {
-        retval.Add(token + wxT("d"));
-        token = wxEmptyString;
+      while (pos < end)
+      {
+        ch = m_text[pos++];
+        if (ch == wxT('\\'))
+        {
+          if (pos < end)
+            pos++;
+        }
+        else if (ch == wxT('"'))
+        {
+          state = lex_code;
+          break;
+        }
       }
-      retval.Add(wxT("\nd"));
-      pos++;
+      AddSpan(spans, start - lineStart, pos - start, TS_CODE_STRING);
+      continue;
+    }
+
+    if (state == lex_comment)
+    {
+      while (pos < end)
+      {
+        ch = m_text[pos++];
+        if (ch == wxT('\\'))
+        {
+          if (pos < end)
+            pos++;
+        }
+        else if ((ch == wxT('/')) && (pos < end) && (m_text[pos] == wxT('*')))
+          pos++;
+        else if ((ch == wxT('*')) && (pos < end) && (m_text[pos] == wxT('/')))
+        {
+          pos++;
+          state = lex_code;
+          break;
+        }
+      }
+      AddSpan(spans, start - lineStart, pos - start, TS_CODE_COMMENT);
+      continue;
     }
-    // A minus and a plus are special tokens as they can be both
-    // operators or part of a number.
-    else if (
-      (Ch==wxT('+')) ||
-      (Ch==wxT('-'))||
-      (Ch==wxT('\x2212')) // An unicode minus sign
-      )
+
+    // A minus and a plus are special as they can be both operators or
+    // part of a number.
+    if ((ch == wxT('+')) || (ch == wxT('-')) || (ch == wxT('\x2212')))
     {
-      if(token != wxEmptyString)
-        retval.Add(token + wxT("d"));
-      token=wxString(Ch);
-      retval.Add(token + wxT("d"));
+      int style = TS_CODE_OPERATOR;
+      if (IsNum(NextNonSpace(pos + 1)) && (state != lex_operand))
+        style = TS_CODE_NUMBER;
+      AddSpan(spans, start - lineStart, 1, style);
       pos++;
-      token = wxEmptyString;
+      state = lex_code;
+      continue;
     }
-    // Check for comment
-    else if ((string.Length() > pos+1) &&
-        ((Ch == '/' && string.GetChar(pos+1) == '*') ||
-         (Ch == '*' && string.GetChar(pos+1) == '/')))
+
+    if ((ch == wxT('/')) && (pos + 1 < end) && (m_text[pos + 1] == wxT('*')))
     {
-      if(token != wxEmptyString) {
-        retval.Add(token + wxT("d"));
-        token = wxEmptyString;
-      }
-      retval.Add(string.SubString(pos, pos+1) + wxT("d"));
-      pos = pos+2;
+      AddSpan(spans, start - lineStart, 2, TS_CODE_COMMENT);
+      pos += 2;
+      state = lex_comment;
+      continue;
     }
-    
-    // Find operators that starts at the current position
-    else if (operators.Find(Ch) != wxNOT_FOUND)
+
+    if ((ch == wxT('*')) && (pos + 1 < end) && (m_text[pos + 1] == wxT('/')))
     {
-      if(token != wxEmptyString) {
-        retval.Add(token + wxT("d"));
-        token = wxEmptyString;
-      }
-      retval.Add(wxString(string.GetChar(pos++)) + wxT("d"));
+      AddSpan(spans, start - lineStart, 2, TS_CODE_OPERATOR);
+      pos += 2;
+      state = lex_code;
+      continue;
     }
-    
-    // Find a keyword that starts at the current position
-    else if ((IsAlpha(Ch)) || (Ch == wxT('\\')))
+
+    if (operators.Find(ch) != wxNOT_FOUND)
     {
-      if(token != wxEmptyString) {
-        retval.Add(token + wxT("d"));
-        token=wxEmptyString;
+      int style = TS_CODE_OPERATOR;
+      state = lex_code;
+      if ((ch == wxT('$')) || (ch == wxT(';')))
+        style = TS_CODE_ENDOFLINE;
+      if (ch == wxT('"'))
+      {
+        style = TS_CODE_STRING;
+        state = lex_string;
       }
-      
-      while((pos<size) && IsAlphaNum(string.GetChar(pos)))
+      AddSpan(spans, start - lineStart, 1, style);
+      pos++;
+      continue;
+    }
+
+    if (IsAlpha(ch))
+    {
+      while ((pos < end) && IsAlphaNum(m_text[pos]))
       {
-        if(string.GetChar(pos) == wxT('\\'))
+        if (m_text[pos] == wxT('\\'))
         {
-          token += string.GetChar(pos);
           pos++;
-          if((pos<size) && (string.GetChar(pos) == wxT('\n')))
-            continue;
+          if (pos >= end)
+            break;
         }
-        token += string.GetChar(pos);
         pos++;
       }
-      
-      retval.Add(token + wxT("d"));
-      token = wxEmptyString;
+
+      // Sometimes we can differ between variables and functions by the context.
+      // But I assume there cannot be an algorithm that always makes
+      // the right decision here:
+      //  - Function names can be used without the parenthesis that make out
+      //    functions.
+      //  - The same name can stand for a function and a variable
+      //  - There are indexed functions
+      //  - using lambda a user can store a function in a variable
+      //  - and is U_C1(t) really meant as a function or does it represent a variable
+      //    named U_C1 that depends on t?
+      int style = TS_CODE_VARIABLE;
+      for (const wxChar **keyword = keywords; *keyword != NULL; keyword++)
+        if (m_text.compare(start, pos - start, *keyword) == 0)
+          style = -1;
+      if ((style != -1) && (NextNonSpace(pos) == wxT('(')))
+        style = TS_CODE_FUNCTION;
+      AddSpan(spans, start - lineStart, pos - start, style);
     }
-    
-    // Find a number that starts at the current positions
-    else if (IsNum(Ch))
+    else if (IsNum(ch))
     {
-      if(token != wxEmptyString) {
-        retval.Add(token + wxT("d"));
-        token=wxEmptyString;
-      }
-            
-      while((pos<size) &&
-            (IsNum(string.GetChar(pos)) ||
-             ((string.GetChar(pos)>= wxT('a')) && (string.GetChar(pos)<= wxT('z'))) ||
-             ((string.GetChar(pos)>= wxT('A')) && (string.GetChar(pos)<= wxT('Z')))
-               )
-        )
-      {
-        token += string.GetChar(pos);
+      while ((pos < end) &&
+             (IsNum(m_text[pos]) ||
+              ((m_text[pos] >= wxT('a')) && (m_text[pos] <= wxT('z'))) ||
+              ((m_text[pos] >= wxT('A')) && (m_text[pos] <= wxT('Z')))))
         pos++;
-      }
-      
-      retval.Add(token + wxT("d"));
-      token=wxEmptyString;
+      AddSpan(spans, start - lineStart, pos - start, TS_CODE_NUMBER);
     }
     else
-      token = token + string.GetChar(pos++);
+    {
+      // Whitespace, parenthesis, commas and everything else that doesn't
+      // start a token of its own is drawn in the default style.
+      while ((pos < end) &&
+             (m_text[pos] != wxT('+')) && (m_text[pos] != wxT('-')) &&
+             (m_text[pos] != wxT('\x2212')) &&
+             (operators.Find(m_text[pos]) == wxNOT_FOUND) &&
+             (!IsAlphaNum(m_text[pos])))
+        pos++;
+      AddSpan(spans, start - lineStart, pos - start, -1);
+    }
+
+    // If the token ends in an operand a sign that follows it is an operator.
+    for (size_t i = pos; i > start; i--)
+      if (!wxIsspace(m_text[i - 1]))
+      {
+        state = IsOperand(m_text[i - 1]) ? lex_operand : lex_code;
+        break;
+      }
   }
-  
-  // Add the last token we detected to the token list
-  retval.Add(token + wxT("d"));
-  
-  return retval;
+
+  m_lines.SetStyle(line, lexState, state, spans);
+  return state;
 }
 
 void EditorCell::StyleText()
 {
-  m_styledText.clear();
-
-  if(m_type == MC_TYPE_INPUT)
+  // Input cells are highlighted, all other cells aren't.
+  if (m_styledType != m_type)
   {
-    wxString textToStyle = m_text;
-    if (m_changeAsterisk)  
-      textToStyle.Replace(wxT("*"), wxT("\xB7"));
-    
-    if(m_firstLineOnly)
-    {
-      size_t newlinepos = textToStyle.find(wxT("\nd"));
-      if(newlinepos != wxNOT_FOUND)
-      {
-        textToStyle = textToStyle.Left(newlinepos) +
-          wxString::Format(wxT(" ... + %i hidden lines"), textToStyle.Freq(wxT('\n')));
-      }
-    }
-    
-    wxArrayString tokens = StringToTokens(textToStyle);
+    m_styledType = m_type;
+    m_lines.InvalidateStyles();
+  }
 
-    wxString lastTokenWithText;
-    for(size_t i=0;i<tokens.GetCount();i++)
-    {
-      wxString token = tokens[i];
-      token = token.Left(token.Length()-1);
-      wxChar Ch = token[0];
-
-      // Save the last non-whitespace character in lastChar -
-      // or a space if there is no such char.
-      wxChar lastChar=wxT(' ');
-      if(lastTokenWithText!=wxEmptyString)
-            lastChar=lastTokenWithText.Right(1)[0];
-      wxString tmp = token;
-      tmp=tmp.Trim();
-      if(tmp!=wxEmptyString)
-        lastTokenWithText = tmp;
-      
-      // Save the next non-whitespace character in lastChar -
-      // or a space if there is no such char.
-      wxChar nextChar=wxT(' ');
-      size_t o = i+1;
-      while(o<tokens.GetCount())
-      {
-        wxString nextToken=tokens[o];
-        nextToken=nextToken.Trim(false);
-        if(nextToken!=wxT("d"))
-        {
-          nextChar=nextToken[0];
-          break;
-        }
-        o++;
-      }
+  if (!m_lines.HasUnstyledLines())
+    return;
 
-      // Handle comments
-      if(token == wxT("\""))
-      {
-        m_styledText.push_back(StyledText(TS_CODE_STRING,token));
-        if (i+1<tokens.GetCount()) {
-          i++;
-          token = tokens[i];
-          token = token.Left(token.Length()-1);
-          m_styledText.push_back(StyledText(TS_CODE_STRING,token));
-          while ((i+1 < tokens.GetCount()) && token != wxT("\"")) {
-            i++;
-            token = tokens[i];
-            token = token.Left(token.Length()-1);
-            m_styledText.push_back(StyledText(TS_CODE_STRING,token));
-          }
-        }
-        continue;
-      }
+  // A token's style can depend on the first character that follows it
+  // => The last line before the edit that isn't blank has to be styled, too.
+  size_t line = m_lines.FirstUnstyled();
+  size_t lastChanged = m_lines.LastUnstyled();
+  while (line > 0)
+  {
+    line--;
+    if (!IsBlankLine(line))
+      break;
+  }
 
-      if((Ch==wxT('+')) ||
-         (Ch==wxT('-'))||
-         (Ch==wxT('\x2212'))
-        )
-      {
-        if(
-          (nextChar>=wxT('0')) &&
-          (nextChar<=wxT('9'))
-          )
-        {
-          // Our sign precedes a number.
-          if(
-            (wxIsalnum(lastChar)) ||
-            (lastChar==wxT('%'))  ||
-            (lastChar==wxT(')'))  ||
-            (lastChar==wxT('}'))  ||
-            (lastChar==wxT(']'))
-            )
-          {
-            m_styledText.push_back(StyledText(TS_CODE_OPERATOR,token));
-          }
-          else
-          {
-            m_styledText.push_back(StyledText(TS_CODE_NUMBER,token));
-          }
-        }
-        else
-            m_styledText.push_back(StyledText(TS_CODE_OPERATOR,token));
-        continue;
-      }
+  int state = lex_code;
+  if (line > 0)
+    state = m_lines.GetLexEnd(line - 1);
 
-      if(token == wxT("/*"))
-      {
-        m_styledText.push_back(StyledText(TS_CODE_COMMENT,token));
-        while ((i+1 < tokens.GetCount()) && (token != wxT("*/"))) {
-          i++;
-          token = tokens[i];
-          token = token.Left(token.Length()-1);
-          m_styledText.push_back(StyledText(TS_CODE_COMMENT,token));
-        }
-        continue;
-      }
-      
-      if(operators.Find(token) != wxNOT_FOUND)
-      {
-        if((token==wxT('$'))||(token==wxT(';')))
-          m_styledText.push_back(StyledText(TS_CODE_ENDOFLINE,token));
-        else
-          m_styledText.push_back(StyledText(TS_CODE_OPERATOR,token));
-        continue;
-      }
-      if(isdigit(token[0]))
-      {
-        m_styledText.push_back(StyledText(TS_CODE_NUMBER,token));
-        continue;
-      }
-      if((IsAlpha(token[0])) || (token[0] == wxT('\\')))
-      {
-        // Sometimes we can differ between variables and functions by the context.
-        // But I assume there cannot be an algorithm that always makes
-        // the right decision here:
-        //  - Function names can be used without the parenthesis that make out
-        //    functions.
-        //  - The same name can stand for a function and a variable
-        //  - There are indexed functions
-        //  - using lambda a user can store a function in a variable
-        //  - and is U_C1(t) really meant as a function or does it represent a variable
-        //    named U_C1 that depends on t?
-        if((tokens.GetCount()>i+1))
-        {
-          wxString nextToken = tokens[i+1];
-          nextToken=nextToken.Trim(false);
-
-          if (token == wxT("for")    ||
-              token == wxT("in")     ||
-              token == wxT("then")   ||
-              token == wxT("while")  ||
-              token == wxT("do")     ||
-              token == wxT("thru")   ||
-              token == wxT("next")   ||
-              token == wxT("step")   ||
-              token == wxT("unless") ||
-              token == wxT("from")   ||
-              token == wxT("if")     ||
-              token == wxT("else")   ||
-              token == wxT("elif")   ||
-              token == wxT("and")    ||
-              token == wxT("or")     ||
-              token == wxT("not")    ||
-              token == wxT("not")    ||
-              token == wxT("true")   ||
-              token == wxT("false"))
-            m_styledText.push_back(token);
-          else if(nextChar==wxT('('))
-            m_styledText.push_back(StyledText(TS_CODE_FUNCTION,token));
-          else
-            m_styledText.push_back(StyledText(TS_CODE_VARIABLE,token));
-          continue;
-        }
-        else
-          m_styledText.push_back(StyledText(TS_CODE_VARIABLE,token));
-      }
-      m_styledText.push_back(StyledText(token));
-    }
-  }
-  else {
-    wxString token;
-    for (size_t i = 0; i<m_text.Length(); i++) {
-      if (m_text.GetChar(i) == '\n') {
-        m_styledText.push_back(StyledText(token));
-        m_styledText.push_back(StyledText(wxT("\n")));
-        token = wxEmptyString;
-      }
-      else
-        token += m_text.GetChar(i);
-    }
-    m_styledText.push_back(StyledText(token));
+  size_t lineStart = m_lines.LineStart(line);
+  for (; line < m_lines.LineCount(); line++)
+  {
+    // Behind the edited lines we can stop as soon as a line starts in the
+    // state it has been styled with: Its styles haven't changed.
+    if ((line > lastChanged) && m_lines.IsStyled(line) && (m_lines.GetLexState(line) == state))
+      break;
+    state = StyleLine(line, lineStart, state);
+    lineStart += m_lines.LineLength(line);
   }
+  m_lines.StylesUpdated();
 }
 
+void EditorCell::ReplaceText(size_t start, size_t end, const wxString &text)
+{
+  m_lines.Replace(m_text, start, end, text);
+}
+
+void EditorCell::ChangeText(const wxString &text)
+{
+  size_t common = MIN(m_text.Length(), text.Length());
+  size_t prefix = 0;
+  while ((prefix < common) && (m_text[prefix] == text[prefix]))
+    prefix++;
+  size_t suffix = 0;
+  while ((suffix < common - prefix) &&
+         (m_text[m_text.Length() - suffix - 1] == text[text.Length() - suffix - 1]))
+    suffix++;
+
+  ReplaceText(prefix, m_text.Length() - suffix,
+              text.Mid(prefix, text.Length() - prefix - suffix));
+}
 
 void EditorCell::SetValue(wxString text)
 {
@@ -2907,50 +2810,46 @@ void EditorCell::SetValue(wxString text)
     if (m_matchParens)
     {
       if (text == wxT("(")) {
-        m_text = wxT("()");
+        text = wxT("()");
         m_positionOfCaret = 1;
       }
       else if (text == wxT("[")) {
-        m_text = wxT("[]");
+        text = wxT("[]");
         m_positionOfCaret = 1;
       }
       else if (text == wxT("{")) {
-        m_text = wxT("{}");
+        text = wxT("{}");
         m_positionOfCaret = 1;
       }
       else if (text == wxT("\"")) {
-        m_text = wxT("\"\"");
+        text = wxT("\"\"");
         m_positionOfCaret = 1;
       }
-      else {
-        m_text = text;
-        m_positionOfCaret = m_text.Length();
-      }
-    }
-    else {
-      m_text = text;
-      m_positionOfCaret = m_text.Length();
+      else
+        m_positionOfCaret = text.Length();
     }
+    else
+      m_positionOfCaret = text.Length();
 
     if (m_insertAns)
     {
-      if (m_text == wxT("+") ||
-          m_text == wxT("*") ||
-          m_text == wxT("/") ||
-          m_text == wxT("^") ||
-          m_text == wxT("=") ||
-          m_text == wxT(","))
+      if (text == wxT("+") ||
+          text == wxT("*") ||
+          text == wxT("/") ||
+          text == wxT("^") ||
+          text == wxT("=") ||
+          text == wxT(","))
       {
-        m_text = wxT("%") + m_text;
-        m_positionOfCaret = m_text.Length();
+        text = wxT("%") + text;
+        m_positionOfCaret = text.Length();
       }
     }
   }
   else
-  {
-    m_text = text;
-    m_positionOfCaret = m_text.Length();
-  }
+    m_positionOfCaret = text.Length();
+
+  // Only the part of the text that actually changes needs to be styled again.
+  ChangeText(text);
 
   FindMatchingParens();
   m_containsChanges = true;
@@ -2972,7 +2871,9 @@ bool EditorCell::CheckChanges()
 int EditorCell::ReplaceAll(wxString oldString, wxString newString,bool IgnoreCase)
 {
   SaveValue();
-  int count = m_text.Replace(oldString, newString);
+  wxString text = m_text;
+  int count = text.Replace(oldString, newString);
+  ChangeText(text);
   if (count > 0)
   {
     m_containsChanges = true;
@@ -3052,9 +2953,7 @@ bool EditorCell::ReplaceSelection(wxString oldStr, wxString newStr, bool keepSel
   
   {
     // We cannot use SetValue() here, since SetValue() tends to move the cursor.
-    m_text = m_text.SubString(0, start - 1) +
-             newStr +
-             m_text.SubString(end, m_text.Length());
+    ReplaceText(start, end, newStr);
     StyleText();
     
     m_containsChanges = true;
@@ -24,9 +24,9 @@
 #define EDITORCELL_H
 
 #include "MathCell.h"
+#include "LineIndex.h"
 
 #include <vector>
-#include <list>
 #include <wx/tokenzr.h>
 
 /*! \file
@@ -120,9 +120,11 @@ public:
   {
     return m_text;
   }
-  /*! Converts m_text to a list of styled text snippets that will later be used by draw().
+  /*! Updates the styled spans draw() uses for the lines that have changed
 
-    \todo Actually set the needed text styles.
+    The lexer restarts at the first changed line, using the state it had
+    reached at the end of the line before, and stops as soon as it reaches
+    an unchanged line in the state that line has been styled with.
    */
   void StyleText();
   void Reset();
@@ -277,11 +279,44 @@ public:
       SetSelection(m_lastSelectionStart,m_text.Length());
     }
 private:
-  /*! Divide a string into tokens
+  //! The states the lexer in StyleText() can be in at the end of a line
+  enum LexState
+  {
+    //! Outside of strings and comments
+    lex_code,
+    //! Like lex_code, but the last token was an operand => a sign is an operator.
+    lex_operand,
+    lex_string,
+    lex_comment
+  };
+  /*! Styles a line
+
+    \param line The line to style
+    \param lineStart The position of the line's first character in m_text
+    \param state The state the lexer is in at the start of the line
+    \return The state the lexer is in at the end of the line
+   */
+  int StyleLine(size_t line, size_t lineStart, int state);
+  //! The first character at or after pos that isn't whitespace, or a space.
+  wxChar NextNonSpace(size_t pos);
+  //! Does a line consist of nothing but whitespace?
+  bool IsBlankLine(size_t line);
+  //! The cell type the current styles have been created for
+  int m_styledType;
+
+  /*! Replaces the characters between start and end by text
+
+    All changes to m_text that don't replace the whole text have to use this
+    function in order to keep m_lines up to date.
+   */
+  void ReplaceText(size_t start, size_t end, const wxString &text);
+  /*! Replaces the whole text
 
-    Used when styling text.
+    Only the part between the common beginning and end of the old and the
+    new text is replaced so only the lines that actually differ need to
+    be measured and styled again.
    */
-  wxArrayString StringToTokens(wxString string);
+  void ChangeText(const wxString &text);
 
 #if defined __WXMAC__
   bool HandleCtrlCommand(wxKeyEvent& ev);
@@ -292,52 +327,9 @@ private:
   bool IsAlpha(wxChar c);
   bool IsNum(wxChar c);
   bool IsAlphaNum(wxChar c);
+  //! Is a sign that follows the character c an operator rather than part of a number?
+  bool IsOperand(wxChar c);
   
-  /*! A piece of styled text for syntax highlighting
-
-   */
-  class StyledText
-  {
-  private:
-    //! The color of this text portion
-    TextStyle  m_style;
-    //! The text of this text portion
-    wxString m_text;
-    //! Do we really want to style this text portion different than the default?
-    bool m_styleThisText;
-  public:    
-    //! Defines a piece of styled text
-    StyledText(TextStyle style,wxString text)
-      {
-        m_text = text;
-        m_style = style;
-        m_styleThisText = true;
-      }
-
-    //! Defines a piece of text with the default style
-    StyledText(wxString text)
-      {
-        m_text = text;
-        m_styleThisText = false;
-      }
-    //! Returns the piece of text
-    wxString GetText()
-      {
-        return m_text;
-      }
-    //! If StyleSet() is true this function returns the color of this text portion
-    TextStyle GetStyle()
-      {
-        return m_style;
-      }
-    // Has a individual text style been set for this text portion?
-    bool StyleSet()
-      {
-        return m_styleThisText;
-      }
-  };
-  
-  std::list<StyledText> m_styledText;
 
 #if wxUSE_UNICODE
   /*! Handle ESC shortcuts for special characters
@@ -349,6 +341,8 @@ private:
   wxString InterpretEscapeString(wxString txt);
 #endif
   wxString m_text;
+  //! Where the lines of m_text begin and how wide they are
+  LineIndex m_lines;
   wxArrayString m_textHistory;
   std::vector<int> m_positionHistory;
   std::vector<int> m_startHistory;
@@ -0,0 +1,106 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "ErrorMatcher.h"
+
+#include <wx/config.h>
+#include <wx/tokenzr.h>
+
+ErrorMatcher::ErrorMatcher()
+{
+  Clear();
+  AddDefaults();
+}
+
+void ErrorMatcher::Clear()
+{
+  m_nodes.clear();
+  m_nodes.push_back(Node());
+}
+
+void ErrorMatcher::AddDefaults()
+{
+  Add(wxT("-- an error."));
+  Add(wxT("incorrect syntax"));
+  Add(wxT("Maxima encountered a Lisp error"));
+  Add(wxT("killcontext: no such context"));
+}
+
+void ErrorMatcher::Add(const wxString &pattern)
+{
+  if(pattern.IsEmpty())
+    return;
+
+  int node = 0;
+  for(size_t i = 0; i < pattern.Length(); i++)
+  {
+    wxChar ch = pattern[i];
+    std::map<wxChar, int>::iterator next = m_nodes[node].m_next.find(ch);
+    if(next != m_nodes[node].m_next.end())
+      node = next->second;
+    else
+    {
+      // push_back() may move the nodes => don't keep a reference across it.
+      m_nodes.push_back(Node());
+      m_nodes[node].m_next[ch] = m_nodes.size() - 1;
+      node = m_nodes.size() - 1;
+    }
+  }
+  m_nodes[node].m_accepts = true;
+}
+
+void ErrorMatcher::AddLines(const wxString &patterns)
+{
+  wxStringTokenizer lines(patterns, wxT("\n"), wxTOKEN_STRTOK);
+  while(lines.HasMoreTokens())
+  {
+    wxString pattern = lines.GetNextToken();
+    pattern.Trim(true);
+    pattern.Trim(false);
+    Add(pattern);
+  }
+}
+
+void ErrorMatcher::ReadConfig()
+{
+  wxString errorPatterns;
+  wxConfig::Get()->Read(wxT("errorPatterns"), &errorPatterns);
+  Clear();
+  AddDefaults();
+  AddLines(errorPatterns);
+}
+
+bool ErrorMatcher::Matches(const wxString &text, size_t begin, size_t end) const
+{
+  while((begin < end) && wxIsspace(text[begin]))
+    begin++;
+
+  int node = 0;
+  for(size_t i = begin; i < end; i++)
+  {
+    std::map<wxChar, int>::const_iterator next = m_nodes[node].m_next.find(text[i]);
+    if(next == m_nodes[node].m_next.end())
+      return false;
+    node = next->second;
+    if(m_nodes[node].m_accepts)
+      return true;
+  }
+  return false;
+}
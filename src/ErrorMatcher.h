@@ -0,0 +1,84 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  Recognizes the lines of maxima's output that tell that an error has occurred.
+ */
+
+#ifndef ERRORMATCHER_H
+#define ERRORMATCHER_H
+
+#include <wx/wx.h>
+#include <wx/string.h>
+
+#include <map>
+#include <vector>
+
+/*! Tests if a line of maxima's output begins with one of a set of error messages
+
+  All patterns are merged into one trie that is built only once. Testing a
+  line therefore costs at most one step per character of the longest
+  matching pattern, no matter how many patterns there are, and most lines
+  are rejected after looking at their first character.
+ */
+class ErrorMatcher
+{
+public:
+  //! Creates a matcher that knows maxima's own error messages.
+  ErrorMatcher();
+  //! Forgets all patterns, including the built-in ones.
+  void Clear();
+  //! Adds maxima's own error messages.
+  void AddDefaults();
+  //! Adds a pattern. Empty patterns are ignored.
+  void Add(const wxString &pattern);
+  /*! Adds a list of patterns, one per line
+
+    Leading and trailing whitespace is removed from every line.
+   */
+  void AddLines(const wxString &patterns);
+  /*! Replaces all patterns by maxima's own error messages and the ones in the config
+
+    The config key errorPatterns holds the user's patterns, one per line.
+   */
+  void ReadConfig();
+  /*! Does the text between begin and end begin with one of the patterns?
+
+    Whitespace at the beginning of this range is skipped.
+   */
+  bool Matches(const wxString &text, size_t begin, size_t end) const;
+  //! Does a line begin with one of the patterns?
+  bool Matches(const wxString &line) const { return Matches(line, 0, line.Length()); }
+
+private:
+  //! A node of the trie
+  struct Node
+  {
+    Node() { m_accepts = false; }
+    //! The node that follows for each character
+    std::map<wxChar, int> m_next;
+    //! Does a pattern end here?
+    bool m_accepts;
+  };
+  //! The trie. m_nodes[0] is its root.
+  std::vector<Node> m_nodes;
+};
+
+#endif // ERRORMATCHER_H
@@ -22,41 +22,135 @@
 
 #include "EvaluationQueue.h"
 
-EvaluationQueueElement::EvaluationQueueElement(GroupCell* gr)
-{
-  group = gr;
-  next = NULL;
-}
+#include <algorithm>
 
 bool EvaluationQueue::Empty()
 {
-  return (m_queue == NULL) && (m_tokens.IsEmpty());
+  return m_queue.empty() && m_tokens.empty();
 }
 
 EvaluationQueue::EvaluationQueue()
 {
-  m_size = 0;
-  m_queue = NULL;
-  m_last = NULL;
   m_workingGroupChanged = false;
+  m_currentSent = false;
+  m_sentAhead = 0;
+}
+
+void EvaluationQueue::ResetSentCells()
+{
+  if(!m_currentSent)
+    return;
+
+  // The current command and the ones that have been sent ahead
+  size_t sent = 1 + m_sentAhead;
+  if(!m_tokens.empty())
+  {
+    m_queue.front()->ResetEvaluated();
+    sent -= std::min(sent, m_tokens.size());
+  }
+  for(size_t i = 0; (i < m_lookahead.size()) && (sent > 0); i++)
+  {
+    m_queue[i + 1]->ResetEvaluated();
+    sent -= std::min(sent, m_lookahead[i].size());
+  }
 }
 
 void EvaluationQueue::Clear()
 {
-  while(!Empty())
-    RemoveFirst();
-  m_size = 0;
-  m_tokens.Clear();
+  ResetSentCells();
+  m_queue.clear();
+  m_queued.clear();
+  m_tokens.clear();
+  m_input = wxEmptyString;
+  m_lookahead.clear();
+  m_lookaheadInput.clear();
   m_workingGroupChanged = false;
+  m_currentSent = false;
+  m_sentAhead = 0;
+  m_sentAheadTimes.clear();
+}
+
+void EvaluationQueue::ClearUnsent()
+{
+  if(m_sentAhead == 0)
+  {
+    Clear();
+    return;
+  }
+
+  // Keep the command maxima works on and all commands that follow it in
+  // maxima's input buffer.
+  size_t keep = 1 + m_sentAhead;
+  size_t cells = 1;
+  if(keep <= m_tokens.size())
+  {
+    if(keep < m_tokens.size())
+      m_queue.front()->ResetEvaluated();
+    m_tokens.resize(keep);
+    m_lookahead.clear();
+    m_lookaheadInput.clear();
+  }
+  else
+  {
+    keep -= m_tokens.size();
+    size_t i = 0;
+    while((i < m_lookahead.size()) && (keep > 0))
+    {
+      if(keep < m_lookahead[i].size())
+      {
+        m_queue[i + 1]->ResetEvaluated();
+        m_lookahead[i].resize(keep);
+      }
+      keep -= m_lookahead[i].size();
+      i++;
+    }
+    m_lookahead.resize(i);
+    m_lookaheadInput.resize(i);
+    cells += i;
+  }
+
+  while(m_queue.size() > cells)
+  {
+    GroupCellCount::iterator count = m_queued.find(m_queue.back());
+    if ((count != m_queued.end()) && (--count->second <= 0))
+      m_queued.erase(count);
+    m_queue.pop_back();
+  }
 }
 
-bool EvaluationQueue::IsInQueue(GroupCell* gr)
+bool EvaluationQueue::PeekAhead(GroupCell *&cell, wxString &command, wxString &input)
 {
-  EvaluationQueueElement* tmp = m_queue;
-  while (tmp != NULL) {
-    if (tmp->group == gr)
+  // The commands maxima already has got are followed by the one we look for.
+  size_t index = 1 + m_sentAhead;
+  input = wxEmptyString;
+  if(index < m_tokens.size())
+  {
+    cell = m_queue.front();
+    command = m_tokens[index];
+    return true;
+  }
+  index -= m_tokens.size();
+
+  for(size_t i = 1; i < m_queue.size(); i++)
+  {
+    // Split the next cell into commands the same way RemoveFirst() would do.
+    if(m_lookahead.size() < i)
+    {
+      m_queue[i]->GetEditable()->AddEnding();
+      m_lookahead.push_back(std::deque<wxString>());
+      m_lookaheadInput.push_back(m_queue[i]->GetEditable()->GetValue());
+      AddTokens(m_lookaheadInput.back(), m_lookahead.back());
+    }
+
+    if(index < m_lookahead[i - 1].size())
+    {
+      cell = m_queue[i];
+      command = m_lookahead[i - 1][index];
+      if(index == 0)
+        input = m_lookaheadInput[i - 1];
       return true;
-    tmp = tmp->next;
+    }
+    index -= m_lookahead[i - 1].size();
   }
   return false;
 }
@@ -67,17 +161,15 @@ void EvaluationQueue::AddToQueue(GroupCell* gr)
   if (gr->GetGroupType() != GC_TYPE_CODE
       || gr->GetEditable() == NULL) // dont add cells which can't be evaluated
     return;
-  EvaluationQueueElement* newelement = new EvaluationQueueElement(gr);
-  if (m_last == NULL)
-    m_queue = m_last = newelement;
-  else {
-    m_last->next = newelement;
-    m_last = newelement;
-  }
-  m_size++;
+  m_queue.push_back(gr);
+  m_queued[gr]++;
   if(emptyWas)
   {
-    AddTokens(gr->GetEditable()->GetValue());
+    // GetCell() would add the ending later and make the input differ from
+    // the one the commands have been split from.
+    gr->GetEditable()->AddEnding();
+    m_input = gr->GetEditable()->GetValue();
+    AddTokens(m_input, m_tokens);
     m_workingGroupChanged = true;
   }
 }
@@ -101,34 +193,50 @@ void EvaluationQueue::AddHiddenTreeToQueue(GroupCell* gr)
 
 void EvaluationQueue::RemoveFirst()
 {
-  if(!m_tokens.IsEmpty())
+  if(!m_tokens.empty())
   {
     m_workingGroupChanged = false;
-    m_tokens.RemoveAt(0);
+    m_tokens.pop_front();
+    // The command that follows might already be on its way to maxima.
+    m_currentSent = (m_sentAhead > 0);
+    if(m_currentSent)
+    {
+      m_sentAhead--;
+      m_sentTime = m_sentAheadTimes.front();
+      m_sentAheadTimes.pop_front();
+    }
   }
   else
   {
-    if (m_queue == NULL)
+    if (m_queue.empty())
       return; // shouldn't happen
-    EvaluationQueueElement* tmp = m_queue;
-    if (m_queue == m_last) {
-      m_queue = m_last = NULL;
-    }
-    else
-      m_queue = m_queue->next;
-    
-    delete tmp;
-    m_size--;
+    GroupCellCount::iterator count = m_queued.find(m_queue.front());
+    if ((count != m_queued.end()) && (--count->second <= 0))
+      m_queued.erase(count);
+    m_queue.pop_front();
     if(!Empty())
     {
-      AddTokens(GetCell()->GetEditable()->GetValue());
+      GroupCell *cell = GetCell();
+      if(m_lookahead.empty())
+      {
+        m_input = cell->GetEditable()->GetValue();
+        AddTokens(m_input, m_tokens);
+      }
+      else
+      {
+        // PeekAhead() has already split this cell into commands.
+        m_tokens.swap(m_lookahead.front());
+        m_lookahead.pop_front();
+        m_input = m_lookaheadInput.front();
+        m_lookaheadInput.pop_front();
+      }
       m_workingGroupChanged = true;
     }
   }
 
 }
 
-void EvaluationQueue::AddTokens(wxString commandString)
+void EvaluationQueue::AddTokens(wxString commandString, std::deque<wxString> &tokens)
 {
   size_t index = 0;
 
@@ -224,7 +332,7 @@ void EvaluationQueue::AddTokens(wxString commandString)
       token.Trim(false);
       token.Trim(true);
       if(token.Length()>1)
-        m_tokens.Add(token);
+        tokens.push_back(token);
       token = wxEmptyString;
     }
   }
@@ -234,22 +342,22 @@ void EvaluationQueue::AddTokens(wxString commandString)
   token.Trim(false);
   token.Trim(true);
   if(token.Length()>1)
-    m_tokens.Add(token);
+    tokens.push_back(token);
 }
 
 GroupCell* EvaluationQueue::GetCell()
 {
-  if(!m_tokens.IsEmpty())
+  if(!m_tokens.empty())
   {
-    return m_queue->group;
+    return m_queue.front();
   }
   else
   {
-    if (m_queue != NULL)
+    if (!m_queue.empty())
     {
-      m_queue->group->GetEditable()->AddEnding();
-      m_queue->group->GetEditable()->ContainsChanges(false);
-      return m_queue->group;
+      m_queue.front()->GetEditable()->AddEnding();
+      m_queue.front()->GetEditable()->ContainsChanges(false);
+      return m_queue.front();
     }
     else
       return NULL; // queue is empty
@@ -260,9 +368,9 @@ wxString EvaluationQueue::GetCommand()
 {
   wxString retval;
   m_userLabel = wxEmptyString;
-  if(!m_tokens.IsEmpty())
+  if(!m_tokens.empty())
   {
-    retval = m_tokens[0];
+    retval = m_tokens.front();
 
     wxString userLabel;
     int colonPos;
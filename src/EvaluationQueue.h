@@ -33,29 +33,57 @@ be sent to maxima.
 
 #include "GroupCell.h"
 #include "wx/arrstr.h"
+#include "wx/hashmap.h"
+#include "wx/time.h"
 
-//! A queue element
-class EvaluationQueueElement {
-  public:
-    EvaluationQueueElement(GroupCell* gr);
-    ~EvaluationQueueElement() {
-    }
-    GroupCell* group;
-    EvaluationQueueElement* next;
-};
+#include <deque>
+
+//! How often each GroupCell is contained in the evaluation queue
+WX_DECLARE_HASH_MAP(GroupCell*, int, wxPointerHash, wxPointerEqual, GroupCellCount);
 
-//! A simple FIFO queue with manual removal of elements
+/*! A simple FIFO queue with manual removal of elements
+
+  MathCtrl::OnPaint() asks for every visible cell if it is in the queue
+  => The queue keeps a count of how often each cell is queued so
+  IsInQueue() doesn't have to search the queue.
+ */
 class EvaluationQueue
 {
 private:
-  wxArrayString m_tokens;
-  int m_size;
+  //! The commands of the current cell that still have to be sent to maxima
+  std::deque<wxString> m_tokens;
+  //! The input of the current cell m_tokens have been split from
+  wxString m_input;
   //! The label the user has assigned to the current command.
   wxString m_userLabel;
-  EvaluationQueueElement* m_queue;
-  EvaluationQueueElement* m_last;
-  //! Adds all commands in commandString as separate tokens to the queue.
-  void AddTokens(wxString commandString);
+  //! The cells in the queue. A cell may be queued more than once.
+  std::deque<GroupCell*> m_queue;
+  //! How often each cell in m_queue is contained in it
+  GroupCellCount m_queued;
+  /*! The commands of the cells that follow the current one
+
+    Element i contains the commands of m_queue[i + 1]. Is only filled by
+    PeekAhead().
+   */
+  std::deque<std::deque<wxString> > m_lookahead;
+  //! The inputs the elements of m_lookahead have been split from
+  std::deque<wxString> m_lookaheadInput;
+  //! Has the current command already been sent to maxima?
+  bool m_currentSent;
+  //! The number of commands after the current one that have already been sent to maxima
+  size_t m_sentAhead;
+  //! When the current command has been sent to maxima, see wxGetLocalTimeMillis()
+  wxLongLong m_sentTime;
+  //! When each of the commands that have been sent ahead has been sent
+  std::deque<wxLongLong> m_sentAheadTimes;
+  //! Adds all commands in commandString as separate tokens to tokens.
+  void AddTokens(wxString commandString, std::deque<wxString> &tokens);
+  /*! Tells the cells maxima has got commands of that they haven't been evaluated
+
+    Is used when these commands are dropped from the queue: Their cells won't
+    be evaluated completely.
+   */
+  void ResetSentCells();
 public:
   /*! Query for the label the user has assigned to the current command.  
 
@@ -69,7 +97,10 @@ public:
   ~EvaluationQueue() {};
 
   //! Is GroupCell gr part of the evaluation queue?
-  bool IsInQueue(GroupCell* gr);
+  bool IsInQueue(GroupCell* gr)
+    {
+      return m_queued.find(gr) != m_queued.end();
+    }
   //! Adds a GroupCell to the evaluation queue.
   void AddToQueue(GroupCell* gr);
   //! Adds all hidden cells attached to the GroupCell gr to the evaluation queue.
@@ -83,15 +114,62 @@ public:
   GroupCell* GetCell();
   //! Is the queue empty?
   bool Empty();
-  //! Clear the queue
+  /*! Clear the queue
+
+    The cells whose commands have already been sent are no longer marked as
+    evaluated, see GroupCell::ResetEvaluated().
+   */
   void Clear();
+  /*! Clear the queue, except for the commands maxima already has got
+
+    maxima will evaluate the commands that have been sent ahead anyway
+    => They are kept in the queue so their output still goes to their cells.
+    A cell only part of whose commands are kept is no longer marked as
+    evaluated.
+   */
+  void ClearUnsent();
+  /*! Returns the next command that hasn't been sent to maxima yet
+
+    Only looks beyond the current command: The current command is sent the
+    normal way.
+    \param cell Is set to the cell the command belongs to
+    \param command Is set to the command
+    \param input Is set to the input of cell the command has been split from
+           if it is the first command of the cell. Else it is set to
+           wxEmptyString.
+    \return false, if there are no more commands.
+   */
+  bool PeekAhead(GroupCell *&cell, wxString &command, wxString &input);
+  //! Marks the command PeekAhead() has returned as sent
+  void SentAhead()
+    {
+      m_sentAhead++;
+      m_sentAheadTimes.push_back(wxGetLocalTimeMillis());
+    }
+  //! The number of commands after the current one that have already been sent
+  size_t CommandsSentAhead() { return m_sentAhead; }
+  //! Marks the current command as sent
+  void CommandSent()
+    {
+      m_currentSent = true;
+      m_sentTime = wxGetLocalTimeMillis();
+    }
+  //! Has the current command already been sent?
+  bool IsCommandSent() { return m_currentSent; }
+  //! When the current command has been sent, see wxGetLocalTimeMillis()
+  wxLongLong GetSentTime() { return m_sentTime; }
+  /*! The input of the current cell its commands have been split from
+
+    The user may have edited the cell since.
+   */
+  wxString GetInput() { return m_input; }
   //! Return the next command that needs to be evaluated.
   wxString GetCommand();
   
   //! Get the size of the queue
   int Size()
     {
-      return m_size;
+      return m_queue.size();
     }
 };
 
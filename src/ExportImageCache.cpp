@@ -0,0 +1,186 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "ExportImageCache.h"
+#include "MappedFile.h"
+
+#include <wx/file.h>
+#include <wx/filename.h>
+
+ExportImageCache::ExportImageCache(wxString imgDir)
+{
+  m_imgDir = imgDir;
+  m_pool = NULL;
+
+  // One line per image: "width height name"
+  MappedFile manifest(ManifestFile());
+  const char *line;
+  size_t length;
+  while(manifest.NextLine(line, length))
+  {
+    wxString entry = MappedFile::ToString(line, length);
+    wxString width = entry.BeforeFirst(wxT(' '));
+    entry = entry.AfterFirst(wxT(' '));
+    wxString height = entry.BeforeFirst(wxT(' '));
+    wxString name = entry.AfterFirst(wxT(' '));
+
+    long x, y;
+    if(width.ToLong(&x) && height.ToLong(&y) && (name != wxEmptyString))
+      m_old[name] = wxSize(x, y);
+  }
+}
+
+ExportImageCache::~ExportImageCache()
+{
+  Cancel();
+  Wait();
+  delete m_pool;
+}
+
+bool ExportImageCache::Lookup(wxString name, wxSize &size)
+{
+  std::map<wxString, wxSize>::iterator it = m_new.find(name);
+  if(it != m_new.end())
+  {
+    size = it->second;
+    return true;
+  }
+
+  it = m_pending.find(name);
+  if(it != m_pending.end())
+  {
+    size = it->second;
+    return true;
+  }
+
+  it = m_old.find(name);
+  if((it == m_old.end()) || (!wxFileExists(m_imgDir + wxT("/") + name)))
+    return false;
+
+  size = it->second;
+  m_new[name] = size;
+  return true;
+}
+
+void ExportImageCache::Write(wxString name, const void *data, size_t length, wxSize size,
+                             bool convertToPng)
+{
+  Queue(name, size, new ImageFileJob(m_imgDir + wxT("/") + name, data, length, convertToPng));
+}
+
+void ExportImageCache::Write(wxString name, wxImage &image, wxSize size)
+{
+  ImageFileJob *job = new ImageFileJob(m_imgDir + wxT("/") + name, image);
+  image = wxImage();
+  Queue(name, size, job);
+}
+
+void ExportImageCache::Export(wxString name, const void *data, size_t length, wxSize size,
+                              bool convertToPng)
+{
+  wxSize oldSize;
+  if(!Lookup(name, oldSize))
+    Write(name, data, length, size, convertToPng);
+}
+
+void ExportImageCache::Queue(wxString name, wxSize size, ImageFileJob *job)
+{
+  if(m_pool == NULL)
+    m_pool = new WorkerPool();
+  m_pending[name] = size;
+  m_jobs.push_back(job);
+  m_jobNames.push_back(name);
+  ImageFileJob::Queue(*m_pool, job);
+}
+
+void ExportImageCache::Cancel()
+{
+  if(m_pool != NULL)
+    m_pool->Cancel();
+}
+
+bool ExportImageCache::Wait()
+{
+  if(m_pool != NULL)
+    m_pool->Wait();
+
+  bool ok = true;
+  for(size_t i = 0; i < m_jobs.size(); i++)
+  {
+    wxString name = m_jobNames[i];
+    if(m_jobs[i]->IsOk())
+      m_new[name] = m_pending[name];
+    else
+    {
+      // A manifest entry for a file that is missing or incomplete would make
+      // the next export believe it was up to date.
+      ok = false;
+      wxString file = m_imgDir + wxT("/") + name;
+      if(wxFileExists(file))
+        wxRemoveFile(file);
+    }
+    delete m_jobs[i];
+  }
+  m_jobs.clear();
+  m_jobNames.clear();
+  m_pending.clear();
+  return ok;
+}
+
+bool ExportImageCache::Finish()
+{
+  bool imagesOk = Wait();
+
+  for(std::map<wxString, wxSize>::iterator it = m_old.begin(); it != m_old.end(); ++it)
+  {
+    wxString file = m_imgDir + wxT("/") + it->first;
+    if((m_new.find(it->first) == m_new.end()) && wxFileExists(file))
+      wxRemoveFile(file);
+  }
+
+  wxString manifest;
+  for(std::map<wxString, wxSize>::iterator it = m_new.begin(); it != m_new.end(); ++it)
+    manifest << it->second.x << wxT(" ") << it->second.y << wxT(" ") << it->first << wxT("\n");
+
+  wxFile file(ManifestFile(), wxFile::write);
+  if(!file.IsOpened())
+    return false;
+  bool ok = file.Write(manifest, wxConvUTF8);
+  return file.Close() && ok && imagesOk;
+}
+
+wxString ExportImageCache::Hash(const wxString &data)
+{
+  // 64 bit FNV-1a: Accidental collisions are practically impossible.
+  wxUint64 hash = wxULL(14695981039346656037);
+  wxCharBuffer utf8 = data.utf8_str();
+  for(const char *c = utf8.data(); *c != 0; c++)
+  {
+    hash ^= (unsigned char) *c;
+    hash *= wxULL(1099511628211);
+  }
+  return wxString::Format(wxT("%08x%08x"), (unsigned int) (hash >> 32), (unsigned int) (hash & 0xFFFFFFFFu));
+}
+
+wxString ExportImageCache::Hash(wxUint32 crc, size_t size)
+{
+  return wxString::Format(wxT("%08x_%lu"), (unsigned int) crc, (unsigned long) size);
+}
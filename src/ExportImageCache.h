@@ -0,0 +1,121 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  Remembers which images an export has written the last time.
+ */
+
+#ifndef EXPORTIMAGECACHE_H
+#define EXPORTIMAGECACHE_H
+
+#include <wx/wx.h>
+
+#include <map>
+#include <vector>
+
+#include "ImageFileJob.h"
+
+/*! Allows the HTML and TeX exports to skip images that haven't changed
+
+  The exports name every image after a hash of everything that affects its
+  contents: The xml of the cells it shows and the settings they are
+  rendered with, or the data of an image that is exported unchanged. An
+  image file whose name is listed in the manifest of the last export into
+  the same directory therefore still is up to date and doesn't need to be
+  rendered, encoded or written again.
+
+  The manifest also stores the size of every image as the html code needs
+  it. Images of the last export that aren't used any more are deleted by
+  Finish().
+
+  The files that have to be written are written by a WorkerPool so the GUI
+  thread can continue with the next cell meanwhile.
+ */
+class ExportImageCache
+{
+public:
+  //! Reads the manifest the last export has left in imgDir
+  ExportImageCache(wxString imgDir);
+  //! Waits for the files that are still being written.
+  ~ExportImageCache();
+  /*! Is there an up-to-date file named name?
+
+    If there is this file is marked as being part of the current export.
+    A file that still is being written counts as up to date, too.
+    \param name The file name, relative to the image directory
+    \param size Is set to the size of the image that has been stored with it.
+   */
+  bool Lookup(wxString name, wxSize &size);
+  /*! Writes data to the file name in the background
+
+    \param name The file name, relative to the image directory
+    \param data The contents of the file. Is copied.
+    \param length The size of data
+    \param size The size of the image, in the unit the html export needs.
+    \param convertToPng Decode data and save the image as a png file?
+   */
+  void Write(wxString name, const void *data, size_t length, wxSize size,
+             bool convertToPng = false);
+  /*! Saves image as the png file name in the background
+
+    Takes over image and leaves it empty: wxImage's reference counting isn't
+    thread-safe, so the caller must not keep a reference.
+   */
+  void Write(wxString name, wxImage &image, wxSize size);
+  //! Write()s data to the file name unless Lookup() says the file is up to date.
+  void Export(wxString name, const void *data, size_t length, wxSize size,
+              bool convertToPng = false);
+  //! Drops all files that haven't started being written yet.
+  void Cancel();
+  /*! Waits for all files, writes the manifest and deletes the files only the last export needed
+
+    \return false, if a file or the manifest could not be written.
+   */
+  bool Finish();
+  //! A hex string that changes if data does
+  static wxString Hash(const wxString &data);
+  //! A hex string that identifies an image by the CRC32 and size of its data
+  static wxString Hash(wxUint32 crc, size_t size);
+
+private:
+  wxString ManifestFile() { return m_imgDir + wxT("/wxmaxima_manifest.txt"); }
+  wxString m_imgDir;
+  //! The files the last export has written
+  std::map<wxString, wxSize> m_old;
+  //! The files that are part of the current export
+  std::map<wxString, wxSize> m_new;
+  //! The files that are queued but not known to have been written, yet
+  std::map<wxString, wxSize> m_pending;
+  //! Is only started once the first file actually has to be written.
+  WorkerPool *m_pool;
+  std::vector<ImageFileJob *> m_jobs;
+  //! The file name each of m_jobs writes to
+  std::vector<wxString> m_jobNames;
+  //! Queues a job that writes the file name for m_pool
+  void Queue(wxString name, wxSize size, ImageFileJob *job);
+  /*! Waits for all jobs. Returns false if one of them has failed.
+
+    Only the files that actually have been written are added to m_new.
+   */
+  bool Wait();
+};
+
+#endif // EXPORTIMAGECACHE_H
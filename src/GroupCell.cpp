@@ -30,12 +30,20 @@
 #include "EditorCell.h"
 #include "ImgCell.h"
 #include "Bitmap.h"
+#include "MathParser.h"
 #include "list"
 
 GroupCell::GroupCell(int groupType, wxString initString) : MathCell()
 {
   m_input = NULL;
   m_output = NULL;
+  m_outputXml = NULL;
+  m_cachedWidth = -1;
+  m_cachedHeight = -1;
+  m_cachedCenter = -1;
+  m_evaluatedSession = -1;
+  m_spilledBytes = 0;
+  m_spilledTruncated = false;
   m_hiddenTree = NULL;
   m_hiddenTreeParent = NULL;
   m_outputRect.x = -1;
@@ -166,6 +174,13 @@ void GroupCell::DestroyOutput(bool destroyFirst)
 {
   MathCell *tmp = m_output, *tmp1;
 
+  // The size the cell had when the file was saved doesn't fit any more.
+  DropCachedSize();
+
+  // Output that hasn't been created yet can be dropped without parsing it.
+  if(destroyFirst)
+    wxDELETE(m_outputXml);
+
   // If there isn't anything to do we can already return.
   if(tmp == NULL)
     return;
@@ -219,6 +234,7 @@ void GroupCell::ResetInputLabelList()
 
 MathCell* GroupCell::Copy()
 {
+  MaterializeOutput();
   GroupCell* tmp = new GroupCell(m_groupType);
   tmp->Hide(m_hide);
   CopyData(this, tmp);
@@ -235,7 +251,7 @@ void GroupCell::Destroy()
   if (m_input != NULL)
     delete m_input;
   m_input = NULL;
-  if (m_output != NULL)
+  if ((m_output != NULL) || (m_outputXml != NULL))
     DestroyOutput();
   m_output = NULL;
   m_next = NULL;
@@ -283,8 +299,9 @@ void GroupCell::SetOutput(MathCell *output)
 {
   if (output == NULL)
     return ;
-  if (m_output != NULL)
+  if ((m_output != NULL) || (m_outputXml != NULL))
     DestroyOutput();
+  DropCachedSize();
 
   m_output = output;
   m_output->SetParent(this);
@@ -299,8 +316,11 @@ void GroupCell::SetOutput(MathCell *output)
 
 void GroupCell::RemoveOutput()
 {
+  ClearSpilledOutput();
+  DropCachedSize();
+
   // If there is nothing to do we can skip the rest of this action.
-  if(m_output == NULL)
+  if((m_output == NULL) && (m_outputXml == NULL))
     return;
   
   DestroyOutput(!(GetGroupType() == GC_TYPE_IMAGE));
@@ -314,6 +334,8 @@ void GroupCell::AppendOutput(MathCell *cell)
 {
   wxASSERT_MSG(cell != NULL,_("Bug: Trying to append NULL to a group cell."));
   if(cell == NULL) return;
+  MaterializeOutput();
+  DropCachedSize();
   cell->SetParent(this);
   if (m_output == NULL) {
     m_output = cell;
@@ -345,6 +367,107 @@ void GroupCell::AppendOutput(MathCell *cell)
     m_appendedCells = cell;
 }
 
+void GroupCell::SpillOutput(wxString text, int type)
+{
+  size_t bytes = (text.Length() + 1) * sizeof(wxChar);
+  if (m_spilledTruncated || (m_spilledBytes + bytes > MAX_SPILLED_OUTPUT))
+  {
+    m_spilledTruncated = true;
+    return;
+  }
+  m_spilledBytes += bytes;
+
+  // Joining consecutive lines keeps the buffer compact. ConsoleAppend() splits
+  // them again. Other types of output might not survive being joined.
+  if ((!m_spilledOutput.empty()) && (m_spilledOutput.back().first == type) &&
+      ((type == MC_TYPE_DEFAULT) || (type == MC_TYPE_ERROR)))
+    m_spilledOutput.back().second += wxT("\n") + text;
+  else
+    m_spilledOutput.push_back(std::make_pair(type, text));
+}
+
+void GroupCell::TakeSpilledOutput(std::vector<std::pair<int, wxString> > &output)
+{
+  output.clear();
+  output.swap(m_spilledOutput);
+  if (m_spilledTruncated)
+    output.push_back(std::make_pair((int) MC_TYPE_ERROR,
+                                    wxString(_("... [output truncated: The suppressed output exceeded the size wxMaxima keeps]"))));
+  ClearSpilledOutput();
+}
+
+void GroupCell::ClearSpilledOutput()
+{
+  m_spilledOutput.clear();
+  m_spilledBytes = 0;
+  m_spilledTruncated = false;
+}
+
+void GroupCell::SetEvaluated(long session, wxString input)
+{
+  m_evaluatedInput = input;
+  m_evaluatedSession = session;
+}
+
+bool GroupCell::IsEvaluated(long session)
+{
+  EditorCell *editor = GetEditable();
+  return (editor != NULL) && (m_evaluatedSession == session) &&
+    (editor->GetValue() == m_evaluatedInput);
+}
+
+void GroupCell::SetLazyOutput(wxXmlNode *xml)
+{
+  DestroyOutput();
+  m_outputXml = xml;
+  ResetSize();
+}
+
+void GroupCell::ParseLazyOutput()
+{
+  // Take the xml away from this cell first: AppendOutput() would otherwise
+  // try to materialize it again.
+  wxXmlNode *xml = m_outputXml;
+  m_outputXml = NULL;
+  m_cachedWidth = m_cachedHeight = m_cachedCenter = -1;
+
+  MathParser mp;
+  MathCell *output = mp.ParseTag(xml->GetChildren());
+  delete xml;
+
+  if (output != NULL)
+  {
+    AppendOutput(output);
+    SetParent(this);
+  }
+  ResetSize();
+}
+
+void GroupCell::SetCachedSize(int width, int height, int center)
+{
+  m_cachedWidth = width;
+  m_cachedHeight = height;
+  m_cachedCenter = center;
+  ResetSize();
+}
+
+bool GroupCell::UseCachedSize(CellParser& parser)
+{
+  if ((m_cachedWidth < 0) || (m_cachedHeight < 0))
+    return false;
+  // Output that hasn't been parsed yet keeps the size the file has stored
+  // until it is drawn, even if the zoom factor or the fonts have changed.
+  return (!parser.ForceUpdate()) || (HasLazyOutput() && !m_hide);
+}
+
+void GroupCell::DropCachedSize()
+{
+  if (m_cachedWidth < 0)
+    return;
+  m_cachedWidth = m_cachedHeight = m_cachedCenter = -1;
+  ResetSize();
+}
+
 void GroupCell::Recalculate(CellParser& parser, int d_fontsize, int m_fontsize)
 {
   m_fontSize = d_fontsize;
@@ -366,6 +489,21 @@ void GroupCell::RecalculateWidths(CellParser& parser, int fontsize)
       return;
     }
 
+    // The size the cell had when it was saved saves us from measuring it
+    // before it actually is drawn.
+    if (UseCachedSize(parser)) {
+      m_width = m_cachedWidth;
+      m_height = m_cachedHeight;
+      m_center = m_cachedCenter;
+      ResetData();
+      return;
+    }
+    m_cachedWidth = m_cachedHeight = m_cachedCenter = -1;
+
+    // Output we don't know the size of has to be created now.
+    if (!m_hide)
+      MaterializeOutput();
+
     UnBreakUpCells();
 
     double scale = parser.GetScale();
@@ -410,11 +548,19 @@ void GroupCell::RecalculateSize(CellParser& parser, int fontsize)
       return;
     }
 
+    m_indent = parser.GetIndent();
+    if (UseCachedSize(parser)) {
+      m_width = m_cachedWidth;
+      m_height = m_cachedHeight;
+      m_center = m_cachedCenter;
+      m_appendedCells = NULL;
+      return;
+    }
+
     double scale = parser.GetScale();
     m_input->RecalculateSizeList(parser, fontsize);
     m_center = m_input->GetMaxCenter();
     m_height = m_input->GetMaxHeight();
-    m_indent = parser.GetIndent();
 
     if (m_output != NULL && !m_hide) {
       MathCell *tmp = m_output;
@@ -496,6 +642,12 @@ void GroupCell::Draw(CellParser& parser, wxPoint point, int fontsize)
 {
   double scale = parser.GetScale();
   wxDC& dc = parser.GetDC();
+  // A cell that has been laid out using its cached size has to be measured
+  // for real as soon as it becomes visible.
+  if ((m_cachedWidth >= 0) && DrawThisCell(parser, point))
+    DropCachedSize();
+  if ((m_outputXml != NULL) && !m_hide && DrawThisCell(parser, point))
+    MaterializeOutput();
   if (m_width == -1 || m_height == -1) {
     RecalculateWidths(parser, fontsize);
     RecalculateSize(parser, fontsize);
@@ -546,7 +698,8 @@ void GroupCell::Draw(CellParser& parser, wxPoint point, int fontsize)
       m_outputRect.y = in.y - m_output->GetMaxCenter();
       m_outputRect.x = in.x;
 
-      while (tmp != NULL) {
+      // Cells MathCtrl::FlushOutputLayout() hasn't laid out yet cannot be drawn.
+      while ((tmp != NULL) && (tmp != m_appendedCells)) {
 
         if (!tmp->m_isBroken) {
           tmp->m_currentPoint.x = in.x;
@@ -633,10 +786,31 @@ void GroupCell::Draw(CellParser& parser, wxPoint point, int fontsize)
     }
 
     UnsetPen(parser);
+
+    if (parser.ShowEvaluationStats() && (m_groupType == GC_TYPE_CODE) &&
+        (m_evaluationStats.m_latency >= 0))
+      DrawEvaluationStats(parser, point, fontsize);
   }
   MathCell::Draw(parser, point, fontsize);
 }
 
+void GroupCell::DrawEvaluationStats(CellParser& parser, wxPoint point, int fontsize)
+{
+  double scale = parser.GetScale();
+  wxDC& dc = parser.GetDC();
+  int size = (int) (((double) MAX(fontsize * 3 / 4, MC_MIN_SIZE)) * scale + 0.5);
+  dc.SetFont(wxFont(size, wxFONTFAMILY_MODERN,
+                    wxFONTSTYLE_NORMAL,
+                    wxFONTWEIGHT_NORMAL,
+                    false,
+                    parser.GetFontName(TS_DEFAULT),
+                    parser.GetFontEncoding()));
+  dc.SetTextForeground(parser.GetColor(TS_CELL_BRACKET));
+  dc.DrawText(wxString::Format(wxT("%.2f s"), m_evaluationStats.m_latency / 1000.0),
+              point.x + m_width + SCALE_PX(20, scale),
+              point.y - m_center);
+}
+
 wxRect GroupCell::HideRect()
 {
   return wxRect(m_currentPoint.x - 10, m_currentPoint.y - m_center, 10, 10);
@@ -646,6 +820,8 @@ wxString GroupCell::ToString()
 {
   wxString str;
   if (GetEditable()) {
+    if (!m_hide)
+      MaterializeOutput();
     str = m_input->ListToString();
     if (m_output != NULL && !m_hide) {
       MathCell *tmp = m_output;
@@ -666,7 +842,8 @@ wxString GroupCell::ToTeX()
 }
 
 
-wxString GroupCell::ToTeX(wxString imgDir, wxString filename, int *imgCounter)
+wxString GroupCell::ToTeX(wxString imgDir, wxString filename, int *imgCounter,
+                          ExportImageCache *imageCache)
 {
   wxString str;
   bool SuppressLeadingNewlines = true;
@@ -681,32 +858,32 @@ wxString GroupCell::ToTeX(wxString imgDir, wxString filename, int *imgCounter)
     break;
 
   case GC_TYPE_IMAGE:
-    if (imgDir != wxEmptyString) {
-      MathCell *copy = m_output->Copy();
+    if ((imgDir != wxEmptyString) && (imageCache != NULL)) {
+      ImgCell *imgCell = dynamic_cast<ImgCell*>(m_output);
       (*imgCounter)++;
-      wxString image = filename + wxString::Format(wxT("_%d"), *imgCounter);
-      wxString file = imgDir + wxT("/") + image + wxT(".") + dynamic_cast<ImgCell*>(copy)->GetExtension();
+      wxMemoryBuffer data = imgCell->GetCompressedImage();
+      wxString image = filename + wxT("_") +
+        ExportImageCache::Hash(imgCell->GetCompressedImageCRC(), data.GetDataLen());
 
       if (!wxDirExists(imgDir))
         wxMkdir(imgDir);
 
-      if (dynamic_cast<ImgCell*>(copy)->ToImageFile(file).x>=0)
-      {
-        str << wxT("\\begin{figure}[htb]\n")
-            << wxT("  \\begin{center}\n")
-            << wxT("    \\includeimage{")
-            << filename << wxT("_img/") << image << wxT("}\n")
-            << wxT("  \\caption{") << m_input->m_next->ToTeX() << wxT("}\n")
-            << wxT("  \\end{center}\n")
-            << wxT("\\end{figure}\n");
-      }
+      imageCache->Export(image + wxT(".") + imgCell->GetExtension(),
+                         data.GetData(), data.GetDataLen(), imgCell->GetOriginalSize());
+      str << wxT("\\begin{figure}[htb]\n")
+          << wxT("  \\begin{center}\n")
+          << wxT("    \\includeimage{")
+          << filename << wxT("_img/") << image << wxT("}\n")
+          << wxT("  \\caption{") << m_input->m_next->ToTeX() << wxT("}\n")
+          << wxT("  \\end{center}\n")
+          << wxT("\\end{figure}\n");
     }
     else
       str << wxT("\n\\verb|<<GRAPHICS>>|\n");
     break;
 
   case GC_TYPE_CODE:
-    str = ToTeXCodeCell(imgDir, filename, imgCounter);
+    str = ToTeXCodeCell(imgDir, filename, imgCounter, imageCache);
     break;
     
   default:
@@ -744,12 +921,15 @@ wxString GroupCell::ToTeX(wxString imgDir, wxString filename, int *imgCounter)
   return str;
 }
 
-wxString GroupCell::ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCounter)
+wxString GroupCell::ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCounter,
+                                  ExportImageCache *imageCache)
 {
   wxString str;
   bool exportInput = true;
   wxConfig::Get()->Read(wxT("exportInput"), &exportInput);
 
+  MaterializeOutput();
+
   // Input cells
   if(exportInput)
   {
@@ -784,7 +964,7 @@ wxString GroupCell::ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCo
       if (tmp->GetType() == MC_TYPE_IMAGE ||
           tmp->GetType() == MC_TYPE_SLIDE)
       {
-        str << ToTeXImage(tmp, imgDir, filename, imgCounter);
+        str << ToTeXImage(tmp, imgDir, filename, imgCounter, imageCache);
       }
       else
       {
@@ -837,19 +1017,19 @@ wxString GroupCell::ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCo
   return str;
 }
 
-wxString GroupCell::ToTeXImage(MathCell *tmp, wxString imgDir, wxString filename, int *imgCounter)
+wxString GroupCell::ToTeXImage(MathCell *tmp, wxString imgDir, wxString filename, int *imgCounter,
+                               ExportImageCache *imageCache)
 {
   wxString str;
   
-  if (imgDir != wxEmptyString)
+  if ((imgDir != wxEmptyString) && (imageCache != NULL))
   {
-    MathCell *copy = tmp->Copy();
     (*imgCounter)++;
-    wxString image = filename + wxString::Format(wxT("_%d"), *imgCounter);	    
     if (!wxDirExists(imgDir))
       if (!wxMkdir(imgDir))
         return wxEmptyString;
-    
+
+    // The images are named after their contents and written in the background.
     // Do we want to output LaTeX animations?
     bool AnimateLaTeX=true;
     wxConfig::Get()->Read(wxT("AnimateLaTeX"), &AnimateLaTeX);
@@ -859,31 +1039,99 @@ wxString GroupCell::ToTeXImage(MathCell *tmp, wxString imgDir, wxString filename
       str << wxT("\\begin{animateinline}{")+wxString::Format(wxT("%i"), src->GetFrameRate())+wxT("}\n");
       for(int i=0;i<src->Length();i++)
       {
-        wxString Frame = imgDir + wxT("/") + image + wxString::Format(wxT("_%i"), i);
-        if((src->GetBitmap(i)).SaveFile(Frame+wxT(".png")))
-          str << wxT("\\includegraphics[width=.95\\linewidth,height=.80\\textheight,keepaspectratio]{")+Frame+wxT("}\n");
-        else
-          str << wxT("\n\\verb|<<GRAPHICS>>|\n");
+        // Frames that already are png files don't need to be converted.
+        wxMemoryBuffer data = src->GetFrameData(i);
+        wxString Frame = imgDir + wxT("/") + filename + wxT("_") +
+          ExportImageCache::Hash(src->GetFrameCRC(i), data.GetDataLen());
+        imageCache->Export(Frame.AfterLast(wxT('/')) + wxT(".png"), data.GetData(), data.GetDataLen(),
+                           wxDefaultSize, src->GetFrameExtension(i).Lower() != wxT("png"));
+        str << wxT("\\includegraphics[width=.95\\linewidth,height=.80\\textheight,keepaspectratio]{")+Frame+wxT("}\n");
         if(i<src->Length()-1)
           str << wxT("\\newframe");
       }
       str << wxT("\\end{animateinline}");
     }
-    else
+    else if (tmp->GetType() == MC_TYPE_IMAGE)
     {
-      wxString file = imgDir + wxT("/") + image + wxT(".") + dynamic_cast<ImgCell*>(copy)->GetExtension();
-      if (dynamic_cast<ImgCell*>(copy)->ToImageFile(file).x>=0)
-        str += wxT("\\includegraphics[width=.95\\linewidth,height=.80\\textheight,keepaspectratio]{") +
-          filename + wxT("_img/") + image + wxT("}");
-      else
-        str << wxT("\n\\verb|<<GRAPHICS>>|\n");
+      ImgCell *imgCell = dynamic_cast<ImgCell*>(tmp);
+      wxMemoryBuffer data = imgCell->GetCompressedImage();
+      wxString image = filename + wxT("_") +
+        ExportImageCache::Hash(imgCell->GetCompressedImageCRC(), data.GetDataLen());
+      imageCache->Export(image + wxT(".") + imgCell->GetExtension(),
+                         data.GetData(), data.GetDataLen(), imgCell->GetOriginalSize());
+      str += wxT("\\includegraphics[width=.95\\linewidth,height=.80\\textheight,keepaspectratio]{") +
+        filename + wxT("_img/") + image + wxT("}");
     }
+    else
+      str << wxT("\n\\verb|<<GRAPHICS>>|\n");
   }
 
   return str;
 }
 
 wxString GroupCell::ToXML()
+{
+  return ToXML(NULL);
+}
+
+void GroupCell::ToXML(XMLWriter &out)
+{
+  out.Write(ToXML(&out));
+}
+
+void GroupCell::ListToXML(XMLWriter &out)
+{
+  GroupCell *tmp = this;
+  while (tmp != NULL)
+  {
+    tmp->ToXML(out);
+    tmp = dynamic_cast<GroupCell*>(tmp->m_next);
+  }
+}
+
+//! Escapes the characters that have a special meaning in xml
+static wxString EscapeXml(wxString text)
+{
+  text.Replace(wxT("&"),  wxT("&amp;"));
+  text.Replace(wxT("<"),  wxT("&lt;"));
+  text.Replace(wxT(">"),  wxT("&gt;"));
+  text.Replace(wxT("'"),  wxT("&apos;"));
+  text.Replace(wxT("\""), wxT("&quot;"));
+  return text;
+}
+
+//! Appends the xml code for node and its children to str
+static void AppendXml(wxXmlNode *node, wxString &str)
+{
+  switch (node->GetType())
+  {
+  case wxXML_ELEMENT_NODE:
+  {
+    str += wxT("<") + node->GetName();
+    for (wxXmlAttribute *attr = node->GetAttributes(); attr != NULL; attr = attr->GetNext())
+      str += wxT(" ") + attr->GetName() + wxT("=\"") + EscapeXml(attr->GetValue()) + wxT("\"");
+    wxXmlNode *child = node->GetChildren();
+    if (child == NULL)
+    {
+      str += wxT("/>");
+      break;
+    }
+    str += wxT(">");
+    for (; child != NULL; child = child->GetNext())
+      AppendXml(child, str);
+    str += wxT("</") + node->GetName() + wxT(">");
+    break;
+  }
+  case wxXML_TEXT_NODE:
+  case wxXML_CDATA_SECTION_NODE:
+    str += EscapeXml(node->GetContent());
+    break;
+  default:
+    break;
+  }
+}
+
+wxString GroupCell::ToXML(XMLWriter *out)
 {
   wxString str;
   str = wxT("\n<cell"); // start opening tag
@@ -930,7 +1178,8 @@ wxString GroupCell::ToXML()
   str += wxT(">\n");
 
   MathCell *input = GetInput();
-  MathCell *output = GetLabel();
+  // Output that hasn't been parsed yet is written back the way it was read.
+  MathCell *output = (m_outputXml == NULL) ? GetLabel() : NULL;
   // write contents
   switch (m_groupType) {
     case GC_TYPE_CODE:
@@ -939,7 +1188,11 @@ wxString GroupCell::ToXML()
         str += input->ListToXML();
         str += wxT("</input>");
       }
-      if (output != NULL) {
+      if (m_outputXml != NULL) {
+        str += wxT("\n");
+        AppendXml(m_outputXml, str);
+      }
+      else if (output != NULL) {
         str += wxT("\n<output>\n");
         str += wxT("<mth>");
         str += output->ListToXML();
@@ -964,7 +1217,14 @@ wxString GroupCell::ToXML()
         str += input->ListToXML();
       if (m_hiddenTree) {
         str += wxT("<fold>");
-        str+= m_hiddenTree->ListToXML();
+        if (out != NULL)
+        {
+          out->Write(str);
+          str = wxEmptyString;
+          m_hiddenTree->ListToXML(*out);
+        }
+        else
+          str+= m_hiddenTree->ListToXML();
         str += wxT("</fold>");
       }
       break;
@@ -1047,6 +1307,7 @@ void GroupCell::SelectRectInOutput(wxRect& rect, wxPoint& one, wxPoint& two,
   }
 
   // Lets select a rectangle
+  MaterializeOutput();
   tmp = m_output;
   *first = *last = NULL;
 
@@ -1149,6 +1410,7 @@ void GroupCell::SelectOutput(MathCell **start, MathCell **end)
   if (m_hide)
     return;
 
+  MaterializeOutput();
   *start = m_output;
 
   while (*start != NULL && ((*start)->GetStyle() != TS_LABEL) && ((*start)->GetStyle() != TS_USERLABEL))
@@ -1209,11 +1471,13 @@ void GroupCell::Hide(bool hide) {
     return;
 
   m_hide = hide;
+  DropCachedSize();
   if ((m_groupType == GC_TYPE_TEXT) || (m_groupType == GC_TYPE_CODE))
     GetEditable()->SetFirstLineOnly(m_hide);
 
   // Don't keep cached versions of scaled images around if they aren't visible at all.
-  GetLabel()->ClearCacheList();
+  if (m_output != NULL)
+    m_output->ClearCacheList();
 
   ResetSize();
   GetEditable()->ResetSize();
@@ -1237,7 +1501,9 @@ bool GroupCell::HideTree(GroupCell *tree)
   GroupCell *tmp = m_hiddenTree;
   while(tmp)
   {
-    tmp->GetLabel()->ClearCacheList();
+    // Output that hasn't been parsed yet doesn't have cached images.
+    if (tmp->m_output != NULL)
+      tmp->m_output->ClearCacheList();
     tmp = dynamic_cast<GroupCell *>(tmp->m_next);
   }
   
@@ -1293,7 +1559,8 @@ GroupCell *GroupCell::Fold() {
   GroupCell *start = end; // first to fold
 
   while (end) {
-    end->GetLabel()->ClearCacheList();
+    if (end->m_output != NULL)
+      end->m_output->ClearCacheList();
  
     GroupCell *tmp = dynamic_cast<GroupCell*>(end->m_next);
     if (tmp == NULL)
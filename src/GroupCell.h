@@ -28,10 +28,20 @@
 #ifndef GROUPCELL_H
 #define GROUPCELL_H
 
+#include <wx/xml/xml.h>
+#include <wx/time.h>
+
+#include <utility>
+#include <vector>
+
 #include "MathCell.h"
 #include "EditorCell.h"
+#include "XMLWriter.h"
+#include "ExportImageCache.h"
 
 #define EMPTY_INPUT_LABEL wxT("-->  ")
+//! The number of bytes of suppressed output a GroupCell keeps at most, see GroupCell::SpillOutput()
+#define MAX_SPILLED_OUTPUT (16 * 1024 * 1024)
 
 enum
 {
@@ -45,6 +55,46 @@ enum
   GC_TYPE_PAGEBREAK
 };
 
+/*! What the last evaluation of a GroupCell has cost
+
+  Is filled in by wxMaxima while the cell is maxima's working group and
+  by MathCtrl::InsertLine() while the output is appended to the cell.
+ */
+struct EvaluationStats
+{
+  EvaluationStats() { Clear(); }
+  void Clear()
+  {
+    m_latency = -1;
+    m_bytes = 0;
+    m_cells = 0;
+    m_layoutTime = 0;
+  }
+  /*! Forget the data of the last evaluation and start measuring the latency
+
+    \param sent When the cell has been sent to maxima, see wxGetLocalTimeMillis().
+           With pipelined commands this may be long before the cell becomes
+           the working group.
+   */
+  void Start(wxLongLong sent)
+  {
+    Clear();
+    m_sent = sent;
+  }
+  //! maxima has sent a prompt: The latency is the time since the cell has been sent
+  void PromptReceived() { m_latency = (wxGetLocalTimeMillis() - m_sent).ToLong(); }
+  //! The milliseconds between sending the cell to maxima and its last prompt. -1 means: Unknown.
+  long m_latency;
+  //! The number of bytes maxima has sent while evaluating the cell
+  long m_bytes;
+  //! The number of output cells that have been parsed from these bytes
+  long m_cells;
+  //! The milliseconds spent appending the output cells and laying them out
+  long m_layoutTime;
+private:
+  wxLongLong m_sent;
+};
+
 /*! A cell grouping input (and, if there is one, also the output) cell to a foldable item
 
 Items where a list of groupcells can be folded include
@@ -86,14 +136,88 @@ public:
     but it will remove eventual error messages attached to the image.
   */
   void RemoveOutput();
-  // exporting
-  wxString ToTeX(wxString imgDir, wxString filename, int *imgCounter);
-  wxString ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCounter);
-  wxString ToTeXImage(MathCell *tmp, wxString imgDir, wxString filename, int *imgCounter);
+  /*! Defer creating the output cells until they are actually needed
+
+    Parsing the output of every cell of a big .wxmx file takes time and memory
+    that is wasted on cells the user never looks at. Instead the GroupCell
+    keeps the &lt;output&gt; tag it has been loaded from and only converts it to
+    cells when the output is drawn, searched, exported or copied.
+
+    The GroupCell takes ownership of xml.
+   */
+  void SetLazyOutput(wxXmlNode *xml);
+  //! Is the output still waiting to be created from the xml it was loaded from?
+  bool HasLazyOutput() { return m_outputXml != NULL; }
+  //! Create the output cells from the xml SetLazyOutput() has stored, if there is any.
+  void MaterializeOutput() { if (m_outputXml != NULL) ParseLazyOutput(); }
+  /*! Remember that input has been sent to maxima
+
+    \param session The number of the maxima process the input has been sent
+           to, see MathCtrl::MaximaStarted().
+    \param input The input that has been sent. The user may have edited the
+           cell since, see EvaluationQueue::GetInput().
+   */
+  void SetEvaluated(long session, wxString input);
+  //! Forget that the cell has been evaluated, for example because it has failed.
+  void ResetEvaluated() { m_evaluatedSession = -1; }
+  //! The input passed to the last SetEvaluated(). Isn't forgotten by ResetEvaluated().
+  wxString GetEvaluatedInput() { return m_evaluatedInput; }
+  /*! Has the current input been evaluated by the maxima process session?
+
+    False if the input has been changed since it has been sent to maxima.
+   */
+  bool IsEvaluated(long session);
+  //! What the last evaluation of this cell has cost
+  EvaluationStats &GetEvaluationStats() { return m_evaluationStats; }
+  /*! Keeps output that exceeds the output limit, see wxMaxima::ConsoleAppend()
+
+    Output beyond MAX_SPILLED_OUTPUT bytes is dropped: A command that outputs
+    text in an endless loop would use up all memory otherwise.
+    \param text The text exactly as it has been passed to ConsoleAppend()
+    \param type The type it has been passed with
+   */
+  void SpillOutput(wxString text, int type);
+  //! Has output been suppressed wxMaxima::ShowSpilledOutput() can display?
+  bool HasSpilledOutput() { return !m_spilledOutput.empty() || m_spilledTruncated; }
+  /*! Hands the suppressed output over to the caller, leaving none behind.
+
+    Ends with a note if output had to be dropped.
+   */
+  void TakeSpilledOutput(std::vector<std::pair<int, wxString> > &output);
+  /*! Tell the cell which size it had when it was saved
+
+    Allows the cell to be laid out without measuring it or creating its output.
+    The cell is measured for real as soon as it is drawn or the worksheet is
+    recalculated with parser.ForceUpdate() set.
+   */
+  void SetCachedSize(int width, int height, int center);
+  //! Forget the size SetCachedSize() has told us.
+  void DropCachedSize();
+  //! Is the cell laid out using the size SetCachedSize() has told us?
+  bool HasCachedSize() { return m_cachedWidth >= 0; }
+  /*! Converts this cell to TeX, exporting its images to imgDir
+
+    \param imageCache Writes the images in the background, naming them after
+           their contents. If this is NULL no images are exported.
+   */
+  wxString ToTeX(wxString imgDir, wxString filename, int *imgCounter,
+                 ExportImageCache *imageCache = NULL);
+  wxString ToTeXCodeCell(wxString imgDir, wxString filename, int *imgCounter,
+                         ExportImageCache *imageCache = NULL);
+  wxString ToTeXImage(MathCell *tmp, wxString imgDir, wxString filename, int *imgCounter,
+                      ExportImageCache *imageCache = NULL);
   wxString ToTeX();
   //! Add Markdown to the TeX representation of input cells.
   wxString TeXMarkdown(wxString str);
   wxString ToXML();
+  /*! Write the xml representation of this cell to out
+
+    Cells that have been folded into this one are written one by one
+    so the xml of a whole section never has to be kept in memory.
+   */
+  void ToXML(XMLWriter &out);
+  //! Write the xml representation of this cell and all cells following it to out
+  void ListToXML(XMLWriter &out);
   //! Return the hide status
   bool IsHidden() { return m_hide; }
   void Hide(bool hide);
@@ -106,8 +230,8 @@ public:
   wxString TexEscapeOutputCell(wxString Input);
   MathCell* GetPrompt() { return m_input; }
   EditorCell* GetInput() { return dynamic_cast<EditorCell*>(m_input->m_next); }
-  MathCell* GetLabel() { return m_output; }
-  MathCell* GetOutput() { if (m_output == NULL) return NULL; else return m_output->m_next; }
+  MathCell* GetLabel() { MaterializeOutput(); return m_output; }
+  MathCell* GetOutput() { MaterializeOutput(); if (m_output == NULL) return NULL; else return m_output->m_next; }
   //
   wxRect GetOutputRect() { return m_outputRect; }
   void RecalculateSize(CellParser& parser, int fontsize);
@@ -202,6 +326,8 @@ public:
 
 protected:
   wxString ToString();
+  //! Draws the time the last evaluation took to the right of the cell
+  void DrawEvaluationStats(CellParser& parser, wxPoint point, int fontsize);
   GroupCell *m_hiddenTree; // here hidden (folded) tree of GCs is stored
   GroupCell *m_hiddenTreeParent; // store linkage to the parent of the fold
   int m_groupType;
@@ -217,8 +343,38 @@ protected:
      - true:  Destroy all output cells.
   */
   void DestroyOutput(bool destroyFirst = true);
+  /*! Returns the xml representation of this cell
+
+    If out isn't NULL the cells folded into this one are written to out
+    directly, together with everything that precedes them.
+   */
+  wxString ToXML(XMLWriter *out);
+  //! Converts m_outputXml to output cells
+  void ParseLazyOutput();
+  //! Can the cell be laid out using the cached size instead of creating its output?
+  bool UseCachedSize(CellParser& parser);
   MathCell *m_input;
   MathCell *m_output;
+  //! The &lt;output&gt; tag the output will be created from, if it hasn't been created yet.
+  wxXmlNode *m_outputXml;
+  //! @{ The size the cell had when it was saved, or -1 if it isn't known.
+  int m_cachedWidth;
+  int m_cachedHeight;
+  int m_cachedCenter;
+  //! @}
+  //! The input as it was when it was sent to maxima the last time
+  wxString m_evaluatedInput;
+  //! The maxima process m_evaluatedInput has been sent to. -1 means: None.
+  long m_evaluatedSession;
+  EvaluationStats m_evaluationStats;
+  //! The type and text of the output that has been suppressed, see SpillOutput()
+  std::vector<std::pair<int, wxString> > m_spilledOutput;
+  //! The number of bytes m_spilledOutput holds
+  size_t m_spilledBytes;
+  //! Has output been dropped because m_spilledOutput was full?
+  bool m_spilledTruncated;
+  //! Drops the suppressed output
+  void ClearSpilledOutput();
   bool m_hide;
   bool m_working;
   int m_indent;
@@ -1,6 +1,7 @@
 #include "Image.h"
 #include <wx/mstream.h>
 #include <wx/wfstream.h>
+#include <zlib.h>
 
 wxMemoryBuffer Image::ReadCompressedImage(wxInputStream *data)
 {
@@ -31,14 +32,16 @@ wxBitmap Image::GetUnscaledBitmap()
 
 Image::Image()
 {
+  m_crcValid = false;
   m_viewportWidth  = 640;
   m_viewportHeight = 480;
   m_scale          = 1;  
-  m_scaledBitmap.Create (1,1);
+  m_scaledBitmap = wxNullBitmap;
 }
 
 Image::Image(const wxBitmap &bitmap)
 {
+  m_crcValid = false;
   m_viewportWidth  = 640;
   m_viewportHeight = 480;
   m_scale          = 1;  
@@ -48,13 +51,25 @@ Image::Image(const wxBitmap &bitmap)
 // constructor which loads an image
 Image::Image(wxString image,bool remove, wxFileSystem *filesystem)
 {
+  m_crcValid = false;
   m_viewportWidth  = 640;
   m_viewportHeight = 480;
   m_scale          = 1;
-  m_scaledBitmap.Create (1,1);
+  m_scaledBitmap = wxNullBitmap;
   LoadImage(image,remove,filesystem);
 }
 
+wxUint32 Image::GetCompressedImageCRC()
+{
+  if(!m_crcValid)
+  {
+    m_crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *) m_compressedImage.GetData(),
+                  m_compressedImage.GetDataLen());
+    m_crcValid = true;
+  }
+  return m_crc;
+}
+
 wxSize Image::ToImageFile(wxString filename)
 {
   wxFileName fn(filename);
@@ -106,12 +121,12 @@ wxBitmap Image::GetBitmap()
   ViewportSize(m_viewportWidth,m_viewportHeight,m_scale);
 
   // Let's see if we have cached the scaled bitmap with the right size
-  if(m_scaledBitmap.GetWidth() == m_width)
+  if(m_scaledBitmap.IsOk() && (m_scaledBitmap.GetWidth() == m_width))
     return m_scaledBitmap;
 
 
   // Seems like we need to create a new scaled bitmap.
-  if(m_scaledBitmap.GetWidth()!=m_width)
+  if(!m_scaledBitmap.IsOk() || (m_scaledBitmap.GetWidth()!=m_width))
     {
       wxImage img;
       if(m_compressedImage.GetDataLen() > 0)
@@ -160,6 +175,7 @@ wxBitmap Image::GetBitmap()
 void Image::LoadImage(const wxBitmap &bitmap)
 {
   // Convert the bitmap to a png image we can use as m_compressedImage
+  m_crcValid = false;
   wxImage image = bitmap.ConvertToImage();
   wxMemoryOutputStream stream;
   image.SaveFile(stream,wxBITMAP_TYPE_PNG);
@@ -170,13 +186,35 @@ void Image::LoadImage(const wxBitmap &bitmap)
   m_extension = wxT("png");
   m_originalWidth  = image.GetWidth();
   m_originalHeight = image.GetHeight();
-  m_scaledBitmap.Create (1,1);
+  m_scaledBitmap = wxNullBitmap;
+}
+
+void Image::LoadImage(const wxMemoryBuffer &compressedImage, wxString extension, wxSize size)
+{
+  m_compressedImage = compressedImage;
+  m_crcValid = false;
+  m_scaledBitmap = wxNullBitmap;
+  m_extension = extension;
+
+  if((size.x > 0) && (size.y > 0))
+    {
+      m_originalWidth  = size.x;
+      m_originalHeight = size.y;
+    }
+  else
+    {
+      // Leave space for an image showing an error message
+      m_originalWidth  = 400;
+      m_originalHeight = 250;
+    }
+  ViewportSize(m_viewportWidth,m_viewportHeight,m_scale);
 }
 
 void Image::LoadImage(wxString image, bool remove,wxFileSystem *filesystem)
 {
   m_compressedImage.Clear();
-  m_scaledBitmap.Create (1,1);
+  m_crcValid = false;
+  m_scaledBitmap = wxNullBitmap;
 
   if (filesystem) {
     wxFSFile *fsfile = filesystem->OpenFile(image);
@@ -265,6 +303,6 @@ void Image::ViewportSize(size_t viewPortWidth,size_t viewPortHeight,double scale
 
   // Clear this cell's image cache if it doesn't contain an image of the size
   // we need right now.
-  if(m_scaledBitmap.GetWidth() != m_width)
+  if(m_scaledBitmap.IsOk() && (m_scaledBitmap.GetWidth() != m_width))
     ClearCache();
 }
@@ -75,7 +75,7 @@ public:
 
     Will recreate the scaled image as soon as needed.
    */
-  void ClearCache() {if((m_scaledBitmap.GetWidth()>1)||(m_scaledBitmap.GetHeight()>1))m_scaledBitmap.Create(1,1);}
+  void ClearCache() {m_scaledBitmap = wxNullBitmap;}
   //! Reads the compressed image into a memory buffer
   wxMemoryBuffer ReadCompressedImage(wxInputStream *data);
   //! Returns the file name extension of the current image
@@ -84,6 +84,13 @@ public:
   void LoadImage(wxString image,bool remove = true, wxFileSystem *filesystem = NULL);
   //! "Loads" an image from a bitmap
   void LoadImage(const wxBitmap &bitmap);
+  /*! "Loads" an image that has already been read and probed
+
+    \param compressedImage The image in its compressed form
+    \param extension The file name extension that matches the image type
+    \param size The size of the image or wxDefaultSize, if it couldn't be decoded
+   */
+  void LoadImage(const wxMemoryBuffer &compressedImage, wxString extension, wxSize size);
   //! Saves the image in its original form, or as .png if it originates in a bitmap
   wxSize ToImageFile(wxString filename);
   //! Returns the bitmap being displayed
@@ -98,6 +105,12 @@ public:
   size_t m_height;
   //! Returns the original image in its compressed form
   wxMemoryBuffer GetCompressedImage(){return m_compressedImage;}
+  /*! The CRC32 of the compressed image
+
+    Is what a zip file stores for the image => Allows to find out if a .wxmx
+    file already contains this image. Is only calculated once.
+   */
+  wxUint32 GetCompressedImageCRC();
   size_t GetOriginalWidth(){return m_originalWidth;}
   size_t GetOriginalHeight(){return m_originalHeight;}
 
@@ -114,7 +127,14 @@ protected:
   size_t m_viewportHeight;
   //! The image in its original compressed form
   wxMemoryBuffer m_compressedImage;
-  //! The bitmap, scaled down to the screen size
+  //! The CRC32 of m_compressedImage, if m_crcValid is true
+  wxUint32 m_crc;
+  bool m_crcValid;
+  /*! The bitmap, scaled down to the screen size
+
+    Is only created once the image is drawn: Loading and saving images
+    therefore works without a display.
+   */
   wxBitmap m_scaledBitmap;
   //! The file extension for the current image type
   wxString m_extension;
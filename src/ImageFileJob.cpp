@@ -0,0 +1,80 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "ImageFileJob.h"
+
+#include <wx/file.h>
+#include <wx/mstream.h>
+
+ImageFileJob::ImageFileJob(wxString file, const wxImage &image)
+{
+  m_file = ThreadSafeCopy(file);
+  m_image = image;
+  m_convertToPng = false;
+  m_ok = false;
+}
+
+ImageFileJob::ImageFileJob(wxString file, const void *data, size_t length, bool convertToPng)
+{
+  m_file = ThreadSafeCopy(file);
+  if(length > 0)
+    m_data.assign((const char *) data, (const char *) data + length);
+  m_convertToPng = convertToPng;
+  m_ok = false;
+}
+
+void ImageFileJob::Run()
+{
+  if(m_image.IsOk())
+  {
+    m_ok = m_image.SaveFile(m_file, wxBITMAP_TYPE_PNG);
+    // The image isn't needed any more => free its memory right now.
+    m_image = wxImage();
+    return;
+  }
+
+  if(m_convertToPng)
+  {
+    if(!m_data.empty())
+    {
+      wxMemoryInputStream in(&m_data[0], m_data.size());
+      wxImage image;
+      if(image.LoadFile(in, wxBITMAP_TYPE_ANY))
+        m_ok = image.SaveFile(m_file, wxBITMAP_TYPE_PNG);
+    }
+    std::vector<char>().swap(m_data);
+    return;
+  }
+
+  wxFile file(m_file, wxFile::write);
+  if(!file.IsOpened())
+    return;
+  m_ok = m_data.empty() || (file.Write(&m_data[0], m_data.size()) == m_data.size());
+  m_ok = file.Close() && m_ok;
+  std::vector<char>().swap(m_data);
+}
+
+void ImageFileJob::Queue(WorkerPool &pool, ImageFileJob *job)
+{
+  while(pool.JobsAdded() - pool.JobsDone() > 2 * pool.Threads())
+    pool.WaitTimeout(20);
+  pool.AddJob(job);
+}
@@ -0,0 +1,76 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  A job that writes an image file outside the GUI thread.
+ */
+
+#ifndef IMAGEFILEJOB_H
+#define IMAGEFILEJOB_H
+
+#include <wx/wx.h>
+#include <wx/image.h>
+
+#include <vector>
+
+#include "WorkerPool.h"
+
+/*! Writes an image to a file from a worker thread
+
+  Laying out and drawing cells needs the GUI thread. Compressing the result
+  to a png file and writing it to disk doesn't: This job does the latter
+  while the GUI thread continues with the next cell.
+ */
+class ImageFileJob : public WorkerJob
+{
+public:
+  /*! Saves image as a png file
+
+    The caller must not keep any other reference to image as wxImage's
+    reference counting isn't thread-safe.
+   */
+  ImageFileJob(wxString file, const wxImage &image);
+  /*! Writes data to file
+
+    \param convertToPng If this is false data is written unchanged. Else it
+           is decoded and saved as a png file.
+   */
+  ImageFileJob(wxString file, const void *data, size_t length, bool convertToPng = false);
+  virtual void Run();
+  //! Has Run() succeeded?
+  bool IsOk() { return m_ok; }
+
+  /*! Queues a job and waits if too many images are waiting to be written
+
+    Keeps the bitmaps the GUI thread renders from piling up in memory faster
+    than the pool can compress them.
+   */
+  static void Queue(WorkerPool &pool, ImageFileJob *job);
+
+private:
+  wxString m_file;
+  wxImage m_image;
+  std::vector<char> m_data;
+  bool m_convertToPng;
+  bool m_ok;
+};
+
+#endif // IMAGEFILEJOB_H
@@ -43,7 +43,16 @@ ImgCell::ImgCell(const wxBitmap &bitmap) : MathCell()
   m_imageBorderWidth = 1;
 }
 
+ImgCell::ImgCell(Image *image) : MathCell()
+{
+  m_image = image;
+  m_type = MC_TYPE_IMAGE;
+  m_drawRectangle = true;
+  m_imageBorderWidth = 1;
+}
+
 int ImgCell::s_counter = 0;
+std::map<wxString, wxUint32> ImgCell::s_crcs;
 
 // constructor which load image
 ImgCell::ImgCell(wxString image, bool remove, wxFileSystem *filesystem) : MathCell()
@@ -166,16 +175,33 @@ wxString ImgCell::ToXML()
   wxString basename = ImgCell::WXMXGetNewFileName();
 
   // add the file to memory
-  if(m_image)
+  WXMXAddImage(basename+m_image -> GetExtension(), m_image);
+  return (m_drawRectangle ? wxT("<img>") : wxT("<img rect=\"false\">")) +
+    basename + m_image -> GetExtension()+ wxT("</img>");
+}
+
+void ImgCell::WXMXAddImage(wxString name, Image *image)
+{
+  if(image)
   {
-    if(m_image->GetCompressedImage())
-      wxMemoryFSHandler::AddFile(basename+m_image -> GetExtension(),
-                                 m_image->GetCompressedImage().GetData(),
-                                 m_image->GetCompressedImage().GetDataLen()
+    if(image->GetCompressedImage())
+    {
+      wxMemoryFSHandler::AddFile(name,
+                                 image->GetCompressedImage().GetData(),
+                                 image->GetCompressedImage().GetDataLen()
         );
+      s_crcs[name] = image->GetCompressedImageCRC();
+    }
   }
-  return (m_drawRectangle ? wxT("<img>") : wxT("<img rect=\"false\">")) +
-    basename + m_image -> GetExtension()+ wxT("</img>");
+}
+
+bool ImgCell::WXMXImageCRC(wxString name, wxUint32 &crc)
+{
+  std::map<wxString, wxUint32>::iterator it = s_crcs.find(name);
+  if(it == s_crcs.end())
+    return false;
+  crc = it->second;
+  return true;
 }
 
 wxString ImgCell::WXMXGetNewFileName()
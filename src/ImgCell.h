@@ -29,12 +29,16 @@
 #include <wx/filesys.h>
 #include <wx/fs_arc.h>
 
+#include <map>
+
 class ImgCell : public MathCell
 {
 public:
   ImgCell();
   ImgCell(wxString image, bool remove = true, wxFileSystem *filesystem = NULL);
   ImgCell(const wxBitmap &bitmap);
+  //! A constructor that takes over an image that has already been loaded
+  ImgCell(Image *image);
   ~ImgCell();
   void Destroy();
   void LoadImage(wxString image, bool remove = true);
@@ -53,6 +57,15 @@ public:
     See also GetExtension().
    */
   wxSize ToImageFile(wxString filename);
+  //! The data ToImageFile() writes if the file name ends in GetExtension()
+  wxMemoryBuffer GetCompressedImage()
+    {if(m_image)return m_image->GetCompressedImage(); else return wxMemoryBuffer();}
+  //! The CRC32 of GetCompressedImage()
+  wxUint32 GetCompressedImageCRC()
+    {if(m_image)return m_image->GetCompressedImageCRC(); else return 0;}
+  //! The size ToImageFile() returns if the file name ends in GetExtension()
+  wxSize GetOriginalSize()
+    {if(m_image)return wxSize(m_image->GetOriginalWidth(),m_image->GetOriginalHeight()); else return wxSize(-1,-1);}
   /*! Removes the cached scaled image from memory
 
     The scaled version of the image will be recreated automatically once it is 
@@ -65,9 +78,16 @@ public:
   bool CopyToClipboard();
   // These methods should only be used for saving wxmx files
   // and are shared with SlideShowCell.
-  static void WXMXResetCounter() { s_counter = 0; }
+  static void WXMXResetCounter() { s_counter = 0; s_crcs.clear(); }
   static wxString WXMXGetNewFileName();
   static int WXMXImageCount() { return s_counter; }
+  //! Puts an image into the memory filesystem the .wxmx writer reads it from
+  static void WXMXAddImage(wxString name, Image *image);
+  /*! The CRC32 of an image WXMXAddImage() has added
+
+    \return false, if the CRC of this image is unknown.
+   */
+  static bool WXMXImageCRC(wxString name, wxUint32 &crc);
   void DrawRectangle(bool draw) { m_drawRectangle = draw; }
   //! Returns the file name extension that matches the image type
   wxString GetExtension(){if(m_image)return m_image->GetExtension(); else return wxEmptyString;}
@@ -80,6 +100,7 @@ protected:
   wxString ToTeX();
   wxString ToXML();
 	static int s_counter;
+	static std::map<wxString, wxUint32> s_crcs;
 	bool m_drawRectangle;
 };
 
@@ -0,0 +1,409 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "LineIndex.h"
+
+LineIndex::LineIndex()
+{
+  m_hasUnstyled = false;
+  m_firstUnstyled = m_lastUnstyled = 0;
+  Build(wxEmptyString);
+}
+
+LineIndex::LineIndex(const LineIndex &index)
+{
+  *this = index;
+}
+
+LineIndex::~LineIndex()
+{
+  DeleteBlocks();
+}
+
+LineIndex &LineIndex::operator=(const LineIndex &index)
+{
+  if (this == &index)
+    return *this;
+
+  DeleteBlocks();
+  for (size_t i = 0; i < index.m_blocks.size(); i++)
+    m_blocks.push_back(new Block(*index.m_blocks[i]));
+  m_lengthTree = index.m_lengthTree;
+  m_countTree = index.m_countTree;
+  m_treeMask = index.m_treeMask;
+  m_lineCount = index.m_lineCount;
+  m_textLength = index.m_textLength;
+  m_hasUnstyled = index.m_hasUnstyled;
+  m_firstUnstyled = index.m_firstUnstyled;
+  m_lastUnstyled = index.m_lastUnstyled;
+  return *this;
+}
+
+void LineIndex::DeleteBlocks()
+{
+  for (size_t i = 0; i < m_blocks.size(); i++)
+    delete m_blocks[i];
+  m_blocks.clear();
+}
+
+void LineIndex::Build(const wxString &text)
+{
+  std::vector<Line> lines;
+  Split(text, 0, text.Length(), true, lines);
+
+  DeleteBlocks();
+  for (size_t i = 0; i < lines.size(); i += LINES_PER_BLOCK)
+  {
+    size_t end = i + LINES_PER_BLOCK;
+    if (end > lines.size())
+      end = lines.size();
+    Block *block = new Block;
+    block->m_lines.assign(lines.begin() + i, lines.begin() + end);
+    UpdateLength(*block);
+    m_blocks.push_back(block);
+  }
+  m_textLength = text.Length();
+  BuildTree();
+  InvalidateStyles();
+}
+
+void LineIndex::Split(const wxString &text, size_t start, size_t end, bool lastLine,
+                      std::vector<Line> &lines)
+{
+  size_t lineStart = start;
+  for (size_t pos = start; pos < end; pos++)
+  {
+    if (text[pos] == wxT('\n'))
+    {
+      lines.push_back(Line(pos + 1 - lineStart));
+      lineStart = pos + 1;
+    }
+  }
+
+  // Only the last line of the text doesn't end in a line break.
+  if (lastLine)
+    lines.push_back(Line(end - lineStart));
+}
+
+void LineIndex::UpdateLength(Block &block)
+{
+  block.m_length = 0;
+  for (size_t i = 0; i < block.m_lines.size(); i++)
+    block.m_length += block.m_lines[i].m_length;
+}
+
+void LineIndex::Replace(wxString &text, size_t start, size_t end, const wxString &insert)
+{
+  if (start > text.Length())
+    start = text.Length();
+  if (end > text.Length())
+    end = text.Length();
+  if (end < start)
+    end = start;
+
+  bool lineBreaks = (insert.find(wxT('\n')) != wxString::npos);
+  for (size_t pos = start; (pos < end) && (!lineBreaks); pos++)
+    lineBreaks = (text[pos] == wxT('\n'));
+
+  size_t first = LineOf(start);
+  long delta = (long)insert.Length() - (long)(end - start);
+  size_t block, index;
+  Locate(first, block, index);
+
+  if (!lineBreaks)
+  {
+    // The common case: Typing or deleting inside a line.
+    text.replace(start, end - start, insert);
+    Line &line = m_blocks[block]->m_lines[index];
+    line.m_length += delta;
+    line.m_width = -1;
+    line.m_styled = false;
+    MarkUnstyled(first, first);
+    m_blocks[block]->m_length += delta;
+    TreeAdd(m_lengthTree, block, delta);
+    m_textLength += delta;
+    return;
+  }
+
+  size_t last = LineOf(end);
+  size_t lastBlock, lastIndex;
+  Locate(last, lastBlock, lastIndex);
+  size_t regionStart = LineStart(first);
+  size_t regionEnd = LineStart(last) + LineLength(last) + delta;
+  text.replace(start, end - start, insert);
+
+  std::vector<Line> lines;
+  Split(text, regionStart, regionEnd, last == m_lineCount - 1, lines);
+  size_t oldCount = last + 1 - first;
+
+  // Only the lines of the blocks the edit has touched have to be moved.
+  Block *target = m_blocks[block];
+  bool blocksChanged = false;
+  if (lastBlock == block)
+    target->m_lines.erase(target->m_lines.begin() + index,
+                          target->m_lines.begin() + lastIndex + 1);
+  else
+  {
+    // The lines behind the edit in the last block it touches are appended to the first one.
+    Block *tail = m_blocks[lastBlock];
+    target->m_lines.erase(target->m_lines.begin() + index, target->m_lines.end());
+    target->m_lines.insert(target->m_lines.end(),
+                           tail->m_lines.begin() + lastIndex + 1, tail->m_lines.end());
+    for (size_t i = block + 1; i <= lastBlock; i++)
+      delete m_blocks[i];
+    m_blocks.erase(m_blocks.begin() + block + 1, m_blocks.begin() + lastBlock + 1);
+    blocksChanged = true;
+  }
+  target->m_lines.insert(target->m_lines.begin() + index, lines.begin(), lines.end());
+  UpdateLength(*target);
+  m_textLength += delta;
+
+  if (Rebalance(block))
+    blocksChanged = true;
+  if (blocksChanged)
+    BuildTree();
+  else
+  {
+    TreeAdd(m_lengthTree, block, delta);
+    TreeAdd(m_countTree, block, (long)lines.size() - (long)oldCount);
+    m_lineCount = m_lineCount + lines.size() - oldCount;
+  }
+
+  // The lines behind the edit have moved.
+  if (m_hasUnstyled)
+  {
+    if (m_firstUnstyled > last)
+      m_firstUnstyled = m_firstUnstyled + lines.size() - oldCount;
+    if (m_lastUnstyled > last)
+      m_lastUnstyled = m_lastUnstyled + lines.size() - oldCount;
+    else if (m_lastUnstyled >= first)
+      m_lastUnstyled = first;
+  }
+  MarkUnstyled(first, first + lines.size() - 1);
+}
+
+bool LineIndex::Rebalance(size_t block)
+{
+  bool changed = false;
+
+  if ((m_blocks[block]->m_lines.size() < LINES_PER_BLOCK / 2) && (m_blocks.size() > 1))
+  {
+    // Merge the block with the one behind it, or the one before it if it is the last one.
+    if (block + 1 == m_blocks.size())
+      block--;
+    Block *merged = m_blocks[block];
+    Block *next = m_blocks[block + 1];
+    merged->m_lines.insert(merged->m_lines.end(), next->m_lines.begin(), next->m_lines.end());
+    merged->m_length += next->m_length;
+    delete next;
+    m_blocks.erase(m_blocks.begin() + block + 1);
+    changed = true;
+  }
+
+  std::vector<Line> &lines = m_blocks[block]->m_lines;
+  if (lines.size() > 2 * LINES_PER_BLOCK)
+  {
+    // Split the block into blocks of LINES_PER_BLOCK lines.
+    std::vector<Block *> blocks;
+    for (size_t i = LINES_PER_BLOCK; i < lines.size(); i += LINES_PER_BLOCK)
+    {
+      size_t end = i + LINES_PER_BLOCK;
+      if (end > lines.size())
+        end = lines.size();
+      Block *newBlock = new Block;
+      newBlock->m_lines.assign(lines.begin() + i, lines.begin() + end);
+      UpdateLength(*newBlock);
+      blocks.push_back(newBlock);
+    }
+    lines.erase(lines.begin() + LINES_PER_BLOCK, lines.end());
+    UpdateLength(*m_blocks[block]);
+    m_blocks.insert(m_blocks.begin() + block + 1, blocks.begin(), blocks.end());
+    changed = true;
+  }
+
+  return changed;
+}
+
+void LineIndex::BuildTree()
+{
+  size_t count = m_blocks.size();
+  m_lengthTree.assign(count + 1, 0);
+  m_countTree.assign(count + 1, 0);
+  m_lineCount = 0;
+  for (size_t i = 1; i <= count; i++)
+  {
+    m_lengthTree[i] += m_blocks[i - 1]->m_length;
+    m_countTree[i] += m_blocks[i - 1]->m_lines.size();
+    m_lineCount += m_blocks[i - 1]->m_lines.size();
+    size_t parent = i + (i & (~i + 1));
+    if (parent <= count)
+    {
+      m_lengthTree[parent] += m_lengthTree[i];
+      m_countTree[parent] += m_countTree[i];
+    }
+  }
+
+  m_treeMask = 1;
+  while (m_treeMask * 2 <= count)
+    m_treeMask *= 2;
+}
+
+void LineIndex::TreeAdd(std::vector<size_t> &tree, size_t block, long delta)
+{
+  for (size_t i = block + 1; i < tree.size(); i += (i & (~i + 1)))
+    tree[i] += delta;
+}
+
+size_t LineIndex::TreeSum(const std::vector<size_t> &tree, size_t count)
+{
+  size_t sum = 0;
+  for (size_t i = count; i > 0; i -= (i & (~i + 1)))
+    sum += tree[i];
+  return sum;
+}
+
+size_t LineIndex::TreeFind(const std::vector<size_t> &tree, size_t &value) const
+{
+  size_t count = 0;
+  for (size_t step = m_treeMask; step > 0; step /= 2)
+  {
+    if ((count + step < tree.size()) && (tree[count + step] <= value))
+    {
+      count += step;
+      value -= tree[count];
+    }
+  }
+  return count;
+}
+
+void LineIndex::Locate(size_t line, size_t &block, size_t &index) const
+{
+  index = line;
+  block = TreeFind(m_countTree, index);
+  if (block >= m_blocks.size())
+  {
+    block = m_blocks.size() - 1;
+    index = m_blocks[block]->m_lines.size() - 1;
+  }
+}
+
+LineIndex::Line &LineIndex::GetLine(size_t line)
+{
+  size_t block, index;
+  Locate(line, block, index);
+  return m_blocks[block]->m_lines[index];
+}
+
+const LineIndex::Line &LineIndex::GetLine(size_t line) const
+{
+  size_t block, index;
+  Locate(line, block, index);
+  return m_blocks[block]->m_lines[index];
+}
+
+size_t LineIndex::LineStart(size_t line) const
+{
+  if (line >= m_lineCount)
+    return m_textLength;
+
+  size_t block, index;
+  Locate(line, block, index);
+  size_t start = TreeSum(m_lengthTree, block);
+  const std::vector<Line> &lines = m_blocks[block]->m_lines;
+  for (size_t i = 0; i < index; i++)
+    start += lines[i].m_length;
+  return start;
+}
+
+size_t LineIndex::ContentLength(size_t line) const
+{
+  if (line + 1 < m_lineCount)
+    return LineLength(line) - 1;
+  else
+    return LineLength(line);
+}
+
+size_t LineIndex::LineOf(size_t pos) const
+{
+  // Find the block pos is in...
+  size_t block = TreeFind(m_lengthTree, pos);
+  if (block >= m_blocks.size())
+  {
+    block = m_blocks.size() - 1;
+    pos = m_blocks[block]->m_length;
+  }
+
+  // ...and the number of lines in this block that end at or before pos.
+  const std::vector<Line> &lines = m_blocks[block]->m_lines;
+  size_t index = 0;
+  while ((index + 1 < lines.size()) && (lines[index].m_length <= pos))
+  {
+    pos -= lines[index].m_length;
+    index++;
+  }
+  return TreeSum(m_countTree, block) + index;
+}
+
+void LineIndex::InvalidateWidths()
+{
+  for (size_t i = 0; i < m_blocks.size(); i++)
+  {
+    std::vector<Line> &lines = m_blocks[i]->m_lines;
+    for (size_t j = 0; j < lines.size(); j++)
+      lines[j].m_width = -1;
+  }
+}
+
+void LineIndex::SetStyle(size_t line, int lexState, int lexEnd, std::vector<StyledSpan> &spans)
+{
+  Line &styled = GetLine(line);
+  styled.m_styled = true;
+  styled.m_lexState = lexState;
+  styled.m_lexEnd = lexEnd;
+  styled.m_spans.swap(spans);
+}
+
+void LineIndex::InvalidateStyles()
+{
+  for (size_t i = 0; i < m_blocks.size(); i++)
+  {
+    std::vector<Line> &lines = m_blocks[i]->m_lines;
+    for (size_t j = 0; j < lines.size(); j++)
+      lines[j].m_styled = false;
+  }
+  m_hasUnstyled = false;
+  MarkUnstyled(0, m_lineCount - 1);
+}
+
+void LineIndex::MarkUnstyled(size_t first, size_t last)
+{
+  if (!m_hasUnstyled)
+  {
+    m_firstUnstyled = first;
+    m_lastUnstyled = last;
+    m_hasUnstyled = true;
+    return;
+  }
+
+  if (first < m_firstUnstyled)
+    m_firstUnstyled = first;
+  if (last > m_lastUnstyled)
+    m_lastUnstyled = last;
+}
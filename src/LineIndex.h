@@ -0,0 +1,197 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  The line index EditorCell uses in order to find lines without scanning its text.
+ */
+
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <wx/string.h>
+
+#include <vector>
+
+//! The number of lines LineIndex tries to keep in every block
+#define LINES_PER_BLOCK 64
+
+//! A piece of a line that is drawn in one style
+struct StyledSpan
+{
+  StyledSpan(size_t start, size_t length, int style)
+  {
+    m_start = start;
+    m_length = length;
+    m_style = style;
+  }
+  //! The position of the first character, relative to the start of the line
+  size_t m_start;
+  size_t m_length;
+  //! The TextStyle to draw the text in. -1 means: The default style.
+  int m_style;
+};
+
+/*! Knows where the lines of a text begin, how wide they are and how they are styled
+
+  The lines are stored in blocks of about LINES_PER_BLOCK lines. Two Fenwick
+  trees over the blocks store how many characters and how many lines each
+  of them contains. This means that finding the line a position belongs to
+  and finding the position a line starts at costs O(log n) in the number of
+  blocks plus a scan of a single block. An edit that doesn't add or remove a
+  line break only has to update one line and the trees. Edits that do only
+  re-scan the lines they touch and move the lines of the block they are in;
+  the trees only are rebuilt if a block has to be split, merged or removed.
+
+  The index doesn't own the text: All changes to the text have to be made
+  using Replace() in order to keep both in sync.
+
+  Every line also remembers the syntax highlighting for its text and the
+  state the lexer was in at its start and end. Replace() marks the lines it
+  touches as unstyled so the lexer knows where it has to start again.
+ */
+class LineIndex
+{
+public:
+  LineIndex();
+  LineIndex(const LineIndex &index);
+  ~LineIndex();
+  LineIndex &operator=(const LineIndex &index);
+  //! Indexes a text from scratch. Forgets all line widths.
+  void Build(const wxString &text);
+  /*! Replaces the characters between start and end of text by insert
+
+    The widths of the lines that have been touched are forgotten.
+   */
+  void Replace(wxString &text, size_t start, size_t end, const wxString &insert);
+  //! The number of lines. An empty text consists of one empty line.
+  size_t LineCount() const { return m_lineCount; }
+  //! The length of the text that has been indexed
+  size_t TextLength() const { return m_textLength; }
+  //! The position of the first character of a line
+  size_t LineStart(size_t line) const;
+  //! The length of a line including its line break
+  size_t LineLength(size_t line) const { return GetLine(line).m_length; }
+  //! The length of a line without its line break
+  size_t ContentLength(size_t line) const;
+  /*! The line the character at pos belongs to
+
+    A position directly after a line break belongs to the next line.
+   */
+  size_t LineOf(size_t pos) const;
+  //! The width of a line in pixels. -1 means: Unknown.
+  int GetWidth(size_t line) const { return GetLine(line).m_width; }
+  void SetWidth(size_t line, int width) { GetLine(line).m_width = width; }
+  //! Forgets the widths of all lines, for example since the font has changed.
+  void InvalidateWidths();
+
+  //! Has the line been styled since it was last changed?
+  bool IsStyled(size_t line) const { return GetLine(line).m_styled; }
+  //! The state the lexer was in at the start of a line that IsStyled()
+  int GetLexState(size_t line) const { return GetLine(line).m_lexState; }
+  //! The state the lexer was in at the end of a line that IsStyled()
+  int GetLexEnd(size_t line) const { return GetLine(line).m_lexEnd; }
+  //! The styled pieces a line consists of
+  const std::vector<StyledSpan> &GetSpans(size_t line) const { return GetLine(line).m_spans; }
+  /*! Stores the styling of a line and marks it as styled
+
+    spans is swapped into the index, which leaves it in an unspecified state.
+   */
+  void SetStyle(size_t line, int lexState, int lexEnd, std::vector<StyledSpan> &spans);
+  //! Does any line need to be styled?
+  bool HasUnstyledLines() const { return m_hasUnstyled; }
+  //! The first line that has been changed since the last call to StylesUpdated()
+  size_t FirstUnstyled() const { return m_firstUnstyled; }
+  //! The last line that has been changed since the last call to StylesUpdated()
+  size_t LastUnstyled() const { return m_lastUnstyled; }
+  //! Tells the index that all changed lines have been styled.
+  void StylesUpdated() { m_hasUnstyled = false; }
+  //! Marks all lines as unstyled.
+  void InvalidateStyles();
+
+private:
+  struct Line
+  {
+    Line(size_t length = 0)
+    {
+      m_length = length;
+      m_width = -1;
+      m_styled = false;
+      m_lexState = m_lexEnd = 0;
+    }
+    size_t m_length;
+    int m_width;
+    bool m_styled;
+    int m_lexState;
+    int m_lexEnd;
+    std::vector<StyledSpan> m_spans;
+  };
+  //! A run of consecutive lines
+  struct Block
+  {
+    std::vector<Line> m_lines;
+    //! The sum of the lengths of m_lines
+    size_t m_length;
+  };
+  //! Splits text[start, end) into lines.
+  static void Split(const wxString &text, size_t start, size_t end, bool lastLine,
+                    std::vector<Line> &lines);
+  //! Recalculates the m_length of a block from its lines.
+  static void UpdateLength(Block &block);
+  //! Adds delta to the entry for a block in a Fenwick tree.
+  static void TreeAdd(std::vector<size_t> &tree, size_t block, long delta);
+  //! The sum of the entries for the first count blocks in a Fenwick tree
+  static size_t TreeSum(const std::vector<size_t> &tree, size_t count);
+  /*! The number of blocks whose entries in a Fenwick tree add up to no more than value
+
+    Subtracts the sum of their entries from value.
+   */
+  size_t TreeFind(const std::vector<size_t> &tree, size_t &value) const;
+  //! Rebuilds the trees and m_lineCount from m_blocks.
+  void BuildTree();
+  //! Finds the block a line is in and the index of the line in this block.
+  void Locate(size_t line, size_t &block, size_t &index) const;
+  Line &GetLine(size_t line);
+  const Line &GetLine(size_t line) const;
+  /*! Merges a block that has become small with its neighbour and splits one that has become big
+
+    \return true, if the number of blocks has changed.
+   */
+  bool Rebalance(size_t block);
+  //! Deletes all blocks.
+  void DeleteBlocks();
+  //! Adds the lines first to last to the range of unstyled lines.
+  void MarkUnstyled(size_t first, size_t last);
+
+  //! The lines. Never empty and never contains an empty block.
+  std::vector<Block *> m_blocks;
+  //! The Fenwick tree over the lengths of the blocks. m_lengthTree[0] isn't used.
+  std::vector<size_t> m_lengthTree;
+  //! The Fenwick tree over the number of lines in the blocks. m_countTree[0] isn't used.
+  std::vector<size_t> m_countTree;
+  //! The largest power of 2 that isn't bigger than the number of blocks
+  size_t m_treeMask;
+  size_t m_lineCount;
+  size_t m_textLength;
+  bool m_hasUnstyled;
+  size_t m_firstUnstyled;
+  size_t m_lastUnstyled;
+};
+
+#endif // LINEINDEX_H
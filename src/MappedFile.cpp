@@ -0,0 +1,181 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "MappedFile.h"
+
+#include <wx/file.h>
+
+#include <string.h>
+
+#if defined __WXMSW__
+#include <wx/msw/wrapwin.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(wxString file)
+{
+  m_data = NULL;
+  m_size = 0;
+  m_pos = 0;
+  m_ok = false;
+  m_map = NULL;
+  m_mapSize = 0;
+
+#if defined __WXMSW__
+  m_fileHandle = INVALID_HANDLE_VALUE;
+  m_mappingHandle = NULL;
+
+  HANDLE fileHandle = CreateFile(file.wc_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(fileHandle != INVALID_HANDLE_VALUE)
+  {
+    m_fileHandle = fileHandle;
+    LARGE_INTEGER size;
+    if(GetFileSizeEx(fileHandle, &size) && (size.QuadPart > 0))
+    {
+      HANDLE mappingHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(mappingHandle != NULL)
+      {
+        m_mappingHandle = mappingHandle;
+        m_map = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if(m_map != NULL)
+          m_mapSize = size.QuadPart;
+      }
+    }
+  }
+#else
+  int fd = open(file.fn_str(), O_RDONLY);
+  if(fd >= 0)
+  {
+    struct stat info;
+    if((fstat(fd, &info) == 0) && S_ISREG(info.st_mode) && (info.st_size > 0))
+    {
+      void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map != MAP_FAILED)
+      {
+        // We read the file from the start to the end exactly once.
+        madvise(map, info.st_size, MADV_SEQUENTIAL);
+        m_map = map;
+        m_mapSize = info.st_size;
+      }
+    }
+    // The mapping stays valid after the file has been closed.
+    close(fd);
+  }
+#endif
+
+  if(m_map != NULL)
+  {
+    m_data = (const char *) m_map;
+    m_size = m_mapSize;
+    m_ok = true;
+  }
+  else
+    Read(file);
+
+  // Skip the UTF-8 byte order mark, if there is one.
+  if((m_size >= 3) && (memcmp(m_data, "\xEF\xBB\xBF", 3) == 0))
+  {
+    m_data += 3;
+    m_size -= 3;
+  }
+}
+
+MappedFile::~MappedFile()
+{
+#if defined __WXMSW__
+  if(m_map != NULL)
+    UnmapViewOfFile(m_map);
+  if(m_mappingHandle != NULL)
+    CloseHandle((HANDLE) m_mappingHandle);
+  if(m_fileHandle != INVALID_HANDLE_VALUE)
+    CloseHandle((HANDLE) m_fileHandle);
+#else
+  if(m_map != NULL)
+    munmap(m_map, m_mapSize);
+#endif
+}
+
+void MappedFile::Read(wxString file)
+{
+  // Empty files and files that don't support mmap() (pipes, some network
+  // file systems) end up here.
+  wxFile in;
+  if(!wxFileExists(file) || !in.Open(file))
+    return;
+
+  wxFileOffset length = in.Length();
+  if(length > 0)
+  {
+    m_buffer.resize(length);
+    if(in.Read(&m_buffer[0], length) != length)
+    {
+      m_buffer.clear();
+      return;
+    }
+    m_data = &m_buffer[0];
+    m_size = m_buffer.size();
+  }
+  m_ok = true;
+}
+
+bool MappedFile::NextLine(const char *&line, size_t &length)
+{
+  if(m_pos >= m_size)
+    return false;
+
+  line = m_data + m_pos;
+  const char *end = m_data + m_size;
+  const char *pos = line;
+  while((pos < end) && (*pos != '\n') && (*pos != '\r'))
+    pos++;
+  length = pos - line;
+
+  // Skip the line ending.
+  if(pos < end)
+  {
+    if((*pos == '\r') && (pos + 1 < end) && (pos[1] == '\n'))
+      pos++;
+    pos++;
+  }
+  m_pos = pos - m_data;
+  return true;
+}
+
+wxString MappedFile::ToString(const char *line, size_t length)
+{
+  // Most lines are plain ASCII which is valid UTF-8, too.
+  wxString retval = wxString::FromUTF8(line, length);
+  if(retval.IsEmpty() && (length > 0))
+    retval = wxString(line, wxConvISO8859_1, length);
+  return retval;
+}
+
+bool MappedFile::StartsWith(const char *line, size_t length, const char *prefix)
+{
+  size_t prefixLength = strlen(prefix);
+  return (length >= prefixLength) && (memcmp(line, prefix, prefixLength) == 0);
+}
@@ -0,0 +1,84 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  A read-only view of a file that maps the file into memory.
+ */
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <wx/wx.h>
+
+#include <vector>
+
+/*! Reads a text file line by line without copying it first
+
+  wxTextFile reads the whole file, converts it to a wxString and then splits
+  this string into a wxArrayString before the first line can be looked at.
+  This class instead maps the file into memory and hands out the lines as
+  pointers into the mapped bytes. Only the lines that are actually needed
+  have to be converted to wxStrings.
+
+  If the file cannot be mapped it is read into a buffer instead.
+ */
+class MappedFile
+{
+public:
+  MappedFile(wxString file);
+  ~MappedFile();
+  //! Could the file be opened?
+  bool IsOk() { return m_ok; }
+  /*! Returns the next line, without its line ending
+
+    Accepts \\n, \\r\\n and \\r as line endings and skips an UTF-8 byte order
+    mark at the beginning of the file.
+    \param line Is set to the beginning of the line. Isn't 0-terminated.
+    \param length Is set to the length of the line, in bytes.
+    \return false, if the end of the file has been reached.
+   */
+  bool NextLine(const char *&line, size_t &length);
+  //! Starts over with the first line.
+  void Rewind() { m_pos = 0; }
+  //! Converts a line to a wxString. Falls back to latin-1 for invalid UTF-8.
+  static wxString ToString(const char *line, size_t length);
+  //! Does the line start with the ASCII string prefix?
+  static bool StartsWith(const char *line, size_t length, const char *prefix);
+
+private:
+  //! Is called if mapping the file fails.
+  void Read(wxString file);
+  const char *m_data;
+  size_t m_size;
+  size_t m_pos;
+  bool m_ok;
+  //! The memory mapping, or NULL if the file has been read into m_buffer
+  void *m_map;
+  size_t m_mapSize;
+  //! The file's contents, if it couldn't be mapped.
+  std::vector<char> m_buffer;
+#if defined __WXMSW__
+  void *m_fileHandle;
+  void *m_mappingHandle;
+#endif
+};
+
+#endif // MAPPEDFILE_H
@@ -33,6 +33,10 @@
 #include "ImgCell.h"
 #include "MarkDown.h"
 #include "ContentAssistantPopup.h"
+#include "WXMXSnapshot.h"
+#include "ExportImageCache.h"
+#include "MaximaKernel.h"
+#include "CellSymbols.h"
 
 #include <wx/clipbrd.h>
 #include <wx/config.h>
@@ -45,6 +49,13 @@
 #include <wx/txtstrm.h>
 #include <wx/filesys.h>
 #include <wx/fs_mem.h>
+#include <wx/mstream.h>
+#include <wx/stopwatch.h>
+#include <wx/progdlg.h>
+#include <wx/buffer.h>
+
+#include <algorithm>
+#include <set>
 
 #define SCROLL_UNIT 10
 #define CARET_TIMER_TIMEOUT 500
@@ -75,6 +86,15 @@ wxScrolledCanvas(
   m_scrolledAwayFromEvaluation = false;
   m_keyboardInactive = true;
   m_tree = NULL;
+  m_progressiveLayout = false;
+  m_recalculateStart = NULL;
+  m_progressiveTarget = NULL;
+  m_progressiveForce = false;
+  m_recalculateScheduled = false;
+  m_maximaSession = 0;
+  m_lastSession = 0;
+  m_showEvaluationStats = false;
+  wxConfig::Get()->Read(wxT("showEvaluationStats"), &m_showEvaluationStats);
   m_mainToolBar = NULL;
   m_memory = NULL;
   m_selectionStart = NULL;
@@ -94,6 +114,7 @@ wxScrolledCanvas(
   m_timer.SetOwner(this, TIMER_ID);
   m_caretTimer.SetOwner(this, CARET_TIMER_ID);
   m_animationTimer.SetOwner(this, ANIMATION_TIMER_ID);
+  m_outputLayoutTimer.SetOwner(this, OUTPUT_LAYOUT_TIMER_ID);
   AnimationRunning(false);
   m_saved = false;
   wxConfig *config = (wxConfig *)wxConfig::Get();
@@ -112,6 +133,7 @@ wxScrolledCanvas(
 }
 
 MathCtrl::~MathCtrl() {
+  StopParallelEvaluation();
   if (m_tree != NULL)
     DestroyTree();
   if (m_memory != NULL)
@@ -140,6 +162,13 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
   CalcUnscrolledPosition(0, rect.GetTop(), &xstart, &top);
   CalcUnscrolledPosition(0, rect.GetBottom(), &xstart, &bottom);
 
+  // Cells that have been laid out using the sizes stored in the .wxmx file
+  // are measured for real as soon as they become visible. Moving the cells
+  // below them is left to RecalculateStep(): Laying out the worksheet isn't
+  // something to do while painting.
+  if (DropVisibleCachedSizes(top, bottom))
+    m_recalculateScheduled = true;
+
   // Test if m_memory is NULL (resize event)
   if (m_memory == NULL) {
     m_memory = new wxBitmap();
@@ -161,6 +190,7 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
   CellParser parser(dcm);
   parser.SetBounds(top, bottom);
   parser.SetZoomFactor(m_zoomFactor);
+  parser.ShowEvaluationStats(m_showEvaluationStats);
   int fontsize = parser.GetDefaultFontSize(); // apply zoomfactor to defaultfontsize
 
   // Draw content
@@ -214,14 +244,17 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
     //
     // Mark groupcells currently in queue. TODO better in gc::draw?
     //
-    if (m_evaluationQueue->GetCell() != NULL) {
+    GroupCell *evaluatingCell = m_evaluationQueue->GetCell();
+    if (evaluatingCell != NULL) {
       GroupCell* tmp = m_tree;
       dcm.SetBrush(*wxTRANSPARENT_BRUSH);
       while (tmp != NULL)
       {
         wxRect rect = tmp->GetRect();        
-        if (m_evaluationQueue->IsInQueue(dynamic_cast<GroupCell*>(tmp))) {
-          if (m_evaluationQueue->GetCell() == tmp)
+        // Only the cells in the viewport need to be asked if they are queued.
+        if ((rect.GetTop() - 2 <= bottom) && (rect.GetBottom() + 3 >= top) &&
+            m_evaluationQueue->IsInQueue(tmp)) {
+          if (evaluatingCell == tmp)
           {
             dcm.SetPen(*(wxThePenList->FindOrCreatePen(parser.GetColor(TS_CELL_BRACKET), 2, wxPENSTYLE_SOLID)));
             dcm.DrawRectangle( 3, rect.GetTop() - 2, MC_GROUP_LEFT_INDENT, rect.GetHeight() + 5);
@@ -233,9 +266,14 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
             dcm.DrawRectangle( 3, rect.GetTop() - 2, MC_GROUP_LEFT_INDENT, rect.GetHeight() + 5);
           }
         }
+        // The cells are sorted by their position => None of the rest is visible.
+        if (rect.GetTop() - 2 > bottom)
+          break;
         tmp = dynamic_cast<GroupCell *>(tmp->m_next);
       }
     }
+    int lastTop = m_lastTop;
+    int lastBottom = m_lastBottom;
     m_lastTop = top;
     m_lastBottom = bottom;
     //
@@ -255,17 +293,23 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
     config->Read(wxT("changeAsterisk"), &changeAsterisk);
     parser.SetChangeAsterisk(changeAsterisk);
 
-    while (tmp != NULL)
+    while ((tmp != NULL) && (tmp != m_recalculateStart))
     {
       wxRect rect = tmp->GetRect();        
+      // The cells are sorted by their position: Once they start below the
+      // viewport there is nothing left to draw and nothing left whose image
+      // cache might need to be cleared.
+      if((rect.GetTop() >= bottom) && (rect.GetTop() >= lastBottom))
+        break;
+
       // Clear the image cache of all cells above or below the viewport.
       if((rect.GetTop() >= bottom) || (rect.GetBottom() <= top))
       {
         // Only actually clear the image cache if we did display the
         // image in the last step: Else it most probably isn't actually cached.
-        if((rect.GetBottom()<=m_lastBottom)||(rect.GetTop()>=m_lastTop))
+        if((rect.GetBottom() >= lastTop) && (rect.GetTop() <= lastBottom))
         {
-          if(tmp->GetOutput())
+          if(!tmp->HasLazyOutput() && tmp->GetOutput())
             tmp->GetOutput()->ClearCacheList();
         }
       }
@@ -274,7 +318,7 @@ void MathCtrl::OnPaint(wxPaintEvent& event) {
       tmp->m_currentPoint.y = point.y;
       if (tmp->DrawThisCell(parser, point))
         tmp->Draw(parser, point, MAX(fontsize, MC_MIN_SIZE));
-      if (tmp->m_next != NULL) {
+      if ((tmp->m_next != NULL) && (tmp->m_next != m_recalculateStart)) {
         point.x = MC_GROUP_LEFT_INDENT;
         point.y += drop + tmp->m_next->GetMaxCenter();
         point.y += MC_GROUP_SKIP;
@@ -393,6 +437,7 @@ GroupCell *MathCtrl::UpdateMLast()
 
 void MathCtrl::ScrollToError()
 {
+  FlushOutputLayout();
   GroupCell *ErrorCell=GetLastWorkingGroup();
   if(ErrorCell != NULL)
   {
@@ -448,11 +493,13 @@ GroupCell *MathCtrl::GetLastWorkingGroup()
   return tmp;
 }
 
-void MathCtrl::InsertLine(MathCell *newCell, bool forceNewLine)
+void MathCtrl::InsertLine(MathCell *newCell, bool forceNewLine, GroupCell *group)
 {
   m_saved = false;
 
-  GroupCell *tmp=GetLastWorkingGroup();
+  GroupCell *tmp = group;
+  if (tmp == NULL)
+    tmp = GetLastWorkingGroup();
   
   // If we still don't have a place to put the line we give up.
   if (tmp == NULL)
@@ -461,37 +508,130 @@ void MathCtrl::InsertLine(MathCell *newCell, bool forceNewLine)
   if(m_tree->Contains(tmp))
   {     
     newCell->ForceBreakLine(forceNewLine);
-    newCell->SetParentList(tmp);
-    
-    tmp->AppendOutput(newCell);
-    
-    wxClientDC dc(this);
-    CellParser parser(dc);
-    parser.SetZoomFactor(m_zoomFactor);
-    parser.SetClientWidth(GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT);
+    AppendLine(tmp, newCell);
 
-    tmp->RecalculateAppended(parser);
-    Recalculate();
+    // The first line after a quiet period is displayed at once. The lines that
+    // follow it within OUTPUT_LAYOUT_INTERVAL are laid out in a single pass.
+    if(!m_outputLayoutTimer.IsRunning())
+    {
+      FlushOutputLayout();
+      m_outputLayoutTimer.StartOnce(OUTPUT_LAYOUT_INTERVAL);
+    }
+  }
+  else
+  {
+    wxASSERT_MSG(m_tree->Contains(tmp),_("Bug: Trying to append maxima's output to a cell outside the worksheet."));
+  }
+}
 
-    if(FollowEvaluation()) {
-      SetSelection(NULL);
-      if(GCContainsCurrentQuestion(tmp))
-      {
-        OpenQuestionCaret();
-      }
-      else
+void MathCtrl::InsertLines(const std::vector<MathCell *> &lines, GroupCell *group)
+{
+  if(lines.empty())
+    return;
+
+  m_saved = false;
+
+  GroupCell *tmp = group;
+  if (tmp == NULL)
+    tmp = GetLastWorkingGroup();
+  
+  if ((tmp == NULL) || (!m_tree->Contains(tmp)))
+  {
+    // Nobody will ever display these cells.
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      MathCell *tmp = lines[i];
+      while (tmp != NULL)
       {
-        SetHCaret(tmp);
-        ScrollToCaret();
+        MathCell *next = tmp->m_next;
+        tmp->Destroy();
+        delete tmp;
+        tmp = next;
       }
     }
+    return;
+  }
+
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    lines[i]->ForceBreakLine(true);
+    AppendLine(tmp, lines[i]);
+  }
+
+  if(!m_outputLayoutTimer.IsRunning())
+  {
+    FlushOutputLayout();
+    m_outputLayoutTimer.StartOnce(OUTPUT_LAYOUT_INTERVAL);
+  }
+}
+
+void MathCtrl::AppendLine(GroupCell *group, MathCell *newLine)
+{
+  EvaluationStats &stats = group->GetEvaluationStats();
+  for (MathCell *cell = newLine; cell != NULL; cell = cell->m_next)
+    stats.m_cells++;
+
+  newLine->SetParentList(group);
+  group->AppendOutput(newLine);
+
+  if (m_appendedGroups.empty() || (m_appendedGroups.back() != group))
+    m_appendedGroups.push_back(group);
+}
+
+void MathCtrl::FlushOutputLayout()
+{
+  if (m_appendedGroups.empty())
+    return;
+
+  std::vector<GroupCell *> groups;
+  groups.swap(m_appendedGroups);
+
+  // Appending and laying out the output is part of what evaluating a cell costs.
+  wxStopWatch stopwatch;
+  bool scrollToCaret = (!FollowEvaluation() && CaretVisibleIs());
+
+  wxClientDC dc(this);
+  CellParser parser(dc);
+  parser.SetZoomFactor(m_zoomFactor);
+  parser.SetClientWidth(GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT);
+
+  GroupCell *last = NULL;
+  for (size_t i = 0; i < groups.size(); i++)
+  {
+    // The cell might have been deleted since its output arrived.
+    if ((m_tree == NULL) || (!m_tree->Contains(groups[i])))
+      continue;
+    long start = stopwatch.Time();
+    groups[i]->RecalculateAppended(parser);
+    groups[i]->GetEvaluationStats().m_layoutTime += stopwatch.Time() - start;
+    last = groups[i];
+  }
+  if (last == NULL)
+    return;
+
+  long start = stopwatch.Time();
+  Recalculate();
+
+  if(FollowEvaluation()) {
+    SetSelection(NULL);
+    if(GCContainsCurrentQuestion(last))
+    {
+      OpenQuestionCaret();
+    }
     else
-      Refresh();
+    {
+      SetHCaret(last);
+      ScrollToCaret();
+    }
   }
   else
   {
-    wxASSERT_MSG(m_tree->Contains(tmp),_("Bug: Trying to append maxima's output to a cell outside the worksheet."));
+    Refresh();
+    if(scrollToCaret)
+      ScrollToCaret();
   }
+
+  last->GetEvaluationStats().m_layoutTime += stopwatch.Time() - start;
 }
 
 void MathCtrl::SetZoomFactor(double newzoom, bool recalc)
@@ -535,6 +675,9 @@ void MathCtrl::Recalculate(bool force)
   if(m_tree)
     m_tree->SetCanvasSize(GetClientSize());
 
+  if(m_progressiveLayout && force)
+    m_progressiveForce = true;
+
   wxClientDC dc(this);
   CellParser parser(dc);
   parser.SetZoomFactor(m_zoomFactor);
@@ -547,21 +690,146 @@ void MathCtrl::Recalculate(bool force)
   point.x = MC_GROUP_LEFT_INDENT;
   point.y = MC_BASE_INDENT ;
 
+  // In progressive mode we only lay out what is visible and the screen
+  // below the cell we want to scroll to.
+  int clientWidth, clientHeight, viewportTop;
+  GetClientSize(&clientWidth, &clientHeight);
+  CalcUnscrolledPosition(0, 0, &clientWidth, &viewportTop);
+  int layoutLimit = viewportTop + clientHeight;
+  bool targetReached = (m_progressiveTarget == NULL);
+
   while (tmp != NULL) {
+    if(m_progressiveLayout && targetReached && (point.y > layoutLimit))
+      break;
     tmp->Recalculate(parser, d_fontsize, m_fontsize);
     point.y += tmp->GetMaxCenter();
     tmp->m_currentPoint.x = point.x;
     tmp->m_currentPoint.y = point.y;
     point.y += tmp->GetMaxDrop();
+    if(tmp == m_progressiveTarget)
+    {
+      targetReached = true;
+      layoutLimit = MAX(layoutLimit, point.y + clientHeight);
+    }
     tmp = dynamic_cast<GroupCell*>(tmp->m_next);
     point.y += MC_GROUP_SKIP;
   }
+  m_recalculateStart = tmp;
+
+  if(m_recalculateStart == NULL)
+  {
+    m_progressiveLayout = false;
+    m_progressiveForce = false;
+  }
+  if(targetReached)
+    m_progressiveTarget = NULL;
   
   AdjustSize();
   // Re-calculate the table of contents
   UpdateTableOfContents();
 }
 
+void MathCtrl::ProgressiveLayout(bool enable, GroupCell *target)
+{
+  m_progressiveLayout = enable;
+  m_progressiveTarget = NULL;
+  if(enable)
+    m_progressiveTarget = target;
+  else
+    m_progressiveForce = false;
+  Recalculate();
+}
+
+bool MathCtrl::RecalculateStep()
+{
+  if(m_recalculateScheduled)
+  {
+    m_recalculateScheduled = false;
+    Recalculate();
+    Refresh();
+    return m_progressiveLayout;
+  }
+
+  if(!m_progressiveLayout)
+    return false;
+
+  // The cell we wanted to continue with might have been deleted in the meantime.
+  if((m_recalculateStart == NULL) || (m_tree == NULL) || (!m_tree->Contains(m_recalculateStart)))
+  {
+    Recalculate(m_progressiveForce);
+    return m_progressiveLayout;
+  }
+
+  wxClientDC dc(this);
+  CellParser parser(dc);
+  parser.SetZoomFactor(m_zoomFactor);
+  parser.SetForceUpdate(m_progressiveForce);
+  parser.SetClientWidth(GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT);
+  int d_fontsize = parser.GetDefaultFontSize();
+  int m_fontsize = parser.GetMathFontSize();
+
+  // Continue directly below the last cell that has been laid out.
+  wxPoint point;
+  point.x = MC_GROUP_LEFT_INDENT;
+  point.y = MC_BASE_INDENT;
+  GroupCell *previous = dynamic_cast<GroupCell*>(m_recalculateStart->m_previous);
+  if(previous != NULL)
+    point.y = previous->m_currentPoint.y + previous->GetMaxDrop() + MC_GROUP_SKIP;
+  int oldBottom = point.y;
+
+  // Don't block the GUI for more than a few milliseconds at a time.
+  wxStopWatch stopwatch;
+  GroupCell *tmp = m_recalculateStart;
+  m_tree->SetCanvasSize(GetClientSize());
+  while ((tmp != NULL) && (stopwatch.Time() < 50)) {
+    tmp->Recalculate(parser, d_fontsize, m_fontsize);
+    point.y += tmp->GetMaxCenter();
+    tmp->m_currentPoint.x = point.x;
+    tmp->m_currentPoint.y = point.y;
+    point.y += tmp->GetMaxDrop();
+    tmp = dynamic_cast<GroupCell*>(tmp->m_next);
+    point.y += MC_GROUP_SKIP;
+  }
+  m_recalculateStart = tmp;
+
+  AdjustSize();
+
+  // Only repaint if the cells we have laid out are visible.
+  int clientWidth, clientHeight, viewportTop;
+  GetClientSize(&clientWidth, &clientHeight);
+  CalcUnscrolledPosition(0, 0, &clientWidth, &viewportTop);
+  if(oldBottom < viewportTop + clientHeight)
+    Refresh();
+
+  if(m_recalculateStart == NULL)
+  {
+    m_progressiveLayout = false;
+    m_progressiveForce = false;
+    UpdateTableOfContents();
+    return false;
+  }
+  return true;
+}
+
+bool MathCtrl::DropVisibleCachedSizes(int top, int bottom)
+{
+  bool dropped = false;
+  GroupCell *tmp = m_tree;
+  while ((tmp != NULL) && (tmp != m_recalculateStart))
+  {
+    wxRect rect = tmp->GetRect();
+    if (rect.GetTop() > bottom)
+      break;
+    if ((rect.GetBottom() >= top) && tmp->HasCachedSize())
+    {
+      tmp->DropCachedSize();
+      dropped = true;
+    }
+    tmp = dynamic_cast<GroupCell*>(tmp->m_next);
+  }
+  return dropped;
+}
+
 /***
  * Resize the control
  */
@@ -886,6 +1154,8 @@ void MathCtrl::OnMouseRightDown(wxMouseEvent& event) {
           group = dynamic_cast<GroupCell *>(m_selectionEnd);
         else
           group = dynamic_cast<GroupCell *>(m_selectionStart);
+        if((group != NULL) && (group != m_workingGroup) && group->HasSpilledOutput())
+          popupMenu->Append(popid_show_spilled_output, _("Show Suppressed Output"), wxEmptyString, wxITEM_NORMAL);
         if(StartOfSectioningUnit(group)->GetGroupType() == GC_TYPE_TITLE)
         {
           popupMenu->AppendSeparator();
@@ -1587,7 +1857,7 @@ bool MathCtrl::CanDeleteRegion(GroupCell *start, GroupCell *end)
   // We refuse deletion of a cell we are planning to evaluate
   while (tmp != NULL)
   {
-    if(m_evaluationQueue->IsInQueue(tmp))
+    if(m_evaluationQueue->IsInQueue(tmp) || IsEvaluatedInParallel(tmp))
       return false;
 
     if(m_cellMouseSelectionStartedIn)
@@ -1786,7 +2056,7 @@ void MathCtrl::DeleteRegion(GroupCell *start,GroupCell *end,std::list <TreeUndoA
     }
 
     // Don't keep cached versions of scaled images around in the undo buffer.
-    if(tmp->GetOutput())
+    if(!tmp->HasLazyOutput() && tmp->GetOutput())
       tmp->GetOutput()->ClearCacheList();
     
     if (tmp == end)
@@ -2858,7 +3128,7 @@ void MathCtrl::GetMaxPoint(int* width, int* height) {
   *width = MC_BASE_INDENT;
   *height = MC_BASE_INDENT;
 
-  while (tmp != NULL) {
+  while ((tmp != NULL) && (tmp != m_recalculateStart)) {
     currentHeight += tmp->GetMaxHeight();
     currentHeight += MC_GROUP_SKIP;
     *height = currentHeight;
@@ -2953,6 +3223,14 @@ void MathCtrl::OnTimer(wxTimerEvent& event) {
     m_timer.Start(50, true);
   }
   break;
+  case OUTPUT_LAYOUT_TIMER_ID:
+    if (!m_appendedGroups.empty())
+    {
+      FlushOutputLayout();
+      // More output is likely to follow => Continue collecting it.
+      m_outputLayoutTimer.StartOnce(OUTPUT_LAYOUT_INTERVAL);
+    }
+    break;
   case ANIMATION_TIMER_ID:
   {
     if (CanAnimate())
@@ -3008,11 +3286,17 @@ void MathCtrl::OnTimer(wxTimerEvent& event) {
  * Destroy the tree
  */
 void MathCtrl::DestroyTree() {
+  // The kernels must not append output to cells that no more exist.
+  StopParallelEvaluation();
+  m_appendedGroups.clear();
   m_hCaretActive = false;
   SetHCaret(NULL);
   DestroyTree(m_tree);
   m_tree = m_last = NULL;
   m_lastWorkingGroup = NULL;
+  m_progressiveLayout = false;
+  m_recalculateStart = m_progressiveTarget = NULL;
+  m_progressiveForce = false;
 }
 
 void MathCtrl::DestroyTree(MathCell* tmp) {
@@ -3250,16 +3534,20 @@ bool MathCtrl::ExportToHTML(wxString file) {
   imgDir_rel = filename + wxT("_htmlimg");
   imgDir     = path + wxT("/") + imgDir_rel;
 
+  bool imgDirCreated = false;
   if (!wxDirExists(imgDir)) {
     if (!wxMkdir(imgDir))
       return false;
+    imgDirCreated = true;
   }
 
   wxFileOutputStream outfile(file);
   if (!outfile.IsOk())
     return false;
 
-  wxTextOutputStream output(outfile);
+  // The html file is written in many small pieces.
+  wxBufferedOutputStream bufferedOutfile(outfile);
+  wxTextOutputStream output(bufferedOutfile);
 
   wxString cssfileName_rel = imgDir_rel + wxT("/") + filename+wxT(".css");
   wxString cssfileName = path + wxT("/") + cssfileName_rel;
@@ -3685,9 +3973,33 @@ bool MathCtrl::ExportToHTML(wxString file) {
   
   bool exportInput = true;
   wxConfig::Get()->Read(wxT("exportInput"), &exportInput);
+
+  // The cells are laid out and drawn in the GUI thread. Compressing the
+  // resulting bitmaps to png files happens in the background meanwhile.
+  // Images that haven't changed since the last export are neither rendered
+  // nor written again. Their names are derived from their contents.
+  ExportImageCache imageCache(imgDir);
+  int bitmapScale = 3;
+  wxConfig::Get()->Read(wxT("bitmapScale"), &bitmapScale);
+  wxString renderSettings = RenderSettings(bitmapScale);
+
+  int cells = 0;
+  for (GroupCell *cell = m_tree; cell != NULL; cell = dynamic_cast<GroupCell*>(cell->m_next))
+    cells++;
+  int cellsDone = 0;
+  bool cancelled = false;
+  wxProgressDialog progress(_("Exporting to HTML"), _("Exporting the worksheet..."),
+                            MAX(cells, 1), this,
+                            wxPD_APP_MODAL | wxPD_AUTO_HIDE | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME);
   
   while (tmp != NULL) {
 
+    if (!progress.Update(cellsDone++))
+    {
+      cancelled = true;
+      break;
+    }
+
     // Handle a code cell
     if (tmp->GetGroupType() == GC_TYPE_CODE)
     {
@@ -3770,23 +4082,33 @@ bool MathCtrl::ExportToHTML(wxString file) {
           }
           else
           {
-            wxString ext;
+            wxString image;
             wxSize size;
             // Something we want to export as an image.
             if(chunk->GetType() == MC_TYPE_IMAGE)
             {
-              ext = wxT(".")+dynamic_cast<ImgCell*>(chunk)->GetExtension();
-              size = dynamic_cast<ImgCell*>(chunk)->ToImageFile(
-                imgDir + wxT("/") + filename + wxString::Format(wxT("_%d"), count) + ext);
+              ImgCell *imgCell = dynamic_cast<ImgCell*>(chunk);
+              wxMemoryBuffer data = imgCell->GetCompressedImage();
+              image = filename + wxT("_") +
+                ExportImageCache::Hash(imgCell->GetCompressedImageCRC(), data.GetDataLen()) +
+                wxT(".") + imgCell->GetExtension();
+              if (!imageCache.Lookup(image, size))
+              {
+                size = imgCell->GetOriginalSize();
+                imageCache.Write(image, data.GetData(), data.GetDataLen(), size);
+              }
             }
             else
             {
-              int bitmapScale = 3;
-              ext=wxT(".png");
-              wxConfig::Get()->Read(wxT("bitmapScale"), &bitmapScale);
-              size = CopyToFile(imgDir + wxT("/") + filename + wxString::Format(wxT("_%d.png"), count),
-                                chunk,
-                                NULL, true, bitmapScale);
+              image = filename + wxT("_") +
+                ExportImageCache::Hash(renderSettings + chunk->ListToXML()) + wxT(".png");
+              if (!imageCache.Lookup(image, size))
+              {
+                Bitmap bmp(bitmapScale);
+                bmp.SetData(CopySelection(chunk, NULL, true));
+                wxImage bitmap = bmp.ToImage(size);
+                imageCache.Write(image, bitmap, size);
+              }
             }
             
             int borderwidth = 0;
@@ -3797,9 +4119,9 @@ bool MathCtrl::ExportToHTML(wxString file) {
             borderwidth = chunk->m_imageBorderWidth;
             
             wxString line = wxT("  <img src=\"") +
-              filename + wxT("_htmlimg/") + filename +
-              wxString::Format(wxT("_%d%s\" width=\"%i\" style=\"max-width:90%%;\" alt=\""),
-                               count,ext,size.x - 2 * borderwidth) +
+              filename + wxT("_htmlimg/") + image +
+              wxString::Format(wxT("\" width=\"%i\" style=\"max-width:90%%;\" alt=\""),
+                               size.x - 2 * borderwidth) +
               alttext +
               wxT("\" >");
             
@@ -3872,13 +4194,13 @@ bool MathCtrl::ExportToHTML(wxString file) {
         else
         {
           ImgCell *imgCell = dynamic_cast<ImgCell*>(out);
-          imgCell->ToImageFile(
-            imgDir + wxT("/") + filename + wxString::Format(wxT("_%d."), count) +
-            imgCell -> GetExtension());
-          output<<wxT("  <IMG src=\"") + filename + wxT("_htmlimg/") +
-            filename +
-            wxString::Format(wxT("_%d.%s\" alt=\"Diagram\" style=\"max-width:90%%;\" >"), count,
-                             imgCell -> GetExtension());
+          wxMemoryBuffer data = imgCell->GetCompressedImage();
+          wxString image = filename + wxT("_") +
+            ExportImageCache::Hash(imgCell->GetCompressedImageCRC(), data.GetDataLen()) +
+            wxT(".") + imgCell -> GetExtension();
+          imageCache.Export(image, data.GetData(), data.GetDataLen(), imgCell->GetOriginalSize());
+          output<<wxT("  <IMG src=\"") + filename + wxT("_htmlimg/") + image +
+            wxT("\" alt=\"Diagram\" style=\"max-width:90%;\" >");
         }
         count++;
       }
@@ -3889,6 +4211,24 @@ bool MathCtrl::ExportToHTML(wxString file) {
     tmp = dynamic_cast<GroupCell*>(tmp->m_next);
   }
 
+  if (cancelled)
+  {
+    // Don't leave a half-written export behind. The images that already have
+    // been written are kept for the next export unless their folder is new.
+    imageCache.Cancel();
+    imageCache.Finish();
+    outfile.Close();
+    cssfile.Close();
+    wxRemoveFile(file);
+    wxRemoveFile(cssfileName);
+    if (imgDirCreated)
+      wxFileName::Rmdir(imgDir, wxPATH_RMDIR_RECURSIVE);
+    return false;
+  }
+
+  // Wait for the images the html code refers to.
+  bool imagesOK = imageCache.Finish();
+
 //////////////////////////////////////////////
 // Footer
 //////////////////////////////////////////////
@@ -3921,183 +4261,181 @@ bool MathCtrl::ExportToHTML(wxString file) {
   output<<wxT(" </BODY>\n");
   output<<wxT("</HTML>\n");
   
+  bufferedOutfile.Sync();
   bool outfileOK = !outfile.GetFile()->Error();
   bool cssOK =     !cssfile.GetFile()->Error();
   outfile.Close();
   cssfile.Close();
   
-  return outfileOK && cssOK;
+  return outfileOK && cssOK && imagesOK;
 }
 
-GroupCell* MathCtrl::CreateTreeFromWXMCode(wxArrayString *wxmLines)
+wxString MathCtrl::RenderSettings(int scale)
 {
-  bool hide = false;
-  GroupCell* tree = NULL;
-  GroupCell* last = NULL;
-  GroupCell* cell = NULL;
+  wxClientDC dc(this);
+  CellParser parser(dc);
 
-  while (!wxmLines->IsEmpty())
-  {
-    if (wxmLines->Item(0) == wxT("/* [wxMaxima: hide output   ] */"))
-      hide = true;
+  wxString settings;
+  settings << parser.GetFontConfigHash() << wxT(";") << scale;
+  for (int i = 0; i < STYLE_NUM; i++)
+    settings << wxT(";") << parser.GetColor(i).GetAsString(wxC2S_HTML_SYNTAX);
+  wxString background = wxT("white");
+  wxConfig::Get()->Read(wxT("Style/Background/color"), &background);
+  settings << wxT(";") << background;
+  return settings;
+}
 
-    // Print title
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: title   start ]"))
-    {
-      wxmLines->RemoveAt(0);
+wxString MathCtrl::LayoutCacheXML()
+{
+  wxClientDC dc(this);
+  CellParser parser(dc);
 
-      wxString line;
-      while ((!wxmLines->IsEmpty()) && (wxmLines->Item(0) != wxT("   [wxMaxima: title   end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
+  wxString xml = wxT("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  xml += wxString::Format(wxT("<layoutcache zoom=\"%i\" fonts=\"%s\" clientwidth=\"%i\">\n"),
+                          int(100.0 * m_zoomFactor),
+                          parser.GetFontConfigHash().c_str(),
+                          GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT);
 
-        wxmLines->RemoveAt(0);
-      }
+  // One entry per cell of content.xml. Cells that haven't been laid out yet
+  // get a size of -1.
+  GroupCell *tmp = m_tree;
+  bool laidOut = true;
+  while (tmp != NULL)
+  {
+    if (tmp == m_recalculateStart)
+      laidOut = false;
+    if (laidOut && (tmp->GetWidth() >= 0) && (tmp->GetHeight() >= 0))
+      xml += wxString::Format(wxT("<cell width=\"%i\" height=\"%i\" center=\"%i\"/>\n"),
+                              tmp->GetWidth(), tmp->GetHeight(), tmp->GetCenter());
+    else
+      xml += wxT("<cell width=\"-1\" height=\"-1\" center=\"-1\"/>\n");
+    tmp = dynamic_cast<GroupCell*>(tmp->m_next);
+  }
+  xml += wxT("</layoutcache>\n");
+  return xml;
+}
 
-      cell = new GroupCell(GC_TYPE_TITLE, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
-    }
+bool MathCtrl::LayoutCacheMatches(wxXmlNode *root, double zoomFactor)
+{
+  if ((root == NULL) || (root->GetName() != wxT("layoutcache")))
+    return false;
 
-    // Print section
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: section start ]"))
-    {
-      wxmLines->RemoveAt(0);
+  wxClientDC dc(this);
+  CellParser parser(dc);
 
-      wxString line;
-      while ((!wxmLines->IsEmpty()) && (wxmLines->Item(0) != wxT("   [wxMaxima: section end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
+  return
+    (root->GetAttribute(wxT("zoom")) == wxString::Format(wxT("%i"), int(100.0 * zoomFactor))) &&
+    (root->GetAttribute(wxT("fonts")) == parser.GetFontConfigHash()) &&
+    (root->GetAttribute(wxT("clientwidth")) ==
+     wxString::Format(wxT("%i"), GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT));
+}
 
-        wxmLines->RemoveAt(0);
-      }
+//! The markers that enclose the contents of a cell in a .wxm file
+struct WXMCellMarkers
+{
+  const wxChar *start;
+  const wxChar *end;
+  int type;
+};
 
-      cell = new GroupCell(GC_TYPE_SECTION, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
-    }
+static const WXMCellMarkers wxmCellMarkers[] =
+{
+  {wxT("/* [wxMaxima: title   start ]"),     wxT("   [wxMaxima: title   end   ] */"),     GC_TYPE_TITLE},
+  {wxT("/* [wxMaxima: section start ]"),     wxT("   [wxMaxima: section end   ] */"),     GC_TYPE_SECTION},
+  {wxT("/* [wxMaxima: subsect start ]"),     wxT("   [wxMaxima: subsect end   ] */"),     GC_TYPE_SUBSECTION},
+  {wxT("/* [wxMaxima: subsubsect start ]"),  wxT("   [wxMaxima: subsubsect end   ] */"),  GC_TYPE_SUBSUBSECTION},
+  {wxT("/* [wxMaxima: comment start ]"),     wxT("   [wxMaxima: comment end   ] */"),     GC_TYPE_TEXT},
+  {wxT("/* [wxMaxima: input   start ] */"),  wxT("/* [wxMaxima: input   end   ] */"),     GC_TYPE_CODE}
+};
 
-    // Print subsection
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: subsect start ]"))
-    {
-      wxmLines->RemoveAt(0);
+GroupCell* MathCtrl::CreateTreeFromWXMCode(const wxArrayString &wxmLines)
+{
+  size_t line = 0;
+  return CreateTreeFromWXMCode(wxmLines, line);
+}
 
-      wxString line;
-      while ((!wxmLines->IsEmpty()) && (wxmLines->Item(0) != wxT("   [wxMaxima: subsect end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
+GroupCell* MathCtrl::CreateTreeFromWXMCode(const wxArrayString &wxmLines, size_t &line)
+{
+  bool hide = false;
+  GroupCell* tree = NULL;
+  GroupCell* last = NULL;
+  GroupCell* cell = NULL;
+  size_t lines = wxmLines.GetCount();
 
-        wxmLines->RemoveAt(0);
-      }
+  while (line < lines)
+  {
+    const wxString &marker = wxmLines[line];
 
-      cell = new GroupCell(GC_TYPE_SUBSECTION, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
-    }
-    
-    // print subsubsection
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: subsubsect start ]"))
+    // Most lines are the contents of cells => Only lines that look like a
+    // marker need to be compared to the markers we know.
+    if (!marker.StartsWith(wxT("/* [wxMaxima: ")))
     {
-      wxmLines->RemoveAt(0);
-
-      wxString line;
-      while ((!wxmLines->IsEmpty()) && (wxmLines->Item(0) != wxT("   [wxMaxima: subsubsect end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
-
-        wxmLines->RemoveAt(0);
-      }
-
-      cell = new GroupCell(GC_TYPE_SUBSUBSECTION, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
+      line++;
+      continue;
     }
 
-    // Print comment
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: comment start ]"))
-    {
-      wxmLines->RemoveAt(0);
-
-      wxString line;
-      while ((!wxmLines->IsEmpty()) && (wxmLines->Item(0) != wxT("   [wxMaxima: comment end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
-
-        wxmLines->RemoveAt(0);
-      }
-
-      cell = new GroupCell(GC_TYPE_TEXT, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
-    }
+    if (marker == wxT("/* [wxMaxima: hide output   ] */"))
+      hide = true;
 
-    // Print input
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: input   start ] */"))
+    else if (marker == wxT("/* [wxMaxima: page break    ] */"))
     {
-      wxmLines->RemoveAt(0);
+      line++;
 
-      wxString line;
-      while ((!wxmLines->IsEmpty()) &&(wxmLines->Item(0) != wxT("/* [wxMaxima: input   end   ] */")))
-      {
-        if (line.Length() == 0)
-          line += wxmLines->Item(0);
-        else
-          line += wxT("\n") + wxmLines->Item(0);
-
-        wxmLines->RemoveAt(0);
-      }
-
-      cell = new GroupCell(GC_TYPE_CODE, line);
-      if (hide) {
-        cell->Hide(true);
-        hide = false;
-      }
+      cell = new GroupCell(GC_TYPE_PAGEBREAK);
     }
 
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: page break    ] */"))
+    else if (marker == wxT("/* [wxMaxima: fold    start ] */"))
     {
-      wxmLines->RemoveAt(0);
+      line++;
 
-      cell = new GroupCell(GC_TYPE_PAGEBREAK);
+      // Folded cells that have no cell they can be hidden in are added as
+      // ordinary cells instead.
+      GroupCell *folded = CreateTreeFromWXMCode(wxmLines, line);
+      if ((folded != NULL) && ((last == NULL) || (!last->HideTree(folded))))
+        cell = folded;
     }
 
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: fold    start ] */"))
+    else if (marker == wxT("/* [wxMaxima: fold    end   ] */"))
     {
-      wxmLines->RemoveAt(0);
+      line++;
 
-      last->HideTree(CreateTreeFromWXMCode(wxmLines));
+      break;
     }
 
-    else if (wxmLines->Item(0) == wxT("/* [wxMaxima: fold    end   ] */"))
+    else
     {
-      wxmLines->RemoveAt(0);
+      for (size_t i = 0; i < sizeof(wxmCellMarkers) / sizeof(wxmCellMarkers[0]); i++)
+      {
+        if (marker != wxmCellMarkers[i].start)
+          continue;
+
+        // Collect the contents of the cell. Leaves line at the end marker.
+        line++;
+        size_t first = line;
+        size_t length = 0;
+        while ((line < lines) && (wxmLines[line] != wxmCellMarkers[i].end))
+        {
+          length += wxmLines[line].Length() + 1;
+          line++;
+        }
 
-      break;
+        wxString contents;
+        contents.Alloc(length);
+        // Like in all earlier versions leading empty lines are dropped.
+        for (size_t j = first; j < line; j++)
+        {
+          if (!contents.IsEmpty())
+            contents += wxT('\n');
+          contents += wxmLines[j];
+        }
+
+        cell = new GroupCell(wxmCellMarkers[i].type, contents);
+        if (hide) {
+          cell->Hide(true);
+          hide = false;
+        }
+        break;
+      }
     }
 
     if (cell) { // if we have created a cell in this pass
@@ -4111,11 +4449,16 @@ GroupCell* MathCtrl::CreateTreeFromWXMCode(wxArrayString *wxmLines)
         last = (GroupCell *)last->m_next;
 
       }
+      // cell may be a list of cells that have been unfolded.
+      while (last->m_next != NULL)
+        last = (GroupCell *)last->m_next;
       cell = NULL;
     }
 
-    if (!wxmLines->IsEmpty())
-      wxmLines->RemoveAt(0);
+    // Skip the end marker of the cell or the line that follows a marker
+    // without contents.
+    if (line < lines)
+      line++;
   }
   
   return tree;
@@ -4135,8 +4478,11 @@ bool MathCtrl::ExportToTeX(wxString file) {
   wxFileOutputStream outfile(file);
   if (!outfile.IsOk())
     return false;
-    
-  wxTextOutputStream output(outfile);
+
+  // Every cell is written as soon as it has been converted => The document
+  // never is held in memory as a whole.
+  wxBufferedOutputStream bufferedOutfile(outfile);
+  wxTextOutputStream output(bufferedOutfile);
 
   // Show a busy cursor as long as we export.
   wxBusyCursor crs;
@@ -4220,22 +4566,26 @@ bool MathCtrl::ExportToTeX(wxString file) {
   //
   // Write contents
   //
+  // The images are written by a WorkerPool while we continue converting
+  // cells. Images that are still up to date from the last export aren't
+  // written again.
+  ExportImageCache imageCache(imgDir);
   while (tmp != NULL) {
-    wxString s = tmp->ToTeX(imgDir, filename, &imgCounter);
-    output<<s<<wxT("\n");
+    output<<tmp->ToTeX(imgDir, filename, &imgCounter, &imageCache)<<wxT("\n");
     tmp = dynamic_cast<GroupCell*>(tmp->m_next);
   }
+  bool imagesOK = !wxDirExists(imgDir) || imageCache.Finish();
   
   //
   // Close document
   //
   output<<wxT("\\end{document}\n");
   
-
+  bufferedOutfile.Sync();
   bool done = !outfile.GetFile()->Error();
   outfile.Close();
   
-  return done;
+  return done && imagesOK;
 }
 
 wxString MathCtrl::UnicodeToMaxima(wxString s)
@@ -4464,12 +4814,75 @@ bool MathCtrl::ExportToMAC(wxString file)
   return true;
 }
 
-wxString ConvertToUnicode(wxString str)
+void MathCtrl::WXMXContent(XMLWriter &out)
 {
-#ifndef wxUSE_UNICODE
-  str=str.wc_str(*wxConvCurrent), wxConvUTF8;
-#endif
-  return str;
+  // **************************************************************************
+  // Find out the number of the cell the cursor is at and save this information
+  // if we find it
+
+  // Determine which cell the cursor is at.
+  long ActiveCellNumber = 1;
+  GroupCell *cursorCell = NULL;
+  if(m_hCaretActive)
+  {
+    cursorCell = GetHCaret();
+
+    // If the cursor is before the 1st cell in the worksheet the cell number
+    // is 0.
+    if(!cursorCell)
+      ActiveCellNumber = 0;
+  }
+  else
+  {
+    if(GetActiveCell())
+      cursorCell = dynamic_cast<GroupCell*>(GetActiveCell()->GetParent());
+  }
+
+  if(cursorCell == NULL)
+    ActiveCellNumber = 0;
+  // We want to save the information that the cursor is in the nth cell.
+  // Count the cells until then.
+  GroupCell *tmp = GetTree();
+  if(tmp == NULL)
+    ActiveCellNumber = -1;
+  if(ActiveCellNumber > 0)
+  {
+    while((tmp)&&(tmp != cursorCell))
+    {
+      tmp=dynamic_cast<GroupCell*>(tmp->m_next);
+      ActiveCellNumber++;
+    }
+  }
+  // Paranoia: What happens if we didn't find the cursor?
+  if(tmp == NULL) ActiveCellNumber = -1;
+
+  WXMXContent(out, m_tree, m_zoomFactor, ActiveCellNumber);
+}
+
+void MathCtrl::WXMXContent(XMLWriter &out, GroupCell *tree, double zoomFactor, long activeCell)
+{
+  out << wxT("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  out << wxT("\n<!--   Created by wxMaxima ") << wxT(VERSION) << wxT("   -->");
+  out << wxT("\n<!--http://wxmaxima.sourceforge.net-->\n");
+
+  // write document
+  out << wxString::Format(wxT("\n<wxMaximaDocument version=\"%i.%i\" zoom=\"%i\""),
+                          DOCUMENT_VERSION_MAJOR, DOCUMENT_VERSION_MINOR,
+                          int(100.0 * zoomFactor));
+
+  // If we know where the cursor was we save this piece of information.
+  // If not we omit it.
+  if(activeCell >= 0)
+    out << wxString::Format(wxT(" activecell=\"%li\""), activeCell);
+
+  out << wxT(">\n");
+
+  // Reset image counter
+  ImgCell::WXMXResetCounter();
+
+  if(tree)
+    tree->ListToXML(out);
+  out << wxT("\n</wxMaximaDocument>");
 }
 
 /*
@@ -4533,121 +4946,80 @@ bool MathCtrl::ExportToWXMX(wxString file,bool markAsSaved)
   // next zip entry is "content.xml", xml of m_tree
 
   zip.PutNextEntry(wxT("content.xml"));
-  output << wxT("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  output << wxT("\n<!--   Created by wxMaxima ") << wxT(VERSION) << wxT("   -->");
-  output << wxT("\n<!--http://wxmaxima.sourceforge.net-->\n");
-
-  // write document
-  output << wxT("\n<wxMaximaDocument version=\"");
-  output << DOCUMENT_VERSION_MAJOR << wxT(".");
-  output << DOCUMENT_VERSION_MINOR << wxT("\" zoom=\"");
-  output << int(100.0 * m_zoomFactor) << wxT("\"");
-
-  // **************************************************************************
-  // Find out the number of the cell the cursor is at and save this information
-  // if we find it
-
-  // Determine which cell the cursor is at.
-  long ActiveCellNumber = 1;
-  GroupCell *cursorCell = NULL;
-  if(m_hCaretActive)
+  // Stream the worksheet cell by cell instead of assembling the xml of the
+  // whole document first.
   {
-    cursorCell = GetHCaret();
-
-    // If the cursor is before the 1st cell in the worksheet the cell number
-    // is 0.
-    if(!cursorCell)
-      ActiveCellNumber = 0;
-  }
-  else
-  {
-    if(GetActiveCell())
-      cursorCell = dynamic_cast<GroupCell*>(GetActiveCell()->GetParent());
-  }
-
-  if(cursorCell == NULL)
-    ActiveCellNumber = 0;
-  // We want to save the information that the cursor is in the nth cell.
-  // Count the cells until then.
-  GroupCell *tmp = GetTree();
-  if(tmp == NULL)
-    ActiveCellNumber = -1;
-  if(ActiveCellNumber > 0)
-  {
-    while((tmp)&&(tmp != cursorCell))
-    {
-      tmp=dynamic_cast<GroupCell*>(tmp->m_next);
-      ActiveCellNumber++;
-    }
+    XMLWriter xmlWriter(zip);
+    WXMXContent(xmlWriter);
+    if(!xmlWriter.Flush())
+      return false;
   }
-  // Paranoia: What happens if we didn't find the cursor?
-  if(tmp == NULL) ActiveCellNumber = -1;
-
-  // If we know where the cursor was we save this piece of information.
-  // If not we omit it.
-  if(ActiveCellNumber >= 0)
-    output << wxString::Format(wxT(" activecell=\"%li\""),ActiveCellNumber);
 
-  output << ">\n";
+  wxConfig::Get()->Read(wxT("OptimizeForVersionControl"), &VcFriendlyWXMX);
+  int level = VcFriendlyWXMX ? 0 : 9;
 
-  // Reset image counter
-  ImgCell::WXMXResetCounter();
+  // The remaining entries are deflated in parallel, if they are compressed.
+  WXMXEntries entries;
 
-  wxString xmlText;
-  if(m_tree)
-    xmlText = ConvertToUnicode(m_tree->ListToXML());
-  size_t xmlLen = xmlText.Length();
-  
-  // Delete all but one control character from the string: there should be
-  // no way for them to enter this string, anyway. But sometimes they still
-  // do...
-  for(size_t index = 0;index<xmlLen;index++)
+  // The sizes of all cells allow to display the file without measuring every
+  // single cell first the next time it is opened.
+  bool layoutCache = true;
+  wxConfig::Get()->Read(wxT("layoutCache"), &layoutCache);
+  if(layoutCache)
   {
-    wxChar c=xmlText[index];
-
-    if(( c <  wxT('\t')) ||
-       ((c >  wxT('\n')) &&(c < wxT(' '))) ||
-       ( c == wxChar((char)0x7F))
-      )
-    {
-      xmlText[index] = wxT(' '); 
-    }   
+    wxCharBuffer xml = LayoutCacheXML().utf8_str();
+    entries.Add(wxT("layoutcache.xml"), xml.data(), xml.length());
   }
   
-  if(m_tree!=NULL)output << xmlText;
-  output << wxT("\n</wxMaximaDocument>");
-
-  wxConfig::Get()->Read(wxT("OptimizeForVersionControl"), &VcFriendlyWXMX);
-  if(!VcFriendlyWXMX)
-    zip.SetLevel(9);
-  
   // save images from memory to zip file
   wxFileSystem *fsystem = new wxFileSystem();
   fsystem->AddHandler(new wxMemoryFSHandler);
   fsystem->ChangePathTo(wxT("memory:"), true);
 
-  for (int i = 1; i<=ImgCell::WXMXImageCount(); i++)
+  // Images that haven't changed since the last save can be copied from the
+  // file we are about to overwrite without compressing them again.
+  bool entriesOk = true;
   {
-    wxString name = wxT("image");
-    name << i << wxT(".*");
-    name = fsystem->FindFirst(name);
+    WXMXOldEntries oldEntries(file);
+
+    for (int i = 1; i<=ImgCell::WXMXImageCount(); i++)
+    {
+      wxString name = wxT("image");
+      name << i << wxT(".*");
+      name = fsystem->FindFirst(name);
     
-    wxFSFile *fsfile = fsystem->OpenFile(name);
+      wxFSFile *fsfile = fsystem->OpenFile(name);
 
-    name = name.Right(name.Length() - 7);
-    if (fsfile) {
-      zip.PutNextEntry(name);
-      wxInputStream *imagefile = fsfile->GetStream();
-      
-      while (!(imagefile->Eof()))
-        imagefile->Read(zip);
+      name = name.Right(name.Length() - 7);
+      if (fsfile) {
+        wxInputStream *imagefile = fsfile->GetStream();
+        if(entriesOk)
+        {
+          std::vector<char> data(imagefile->GetSize());
+          if(!data.empty())
+            imagefile->Read(&data[0], data.size());
+          wxUint32 crc = 0;
+          bool hasCrc = ImgCell::WXMXImageCRC(name, crc);
+          entries.Add(name, data.empty() ? NULL : &data[0], imagefile->LastRead(),
+                      hasCrc, crc);
+        }
+
+        delete imagefile;
+        wxMemoryFSHandler::RemoveFile(name);
 
-      delete imagefile;
-      wxMemoryFSHandler::RemoveFile(name);
+        // Only a few images are held in memory at a time.
+        if(entries.IsFull())
+          entriesOk = entries.WriteTo(zip, level, &oldEntries);
+      }
     }
+
+    if(entriesOk)
+      entriesOk = entries.WriteTo(zip, level, &oldEntries);
   }
 
   delete fsystem;
+  if(!entriesOk)
+    return false;
 
   if(!zip.Close())
     return false;
@@ -4655,24 +5027,47 @@ bool MathCtrl::ExportToWXMX(wxString file,bool markAsSaved)
     return false;
   
   // Now that all data is save we can overwrite the actual save file.
-  if(!wxRenameFile(backupfile,file,true))
-  {
-    // We might have failed to move the file because an over-eager virus scanner wants to
-    // scan it and a design decision of a filesystem driver might hinder us from moving
-    // it during this action => Wait for a second and retry.
-    wxSleep(1);
-    if(!wxRenameFile(backupfile,file,true))
-    {
-      wxSleep(1);
-      if(!wxRenameFile(backupfile,file,true))
-        return false;
-    }
-  }
+  if(!WXMXSnapshot::MoveIntoPlace(backupfile,file))
+    return false;
   if(markAsSaved)
     m_saved = true;
   return true;
 }
 
+WXMXSnapshot *MathCtrl::SnapshotWXMX(wxString file, wxEvtHandler *notify, int notifyId)
+{
+  WXMXSnapshot *snapshot = new WXMXSnapshot(file, notify, notifyId);
+
+  {
+    wxMemoryOutputStream content;
+    XMLWriter xmlWriter(content);
+    WXMXContent(xmlWriter);
+    xmlWriter.Flush();
+    wxStreamBuffer *buffer = content.GetOutputStreamBuffer();
+    snapshot->m_content.assign((const char *) buffer->GetBufferStart(), content.GetSize());
+  }
+
+  bool VcFriendlyWXMX = true;
+  wxConfig::Get()->Read(wxT("OptimizeForVersionControl"), &VcFriendlyWXMX);
+  snapshot->m_compress = !VcFriendlyWXMX;
+
+  bool layoutCache = true;
+  wxConfig::Get()->Read(wxT("layoutCache"), &layoutCache);
+  if(layoutCache)
+  {
+    wxCharBuffer xml = LayoutCacheXML().utf8_str();
+    snapshot->m_layoutCache.assign(xml.data(), xml.length());
+  }
+
+  // Take the images WXMXContent() has put into the memory filesystem.
+  snapshot->TakeImages();
+
+  // From the user's point of view the document is saved now: Any change
+  // that happens from here on isn't part of the snapshot.
+  m_saved = true;
+  return snapshot;
+}
+
 /**!
  * CanEdit: we can edit the input if the we have the whole input in selection!
  */
@@ -4809,6 +5204,10 @@ void MathCtrl::AddDocumentToEvaluationQueue()
 
 void MathCtrl::AddToEvaluationQueue(GroupCell *cell)
 {
+  // Two maxima processes writing to the same cell would mix their output.
+  if(IsEvaluatedInParallel(cell))
+    return;
+
   // Gray out the output of the cell in order to mark it as "not current".
   if(cell->GetInput())
     cell->GetInput()->ContainsChanges(true);
@@ -4863,6 +5262,216 @@ void MathCtrl::AddSelectionToEvaluationQueue(GroupCell *start,GroupCell *end)
   SetHCaret(dynamic_cast<GroupCell*>(end));
 }
 
+//! Appends all code cells of the list starting with cell, including hidden ones, to cells
+static void CollectCodeCells(GroupCell *cell, std::vector<GroupCell *> &cells)
+{
+  while (cell != NULL)
+  {
+    if ((cell->GetGroupType() == GC_TYPE_CODE) && (cell->GetEditable() != NULL))
+      cells.push_back(cell);
+    CollectCodeCells(cell->GetHiddenTree(), cells);
+    cell = dynamic_cast<GroupCell*>(cell->m_next);
+  }
+}
+
+void MathCtrl::AddStaleToEvaluationQueue()
+{
+  std::vector<GroupCell *> cells;
+  CollectCodeCells(m_tree, cells);
+
+  // The symbols the outdated cells above the current one define
+  std::set<wxString> changed;
+  GroupCell *last = NULL;
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    GroupCell *cell = cells[i];
+    CellSymbols symbols(cell->GetEditable()->GetValue());
+    if (cell->IsEvaluated(m_maximaSession) && !symbols.UsesAny(changed))
+      continue;
+
+    changed.insert(symbols.Defines().begin(), symbols.Defines().end());
+
+    // The cells that use a definition an edit has removed or renamed are outdated, too.
+    wxString evaluatedInput = cell->GetEvaluatedInput();
+    if (evaluatedInput != cell->GetEditable()->GetValue())
+    {
+      CellSymbols evaluatedSymbols(evaluatedInput);
+      changed.insert(evaluatedSymbols.Defines().begin(), evaluatedSymbols.Defines().end());
+    }
+
+    if ((cell != m_workingGroup) && !m_evaluationQueue->IsInQueue(cell))
+    {
+      AddToEvaluationQueue(cell);
+      last = cell;
+    }
+  }
+
+  FollowEvaluation(true);
+  if (last != NULL)
+    SetHCaret(last);
+}
+
+bool MathCtrl::ExportEvaluationStats(wxString file)
+{
+  wxFileOutputStream output(file);
+  if (!output.IsOk())
+    return false;
+  wxTextOutputStream text(output);
+
+  text << wxT("cell,input,latency_ms,bytes_received,cells_parsed,layout_ms\n");
+
+  std::vector<GroupCell *> cells;
+  CollectCodeCells(m_tree, cells);
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    EvaluationStats &stats = cells[i]->GetEvaluationStats();
+    if (stats.m_latency < 0)
+      continue;
+
+    wxString input = cells[i]->GetEditable()->GetValue();
+    input = input.BeforeFirst(wxT('\n'));
+    input.Trim();
+    input.Replace(wxT("\""), wxT("\"\""));
+    text << wxString::Format(wxT("%li,\""), (long) i + 1) << input <<
+      wxString::Format(wxT("\",%li,%li,%li,%li\n"), stats.m_latency, stats.m_bytes,
+                       stats.m_cells, stats.m_layoutTime);
+  }
+  text.Flush();
+  output.Close();
+  return output.IsOk();
+}
+
+void MathCtrl::ShowEvaluationStats(bool show)
+{
+  m_showEvaluationStats = show;
+  wxConfig::Get()->Write(wxT("showEvaluationStats"), m_showEvaluationStats);
+  Refresh();
+}
+
+void MathCtrl::EvaluateSectionsInParallel(wxString file)
+{
+  GroupCell *start = m_tree;
+  GroupCell *end = NULL;
+  if(CellsSelected() && (m_selectionStart->GetType() == MC_TYPE_GROUP))
+  {
+    start = StartOfSectioningUnit(dynamic_cast<GroupCell*>(m_selectionStart));
+    end = dynamic_cast<GroupCell*>(m_selectionEnd);
+  }
+
+  // Split the region into sections
+  std::vector<std::vector<GroupCell *> > sections;
+  bool endReached = false;
+  for(GroupCell *tmp = start; tmp != NULL; tmp = dynamic_cast<GroupCell*>(tmp->m_next))
+  {
+    int type = tmp->GetGroupType();
+    if(sections.empty() || (type == GC_TYPE_TITLE) || (type == GC_TYPE_SECTION))
+    {
+      // The section the last selected cell belongs to ends here.
+      if(endReached)
+        break;
+      sections.push_back(std::vector<GroupCell *>());
+    }
+
+    if((type == GC_TYPE_CODE) && (tmp->GetEditable() != NULL) && (tmp != m_workingGroup) &&
+       !m_evaluationQueue->IsInQueue(tmp) && !IsEvaluatedInParallel(tmp))
+      sections.back().push_back(tmp);
+
+    if(tmp == end)
+      endReached = true;
+  }
+
+  for(size_t i = 0; i < sections.size(); i++)
+  {
+    if(sections[i].empty())
+      continue;
+
+    MaximaKernel *kernel = new MaximaKernel(file, this, PARALLEL_KERNEL_ID, true, ++m_lastSession);
+    for(size_t j = 0; j < sections[i].size(); j++)
+    {
+      // Gray out the output of the cell in order to mark it as "not current".
+      if(sections[i][j]->GetInput())
+        sections[i][j]->GetInput()->ContainsChanges(true);
+      kernel->AddToQueue(sections[i][j]);
+    }
+    m_kernels.push_back(kernel);
+  }
+
+  StartParallelKernels();
+  Refresh();
+}
+
+void MathCtrl::StartParallelKernels()
+{
+  long maxKernels = wxThread::GetCPUCount();
+  wxConfig::Get()->Read(wxT("parallelKernels"), &maxKernels);
+  if(maxKernels < 1)
+    maxKernels = 1;
+
+  long running = 0;
+  for(size_t i = 0; i < m_kernels.size(); i++)
+    if(m_kernels[i]->IsStarted() && !m_kernels[i]->IsFinished())
+      running++;
+
+  // Start() may finish a kernel at once => Count it as running until its
+  // notification has arrived.
+  for(size_t i = 0; (i < m_kernels.size()) && (running < maxKernels); i++)
+  {
+    if(m_kernels[i]->IsStarted())
+      continue;
+    m_kernels[i]->Start();
+    running++;
+  }
+}
+
+bool MathCtrl::IsEvaluatedInParallel(GroupCell *cell)
+{
+  for(size_t i = 0; i < m_kernels.size(); i++)
+    if(m_kernels[i]->IsBusyWith(cell))
+      return true;
+  return false;
+}
+
+void MathCtrl::StopParallelEvaluation()
+{
+  for(size_t i = 0; i < m_kernels.size(); i++)
+    delete m_kernels[i];
+  m_kernels.clear();
+}
+
+void MathCtrl::OnKernelEvent(wxThreadEvent& event)
+{
+  // The kernel may have been stopped and deleted while the event was waiting
+  // to be processed => Don't look at the object before we know it still exists.
+  wxObject *sender = event.GetEventObject();
+  std::vector<MaximaKernel *>::iterator it = m_kernels.begin();
+  while((it != m_kernels.end()) && (static_cast<wxObject *>(*it) != sender))
+    ++it;
+  if(it == m_kernels.end())
+    return;
+  MaximaKernel *kernel = *it;
+
+  std::vector<GroupCell *> cells = kernel->TakeChangedCells();
+  if(!cells.empty())
+  {
+    m_saved = false;
+    wxClientDC dc(this);
+    CellParser parser(dc);
+    parser.SetZoomFactor(m_zoomFactor);
+    parser.SetClientWidth(GetClientSize().GetWidth() - MC_GROUP_LEFT_INDENT - MC_BASE_INDENT);
+    for(size_t i = 0; i < cells.size(); i++)
+      cells[i]->RecalculateAppended(parser);
+    Recalculate();
+  }
+
+  if((event.GetInt() == MaximaKernel::KERNEL_FINISHED) && kernel->IsFinished())
+  {
+    m_kernels.erase(it);
+    delete kernel;
+    StartParallelKernels();
+  }
+  Refresh();
+}
+
 void MathCtrl::AddDocumentTillHereToEvaluationQueue()
 {
   FollowEvaluation(true);
@@ -5365,7 +5974,7 @@ void MathCtrl::PasteFromClipboard(bool primary)
           lines_array.Add(lines.GetNextToken());
 
         // Load the array like we would do with a .wxm file
-        GroupCell *contents = CreateTreeFromWXMCode(&lines_array);
+        GroupCell *contents = CreateTreeFromWXMCode(lines_array);
         
         // Add the result of the last operation to the worksheet.
         if(contents)
@@ -6328,6 +6937,8 @@ BEGIN_EVENT_TABLE(MathCtrl, wxScrolledCanvas)
   EVT_TIMER(TIMER_ID, MathCtrl::OnTimer)
   EVT_TIMER(CARET_TIMER_ID, MathCtrl::OnTimer)
   EVT_TIMER(ANIMATION_TIMER_ID, MathCtrl::OnTimer)
+  EVT_TIMER(OUTPUT_LAYOUT_TIMER_ID, MathCtrl::OnTimer)
+  EVT_THREAD(PARALLEL_KERNEL_ID, MathCtrl::OnKernelEvent)
   EVT_KEY_DOWN(MathCtrl::OnKeyDown)
   EVT_CHAR(MathCtrl::OnChar)
   EVT_ERASE_BACKGROUND(MathCtrl::OnEraseBackground)
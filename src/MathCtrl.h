@@ -28,6 +28,7 @@
 #include <wx/textfile.h>
 #include <wx/fdrepdlg.h>
 #include <list>
+#include <vector>
 
 #include "MathCell.h"
 #include "EditorCell.h"
@@ -37,6 +38,12 @@
 #include "AutocompletePopup.h"
 #include "Structure.h"
 #include "ToolBar.h"
+#include "WXMXSnapshot.h"
+
+//! The minimum time between two layouts of the output maxima sends [in milliseconds]
+#define OUTPUT_LAYOUT_INTERVAL 40
+
+class MaximaKernel;
 
 /*! The canvas that contains the spreadsheet the whole program is about.
 
@@ -51,6 +58,11 @@ private:
   size_t m_lastTop;
   //! The last ending for the area being drawn
   size_t m_lastBottom;
+  /*! Converts the wxm description that starts at wxmLines[line] into cells
+
+    Stops after a fold end marker. Advances line past everything it has read.
+   */
+  static GroupCell* CreateTreeFromWXMCode(const wxArrayString &wxmLines, size_t &line);
   /*! \defgroup UndoBufferFill
 
     These methods and classes contain the undo functionality for tree changes:
@@ -253,9 +265,13 @@ private:
   {
     TIMER_ID,
     CARET_TIMER_ID,
-    ANIMATION_TIMER_ID
+    ANIMATION_TIMER_ID,
+    OUTPUT_LAYOUT_TIMER_ID
   };
 
+  //! The id of the notifications the kernels of EvaluateSectionsInParallel() send
+  enum { PARALLEL_KERNEL_ID = 1 };
+
   //! Add a line to a file.
   void AddLineToFile(wxTextFile& output, wxString s, bool unicode = true);
   //! Copy the currently selected cells
@@ -275,6 +291,10 @@ private:
   void GetMaxPoint(int* width, int* height);
   //! Is executed if a timer associated with MathCtrl has expired.
   void OnTimer(wxTimerEvent& event);
+  //! Lays out the output a kernel of EvaluateSectionsInParallel() has appended
+  void OnKernelEvent(wxThreadEvent& event);
+  //! Starts as many kernels of EvaluateSectionsInParallel() as we may run at once
+  void StartParallelKernels();
   /*! Has the autosave interval expired?
   
     True means: A save will be issued after the user stops typing.
@@ -387,6 +407,27 @@ private:
   //! The list of tree that contains the document itself
   GroupCell *m_tree;
   GroupCell *m_last;
+  //! Is only the visible part of the worksheet laid out by Recalculate()?
+  bool m_progressiveLayout;
+  /*! The first cell progressive layout hasn't reached yet
+
+    NULL means: All cells have been laid out.
+   */
+  GroupCell *m_recalculateStart;
+  //! The cell progressive layout has to lay out together with the screen below it
+  GroupCell *m_progressiveTarget;
+  //! Has a forced recalculation been requested while progressive layout was active?
+  bool m_progressiveForce;
+  //! Has OnPaint() measured cells that had been laid out using their cached sizes?
+  bool m_recalculateScheduled;
+  //! The kernels EvaluateSectionsInParallel() has created that haven't finished yet
+  std::vector<MaximaKernel *> m_kernels;
+  //! The number of the maxima process the worksheet talks to, see MaximaStarted()
+  long m_maximaSession;
+  //! The number the last maxima process that has been started has got. Kernels count, too.
+  long m_lastSession;
+  //! Does the worksheet show how long the evaluation of each cell took?
+  bool m_showEvaluationStats;
   /*! The group cell maxima is currently working on.
 
     NULL means that maxima isn't currently evaluating a cell.
@@ -418,6 +459,12 @@ private:
    */
   bool m_editingEnabled;
   wxTimer m_timer, m_caretTimer, m_animationTimer;
+  //! Determines when the output InsertLine() has appended is laid out next
+  wxTimer m_outputLayoutTimer;
+  //! The cells InsertLine() has appended output to that hasn't been laid out yet
+  std::vector<GroupCell *> m_appendedGroups;
+  //! Appends a list of output cells to group without laying them out
+  void AppendLine(GroupCell *group, MathCell *newLine);
   //! True only when an animation is running
   bool m_animate;
   wxBitmap *m_memory;
@@ -436,7 +483,7 @@ public:
 
     \todo We perhaps could think of only doing this outside of strings.
    */
-  wxString UnicodeToMaxima(wxString s);
+  static wxString UnicodeToMaxima(wxString s);
   //! Unfold the cell that produced the error, if necessary and, if requested, scroll to it
   void ScrollToError();
   //! Get the last known GroupCell maxima was working on
@@ -505,6 +552,7 @@ public:
     popid_evaluate,
     popid_evaluate_section,
     popid_merge_cells,
+    popid_show_spilled_output,
     popid_insert_text,
     popid_insert_title,
     popid_insert_section,
@@ -525,7 +573,7 @@ public:
   //! Clear the whole worksheet
   void DestroyTree();
   //! Delete a  part of the worksheet that previously has been unlinked.
-  void DestroyTree(MathCell* tree);
+  static void DestroyTree(MathCell* tree);
   MathCell* CopyTree();
   /*! Insert group cells into the worksheet
 
@@ -554,12 +602,49 @@ public:
 
     If maxima isn't currently evaluating and therefore there is no working group
     the line is appended to m_last, instead.
+
+    The line isn't laid out at once: All lines that arrive within
+    OUTPUT_LAYOUT_INTERVAL are laid out and displayed together by
+    FlushOutputLayout().
+
+    \param group The cell to append to. NULL means: The working group.
   */
-  void InsertLine(MathCell *newLine, bool forceNewLine = false);
+  void InsertLine(MathCell *newLine, bool forceNewLine = false, GroupCell *group = NULL);
+  /*! Add a batch of lines to the output cell of the working group
+
+    \param lines The lists of cells to append. Each of them starts a new line.
+    \param group The cell to append to. NULL means: The working group.
+   */
+  void InsertLines(const std::vector<MathCell *> &lines, GroupCell *group = NULL);
+  //! Lays out and displays the output InsertLine() hasn't laid out yet
+  void FlushOutputLayout();
   void Recalculate(bool force = false);  
   void RecalculateForce() {
     Recalculate(true);
   }
+  /*! Enables or disables progressive layout
+
+    While progressive layout is enabled Recalculate() only lays out the cells
+    up to the end of the visible part of the worksheet or, if target isn't
+    NULL, up to one screen below target. The rest of the cells is laid out by
+    RecalculateStep() while wxMaxima is idle.
+
+    Disabling progressive layout lays out all cells that still need it.
+   */
+  void ProgressiveLayout(bool enable, GroupCell *target = NULL);
+  /*! Lays out the next few cells progressive layout hasn't reached yet.
+
+    Also moves the cells below the ones OnPaint() has measured for real to
+    their new positions.
+
+    \return true, if there are cells left that still need to be laid out.
+   */
+  bool RecalculateStep();
+  /*! Drops the cached sizes of the cells between top and bottom
+
+    \return true, if the worksheet needs to be recalculated.
+   */
+  bool DropVisibleCachedSizes(int top, int bottom);
   /*! Empties the current document
 
     Used before opening a new file or when the "new" button is pressed.
@@ -668,8 +753,55 @@ public:
                              worksheet's "modified" status.
   */
   bool ExportToWXMX(wxString file, bool markAsSaved = true);	
+  /*! Copies everything ExportToWXMX() would write into a snapshot
+
+    The snapshot can be written to file by a worker thread. Marks the
+    worksheet as saved: Writing the snapshot is expected to succeed.
+
+    \param file The file the snapshot will be written to
+    \param notify The event handler to notify once the file has been written
+    \param notifyId The id of the wxThreadEvent notify is sent
+   */
+  WXMXSnapshot *SnapshotWXMX(wxString file, wxEvtHandler *notify = NULL, int notifyId = wxID_ANY);
+  //! Writes content.xml to out
+  void WXMXContent(XMLWriter &out);
+  /*! Writes content.xml for the worksheet tree to out
+
+    Doesn't need a window => Can be used for worksheets that aren't displayed.
+
+    \param activeCell The number of the cell the cursor is in. -1 means: Unknown.
+   */
+  static void WXMXContent(XMLWriter &out, GroupCell *tree, double zoomFactor, long activeCell = -1);
+  /*! The layout cache ExportToWXMX() stores in the .wxmx file
+
+    Contains the size of every cell of the worksheet together with the zoom
+    factor, fonts and window width the sizes are valid for.
+   */
+  wxString LayoutCacheXML();
+  /*! Everything besides the cells themselves that affects exported bitmaps
+
+    \param scale The factor the bitmaps are scaled up by
+   */
+  wxString RenderSettings(int scale);
+  /*! Can a layout cache be used with the current fonts and window size?
+
+    \param root The root node of layoutcache.xml
+    \param zoomFactor The zoom factor the worksheet will be displayed with
+   */
+  bool LayoutCacheMatches(wxXmlNode *root, double zoomFactor);
   //! export to a LaTeX file
   bool ExportToTeX(wxString file);
+  /*! Export what the last evaluation of each code cell has cost to a .csv file
+
+    One line per code cell that has been evaluated: The cell's number, the
+    first line of its input, the milliseconds until maxima's last prompt,
+    the bytes maxima has sent, the number of output cells and the
+    milliseconds spent laying them out.
+   */
+  bool ExportEvaluationStats(wxString file);
+  //! Show how long the last evaluation of each code cell took?
+  void ShowEvaluationStats(bool show);
+  bool ShowEvaluationStats() { return m_showEvaluationStats; }
   /*! Convert the current selection to a string 
     \param lb
      - true:  Include linebreaks
@@ -795,6 +927,37 @@ public:
   void AddSelectionToEvaluationQueue(GroupCell *start,GroupCell *end);
   //! Schedule this cell for evaluation
   void AddCellToEvaluationQueue(GroupCell* gc);
+  /*! Schedule the cells whose results might be outdated for evaluation
+
+    A code cell is outdated if it hasn't been evaluated by the current maxima
+    process, if its input has been changed since, or if it uses a symbol an
+    outdated cell above it defines or has defined when it was evaluated last.
+    See CellSymbols for the limits of this analysis.
+   */
+  void AddStaleToEvaluationQueue();
+  //! Tells the worksheet that a new maxima process has been started
+  void MaximaStarted() { m_maximaSession = ++m_lastSession; }
+  //! Tells the worksheet that the input of cell has been sent to maxima
+  void CellEvaluated(GroupCell *cell, wxString input) { cell->SetEvaluated(m_maximaSession, input); }
+  /*! Evaluates independent sections at the same time
+
+    Every title and section of the selection, or of the whole worksheet if
+    nothing is selected, is evaluated by a maxima process of its own. The code
+    cells that precede the first title or section form a section, too. The
+    config entry "parallelKernels" limits the number of maxima processes that
+    run at the same time. The default is one per CPU.
+
+    Each of these processes starts from scratch: Sections that depend on
+    definitions from other sections cannot be evaluated this way.
+
+    \param file The file the worksheet has been saved to. maxima is told to
+           work in its directory.
+   */
+  void EvaluateSectionsInParallel(wxString file);
+  //! Is cell evaluated by a kernel EvaluateSectionsInParallel() has started?
+  bool IsEvaluatedInParallel(GroupCell *cell);
+  //! Stops all kernels EvaluateSectionsInParallel() has started
+  void StopParallelEvaluation();
   //! The list of cells that have to be evaluated
   EvaluationQueue* m_evaluationQueue;
   // methods for folding
@@ -853,8 +1016,12 @@ public:
     \retval true = maxima waits for the answer of a question.
   */
   bool QuestionPending(){return m_questionPrompt;}
-  //! Converts a wxm description into individual cells
-  GroupCell* CreateTreeFromWXMCode(wxArrayString *wxmLines);
+  /*! Converts a wxm description into individual cells
+
+    Reads the lines only once, so the time this takes grows linearly with the
+    size of the file.
+   */
+  static GroupCell* CreateTreeFromWXMCode(const wxArrayString &wxmLines);
 
     /*! Does maxima wait for the answer of a question?
 
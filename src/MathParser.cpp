@@ -72,8 +72,10 @@ wxXmlNode* MathParser::GetNextTag(wxXmlNode* node)
   return SkipWhitespaceNode(node);
 }
 
-MathParser::MathParser(wxString zipfile)
+MathParser::MathParser(wxString zipfile, WXMXLoader *loader)
 {
+  m_wxmxLoader = loader;
+  m_lazyOutput = false;
   m_ParserStyle = MC_TYPE_DEFAULT;
   m_FracStyle = FracCell::FC_NORMAL;
   m_highlight = false;
@@ -91,6 +93,18 @@ MathParser::~MathParser()
     delete m_fileSystem;
 }
 
+bool MathParser::ContainsImages(wxXmlNode* node)
+{
+  for (node = node->GetChildren(); node != NULL; node = node->GetNext())
+  {
+    if ((node->GetName() == wxT("img")) || (node->GetName() == wxT("slide")))
+      return true;
+    if (ContainsImages(node))
+      return true;
+  }
+  return false;
+}
+
 // ParseCellTag
 // This function is responsible for creating
 // a tree of groupcells when loading XML document.
@@ -109,6 +123,7 @@ MathCell* MathParser::ParseCellTag(wxXmlNode* node)
 
   if (type == wxT("code")) {
     group = new GroupCell(GC_TYPE_CODE);
+    bool hasOutput = false;
     wxXmlNode *children = node->GetChildren();
     children = SkipWhitespaceNode(children);
     while (children) {
@@ -119,8 +134,20 @@ MathCell* MathParser::ParseCellTag(wxXmlNode* node)
       }
       if (children->GetName() == wxT("output"))
       {
+        // Images are read from the .wxmx file => They cannot wait until the
+        // file might have been overwritten.
+        if (m_lazyOutput && !hasOutput && !ContainsImages(children))
+        {
+          wxXmlNode *next = GetNextTag(children);
+          node->RemoveChild(children);
+          group->SetLazyOutput(children);
+          hasOutput = true;
+          children = next;
+          continue;
+        }
         MathCell *tag = ParseTag(children->GetChildren());
         group->AppendOutput(tag);
+        hasOutput = true;
       }
       children = GetNextTag(children);
     }
@@ -996,8 +1023,14 @@ MathCell* MathParser::ParseTag(wxXmlNode* node, bool all)
 #endif
 
         ImgCell *tmp;
+        Image *image = NULL;
+
+        if (m_wxmxLoader)
+          image = m_wxmxLoader->GetImage(filename);
 
-        if (m_fileSystem) // loading from zip
+        if (image) // has already been read from the zip file
+          tmp = new ImgCell(image);
+        else if (m_fileSystem) // loading from zip
           tmp = new ImgCell(filename, false, m_fileSystem);
         else if (node->GetAttribute(wxT("del"), wxT("yes")) != wxT("no"))
           tmp = new ImgCell(filename, true, NULL);
@@ -1036,7 +1069,28 @@ MathCell* MathParser::ParseTag(wxXmlNode* node, bool all)
             images.Add(token);
           }
         }
-        tmp->LoadImages(images);
+
+        // Use the images the loader has read in advance - if it has read
+        // all of them.
+        vector<Image*> preloaded;
+        if (m_wxmxLoader)
+        {
+          for (size_t i = 0; i < images.GetCount(); i++)
+          {
+            Image *image = m_wxmxLoader->GetImage(images[i]);
+            if (image == NULL)
+              break;
+            preloaded.push_back(image);
+          }
+        }
+        if (preloaded.size() == images.GetCount())
+          tmp->LoadImages(preloaded);
+        else
+        {
+          for (size_t i = 0; i < preloaded.size(); i++)
+            wxDELETE(preloaded[i]);
+          tmp->LoadImages(images);
+        }
         if (cell == NULL)
           cell = tmp;
         else
@@ -34,6 +34,7 @@ The header file for the xml cell parser
 
 #include "MathCell.h"
 #include "TextCell.h"
+#include "WXMXLoader.h"
 
 /*! This class handles parsing the xml representation of a cell tree.
 
@@ -43,11 +44,24 @@ inside a wxmx file
 class MathParser
 {
 public:
-  MathParser(wxString zipfile = wxEmptyString);
+  /*! The constructor
+
+    \param zipfile The .wxmx file images are loaded from
+    \param loader  The loader that already has read the images from zipfile, or NULL
+   */
+  MathParser(wxString zipfile = wxEmptyString, WXMXLoader *loader = NULL);
   ~MathParser();
   MathCell* ParseLine(wxString s, int style = MC_TYPE_DEFAULT);
   MathCell* ParseTag(wxXmlNode* node, bool all = true);
+  /*! Keep the output of code cells as xml until it is needed
+
+    If this is enabled ParseTag() removes the &lt;output&gt; tags it hands
+    to the GroupCells from the xml tree it parses.
+   */
+  void SetLazyOutput(bool lazy) { m_lazyOutput = lazy; }
 private:
+  //! Does the xml tree below node contain an image?
+  bool ContainsImages(wxXmlNode* node);
   /*! Get the next xml tag
 
     wxXmlNode can operate in two modes:
@@ -103,6 +117,8 @@ private:
   int m_displayedDigits;
   bool m_highlight;
   wxFileSystem *m_fileSystem; // used for loading pictures in <img> and <slide>
+  WXMXLoader *m_wxmxLoader; // provides the pictures that have been read in advance
+  bool m_lazyOutput; // keep the output of code cells as xml
 };
 
 #endif // MATHPARSER_H
@@ -0,0 +1,608 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "MaximaKernel.h"
+#include "wxMaxima.h"
+#include "MathCtrl.h"
+#include "TextCell.h"
+
+#include <wx/config.h>
+#include <wx/filename.h>
+
+//! The markers maxima's prompts are enclosed in, see wxMaxima::SetupVariables()
+static const wxString promptPrefix = wxT("<PROMPT-P/>");
+static const wxString promptSuffix = wxT("<PROMPT-S/>");
+static const wxString symbolsPrefix = wxT("<wxxml-symbols>");
+static const wxString symbolsSuffix = wxT("</wxxml-symbols>");
+static const wxString firstPrompt = wxT("(%i1) ");
+//! The prompt gcl shows when an error drops maxima into the lisp debugger
+static const wxString lispError = wxT("dbl:MAXIMA>>");
+
+MaximaKernel::MaximaKernel(wxString file, wxEvtHandler *notify, int notifyId, bool notifyOutput,
+                           long session)
+{
+  m_file = file;
+  m_notify = notify;
+  m_notifyId = notifyId;
+  m_notifyOutput = notifyOutput;
+  m_session = session;
+  m_outputNotified = false;
+  m_started = false;
+  m_ok = false;
+  m_finished = false;
+  m_workingGroup = NULL;
+  m_server = NULL;
+  m_client = NULL;
+  m_process = NULL;
+  m_pid = -1;
+  m_processPid = -1;
+  m_port = 0;
+  m_first = true;
+  m_outputPromptRegEx.Compile(wxT("<lbl>.*</lbl>"));
+  m_errorMatcher.ReadConfig();
+  m_pollTimer.SetOwner(this, poll_timer_id);
+}
+
+MaximaKernel::~MaximaKernel()
+{
+  Abort();
+}
+
+void MaximaKernel::Start()
+{
+  m_started = true;
+
+  // There is nothing maxima could do for us.
+  if (m_queue.Empty())
+  {
+    Finish();
+    return;
+  }
+
+  if (!StartServer())
+    Fail(_("Starting the server failed"));
+  else if (!StartMaxima())
+    Fail(_("Starting Maxima failed"));
+}
+
+void MaximaKernel::Abort()
+{
+  m_finished = true;
+  StopMaxima();
+  m_queue.Clear();
+  m_workingGroup = NULL;
+  m_changedCells.clear();
+}
+
+std::vector<GroupCell *> MaximaKernel::TakeChangedCells()
+{
+  std::vector<GroupCell *> cells;
+  cells.swap(m_changedCells);
+  m_outputNotified = false;
+  return cells;
+}
+
+bool MaximaKernel::StartServer()
+{
+  wxIPV4address addr;
+
+#ifndef __WXMAC__
+  addr.LocalHost();
+#else
+  addr.AnyAddress();
+#endif
+
+  // Many runners may start at the same time => Let the system choose a port
+  // that is free instead of probing for one.
+  addr.Service(0);
+
+  m_server = new wxSocketServer(addr);
+  wxIPV4address local;
+  if ((!m_server->IsOk()) || (!m_server->GetLocal(local)))
+  {
+    m_server->Destroy();
+    m_server = NULL;
+    return false;
+  }
+  m_port = local.Service();
+
+  m_server->SetEventHandler(*this, socket_server_id);
+  m_server->SetNotify(wxSOCKET_CONNECTION_FLAG);
+  m_server->Notify(true);
+  return true;
+}
+
+bool MaximaKernel::StartMaxima()
+{
+  wxString command = wxMaxima::MaximaCommand(m_port);
+  if (command.IsEmpty())
+    return false;
+
+#if defined(__WXMSW__)
+  wxSetEnv(wxT("home"), wxGetHomeDir());
+  wxSetEnv(wxT("maxima_signals_thread"), wxT("1"));
+#endif
+
+  m_process = new wxProcess(this, maxima_process_id);
+  m_process->Redirect();
+  // A process group of its own allows StopMaxima() to kill the lisp maxima's
+  // script has started, too.
+  m_processPid = wxExecute(command, wxEXEC_ASYNC | wxEXEC_MAKE_GROUP_LEADER, m_process);
+  if (m_processPid <= 0)
+  {
+    delete m_process;
+    m_process = NULL;
+    return false;
+  }
+
+  // Nobody reads what maxima writes to stdout and stderr otherwise, and a
+  // full pipe would block maxima.
+  m_pollTimer.Start(1000);
+  return true;
+}
+
+void MaximaKernel::StopMaxima()
+{
+  m_pollTimer.Stop();
+
+  // The pid from maxima's banner is only known once maxima has connected,
+  // and only is known to be still in use while it stays connected.
+  if (m_client)
+  {
+    m_client->Notify(false);
+    if (m_pid > 0)
+      wxProcess::Kill(m_pid, wxSIGKILL);
+    m_client->Destroy();
+    m_client = NULL;
+  }
+  m_pid = -1;
+
+  // A detached process deletes itself as soon as maxima has terminated.
+  if (m_process)
+  {
+    if (m_processPid > 0)
+      wxProcess::Kill(m_processPid, wxSIGKILL, wxKILL_CHILDREN);
+    m_process->Detach();
+    m_process = NULL;
+  }
+  m_processPid = -1;
+
+  if (m_server)
+  {
+    m_server->Destroy();
+    m_server = NULL;
+  }
+}
+
+void MaximaKernel::DrainProcessOutput()
+{
+  if (m_process == NULL)
+    return;
+
+  while (m_process->IsInputAvailable())
+    m_process->GetInputStream()->GetC();
+  while (m_process->IsErrorAvailable())
+    m_process->GetErrorStream()->GetC();
+}
+
+void MaximaKernel::SendMaxima(wxString s)
+{
+  s = MathCtrl::UnicodeToMaxima(s);
+
+  if (s.StartsWith(wxT(":lisp ")) || s.StartsWith(wxT(":lisp\n")))
+    s.Replace(wxT("\n"), wxT(" "));
+
+  s.Trim(true);
+  s.Append(wxT("\n"));
+
+  if (m_client)
+  {
+#if wxUSE_UNICODE
+    wxCharBuffer buffer = s.utf8_str();
+    m_client->Write(buffer.data(), strlen(buffer.data()));
+#else
+    m_client->Write(s.c_str(), s.Length());
+#endif
+  }
+}
+
+void MaximaKernel::SetupVariables()
+{
+  wxArrayString commands = wxMaxima::SetupCommands(promptPrefix, promptSuffix);
+  for (size_t i = 0; i < commands.GetCount(); i++)
+    SendMaxima(commands[i]);
+
+  // Make file I/O relative to the worksheet, like wxMaxima::SetCWD() does.
+  // A worksheet that hasn't been saved yet doesn't have a directory.
+  bool wxcd = true;
+#if defined (__WXMSW__)
+  wxConfig::Get()->Read(wxT("wxcd"), &wxcd);
+#endif
+  if (wxcd && !m_file.IsEmpty())
+  {
+    wxFileName filename(m_file);
+    filename.MakeAbsolute();
+    wxString filenamestring = filename.GetFullPath();
+    wxString dirname = filename.GetPath();
+#if defined __WXMSW__
+    filenamestring.Replace(wxT("\\"), wxT("/"));
+    dirname.Replace(wxT("\\"), wxT("/"));
+#endif
+    SendMaxima(wxT(":lisp-quiet (setf $wxfilename \"") + filenamestring + wxT("\")"));
+    SendMaxima(wxT(":lisp-quiet (setf $wxdirname \"") + dirname + wxT("\")"));
+    SendMaxima(wxT(":lisp-quiet (wx-cd \"") + filenamestring + wxT("\")"));
+  }
+}
+
+void MaximaKernel::EvaluateNext()
+{
+  while (!m_finished)
+  {
+    GroupCell *cell = m_queue.GetCell();
+    if (cell == NULL)
+    {
+      Finish();
+      return;
+    }
+
+    if (m_queue.m_workingGroupChanged)
+    {
+      cell->RemoveOutput();
+      m_changedCells.push_back(cell);
+    }
+
+    wxString text = m_queue.GetCommand();
+    if ((text == wxEmptyString) || (text == wxT(";")) || (text == wxT("$")))
+    {
+      m_queue.RemoveFirst();
+      continue;
+    }
+
+    m_workingGroup = cell;
+    wxString parenthesisError = wxMaxima::GetUnmatchedParenthesisState(cell->GetEditable()->ToString());
+    if (parenthesisError != wxEmptyString)
+    {
+      AppendText(_("Refusing to send cell to maxima: ") + parenthesisError, MC_TYPE_ERROR);
+      Finish(_("Refusing to send cell to maxima: ") + parenthesisError);
+      return;
+    }
+
+    cell->GetPrompt()->SetValue(m_lastPrompt);
+    if (m_queue.m_workingGroupChanged)
+      cell->SetEvaluated(m_session, m_queue.GetInput());
+    SendMaxima(text);
+    return;
+  }
+}
+
+void MaximaKernel::ServerEvent(wxSocketEvent &event)
+{
+  if (event.GetSocketEvent() != wxSOCKET_CONNECTION)
+    return;
+
+  wxSocketBase *client = m_server->Accept(false);
+  if (client == NULL)
+    return;
+  if (m_client != NULL)
+  {
+    client->Destroy();
+    return;
+  }
+
+  m_client = client;
+  m_client->SetEventHandler(*this, socket_client_id);
+  m_client->SetNotify(wxSOCKET_INPUT_FLAG | wxSOCKET_LOST_FLAG);
+  m_client->Notify(true);
+  DrainProcessOutput();
+  SetupVariables();
+}
+
+void MaximaKernel::ClientEvent(wxSocketEvent &event)
+{
+  switch (event.GetSocketEvent())
+  {
+  case wxSOCKET_INPUT:
+  {
+    DrainProcessOutput();
+    if (m_client == NULL)
+      return;
+
+    char buffer[SOCKET_SIZE + 1];
+    m_client->Read(buffer, SOCKET_SIZE);
+    if (m_client->Error())
+      return;
+
+    int read = m_client->LastCount();
+    buffer[read] = 0;
+    // Convert early nulls to spaces, like wxMaxima::SanitizeSocketBuffer() does.
+    for (int i = 0; i < read; i++)
+      if (buffer[i] == 0)
+        buffer[i] = ' ';
+#if wxUSE_UNICODE
+    m_currentOutput += wxString(buffer, wxConvUTF8);
+#else
+    m_currentOutput += wxString(buffer, *wxConvCurrent);
+#endif
+    ReadOutput();
+    // One notification per chunk of data is enough for the owner to keep up.
+    if (m_notifyOutput && !m_finished && !m_changedCells.empty() && !m_outputNotified)
+    {
+      m_outputNotified = true;
+      Notify(KERNEL_OUTPUT);
+    }
+    break;
+  }
+
+  case wxSOCKET_LOST:
+    if (m_client == NULL)
+      return;
+    m_client->Destroy();
+    m_client = NULL;
+    Fail(_("Lost the connection to maxima"));
+    break;
+
+  default:
+    break;
+  }
+}
+
+void MaximaKernel::OnProcessEvent(wxProcessEvent &WXUNUSED(event))
+{
+  delete m_process;
+  m_process = NULL;
+  Fail(_("Maxima has terminated"));
+}
+
+void MaximaKernel::OnPollTimer(wxTimerEvent &WXUNUSED(event))
+{
+  DrainProcessOutput();
+}
+
+void MaximaKernel::ReadOutput()
+{
+  // The first prompt tells us maxima's process id. Everything before it is
+  // maxima's banner.
+  if (m_first)
+  {
+    int end = m_currentOutput.Find(firstPrompt);
+    if (end == wxNOT_FOUND)
+      return;
+
+    int start = m_currentOutput.Find(wxT("pid="));
+    if (start != wxNOT_FOUND)
+    {
+      start += 4;
+      int newline = m_currentOutput.find(wxT('\n'), start);
+      if (newline != wxNOT_FOUND)
+        m_currentOutput.SubString(start, newline - 1).ToLong(&m_pid);
+    }
+
+    m_first = false;
+    m_currentOutput = wxEmptyString;
+    m_lastPrompt = firstPrompt;
+    EvaluateNext();
+    return;
+  }
+
+  const wxString markers[] = {wxT("<mth>"), promptPrefix, promptSuffix, symbolsPrefix, lispError};
+  wxString &data = m_currentOutput;
+  while ((!data.IsEmpty()) && (!m_finished))
+  {
+    // Autocompletion symbols are of no use without a worksheet the user
+    // edits.
+    if (data.StartsWith(symbolsPrefix))
+    {
+      int end = data.Find(symbolsSuffix);
+      if (end == wxNOT_FOUND)
+        return;
+      data = data.Mid(end + symbolsSuffix.Length());
+      continue;
+    }
+
+    if (data.StartsWith(wxT("<mth>")))
+    {
+      int end = data.Find(wxT("</mth>"));
+      if (end == wxNOT_FOUND)
+        return;
+      AppendMath(data.Left(end + 6));
+      data = data.Mid(end + 6);
+      continue;
+    }
+
+    if (data.StartsWith(promptPrefix))
+    {
+      int end = data.Find(promptSuffix);
+      if (end == wxNOT_FOUND)
+        return;
+      wxString prompt = data.SubString(promptPrefix.Length(), end - 1);
+      data = data.Mid(end + promptSuffix.Length());
+      ReadPrompt(prompt);
+      continue;
+    }
+
+    // Everything else is text that ends at the next newline or tag.
+    int end = data.Find(wxT('\n'));
+    if (end != wxNOT_FOUND)
+      end++;
+    int marker = -1;
+    for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); i++)
+    {
+      int pos = data.Find(markers[i]);
+      if ((pos != wxNOT_FOUND) && ((end == wxNOT_FOUND) || (pos < end)))
+      {
+        end = pos;
+        marker = i;
+      }
+    }
+
+    // Wait for the rest of the line.
+    if (end == wxNOT_FOUND)
+      return;
+
+    // The text that precedes a prompt whose prefix has been lost is the prompt.
+    if ((marker >= 0) && (markers[marker] == promptSuffix))
+    {
+      wxString prompt = data.Left(end);
+      data = data.Mid(end + promptSuffix.Length());
+      if (!prompt.IsEmpty())
+        ReadPrompt(prompt);
+      continue;
+    }
+
+    if ((end == 0) && (marker >= 0) && (markers[marker] == lispError))
+    {
+      AppendText(lispError, MC_TYPE_ERROR);
+      Finish(_("Maxima has entered the lisp debugger"));
+      return;
+    }
+
+    wxString line = data.Left(end);
+    data = data.Mid(end);
+
+    wxString trimmedLine = line;
+    trimmedLine.Trim(true);
+    trimmedLine.Trim(false);
+    if (trimmedLine.IsEmpty())
+      continue;
+
+    if (m_errorMatcher.Matches(line))
+    {
+      AppendText(line, MC_TYPE_ERROR);
+      Finish(trimmedLine);
+      return;
+    }
+    AppendText(line, MC_TYPE_DEFAULT);
+  }
+}
+
+void MaximaKernel::ReadPrompt(wxString prompt)
+{
+  // Input prompts begin with (%i. Question prompts don't.
+  if (prompt.StartsWith(wxT("(%i")))
+  {
+    m_lastPrompt = prompt;
+    m_queue.RemoveFirst();
+    EvaluateNext();
+    return;
+  }
+
+  // Nobody is there to answer a question.
+  if (prompt.Find(wxT("<mth>")) != wxNOT_FOUND)
+    AppendMath(prompt, MC_TYPE_PROMPT);
+  else
+    AppendText(prompt, MC_TYPE_PROMPT);
+  Finish(_("Maxima has asked a question"));
+}
+
+void MaximaKernel::Append(MathCell *cell, bool newLine)
+{
+  // Output that doesn't belong to a cell of the worksheet is dropped.
+  if (m_workingGroup == NULL)
+  {
+    MathCtrl::DestroyTree(cell);
+    return;
+  }
+
+  cell->ForceBreakLine(newLine);
+  cell->SetParentList(m_workingGroup);
+  m_workingGroup->AppendOutput(cell);
+  if (m_changedCells.empty() || (m_changedCells.back() != m_workingGroup))
+    m_changedCells.push_back(m_workingGroup);
+}
+
+void MaximaKernel::AppendMath(wxString xml, int type)
+{
+  // Show the label the user has assigned instead of maxima's %o label, like
+  // wxMaxima::ReadMath() does.
+  bool showUserDefinedLabels = true;
+  wxConfig::Get()->Read(wxT("showUserDefinedLabels"), &showUserDefinedLabels);
+  if (showUserDefinedLabels && (m_queue.GetUserLabel() != wxEmptyString))
+    m_outputPromptRegEx.Replace(&xml, wxT("<lbl userdefined=\"yes\">(") +
+                                m_queue.GetUserLabel() + wxT(")</lbl>"), 1);
+
+  xml.Trim(true);
+  xml.Trim(false);
+  xml.Replace(wxT("\n"), wxT(" "), true);
+
+  MathCell *cell = m_parser.ParseLine(wxT("<span>") + xml + wxT("</span>"), type);
+  if (cell == NULL)
+    return;
+  cell->SetSkip(true);
+  Append(cell, (type == MC_TYPE_PROMPT) || cell->BreakLineHere());
+}
+
+void MaximaKernel::AppendText(wxString text, int type)
+{
+  text.Replace(promptSuffix, wxEmptyString);
+  text.Trim(true);
+  if (text.IsEmpty())
+    return;
+
+  TextCell *cell = new TextCell(text);
+  cell->SetType(type);
+  Append(cell, true);
+}
+
+void MaximaKernel::Fail(wxString error)
+{
+  if (m_finished)
+    return;
+
+  if (m_workingGroup == NULL)
+    m_workingGroup = m_queue.GetCell();
+  AppendText(error, MC_TYPE_ERROR);
+  Finish(error);
+}
+
+void MaximaKernel::Finish(wxString error)
+{
+  if (m_finished)
+    return;
+  m_finished = true;
+  m_error = error;
+  m_ok = m_error.IsEmpty();
+
+  // The cell the kernel has failed on hasn't been evaluated.
+  if ((!m_ok) && (m_workingGroup != NULL))
+    m_workingGroup->ResetEvaluated();
+
+  StopMaxima();
+  m_queue.Clear();
+  m_workingGroup = NULL;
+
+  if (m_notifyOutput && !m_changedCells.empty() && !m_outputNotified)
+    Notify(KERNEL_OUTPUT);
+  Notify(KERNEL_FINISHED);
+}
+
+void MaximaKernel::Notify(NotificationType type)
+{
+  wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD, m_notifyId);
+  event->SetEventObject(this);
+  event->SetInt(type);
+  wxQueueEvent(m_notify, event);
+}
+
+BEGIN_EVENT_TABLE(MaximaKernel, wxEvtHandler)
+  EVT_SOCKET(socket_server_id, MaximaKernel::ServerEvent)
+  EVT_SOCKET(socket_client_id, MaximaKernel::ClientEvent)
+  EVT_END_PROCESS(maxima_process_id, MaximaKernel::OnProcessEvent)
+  EVT_TIMER(poll_timer_id, MaximaKernel::OnPollTimer)
+END_EVENT_TABLE()
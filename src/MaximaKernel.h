@@ -0,0 +1,188 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  A maxima process that evaluates cells of a worksheet on its own.
+ */
+
+#ifndef MAXIMAKERNEL_H
+#define MAXIMAKERNEL_H
+
+#include <wx/wx.h>
+#include <wx/process.h>
+#include <wx/regex.h>
+#include <wx/socket.h>
+#include <wx/timer.h>
+
+#include <vector>
+
+#include "GroupCell.h"
+#include "EvaluationQueue.h"
+#include "MathParser.h"
+#include "ErrorMatcher.h"
+
+/*! A maxima process that evaluates a list of cells
+
+  The kernel starts its own maxima process, talks to it using the same socket
+  protocol the wxMaxima window uses and appends maxima's output to the cells
+  it evaluates. It never lays out the cells it appends output to: This is left
+  to the owner, which may not have a display at all.
+
+  The kernel stops at the first error and at the first question maxima asks:
+  There is nobody who could answer it.
+
+  The owner is sent a wxThreadEvent with the id notifyId and the kernel as its
+  event object. GetInt() tells which of the NotificationType the event is.
+ */
+class MaximaKernel : public wxEvtHandler
+{
+public:
+  enum NotificationType
+  {
+    //! Output has been appended to the cells TakeChangedCells() returns.
+    KERNEL_OUTPUT,
+    //! The kernel has finished. IsOk() tells if it has succeeded.
+    KERNEL_FINISHED
+  };
+
+  /*! The constructor
+
+    \param file The worksheet the cells belong to. maxima is told to work in
+           its directory.
+    \param notify The event handler that is sent the notifications
+    \param notifyId The id of the notifications
+    \param notifyOutput Send a KERNEL_OUTPUT notification every time output
+           has been appended?
+    \param session The number the cells the kernel evaluates are marked as
+           evaluated with, see GroupCell::SetEvaluated(). The kernel is a maxima
+           process of its own, so this must not be the number of the maxima
+           process of the worksheet.
+   */
+  MaximaKernel(wxString file, wxEvtHandler *notify, int notifyId, bool notifyOutput = false,
+               long session = -1);
+  ~MaximaKernel();
+  //! Adds a cell to the list of cells to evaluate. Is to be called before Start().
+  void AddToQueue(GroupCell *cell) { m_queue.AddToQueue(cell); }
+  //! Starts maxima. Sends the KERNEL_FINISHED notification on failure, too.
+  void Start();
+  //! Stops maxima without touching any cell again. Sends no notification.
+  void Abort();
+  //! Has Start() been called?
+  bool IsStarted() { return m_started; }
+  //! Has the kernel finished?
+  bool IsFinished() { return m_finished; }
+  //! Have all cells been evaluated without errors?
+  bool IsOk() { return m_ok; }
+  //! Why the kernel has stopped early
+  wxString GetError() { return m_error; }
+  //! Will the kernel still append output to cell?
+  bool IsBusyWith(GroupCell *cell)
+    {
+      return (!m_finished) && ((cell == m_workingGroup) || m_queue.IsInQueue(cell));
+    }
+  //! Returns the cells output has been appended to since the last call
+  std::vector<GroupCell *> TakeChangedCells();
+
+private:
+  enum
+  {
+    socket_server_id = 1,
+    socket_client_id,
+    maxima_process_id,
+    poll_timer_id
+  };
+
+  bool StartServer();
+  bool StartMaxima();
+  //! Kills maxima and closes the sockets
+  void StopMaxima();
+  //! Sends a command to maxima
+  void SendMaxima(wxString s);
+  //! Sends the commands the wxMaxima window sends on connecting
+  void SetupVariables();
+  //! Sends the next command from the evaluation queue or finishes
+  void EvaluateNext();
+  //! Handles everything m_currentOutput contains so far
+  void ReadOutput();
+  //! Handles a prompt maxima has sent
+  void ReadPrompt(wxString prompt);
+  //! Appends cell to the output of the cell maxima works on
+  void Append(MathCell *cell, bool newLine);
+  //! Appends the xml maxima has sent to the current cell
+  void AppendMath(wxString xml, int type = MC_TYPE_DEFAULT);
+  //! Appends a line of text maxima has sent to the current cell
+  void AppendText(wxString text, int type);
+  //! Shows error in the cell that is evaluated next and finishes
+  void Fail(wxString error);
+  //! Stops maxima and sends the KERNEL_FINISHED notification
+  void Finish(wxString error = wxEmptyString);
+  //! Sends a notification of the given type
+  void Notify(NotificationType type);
+  //! Reads and discards what maxima writes to stdout and stderr
+  void DrainProcessOutput();
+
+  void ServerEvent(wxSocketEvent &event);
+  void ClientEvent(wxSocketEvent &event);
+  void OnProcessEvent(wxProcessEvent &event);
+  void OnPollTimer(wxTimerEvent &event);
+
+  wxString m_file;
+  wxEvtHandler *m_notify;
+  int m_notifyId;
+  bool m_notifyOutput;
+  long m_session;
+  //! Has a KERNEL_OUTPUT notification been sent since the last TakeChangedCells()?
+  bool m_outputNotified;
+  bool m_started;
+  bool m_ok;
+  bool m_finished;
+  wxString m_error;
+
+  EvaluationQueue m_queue;
+  //! Recognizes the lines of maxima's output that are error messages
+  ErrorMatcher m_errorMatcher;
+  //! The cell maxima currently works on
+  GroupCell *m_workingGroup;
+  //! The cells output has been appended to since the last TakeChangedCells()
+  std::vector<GroupCell *> m_changedCells;
+  MathParser m_parser;
+  //! Searches for maxima's output prompts
+  wxRegEx m_outputPromptRegEx;
+
+  wxSocketServer *m_server;
+  wxSocketBase *m_client;
+  wxProcess *m_process;
+  //! The process id of the lisp, as maxima's banner tells it
+  long m_pid;
+  //! The process id wxExecute() has returned. May be the one of a script.
+  long m_processPid;
+  int m_port;
+  //! Have we already seen maxima's first prompt?
+  bool m_first;
+  //! The data from maxima that hasn't been handled yet
+  wxString m_currentOutput;
+  wxString m_lastPrompt;
+  //! Makes sure maxima's stdout and stderr are read
+  wxTimer m_pollTimer;
+
+  DECLARE_EVENT_TABLE()
+};
+
+#endif // MAXIMAKERNEL_H
@@ -21,11 +21,13 @@
 
 #include "SlideShowCell.h"
 #include "ImgCell.h"
+#include "AnimationEncoder.h"
 
 #include <wx/file.h>
 #include <wx/filename.h>
 #include <wx/filesys.h>
 #include <wx/fs_mem.h>
+#include <wx/wfstream.h>
 #include <wx/utils.h>
 #include <wx/clipbrd.h>
 #include <wx/config.h>
@@ -102,6 +104,14 @@ void SlideShow::LoadImages(wxArrayString images)
   m_displayed = 0;
 }
 
+void SlideShow::LoadImages(vector<Image*> images)
+{
+  m_images = images;
+  m_size = m_images.size();
+  m_fileSystem = NULL;
+  m_displayed = 0;
+}
+
 MathCell* SlideShow::Copy()
 {
   SlideShow* tmp = new SlideShow;
@@ -202,14 +212,7 @@ wxString SlideShow::ToXML()
   for (int i=0; i<m_size; i++) {
     wxString basename = ImgCell::WXMXGetNewFileName();
     // add the file to memory
-    if(m_images[i])
-    {
-      if(m_images[i]->GetCompressedImage())
-        wxMemoryFSHandler::AddFile(basename+m_images[i] -> GetExtension(),
-                                   m_images[i]->GetCompressedImage().GetData(),
-                                   m_images[i]->GetCompressedImage().GetDataLen()
-          );
-    }
+    ImgCell::WXMXAddImage(basename+m_images[i] -> GetExtension(), m_images[i]);
 
     images += basename + m_images[i] -> GetExtension()+wxT(";");
   }
@@ -227,59 +230,39 @@ wxSize SlideShow::ToImageFile(wxString file)
 
 wxSize SlideShow::ToGif(wxString file)
 {
-  wxArrayString which;
-  bool success = true;
-
-  wxString convert(wxT("convert -delay "+wxString::Format(wxT("%i"),100/GetFrameRate())));
-  wxString convertArgs;
-
-  wxString tmpdir = wxFileName::GetTempDir();
-
+  // All frames are centered on a canvas that is big enough for the
+  // biggest frame.
+  wxSize size(0,0);
   for (int i=0; i<m_size; i++)
   {
-    wxFileName imgname(tmpdir, wxString::Format(wxT("wxm_anim%d.png"), i));
-
-    wxImage image = m_images[i]->ToImageFile(imgname.GetFullPath());
-
-    convert << wxT(" \"") << imgname.GetFullPath() << wxT("\"");
+    if(m_images[i]->GetOriginalWidth() > size.x)
+      size.x = m_images[i]->GetOriginalWidth();
+    if(m_images[i]->GetOriginalHeight() > size.y)
+      size.y = m_images[i]->GetOriginalHeight();
   }
 
-  convert << wxT(" \"") << file << wxT("\"");
+  AnimationEncoder encoder(AnimationEncoder::FormatFromFileName(file),
+                           size.x, size.y, 1000 / GetFrameRate());
+  for (int i=0; i<m_size; i++)
+    encoder.AddFrame(m_images[i]->GetCompressedImage());
 
-#if defined __WXMSW__
-  if (!wxShell(convert))
-#else
-  if (wxExecute(convert, wxEXEC_SYNC) != 0)
-#endif
+  bool success = false;
   {
-    success = false;
-    wxMessageBox(_("There was an error during GIF export!\n\nMake sure ImageMagick is installed and wxMaxima can find the convert program."),
-        wxT("Error"), wxICON_ERROR);
+    wxFileOutputStream out(file);
+    if(out.IsOk())
+      success = encoder.Write(out) && out.Close();
   }
 
-  for (int i=0; i<m_size; i++)
+  if(!success)
   {
-    wxFileName imgname(tmpdir, wxString::Format(wxT("wxm_anim%d.png"), i));
-    wxRemoveFile(imgname.GetFullPath());
+    wxRemoveFile(file);
+    if(!encoder.IsCancelled())
+      wxMessageBox(_("There was an error during the export of the animation!"),
+                   wxT("Error"), wxICON_ERROR);
+    return wxSize(-1,-1);
   }
 
-  if(success)
-  {
-    if(m_size>0)
-      return wxSize(m_images[1]->GetOriginalWidth(),m_images[1]->GetOriginalHeight());
-    else
-    {
-      wxSize retval;
-      retval.x=retval.y=0;
-      return retval;
-    }
-  }
-  else
-  {
-    wxSize retval;
-    retval.x=retval.y=-1;
-    return retval;
-  }
+  return size;
 }
 
 void SlideShow::ClearCache()
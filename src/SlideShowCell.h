@@ -52,18 +52,29 @@ public:
   virtual void ClearCache();
   void Destroy();
   void LoadImages(wxArrayString images);
+  //! Takes over a list of images that have already been loaded
+  void LoadImages(vector<Image*> images);
   MathCell* Copy();
   void SelectInner(wxRect& rect, MathCell** first, MathCell** last)
   {
     *first = *last = this;
   }
   int GetDisplayedIndex() { return m_displayed; }
+  //! The CRC32 of the compressed data of frame n
+  wxUint32 GetFrameCRC(int n) { return m_images[n]->GetCompressedImageCRC(); }
+  //! The compressed data of frame n
+  wxMemoryBuffer GetFrameData(int n) { return m_images[n]->GetCompressedImage(); }
+  //! The file name extension that matches GetFrameData(n)
+  wxString GetFrameExtension(int n) { return m_images[n]->GetExtension(); }
   wxImage GetBitmap(int n) { return m_images[n]->GetUnscaledBitmap().ConvertToImage(); }
   void SetDisplayedIndex(int ind);
   int Length() { return m_size; }
   //! Exports the image the slideshow currently displays
   wxSize ToImageFile(wxString filename);
-  //! Exports the whole animation as animated gif
+  /*! Exports the whole animation as animated gif
+
+    If the file name ends in .png or .apng an animated png is generated instead.
+   */
   wxSize ToGif(wxString filename);
   bool CopyToClipboard();
   /*! Get the frame rate of this SlideShow [in Hz].
@@ -0,0 +1,180 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "WXMXLoader.h"
+
+#include <wx/file.h>
+#include <wx/filename.h>
+#include <wx/wfstream.h>
+#include <wx/mstream.h>
+#include <wx/zstream.h>
+#include <wx/zipstrm.h>
+
+WXMXLoader::WXMXLoader(wxString wxmxFile)
+{
+  m_wxmxFile = wxmxFile;
+}
+
+WXMXLoader::~WXMXLoader()
+{
+  // Make sure no worker accesses a job we are about to delete.
+  m_pool.Cancel();
+  m_pool.Wait();
+
+  for(std::map<wxString, ImageJob *>::iterator it = m_images.begin(); it != m_images.end(); ++it)
+    delete it->second;
+}
+
+bool WXMXLoader::Load(wxXmlDocument &xmldoc)
+{
+  wxFFileInputStream in(m_wxmxFile);
+  if(!in.IsOk())
+    return false;
+
+  // The input stream is seekable => GetNextEntry() reads the entries from the
+  // central directory without ever touching the data of the images.
+  wxZipInputStream zip(in);
+  wxZipEntry *content = NULL;
+  wxZipEntry *layoutCache = NULL;
+  wxZipEntry *entry;
+  while((entry = zip.GetNextEntry()) != NULL)
+  {
+    wxString name = entry->GetInternalName();
+    if(name == wxT("content.xml"))
+    {
+      wxDELETE(content);
+      content = entry;
+      continue;
+    }
+    if(name == wxT("layoutcache.xml"))
+    {
+      wxDELETE(layoutCache);
+      layoutCache = entry;
+      continue;
+    }
+
+    if((!entry->IsDir()) &&
+       (wxImage::FindHandler(wxFileName(name).GetExt().Lower(), wxBITMAP_TYPE_ANY) != NULL) &&
+       (m_images.find(name) == m_images.end()))
+    {
+      ImageJob *job = new ImageJob(m_wxmxFile, entry->GetOffset(), entry->GetCompressedSize(),
+                                   entry->GetSize(), entry->GetMethod());
+      m_images[name] = job;
+      m_pool.AddJob(job);
+    }
+    delete entry;
+  }
+
+  // Parse content.xml while the workers are busy decoding the images.
+  bool success = (content != NULL) && zip.OpenEntry(*content) &&
+    xmldoc.Load(zip, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES);
+  wxDELETE(content);
+
+  // The layout cache is optional => Failing to read it isn't an error.
+  if(success && (layoutCache != NULL) && zip.OpenEntry(*layoutCache))
+  {
+    if(!m_layoutCache.Load(zip, wxT("UTF-8")))
+      m_layoutCache = wxXmlDocument();
+  }
+  wxDELETE(layoutCache);
+
+  m_pool.Wait();
+  return success;
+}
+
+Image *WXMXLoader::GetImage(wxString name)
+{
+  std::map<wxString, ImageJob *>::iterator it = m_images.find(name);
+  if((it == m_images.end()) || (!it->second->m_ok))
+    return NULL;
+
+  ImageJob *job = it->second;
+  wxMemoryBuffer data;
+  if(job->m_data.size() > 0)
+    data.AppendData(&job->m_data[0], job->m_data.size());
+
+  Image *image = new Image();
+  image->LoadImage(data, wxFileName(name).GetExt(), job->m_imageSize);
+  return image;
+}
+
+WXMXLoader::ImageJob::ImageJob(wxString wxmxFile, wxFileOffset offset, wxFileOffset compressedSize,
+                               wxFileOffset size, int method)
+{
+  m_wxmxFile = ThreadSafeCopy(wxmxFile);
+  m_offset = offset;
+  m_compressedSize = compressedSize;
+  m_size = size;
+  m_method = method;
+  m_imageSize = wxDefaultSize;
+  m_ok = false;
+}
+
+void WXMXLoader::ImageJob::Run()
+{
+  wxFile file(m_wxmxFile);
+  if(!file.IsOpened())
+    return;
+
+  // Skip the local header whose file name and extra field lengths may
+  // differ from the ones in the central directory.
+  unsigned char header[30];
+  if((file.Seek(m_offset) == wxInvalidOffset) || (file.Read(header, 30) != 30))
+    return;
+  if((header[0] != 'P') || (header[1] != 'K') || (header[2] != 3) || (header[3] != 4))
+    return;
+  wxFileOffset dataStart = m_offset + 30 +
+    (header[26] | (header[27] << 8)) +
+    (header[28] | (header[29] << 8));
+
+  if((m_compressedSize <= 0) || (m_size <= 0))
+    return;
+
+  std::vector<unsigned char> compressed(m_compressedSize);
+  if((file.Seek(dataStart) == wxInvalidOffset) ||
+     (file.Read(&compressed[0], m_compressedSize) != m_compressedSize))
+    return;
+
+  if(m_method == wxZIP_METHOD_STORE)
+    m_data.swap(compressed);
+  else if(m_method == wxZIP_METHOD_DEFLATE)
+  {
+    wxMemoryInputStream rawStream(&compressed[0], compressed.size());
+    wxZlibInputStream inflater(rawStream, wxZLIB_NO_HEADER);
+    m_data.resize(m_size);
+    inflater.Read(&m_data[0], m_size);
+    if(inflater.LastRead() != (size_t) m_size)
+    {
+      m_data.clear();
+      return;
+    }
+  }
+  else
+    return;
+
+  // Decode the image once in order to learn its size. This is the part
+  // Image::LoadImage() would otherwise have to do in the GUI thread.
+  wxMemoryInputStream imageStream(&m_data[0], m_data.size());
+  wxImage image;
+  if(image.LoadFile(imageStream, wxBITMAP_TYPE_ANY))
+    m_imageSize = wxSize(image.GetWidth(), image.GetHeight());
+
+  m_ok = true;
+}
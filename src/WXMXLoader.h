@@ -0,0 +1,103 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  The loader that reads the contents of a .wxmx file in parallel.
+ */
+
+#ifndef WXMXLOADER_H
+#define WXMXLOADER_H
+
+#include <wx/wx.h>
+#include <wx/xml/xml.h>
+
+#include <map>
+#include <vector>
+
+#include "WorkerPool.h"
+#include "Image.h"
+
+/*! Reads a .wxmx file
+
+  Opening a .wxmx file via wxFileSystem means that the zip file's central
+  directory is read once for content.xml and once more for every single
+  image, and that the images are inflated and decoded one after another.
+
+  This class instead reads the central directory only once and hands every
+  image to a WorkerPool that reads, inflates and decodes it while the GUI
+  thread parses content.xml.
+ */
+class WXMXLoader
+{
+public:
+  WXMXLoader(wxString wxmxFile);
+  ~WXMXLoader();
+
+  /*! Loads content.xml and all images the file contains
+
+    Returns as soon as content.xml is parsed and all images have been decoded.
+    \return false, if content.xml could not be read.
+   */
+  bool Load(wxXmlDocument &xmldoc);
+
+  /*! Returns a new Image object for the image "name" from the .wxmx file
+
+    \return NULL, if the image hasn't been preloaded successfully. In this
+    case the caller has to fall back to reading the image via wxFileSystem.
+   */
+  Image *GetImage(wxString name);
+
+  /*! The root node of the layout cache the file contains
+
+    \return NULL, if the file doesn't contain a layout cache.
+   */
+  wxXmlNode *GetLayoutCache() { return m_layoutCache.GetRoot(); }
+
+private:
+  //! Reads, inflates and probes a single image from the zip archive
+  class ImageJob : public WorkerJob
+  {
+  public:
+    ImageJob(wxString wxmxFile, wxFileOffset offset, wxFileOffset compressedSize,
+             wxFileOffset size, int method);
+    virtual void Run();
+    //! The uncompressed image
+    std::vector<unsigned char> m_data;
+    //! The dimensions of the image, if it could be decoded.
+    wxSize m_imageSize;
+    //! Could the image be read?
+    bool m_ok;
+  private:
+    wxString m_wxmxFile;
+    //! The position of the zip entry's local header
+    wxFileOffset m_offset;
+    wxFileOffset m_compressedSize;
+    wxFileOffset m_size;
+    int m_method;
+  };
+
+  wxString m_wxmxFile;
+  WorkerPool m_pool;
+  std::map<wxString, ImageJob *> m_images;
+  //! The cell sizes MathCtrl::LayoutCacheXML() has stored in the file
+  wxXmlDocument m_layoutCache;
+};
+
+#endif // WXMXLOADER_H
@@ -0,0 +1,326 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "WXMXSnapshot.h"
+#include "ImgCell.h"
+
+#include <wx/filefn.h>
+#include <wx/filesys.h>
+#include <wx/fs_mem.h>
+#include <wx/mstream.h>
+
+#include <algorithm>
+
+WXMXSnapshot::WXMXSnapshot(wxString file, wxEvtHandler *notify, int notifyId)
+{
+  m_file = ThreadSafeCopy(file);
+  m_notify = notify;
+  m_notifyId = notifyId;
+  m_compress = false;
+  m_ok = false;
+}
+
+void WXMXSnapshot::TakeImages()
+{
+  wxFileSystem *fsystem = new wxFileSystem();
+  fsystem->AddHandler(new wxMemoryFSHandler);
+  fsystem->ChangePathTo(wxT("memory:"), true);
+
+  for (int i = 1; i<=ImgCell::WXMXImageCount(); i++)
+  {
+    wxString name = wxT("image");
+    name << i << wxT(".*");
+    name = fsystem->FindFirst(name);
+    
+    wxFSFile *fsfile = fsystem->OpenFile(name);
+
+    name = name.Right(name.Length() - 7);
+    if (fsfile) {
+      wxInputStream *imagefile = fsfile->GetStream();
+      std::vector<char> data(imagefile->GetSize());
+      if(!data.empty())
+        imagefile->Read(&data[0], data.size());
+      wxUint32 crc = 0;
+      bool hasCrc = ImgCell::WXMXImageCRC(name, crc);
+      AddImage(name, data.empty() ? NULL : &data[0], imagefile->LastRead(),
+               hasCrc, crc);
+
+      delete fsfile;
+      wxMemoryFSHandler::RemoveFile(name);
+    }
+  }
+
+  delete fsystem;
+}
+
+void WXMXSnapshot::Run()
+{
+  m_ok = Write();
+  if(m_notify != NULL)
+    wxQueueEvent(m_notify, new wxThreadEvent(wxEVT_THREAD, m_notifyId));
+}
+
+bool WXMXSnapshot::Write()
+{
+  wxString backupfile = m_file + wxT("~");
+  if(wxFileExists(backupfile))
+  {
+    if(!wxRemoveFile(backupfile))
+      return false;
+  }
+
+  {
+    wxFFileOutputStream out(backupfile);
+    if (!out.IsOk())
+      return false;
+    wxZipOutputStream zip(out);
+
+    // The layout of the file is the same ExportToWXMX() produces: An
+    // uncompressed mimetype and content.xml followed by the rest.
+    const char mimetype[] = "text/x-wxmathml";
+    zip.SetLevel(0);
+    zip.PutNextEntry(wxT("mimetype"));
+    zip.Write(mimetype, strlen(mimetype));
+
+    zip.PutNextEntry(wxT("content.xml"));
+    zip.Write(m_content.data(), m_content.size());
+
+    WXMXEntries entries;
+    if(!m_layoutCache.empty())
+      entries.Add(wxT("layoutcache.xml"), m_layoutCache.data(), m_layoutCache.size());
+    if(!entries.WriteTo(zip, m_compress ? 9 : 0))
+      return false;
+
+    // The file we are about to replace still is intact. It has to be closed
+    // again before MoveIntoPlace() replaces it, though: Windows cannot
+    // rename a file over one that is open.
+    {
+      WXMXOldEntries oldEntries(m_file);
+      if(!m_images.WriteTo(zip, m_compress ? 9 : 0, &oldEntries))
+        return false;
+    }
+
+    if(!zip.Close())
+      return false;
+    if(!out.Close())
+      return false;
+  }
+
+  return MoveIntoPlace(backupfile, m_file);
+}
+
+WXMXOldEntries::WXMXOldEntries(wxString file)
+{
+  m_file = NULL;
+  m_zip = NULL;
+  if(!wxFileExists(file))
+    return;
+
+  m_file = new wxFFileInputStream(file);
+  if(!m_file->IsOk())
+    return;
+
+  // The input stream is seekable => The entries are read from the central
+  // directory and can be opened in any order later.
+  m_zip = new wxZipInputStream(*m_file);
+  wxZipEntry *entry;
+  while((entry = m_zip->GetNextEntry()) != NULL)
+  {
+    if(entry->IsDir())
+      delete entry;
+    else
+      m_entries.insert(std::pair<wxUint32, wxZipEntry *>(entry->GetCrc(), entry));
+  }
+}
+
+WXMXOldEntries::~WXMXOldEntries()
+{
+  for(std::multimap<wxUint32, wxZipEntry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    delete it->second;
+  delete m_zip;
+  delete m_file;
+}
+
+wxZipEntry *WXMXOldEntries::Find(wxUint32 crc, size_t size)
+{
+  std::pair<std::multimap<wxUint32, wxZipEntry *>::iterator,
+            std::multimap<wxUint32, wxZipEntry *>::iterator> range = m_entries.equal_range(crc);
+  for(std::multimap<wxUint32, wxZipEntry *>::iterator it = range.first; it != range.second; ++it)
+  {
+    if(it->second->GetSize() == (wxFileOffset) size)
+      return it->second;
+  }
+  return NULL;
+}
+
+bool WXMXOldEntries::Copy(wxZipOutputStream &zip, wxString name, wxUint32 crc, size_t size)
+{
+  wxZipEntry *entry = Find(crc, size);
+  if(entry == NULL)
+    return false;
+
+  // CopyEntry() takes ownership of the entry it is given.
+  wxZipEntry *copy = entry->Clone();
+  copy->SetName(name);
+  return zip.CopyEntry(copy, *m_zip);
+}
+
+void WXMXEntries::Add(wxString name, const void *data, size_t length,
+                      bool hasCrc, wxUint32 crc)
+{
+  m_entries.push_back(new Entry(name, data, length, hasCrc, crc));
+}
+
+void WXMXEntries::Clear()
+{
+  for(size_t i = 0; i < m_entries.size(); i++)
+    delete m_entries[i];
+  m_entries.clear();
+}
+
+size_t WXMXEntries::BatchSize()
+{
+  return 2 * std::max(wxThread::GetCPUCount(), 1);
+}
+
+bool WXMXEntries::WriteTo(wxZipOutputStream &zip, int level, WXMXOldEntries *oldEntries)
+{
+  zip.SetLevel(level);
+
+  WorkerPool *pool = NULL;
+  bool ok = true;
+  for(size_t start = 0; (start < m_entries.size()) && ok; start += BatchSize())
+  {
+    size_t end = std::min(start + BatchSize(), m_entries.size());
+
+    // Decide which entries can be copied from the old file and deflate the rest.
+    std::vector<bool> copy(end - start, false);
+    std::vector<Entry *> deflate;
+    for(size_t i = start; i < end; i++)
+    {
+      Entry *entry = m_entries[i];
+      if((oldEntries != NULL) && entry->m_hasCrc &&
+         oldEntries->CanCopy(entry->m_crc, entry->m_data.size()))
+        copy[i - start] = true;
+      else if(level > 0)
+      {
+        entry->m_level = level;
+        deflate.push_back(entry);
+      }
+    }
+
+    // A single entry isn't worth starting any threads for.
+    if(deflate.size() == 1)
+      deflate[0]->Run();
+    else if(deflate.size() > 1)
+    {
+      if(pool == NULL)
+        pool = new WorkerPool;
+      for(size_t i = 0; i < deflate.size(); i++)
+        pool->AddJob(deflate[i]);
+      pool->Wait();
+    }
+
+    for(size_t i = start; (i < end) && ok; i++)
+    {
+      Entry *entry = m_entries[i];
+      if(copy[i - start])
+        ok = oldEntries->Copy(zip, entry->m_name, entry->m_crc, entry->m_data.size());
+      else if(level > 0)
+        ok = entry->CopyTo(zip);
+      else
+      {
+        ok = zip.PutNextEntry(entry->m_name);
+        if(ok && !entry->m_data.empty())
+          ok = zip.Write(&entry->m_data[0], entry->m_data.size()).IsOk();
+      }
+    }
+
+    // Entries that have been written don't need to occupy memory any more.
+    for(size_t i = start; i < end; i++)
+      wxDELETE(m_entries[i]);
+  }
+
+  delete pool;
+  Clear();
+  return ok;
+}
+
+WXMXEntries::Entry::Entry(wxString name, const void *data, size_t length,
+                          bool hasCrc, wxUint32 crc)
+{
+  m_name = ThreadSafeCopy(name);
+  if(length > 0)
+    m_data.assign((const char *) data, (const char *) data + length);
+  m_hasCrc = hasCrc;
+  m_crc = crc;
+  m_level = 0;
+}
+
+void WXMXEntries::Entry::Run()
+{
+  wxMemoryOutputStream memory;
+  {
+    wxZipOutputStream zip(memory, m_level);
+    zip.PutNextEntry(m_name);
+    if(!m_data.empty())
+      zip.Write(&m_data[0], m_data.size());
+    if(!zip.Close())
+      return;
+  }
+
+  m_compressed.resize(memory.GetSize());
+  if(!m_compressed.empty())
+    memory.CopyTo(&m_compressed[0], m_compressed.size());
+}
+
+bool WXMXEntries::Entry::CopyTo(wxZipOutputStream &zip)
+{
+  if(m_compressed.empty())
+    return false;
+
+  // CopyEntry() copies the deflated data as-is.
+  wxMemoryInputStream memory(&m_compressed[0], m_compressed.size());
+  wxZipInputStream in(memory);
+  wxZipEntry *entry = in.GetNextEntry();
+  if(entry == NULL)
+    return false;
+  return zip.CopyEntry(entry, in);
+}
+
+bool WXMXSnapshot::MoveIntoPlace(wxString backupfile, wxString file)
+{
+  // Now that all data is save we can overwrite the actual save file.
+  if(!wxRenameFile(backupfile,file,true))
+  {
+    // We might have failed to move the file because an over-eager virus scanner wants to
+    // scan it and a design decision of a filesystem driver might hinder us from moving
+    // it during this action => Wait for a second and retry.
+    wxSleep(1);
+    if(!wxRenameFile(backupfile,file,true))
+    {
+      wxSleep(1);
+      if(!wxRenameFile(backupfile,file,true))
+        return false;
+    }
+  }
+  return true;
+}
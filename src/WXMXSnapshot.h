@@ -0,0 +1,205 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  A copy of a worksheet that can be written to a .wxmx file by a worker thread.
+ */
+
+#ifndef WXMXSNAPSHOT_H
+#define WXMXSNAPSHOT_H
+
+#include <wx/wx.h>
+#include <wx/wfstream.h>
+#include <wx/zipstrm.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+/*! The entries of the .wxmx file that is about to be overwritten
+
+  Images that haven't changed since the file has been saved the last time
+  don't need to be compressed again: They can be copied from the old file
+  without inflating and deflating them. The entries are identified by the
+  CRC32 and size of their data, which the zip file's central directory
+  already contains.
+ */
+class WXMXOldEntries
+{
+public:
+  //! Reads the central directory of file, if there is such a file.
+  WXMXOldEntries(wxString file);
+  ~WXMXOldEntries();
+  //! Does the old file contain an entry with this data?
+  bool CanCopy(wxUint32 crc, size_t size) { return Find(crc, size) != NULL; }
+  /*! Copies the entry with the given data to zip, without recompressing it
+
+    \param zip The zip file to copy the entry to
+    \param name The name the entry gets in zip
+    \param crc The CRC32 of the entry's data
+    \param size The size of the entry's data
+    \return false, if copying failed.
+   */
+  bool Copy(wxZipOutputStream &zip, wxString name, wxUint32 crc, size_t size);
+
+private:
+  wxZipEntry *Find(wxUint32 crc, size_t size);
+  wxFFileInputStream *m_file;
+  wxZipInputStream *m_zip;
+  std::multimap<wxUint32, wxZipEntry *> m_entries;
+};
+
+/*! The entries of a .wxmx file that follow content.xml
+
+  Deflating the images of a worksheet one after another at level 9 is what
+  makes saving a .wxmx file slow. This class collects the entries first and
+  then deflates them on a WorkerPool, every entry into a small zip archive of
+  its own in memory. The compressed data is then copied into the actual file
+  in the order the entries have been added => The result is an ordinary zip
+  file.
+
+  Only a few entries are deflated at a time and every entry is deleted as
+  soon as it has been written, so the compressed copies never need more
+  memory than a few images do. Callers that can produce the entries one by
+  one write them out whenever IsFull() says enough of them are waiting.
+ */
+class WXMXEntries
+{
+public:
+  WXMXEntries(){}
+  ~WXMXEntries(){ Clear(); }
+  /*! Adds an entry
+
+    \param name The name of the zip entry
+    \param data The contents of the entry. Is copied.
+    \param length The size of data
+    \param crc The CRC32 of data, if hasCrc is true. Allows to copy the entry
+           from the old file instead of compressing it again.
+   */
+  void Add(wxString name, const void *data, size_t length,
+           bool hasCrc = false, wxUint32 crc = 0);
+  //! Are there enough entries to keep all threads of a WriteTo() busy?
+  bool IsFull() { return m_entries.size() >= BatchSize(); }
+  /*! Writes all entries to zip and forgets about them
+
+    \param zip The zip file to write to
+    \param level The compression level. 0 means: Store the entries uncompressed.
+    \param oldEntries The entries of the file that is overwritten, or NULL
+    \return false, if writing failed.
+   */
+  bool WriteTo(wxZipOutputStream &zip, int level, WXMXOldEntries *oldEntries = NULL);
+  //! Forgets about all entries
+  void Clear();
+
+private:
+  //! The number of entries WriteTo() deflates at a time
+  static size_t BatchSize();
+  //! A zip entry that can be deflated by a worker thread
+  class Entry : public WorkerJob
+  {
+  public:
+    Entry(wxString name, const void *data, size_t length, bool hasCrc, wxUint32 crc);
+    //! Deflates m_data into m_compressed
+    virtual void Run();
+    //! Copies the compressed entry to zip
+    bool CopyTo(wxZipOutputStream &zip);
+    wxString m_name;
+    std::vector<char> m_data;
+    bool m_hasCrc;
+    wxUint32 m_crc;
+    //! The compression level Run() uses
+    int m_level;
+    //! A zip archive that contains nothing but this entry, once Run() has succeeded.
+    std::vector<char> m_compressed;
+  };
+  std::vector<Entry *> m_entries;
+};
+
+/*! Everything that goes into a .wxmx file
+
+  MathCtrl::SnapshotWXMX() fills in the xml and the images in the GUI thread.
+  Compressing them, writing the file and moving it into place doesn't need
+  the worksheet any more and therefore can be done by a WorkerPool while the
+  user continues to edit the worksheet.
+ */
+class WXMXSnapshot : public WorkerJob
+{
+public:
+  /*! The constructor
+
+    \param file The .wxmx file to write
+    \param notify The event handler that is sent a wxThreadEvent with the id
+           notifyId as soon as Run() has finished, or NULL.
+   */
+  WXMXSnapshot(wxString file, wxEvtHandler *notify = NULL, int notifyId = wxID_ANY);
+  /*! Adds an image to the snapshot
+
+    \param name The name of the image's zip entry
+    \param data The image
+    \param length The size of data
+    \param crc The CRC32 of data, if hasCrc is true. Allows to copy the image
+           from the old file instead of compressing it again.
+   */
+  void AddImage(wxString name, const void *data, size_t length,
+                bool hasCrc = false, wxUint32 crc = 0)
+    { m_images.Add(name, data, length, hasCrc, crc); }
+  /*! Takes the images ImgCell::ToXML() has put into the memory filesystem
+
+    Is to be called in the GUI thread right after content.xml has been generated.
+   */
+  void TakeImages();
+  //! Writes the file and sends the notification
+  virtual void Run();
+  /*! Writes the file
+
+    \return false, if the file could not be written.
+   */
+  bool Write();
+  //! Has Run() succeeded?
+  bool IsOk() { return m_ok; }
+  //! The name of the file the snapshot is written to
+  wxString GetFile() { return m_file; }
+
+  /*! Replaces file by the file backupfile
+
+    Retries a few times as an over-eager virus scanner may block the file for
+    a short while after it has been written.
+   */
+  static bool MoveIntoPlace(wxString backupfile, wxString file);
+
+  //! content.xml, in UTF-8
+  std::string m_content;
+  //! layoutcache.xml, in UTF-8. Isn't written if empty.
+  std::string m_layoutCache;
+  //! Compress everything but content.xml?
+  bool m_compress;
+
+private:
+  WXMXEntries m_images;
+  wxString m_file;
+  wxEvtHandler *m_notify;
+  int m_notifyId;
+  bool m_ok;
+};
+
+#endif // WXMXSNAPSHOT_H
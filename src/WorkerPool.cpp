@@ -0,0 +1,161 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "WorkerPool.h"
+
+wxString WorkerJob::ThreadSafeCopy(const wxString &str)
+{
+  return wxString(str.c_str());
+}
+
+WorkerPool::WorkerPool(int threads) :
+  m_jobAvailable(m_mutex),
+  m_allDone(m_mutex)
+{
+  m_active = 0;
+  m_jobsDone = 0;
+  m_jobsAdded = 0;
+  m_shutdown = false;
+
+  if(threads < 0)
+    threads = wxThread::GetCPUCount();
+  if(threads < 1)
+    threads = 1;
+
+  for(int i = 0; i < threads; i++)
+  {
+    WorkerThread *thread = new WorkerThread(this);
+    if((thread->Create() != wxTHREAD_NO_ERROR) || (thread->Run() != wxTHREAD_NO_ERROR))
+    {
+      delete thread;
+      break;
+    }
+    m_threads.push_back(thread);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    wxMutexLocker lock(m_mutex);
+    m_jobs.clear();
+    m_shutdown = true;
+    m_jobAvailable.Broadcast();
+  }
+
+  for(size_t i = 0; i < m_threads.size(); i++)
+  {
+    m_threads[i]->Wait();
+    delete m_threads[i];
+  }
+}
+
+void WorkerPool::AddJob(WorkerJob *job)
+{
+  if(m_threads.empty())
+  {
+    job->Run();
+    wxMutexLocker lock(m_mutex);
+    m_jobsAdded++;
+    m_jobsDone++;
+    return;
+  }
+
+  wxMutexLocker lock(m_mutex);
+  m_jobs.push_back(job);
+  m_jobsAdded++;
+  m_jobAvailable.Signal();
+}
+
+void WorkerPool::Wait()
+{
+  wxMutexLocker lock(m_mutex);
+  while(!Idle())
+    m_allDone.Wait();
+}
+
+bool WorkerPool::WaitTimeout(unsigned long milliseconds)
+{
+  wxMutexLocker lock(m_mutex);
+  if(!Idle())
+    m_allDone.WaitTimeout(milliseconds);
+  return Idle();
+}
+
+void WorkerPool::Cancel()
+{
+  wxMutexLocker lock(m_mutex);
+  m_jobs.clear();
+  if(Idle())
+    m_allDone.Broadcast();
+}
+
+int WorkerPool::JobsDone()
+{
+  wxMutexLocker lock(m_mutex);
+  return m_jobsDone;
+}
+
+int WorkerPool::JobsAdded()
+{
+  wxMutexLocker lock(m_mutex);
+  return m_jobsAdded;
+}
+
+WorkerJob *WorkerPool::NextJob()
+{
+  wxMutexLocker lock(m_mutex);
+  while(m_jobs.empty() && !m_shutdown)
+    m_jobAvailable.Wait();
+
+  if(m_shutdown)
+    return NULL;
+
+  WorkerJob *job = m_jobs.front();
+  m_jobs.pop_front();
+  m_active++;
+  return job;
+}
+
+void WorkerPool::JobFinished()
+{
+  wxMutexLocker lock(m_mutex);
+  m_active--;
+  m_jobsDone++;
+  if(Idle())
+    m_allDone.Broadcast();
+}
+
+WorkerPool::WorkerThread::WorkerThread(WorkerPool *pool) :
+  wxThread(wxTHREAD_JOINABLE)
+{
+  m_pool = pool;
+}
+
+wxThread::ExitCode WorkerPool::WorkerThread::Entry()
+{
+  WorkerJob *job;
+  while((job = m_pool->NextJob()) != NULL)
+  {
+    job->Run();
+    m_pool->JobFinished();
+  }
+  return (wxThread::ExitCode) 0;
+}
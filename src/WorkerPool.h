@@ -0,0 +1,119 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+/*! \file
+  A pool of worker threads that processes jobs that don't touch the GUI.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <wx/string.h>
+#include <wx/thread.h>
+
+#include <deque>
+#include <vector>
+
+/*! A job a WorkerPool can run
+
+  Jobs run outside the GUI thread. This means they must not create or
+  access any windows, device contexts, bitmaps or other GDI objects.
+  wxImage, streams and files are fine, though.
+ */
+class WorkerJob
+{
+public:
+  virtual ~WorkerJob(){}
+  //! Does the actual work. Is called from a worker thread.
+  virtual void Run() = 0;
+  /*! A copy of str that doesn't share its data with str
+
+    wxString's copy constructor isn't guaranteed to be thread-safe: Strings
+    a job keeps and another thread might copy or destroy meanwhile have to
+    be copied using this function.
+   */
+  static wxString ThreadSafeCopy(const wxString &str);
+};
+
+/*! A pool of worker threads
+
+  The pool doesn't take ownership of the jobs it is given: The caller
+  typically wants to read their results after Wait() has returned.
+
+  If no threads can be created all jobs are run synchronously by AddJob().
+ */
+class WorkerPool
+{
+public:
+  /*! The constructor
+
+    \param threads The number of threads to start. -1 means: One per CPU.
+   */
+  WorkerPool(int threads = -1);
+  //! Drops all jobs that haven't started yet and waits for the running ones.
+  ~WorkerPool();
+  //! Queues a job.
+  void AddJob(WorkerJob *job);
+  //! Waits until all queued jobs have been processed.
+  void Wait();
+  /*! Waits until all queued jobs have been processed or a timeout is reached
+
+    \return true, if all jobs have been processed.
+   */
+  bool WaitTimeout(unsigned long milliseconds);
+  //! Drops all jobs that haven't been started yet.
+  void Cancel();
+  //! The number of jobs that have been finished so far
+  int JobsDone();
+  //! The number of jobs that have been added so far
+  int JobsAdded();
+  //! The number of threads the pool has been able to start
+  int Threads() { return m_threads.size(); }
+
+private:
+  class WorkerThread : public wxThread
+  {
+  public:
+    WorkerThread(WorkerPool *pool);
+    virtual ExitCode Entry();
+  private:
+    WorkerPool *m_pool;
+  };
+
+  //! Blocks until a job is available. Returns NULL if the pool shuts down.
+  WorkerJob *NextJob();
+  //! Marks a job as done.
+  void JobFinished();
+  //! Are all jobs done? Must be called with m_mutex locked.
+  bool Idle() { return m_jobs.empty() && (m_active == 0); }
+
+  wxMutex m_mutex;
+  wxCondition m_jobAvailable;
+  wxCondition m_allDone;
+  std::deque<WorkerJob *> m_jobs;
+  std::vector<WorkerThread *> m_threads;
+  //! The number of jobs that are currently being run
+  int m_active;
+  int m_jobsDone;
+  int m_jobsAdded;
+  bool m_shutdown;
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,66 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "XMLWriter.h"
+
+XMLWriter::XMLWriter(wxOutputStream &out, size_t bufferSize) :
+  m_out(out)
+{
+  m_bufferSize = bufferSize;
+  m_buffer.reserve(bufferSize);
+  m_ok = true;
+}
+
+XMLWriter::~XMLWriter()
+{
+  Flush();
+}
+
+void XMLWriter::Write(const wxString &text)
+{
+  wxCharBuffer utf8 = text.utf8_str();
+  size_t start = m_buffer.size();
+  m_buffer.append(utf8.data(), utf8.length());
+
+  // Bytes of multi-byte UTF-8 sequences are always >= 0x80 => Control
+  // characters can be replaced byte by byte.
+  for (size_t i = start; i < m_buffer.size(); i++)
+  {
+    unsigned char c = m_buffer[i];
+    if ((c < '\t') || ((c > '\n') && (c < ' ')) || (c == 0x7F))
+      m_buffer[i] = ' ';
+  }
+
+  if (m_buffer.size() >= m_bufferSize)
+    Flush();
+}
+
+bool XMLWriter::Flush()
+{
+  if (!m_buffer.empty())
+  {
+    m_out.Write(m_buffer.data(), m_buffer.size());
+    if (m_out.LastWrite() != m_buffer.size())
+      m_ok = false;
+    m_buffer.clear();
+  }
+  return m_ok;
+}
@@ -0,0 +1,70 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2015 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+/*! \file
+  A buffered writer that streams xml to a wxOutputStream.
+ */
+
+#ifndef XMLWRITER_H
+#define XMLWRITER_H
+
+#include <wx/wx.h>
+#include <wx/stream.h>
+
+#include <string>
+
+/*! Writes xml to a stream in UTF-8 without ever keeping the whole document in memory
+
+  The text that is written is converted to UTF-8 and stripped from all
+  control characters except tabs and newlines: These aren't allowed in xml
+  and there should be no way for them to enter a worksheet. But sometimes
+  they still do...
+ */
+class XMLWriter
+{
+public:
+  /*! The constructor
+
+    \param out The stream to write to. Has to outlive this object.
+    \param bufferSize The number of bytes to collect before writing them to out.
+   */
+  XMLWriter(wxOutputStream &out, size_t bufferSize = 65536);
+  //! Writes everything that is still buffered.
+  ~XMLWriter();
+  //! Appends text to the output
+  void Write(const wxString &text);
+  XMLWriter &operator<<(const wxString &text) { Write(text); return *this; }
+  /*! Writes everything that is still buffered to the stream
+
+    \return false, if writing to the stream failed.
+   */
+  bool Flush();
+  //! Could everything be written so far?
+  bool IsOk() { return m_ok; }
+
+private:
+  wxOutputStream &m_out;
+  std::string m_buffer;
+  size_t m_bufferSize;
+  bool m_ok;
+};
+
+#endif // XMLWRITER_H
@@ -29,8 +29,10 @@
 #include <wx/fileconf.h>
 #include "Dirstructure.h"
 #include <iostream>
+#include <string.h>
 
 #include "wxMaxima.h"
+#include "BatchRunner.h"
 #include "Setup.h"
 
 // On wxGTK2 we support printing only if wxWidgets is compiled with gnome_print.
@@ -44,7 +46,106 @@
 #endif
 
 
+#if defined __WXMSW__
 IMPLEMENT_APP(MyApp)
+#else
+IMPLEMENT_WX_THEME_SUPPORT
+IMPLEMENT_APP_NO_MAIN(MyApp)
+
+/*! The entry point
+
+  Batch runs are done by a console application: Initializing the GUI toolkit
+  would fail on machines without a display server.
+ */
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-b") == 0) || (strcmp(argv[i], "--batch") == 0))
+    {
+      wxApp::SetInstance(new BatchApp());
+      break;
+    }
+  }
+  return wxEntry(argc, argv);
+}
+#endif
+
+static const wxCmdLineEntryDesc cmdLineDesc[] =
+{
+  { wxCMD_LINE_SWITCH, "v", "version", "Output the version info" },
+  /* Usually wxCMD_LINE_OPTION_HELP is used with the following option, but that displays a message
+   * using a own window and we want the message on the command line. If a user enters a command
+   * line option, he expects probably a answer just on the command line... */
+  { wxCMD_LINE_SWITCH, "h", "help", "show this help message", wxCMD_LINE_VAL_NONE},
+  { wxCMD_LINE_OPTION, "o", "open", "open a file" },
+  { wxCMD_LINE_SWITCH, "b", "batch","run the files without opening a window, save them and exit afterwards. Stops on questions and errors." },
+  { wxCMD_LINE_OPTION, "j", "jobs", "the number of files to run in parallel in batch mode", wxCMD_LINE_VAL_NUMBER },
+#if defined __WXMSW__
+  { wxCMD_LINE_OPTION, "f", "ini", "open an input file" },
+#endif
+  { wxCMD_LINE_PARAM, NULL, NULL, "input file", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE },
+  { wxCMD_LINE_NONE }
+};
+
+/*! Starts evaluating the files given on the command line without a window
+
+  \return NULL, if there is nothing to evaluate.
+ */
+static BatchSession *StartBatchSession(wxCmdLineParser &cmdLineParser)
+{
+  wxArrayString files;
+  wxString file;
+  if (cmdLineParser.Found(wxT("o"), &file))
+    files.Add(file);
+  for (size_t i = 0; i < cmdLineParser.GetParamCount(); i++)
+    files.Add(cmdLineParser.GetParam(i));
+
+  if (files.IsEmpty())
+  {
+    std::cout << cmdLineParser.GetUsageString();
+    return NULL;
+  }
+
+  for (size_t i = 0; i < files.GetCount(); i++)
+  {
+    wxFileName FileName = files[i];
+    FileName.MakeAbsolute();
+    files[i] = FileName.GetFullPath();
+  }
+
+  long jobs = -1;
+  cmdLineParser.Found(wxT("j"), &jobs);
+
+  BatchSession *session = new BatchSession(files, jobs);
+  session->Start();
+  return session;
+}
+
+bool BatchApp::OnInit()
+{
+  wxCmdLineParser cmdLineParser(argc, argv);
+  cmdLineParser.SetDesc(cmdLineDesc);
+  if (cmdLineParser.Parse() != 0)
+    return false;
+
+  wxConfig::Set(new wxConfig(wxT("wxMaxima")));
+
+  wxImage::AddHandler(new wxPNGHandler);
+  wxImage::AddHandler(new wxXPMHandler);
+  wxImage::AddHandler(new wxJPEGHandler);
+
+  wxFileSystem::AddHandler(new wxZipFSHandler);
+
+  m_session = StartBatchSession(cmdLineParser);
+  return m_session != NULL;
+}
+
+int BatchApp::OnExit()
+{
+  wxDELETE(m_session);
+  return wxAppConsole::OnExit();
+}
 
 void MyApp::Cleanup_Static()
 {
@@ -56,29 +157,12 @@ void MyApp::Cleanup_Static()
 bool MyApp::OnInit()
 {
   m_frame = NULL;
+  m_batchSession = NULL;
 //  atexit(Cleanup_Static);
   int lang = wxLANGUAGE_UNKNOWN;
   
-  bool batchmode = false;
-
   wxCmdLineParser cmdLineParser(argc, argv);
 
-  static const wxCmdLineEntryDesc cmdLineDesc[] =
-    {
-      { wxCMD_LINE_SWITCH, "v", "version", "Output the version info" },
-      /* Usually wxCMD_LINE_OPTION_HELP is used with the following option, but that displays a message
-       * using a own window and we want the message on the command line. If a user enters a command
-       * line option, he expects probably a answer just on the command line... */
-      { wxCMD_LINE_SWITCH, "h", "help", "show this help message", wxCMD_LINE_VAL_NONE},
-      { wxCMD_LINE_OPTION, "o", "open", "open a file" },
-      { wxCMD_LINE_SWITCH, "b", "batch","run the file and exit afterwards. Halts on questions and stops on errors." },
-#if defined __WXMSW__
-      { wxCMD_LINE_OPTION, "f", "ini", "open an input file" },
-#endif
-      { wxCMD_LINE_PARAM, NULL, NULL, "input file", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-      { wxCMD_LINE_NONE }
-    };
-
   cmdLineParser.SetDesc(cmdLineDesc);
   cmdLineParser.Parse();
   wxString ini, file;
@@ -156,9 +240,11 @@ bool MyApp::OnInit()
       wxExit();
     }
 
+  // Batch runs don't need a window.
   if (cmdLineParser.Found(wxT("b")))
   {
-    batchmode = true;
+    m_batchSession = StartBatchSession(cmdLineParser);
+    return m_batchSession != NULL;
   }
 
   if (cmdLineParser.Found(wxT("o"), &file))
@@ -166,7 +252,7 @@ bool MyApp::OnInit()
       wxFileName FileName=file;
       FileName.MakeAbsolute();
       wxString CanonicalFilename=FileName.GetFullPath();
-      NewWindow(wxString(CanonicalFilename),batchmode);
+      NewWindow(wxString(CanonicalFilename));
       return true;
     }
   else
@@ -176,7 +262,7 @@ bool MyApp::OnInit()
 	  wxFileName FileName=cmdLineParser.GetParam();
 	  FileName.MakeAbsolute();
 	  wxString CanonicalFilename=FileName.GetFullPath();
-	  NewWindow(CanonicalFilename,batchmode);
+	  NewWindow(CanonicalFilename);
 	}
       else
 	NewWindow();
@@ -184,11 +270,17 @@ bool MyApp::OnInit()
   return true;
 }
 
+int MyApp::OnExit()
+{
+  wxDELETE(m_batchSession);
+  return wxApp::OnExit();
+}
+
 #if defined __WXMAC__
 int window_counter = 0;
 #endif
 
-void MyApp::NewWindow(wxString file,bool batchmode)
+void MyApp::NewWindow(wxString file)
 {
   int x = 40, y = 40, h = 650, w = 950, m = 0;
   int rs = 0;
@@ -233,7 +325,6 @@ void MyApp::NewWindow(wxString file,bool batchmode)
     m_frame->SetOpenFile(file);
   }
 
-  m_frame->SetBatchMode(batchmode);
 #if defined __WXMAC__
   topLevelWindows.Append(m_frame);
   if (topLevelWindows.GetCount()>1)
@@ -44,6 +44,7 @@
 #include "SlideShowCell.h"
 #include "PlotFormatWiz.h"
 #include "Dirstructure.h"
+#include "MappedFile.h"
 
 #include <wx/clipbrd.h>
 #include <wx/filedlg.h>
@@ -69,6 +70,9 @@
 #include <wx/sstream.h>
 #include <list>
 
+//! The number of commands wxMaxima::SendCommandsAhead() may send ahead of maxima
+#define MAX_COMMANDS_AHEAD 16
+
 #if defined __WXMAC__
 #define MACPREFIX "wxMaxima.app/Contents/Resources/"
 #endif
@@ -103,6 +107,11 @@ void wxMaxima::ConfigChanged()
   m_autoSaveInterval = 0;
   config->Read(wxT("autoSaveInterval"), &m_autoSaveInterval);
   m_autoSaveInterval *= 60000;
+
+  m_abortOnError = false;
+  config->Read(wxT("abortOnError"), &m_abortOnError);
+
+  m_errorMatcher.ReadConfig();
 }
 
 wxMaxima *MyApp::m_frame;
@@ -116,6 +125,9 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, const wxString title,
   ConfigChanged();
   m_unsuccessfullConnectionAttempts = 0;
   m_outputCellsFromCurrentCommand = 0;
+  m_pendingOutputLength = 0;
+  m_socketPaused = false;
+  m_outputTarget = NULL;
   m_CWD = wxEmptyString;
   m_port = 4010;
   m_pid = -1;
@@ -138,6 +150,14 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, const wxString title,
   m_client = NULL;
   m_server = NULL;
 
+  m_pendingXmlRoot = NULL;
+  m_pendingXmlNode = NULL;
+  m_pendingLoader = NULL;
+  m_pendingParser = NULL;
+  m_pendingWarning = true;
+  m_pendingLayoutCache = NULL;
+  m_pendingLayoutCacheExact = true;
+
   config->Read(wxT("lastPath"), &m_lastPath);
   m_lastPrompt = wxEmptyString;
 
@@ -166,9 +186,12 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, const wxString title,
   m_console->SetFocus();
   m_console->m_keyboardInactiveTimer.SetOwner(this,KEYBOARD_INACTIVITY_TIMER_ID);
   m_maximaStdoutPollTimer.SetOwner(this,MAXIMA_STDOUT_POLL_ID);
+  m_outputFlushTimer.SetOwner(this,OUTPUT_FLUSH_TIMER_ID);
 
   m_autoSaveIntervalExpired = false;
   m_autoSaveTimer.SetOwner(this,AUTO_SAVE_TIMER_ID);
+  m_autoSavePool = new WorkerPool(1);
+  m_autoSaveJob = NULL;
   
 #if wxUSE_DRAG_AND_DROP
   m_console->SetDropTarget(new MyDropTarget(this));
@@ -191,6 +214,11 @@ wxMaxima::~wxMaxima()
 
   if (m_printData != NULL)
     delete m_printData;
+
+  DropPendingLoad();
+
+  FinishAutoSave();
+  delete m_autoSavePool;
 }
 
 
@@ -315,24 +343,25 @@ void wxMaxima::ConsoleAppend(wxString s, int type)
     return ;
   }
 
-  if(m_maxOutputCellsPerCommand > 0)
+  // Output ShowSpilledOutput() replays isn't subject to the output limit.
+  if((m_maxOutputCellsPerCommand > 0) && (m_outputTarget == NULL))
   {
     // If we already have output more lines than we are allowed to we a inform the user
-    // about this and return.
+    // about this.
     if(m_outputCellsFromCurrentCommand++ == m_maxOutputCellsPerCommand)
-    {
-      DoRawConsoleAppend(_("... [suppressed additional lines since the output is longer than allowed in the configuration] "), MC_TYPE_ERROR);
-      return; 
-    };
+      DoRawConsoleAppend(_("... [suppressed additional lines since the output is longer than allowed in the configuration. \"Show Suppressed Output\" in the cell's context menu displays them] "), MC_TYPE_ERROR);
     
-    
-    // If we already have output more lines than we are allowed to and we already
-    // have informed the user about this we return immediately
+    // The lines that exceed the limit are kept in a buffer instead of being displayed.
     if(m_outputCellsFromCurrentCommand > m_maxOutputCellsPerCommand)
+    {
+      GroupCell *group = m_console->GetLastWorkingGroup();
+      if(group != NULL)
+        group->SpillOutput(s, type);
       return;
+    }
   }
   
-  if (type != MC_TYPE_ERROR)
+  if ((type != MC_TYPE_ERROR) && (m_outputTarget == NULL))
     StatusMaximaBusy(parsing);
 
   if (type == MC_TYPE_DEFAULT)
@@ -346,7 +375,7 @@ void wxMaxima::ConsoleAppend(wxString s, int type)
         t.Trim();
         t.Trim(false);
         if (t.Length())
-          DoRawConsoleAppend(s, MC_TYPE_DEFAULT);
+          AppendRawOutput(s);
         s = wxEmptyString;
       }
       else {
@@ -359,7 +388,7 @@ void wxMaxima::ConsoleAppend(wxString s, int type)
         pre1.Trim();
         pre1.Trim(false);
         if (pre1.Length())
-          DoRawConsoleAppend(pre, MC_TYPE_DEFAULT);
+          AppendRawOutput(pre);
 
         // If the math tag ends inside this string we add the whole tag.
         int end = s.Find(wxT("</mth>"));
@@ -402,6 +431,9 @@ void wxMaxima::DoConsoleAppend(wxString s, int type, bool newLine,
   if(s.IsEmpty())
     return;
 
+  // Keep the output in the order maxima has sent it.
+  FlushPendingOutput();
+
   s.Replace(wxT("\n"), wxT(" "), true);
 
   cell = m_MParser.ParseLine(s, type);
@@ -414,7 +446,7 @@ void wxMaxima::DoConsoleAppend(wxString s, int type, bool newLine,
   }
 
   cell->SetSkip(bigSkip);
-  m_console->InsertLine(cell, newLine || cell->BreakLineHere());
+  m_console->InsertLine(cell, newLine || cell->BreakLineHere(), m_outputTarget);
 }
 
 void wxMaxima::DoRawConsoleAppend(wxString s, int type)
@@ -422,43 +454,102 @@ void wxMaxima::DoRawConsoleAppend(wxString s, int type)
   if(s.IsEmpty())
     return;
 
-  bool scrollToCaret = (!m_console->FollowEvaluation()&&m_console->CaretVisibleIs());
+  // Keep the output in the order maxima has sent it.
+  FlushPendingOutput();
 
   if (type == MC_TYPE_MAIN_PROMPT)
   {
     TextCell* cell = new TextCell(s);
     cell->SetType(type);
-    m_console->InsertLine(cell, true);
+    m_console->InsertLine(cell, true, m_outputTarget);
   }
 
   else
   {
-    wxStringTokenizer tokens(s, wxT("\n"));
-    int count = 0;
-    MathCell *tmp = NULL, *lst = NULL;
-    while (tokens.HasMoreTokens())
-    {
-      TextCell* cell = new TextCell(tokens.GetNextToken());
+    MathCell *cells = RawOutputCells(s, type);
+    if(cells != NULL)
+      m_console->InsertLine(cells, true, m_outputTarget);
+  }
+}
 
-      cell->SetType(type);
+MathCell *wxMaxima::RawOutputCells(wxString s, int type)
+{
+  wxStringTokenizer tokens(s, wxT("\n"));
+  MathCell *tmp = NULL, *lst = NULL;
+  while (tokens.HasMoreTokens())
+  {
+    TextCell* cell = new TextCell(tokens.GetNextToken());
 
-      if (tokens.HasMoreTokens())
-        cell->SetSkip(false);
+    cell->SetType(type);
 
-      if (lst == NULL)
-        tmp = lst = cell;
-      else {
-        lst->AppendCell(cell);
-        cell->ForceBreakLine(true);
-        lst = cell;
-      }
+    if (tokens.HasMoreTokens())
+      cell->SetSkip(false);
 
-      count++;
+    if (lst == NULL)
+      tmp = lst = cell;
+    else {
+      lst->AppendCell(cell);
+      cell->ForceBreakLine(true);
+      lst = cell;
     }
-    m_console->InsertLine(tmp, true);
   }
+  return tmp;
+}
+
+void wxMaxima::AppendRawOutput(wxString s)
+{
+  // Output ShowSpilledOutput() replays is displayed in one go, anyway.
+  if(m_outputTarget != NULL)
+  {
+    DoRawConsoleAppend(s, MC_TYPE_DEFAULT);
+    return;
+  }
+
+  m_pendingOutput.push_back(s);
+  m_pendingOutputLength += s.Length();
 
-  if(scrollToCaret) m_console -> ScrollToCaret();
+  // The first line after a quiet period is displayed at once. The lines that
+  // follow it within OUTPUT_FLUSH_INTERVAL are displayed together.
+  if(!m_outputFlushTimer.IsRunning())
+  {
+    FlushPendingOutput();
+    m_outputFlushTimer.StartOnce(OUTPUT_FLUSH_INTERVAL);
+  }
+}
+
+void wxMaxima::FlushPendingOutput()
+{
+  if(m_pendingOutput.empty())
+    return;
+
+  std::vector<wxString> pending;
+  pending.swap(m_pendingOutput);
+  m_pendingOutputLength = 0;
+
+  // Each chunk keeps the line breaks and skips DoRawConsoleAppend() would have
+  // given it, but all of them are appended as a single batch.
+  std::vector<MathCell *> lines;
+  for(size_t i = 0; i < pending.size(); i++)
+  {
+    MathCell *cells = RawOutputCells(pending[i], MC_TYPE_DEFAULT);
+    if(cells != NULL)
+      lines.push_back(cells);
+  }
+  m_console->InsertLines(lines);
+}
+
+void wxMaxima::ShowSpilledOutput(GroupCell *group)
+{
+  std::vector<std::pair<int, wxString> > output;
+  group->TakeSpilledOutput(output);
+  if(output.empty())
+    return;
+
+  FlushPendingOutput();
+  m_outputTarget = group;
+  for(size_t i = 0; i < output.size(); i++)
+    ConsoleAppend(output[i].second, output[i].first);
+  m_outputTarget = NULL;
 }
 
 /*! Remove empty statements
@@ -603,91 +694,121 @@ void wxMaxima::SanitizeSocketBuffer(char *buffer, int length)
   }
 }
 
-void wxMaxima::ClientEvent(wxSocketEvent& event)
+void wxMaxima::ReadSocket()
 {
   char buffer[SOCKET_SIZE + 1];
   int read;
-  switch (event.GetSocketEvent())
-  {
 
-  case wxSOCKET_INPUT:
-    ReadStdErr();
+  m_client->Read(buffer, SOCKET_SIZE);
 
-    // It is theoretically possible that the client has exited after sending us
-    // data and before we had been able to process it.
-    if(m_client == NULL)
-      return;
-    
-    m_client->Read(buffer, SOCKET_SIZE);
+  if (!m_client->Error())
+  {
+    read = m_client->LastCount();
+    buffer[read] = 0;
+
+    if(m_console->GetWorkingGroup() != NULL)
+      m_console->GetWorkingGroup()->GetEvaluationStats().m_bytes += read;
     
-    if (!m_client->Error())
-    {
-      read = m_client->LastCount();
-      buffer[read] = 0;
-      
-      SanitizeSocketBuffer(buffer, read);
+    SanitizeSocketBuffer(buffer, read);
 
-      wxString newChars;
+    wxString newChars;
 #if wxUSE_UNICODE
-      newChars = wxString(buffer, wxConvUTF8);
+    newChars = wxString(buffer, wxConvUTF8);
 #else
-      newChars = wxString(buffer, *wxConvCurrent);
+    newChars = wxString(buffer, *wxConvCurrent);
 #endif
-      if(IsPaneDisplayed(menu_pane_xmlInspector))
-      {
-        m_xmlInspector->Add(newChars);
-      }
+    if(IsPaneDisplayed(menu_pane_xmlInspector))
+    {
+      m_xmlInspector->Add(newChars);
+    }
 
-      m_currentOutput +=newChars;
+    m_currentOutput +=newChars;
 
-      if (!m_dispReadOut &&
-	  (m_currentOutput != wxT("\n")) &&
-	  (m_currentOutput != wxT("<wxxml-symbols></wxxml-symbols>")))
-      {
-	StatusMaximaBusy(transferring);
-        m_dispReadOut = true;
-      }
+    if (!m_dispReadOut &&
+        (m_currentOutput != wxT("\n")) &&
+        (m_currentOutput != wxT("<wxxml-symbols></wxxml-symbols>")))
+    {
+      StatusMaximaBusy(transferring);
+      m_dispReadOut = true;
+    }
 
-      // This function determines the port maxima is running uü from  the text
-      // maxima outputs at startup and discards this piece of text afterwards.
-      if (m_first && m_currentOutput.Find(m_firstPrompt) > -1)
-        ReadFirstPrompt(m_currentOutput);
+    // This function determines the port maxima is running uü from  the text
+    // maxima outputs at startup and discards this piece of text afterwards.
+    if (m_first && m_currentOutput.Find(m_firstPrompt) > -1)
+      ReadFirstPrompt(m_currentOutput);
 
 
-      // The next function calls each extract and remove one type of information from
-      // the data string we got - but only do so after the piece of information it
-      // is able to detect has been transferred as a whole.
-      ReadLoadSymbols(m_currentOutput);
+    // The next function calls each extract and remove one type of information from
+    // the data string we got - but only do so after the piece of information it
+    // is able to detect has been transferred as a whole.
+    ReadLoadSymbols(m_currentOutput);
 
-      // Handle text that isn't XML output: Mostly Error messages or warnings.
-      if(!m_first)
-        ReadMiscText(m_currentOutput);
+    // Handle text that isn't XML output: Mostly Error messages or warnings.
+    if(!m_first)
+      ReadMiscText(m_currentOutput);
 
-      // Handle XML text: All 1D and 2D maths for example.
-      ReadMath(m_currentOutput);
+    // Handle XML text: All 1D and 2D maths for example.
+    ReadMath(m_currentOutput);
 
-      // Handle eventual error messages
-      if (!m_first)
-      {
-        ReadLispError(m_currentOutput);
-        ReadMiscText(m_currentOutput);
-      }
+    // Handle eventual error messages
+    if (!m_first)
+    {
+      ReadLispError(m_currentOutput);
+      ReadMiscText(m_currentOutput);
+    }
+
+    // The prompt that tells us that maxima awaits the next command
+    ReadPrompt(m_currentOutput);
 
-      // The prompt that tells us that maxima awaits the next command
-      ReadPrompt(m_currentOutput);
+    // Seems like we need to scan for error messages again for some reason.
+    if (!m_first)
+      ReadMiscText(m_currentOutput);
+  }
+}
 
-      // Seems like we need to scan for error messages again for some reason.
-      if (!m_first)
-        ReadMiscText(m_currentOutput);
+void wxMaxima::ResumeSocket()
+{
+  if((!m_socketPaused) || OutputBacklogged())
+    return;
+
+  m_socketPaused = false;
+  // ClientEvent() has left data in the socket => Reading won't block.
+  if(m_client != NULL)
+    ReadSocket();
+}
+
+void wxMaxima::ClientEvent(wxSocketEvent& event)
+{
+  switch (event.GetSocketEvent())
+  {
+
+  case wxSOCKET_INPUT:
+    ReadStdErr();
+
+    // It is theoretically possible that the client has exited after sending us
+    // data and before we had been able to process it.
+    if(m_client == NULL)
+      return;
+
+    // If the GUI cannot keep up with maxima's output we leave the data in the
+    // socket until it has. wxWidgets won't send another wxSOCKET_INPUT before
+    // we have read from the socket => ResumeSocket() does this.
+    if(OutputBacklogged())
+    {
+      m_socketPaused = true;
+      return;
     }
+
+    ReadSocket();
     break;
 
   case wxSOCKET_LOST:
+    FlushPendingOutput();
+    m_socketPaused = false;
     if (!m_closing)
       m_console->m_evaluationQueue->Clear();
     // Inform the user that the evaluation queue is empty.
     EvaluationQueueLength(0);
-    SetBatchMode(false);
     m_console->SetWorkingGroup(NULL);
     m_console->SetSelection(NULL);
     m_console->SetActiveCell(NULL);
@@ -750,7 +871,6 @@ void wxMaxima::ServerEvent(wxSocketEvent& event)
     m_console->m_evaluationQueue->Clear();
     // Inform the user that the evaluation queue is empty.
     EvaluationQueueLength(0);
-    SetBatchMode(false);
     m_pid = -1;
     m_isConnected = false;
     if (!m_closing)
@@ -837,23 +957,14 @@ bool wxMaxima::StartMaxima(bool force)
     m_console->SetWorkingGroup(NULL);
 
     m_variablesOK = false;
-    wxString command = GetCommand();;
+    wxString command = MaximaCommand(m_port);
 
     if (command.Length() > 0)
     {
 
 #if defined(__WXMSW__)
-      wxString clisp = command.SubString(1, command.Length() - 3);
-      clisp.Replace("\\bin\\maxima.bat", "\\clisp-*.*");
-      if (wxFindFirstFile(clisp, wxDIR).empty())
-        command.Append(wxString::Format(wxT(" -s %d "), m_port));
-      else
-        command.Append(wxString::Format(wxT(" -r \":lisp (setup-client %d)\""), m_port));
       wxSetEnv(wxT("home"), wxGetHomeDir());
       wxSetEnv(wxT("maxima_signals_thread"), wxT("1"));
-#else
-      command.Append(wxString::Format(wxT(" -r \":lisp (setup-client %d)\""),
-                                      m_port));
 #endif
 
 #if defined __WXMAC__
@@ -864,6 +975,8 @@ bool wxMaxima::StartMaxima(bool force)
       m_process->Redirect();
       m_first = true;
       m_pid = -1;
+      // Everything the old process has evaluated is lost.
+      m_console->MaximaStarted();
       SetStatusText(_("Starting Maxima..."), 1);
       wxExecute(command, wxEXEC_ASYNC, m_process);
       m_input = m_process->GetInputStream();
@@ -872,7 +985,10 @@ bool wxMaxima::StartMaxima(bool force)
       SetStatusText(_("Maxima started. Waiting for connection..."), 1);
     }
     else
+    {
+      MaximaNotFound();
       return false;
+    }
 
     if (m_openFile.Length())
     {
@@ -892,6 +1008,9 @@ void wxMaxima::Interrupt(wxCommandEvent& event)
     GetMenuBar()->Enable(menu_interrupt_id, false);
     return ;
   }
+  // The cell maxima works on won't be evaluated completely.
+  if(m_console->GetWorkingGroup() != NULL)
+    m_console->GetWorkingGroup()->ResetEvaluated();
 #if defined (__WXMSW__)
   wxString path, maxima = GetCommand(false);
   wxArrayString out;
@@ -998,58 +1117,40 @@ void wxMaxima::ReadMiscText(wxString &data)
     return;
 
   // Add all text lines to the console until we reach a known XML tag.
-  int newLinePos;
-  while((newLinePos=data.Find("\n")) != wxNOT_FOUND)
-    {
-     if(data.StartsWith(wxT("<mth")))
-       return;
+  // The lines are only copied once and the consumed part of data is
+  // removed in one go at the end.
+  size_t pos = 0;
+  size_t newLinePos;
+  while((newLinePos = data.find(wxT('\n'), pos)) != wxString::npos)
+  {
+    if((data.compare(pos, 4, wxT("<mth")) == 0) ||
+       (data.compare(pos, m_promptPrefix.Length(), m_promptPrefix) == 0) ||
+       (data.compare(pos, m_symbolsPrefix.Length(), m_symbolsPrefix) == 0))
+      break;
 
-     if(data.StartsWith(m_promptPrefix))
-       return;
+    wxString textline = data.Mid(pos, newLinePos + 1 - pos);
+    bool isError = m_errorMatcher.Matches(data, pos, newLinePos);
+    pos = newLinePos + 1;
 
-     if(data.StartsWith(m_symbolsPrefix))
-       return;
-     
-     // extract a string from the Data lines
-     wxString textline;
-     if(newLinePos == 0)
-     {
-       textline = wxT("\n");
-       data = data.Right(data.Length() - 1);
-     }
-     else
-     {
-       textline = data.Left(newLinePos + 1);
-       data = data.Right(data.Length() - newLinePos - 1);
-     }
-     wxString trimmedLine = textline;
-
-     trimmedLine.Trim(true);
-     trimmedLine.Trim(false);
-
-     if(
-       (trimmedLine.StartsWith(wxT("-- an error."))) ||
-       (trimmedLine.StartsWith(wxT("incorrect syntax"))) ||
-       (trimmedLine.StartsWith(wxT("Maxima encountered a Lisp error"))) ||
-       (trimmedLine.StartsWith(wxT("killcontext: no such context")))
-       )
-     {
-       ConsoleAppend(textline,MC_TYPE_ERROR);
-
-       bool abortOnError = false;
-       wxConfig::Get()->Read(wxT("abortOnError"), &abortOnError);
-       if(abortOnError || m_batchmode)
-         m_console->m_evaluationQueue->Clear();
-       {
-         SetBatchMode(false);
-         // Inform the user that the evaluation queue is empty.
-         EvaluationQueueLength(0);
-         m_console->ScrollToError();
-       }
-     }
-     else
-       ConsoleAppend(textline,MC_TYPE_DEFAULT);
-    }   
+    if(isError)
+    {
+      ConsoleAppend(textline,MC_TYPE_ERROR);
+      // A cell that has failed has to be evaluated again.
+      if(m_console->GetWorkingGroup() != NULL)
+        m_console->GetWorkingGroup()->ResetEvaluated();
+
+      if(m_abortOnError)
+        m_console->m_evaluationQueue->ClearUnsent();
+      {
+        // Inform the user that the evaluation queue is empty.
+        EvaluationQueueLength(0);
+        m_console->ScrollToError();
+      }
+    }
+    else
+      ConsoleAppend(textline,MC_TYPE_DEFAULT);
+  }
+  data.erase(0, pos);
 }
 
 
@@ -1168,12 +1269,18 @@ void wxMaxima::ReadPrompt(wxString &data)
   // Input prompts begin with (%i. Question prompts don't.
   if (o.StartsWith(wxT("(%i")))
   {
+    // The output that is still waiting to be displayed belongs to the cell
+    // maxima has just finished.
+    FlushPendingOutput();
+
     // Maxima displayed a new main prompt => We don't have a question
     m_console->QuestionAnswered();
 
     //m_lastPrompt = o.Mid(1,o.Length()-1);
     //m_lastPrompt.Replace(wxT(")"), wxT(":"), false);
     m_lastPrompt = o;
+    if(m_console->GetWorkingGroup() != NULL)
+      m_console->GetWorkingGroup()->GetEvaluationStats().PromptReceived();
     // remove the event maxima has just processed from the evaluation queue
     m_console->m_evaluationQueue->RemoveFirst();
     // if we remove a command from the evaluation queue the next output line will be the
@@ -1201,13 +1308,6 @@ void wxMaxima::ReadPrompt(wxString &data)
         m_console->SetActiveCell(NULL);
       }
       m_console->FollowEvaluation(false);
-      if(m_batchmode)
-      {
-        SaveFile(false);
-        wxCloseEvent *closeEvent;
-        closeEvent = new wxCloseEvent();
-        GetEventHandler()->QueueEvent(closeEvent);
-      }
       // Inform the user that the evaluation queue is empty.
       EvaluationQueueLength(0);
       m_console->Refresh();
@@ -1242,6 +1342,15 @@ void wxMaxima::ReadPrompt(wxString &data)
       else
         DoRawConsoleAppend(o, MC_TYPE_PROMPT);
     }
+    // maxima reads the answer from the same stream it reads its commands from
+    // => The commands we have sent ahead may be read as the answer. Nobody can
+    // tell which output belongs to which cell any more.
+    if(m_console->m_evaluationQueue->CommandsSentAhead() > 0)
+    {
+      DiscardCommandsSentAhead(_("Commands that have been sent ahead may have been read as the answer to this question. Maxima has been restarted."));
+      data = wxEmptyString;
+      return;
+    }
     if(m_console->ScrolledAwayFromEvaluation())
     {
       if(m_console->m_mainToolBar)
@@ -1328,13 +1437,18 @@ void wxMaxima::SetCWD(wxString file)
 bool wxMaxima::OpenWXMFile(wxString file, MathCtrl *document, bool clearDocument)
 {
   SetStatusText(_("Opening file"), 1);
+
+  if (clearDocument)
+    DropPendingLoad();
+  else
+    FinishPendingLoad();
   document->Freeze();
 
   // open wxm file
-  wxTextFile inputFile(file);
-  wxArrayString *wxmLines = NULL;
+  MappedFile inputFile(file);
+  wxArrayString wxmLines;
 
-  if (!inputFile.Open()) {
+  if (!inputFile.IsOk()) {
     document->Thaw();
     wxMessageBox(_("wxMaxima encountered an error loading ") + file, _("Error"), wxOK | wxICON_EXCLAMATION);
     StatusMaximaBusy(waiting);
@@ -1345,30 +1459,24 @@ bool wxMaxima::OpenWXMFile(wxString file, MathCtrl *document, bool clearDocument
   // Show a busy cursor as long as we open a file.
   wxBusyCursor crs;
 
-  if (inputFile.GetFirstLine() !=
-      wxT("/* [wxMaxima batch file version 1] [ DO NOT EDIT BY HAND! ]*/"))
+  const char *line;
+  size_t length;
+  if ((!inputFile.NextLine(line, length)) ||
+      (MappedFile::ToString(line, length) !=
+       wxT("/* [wxMaxima batch file version 1] [ DO NOT EDIT BY HAND! ]*/")))
   {
-    inputFile.Close();
     document->Thaw();
     wxMessageBox(_("wxMaxima encountered an error loading ") + file, _("Error"), wxOK | wxICON_EXCLAMATION);
     return false;
   }
 
-  wxmLines = new wxArrayString();
-  wxString line;
-  for (line = inputFile.GetFirstLine();
-       !inputFile.Eof();
-       line = inputFile.GetNextLine()) {
-    wxmLines->Add(line);
-  }
-  wxmLines->Add(line);
-
-  inputFile.Close();
+  // The lines are converted directly from the mapped file.
+  inputFile.Rewind();
+  while (inputFile.NextLine(line, length))
+    wxmLines.Add(MappedFile::ToString(line, length));
 
   GroupCell *tree = m_console->CreateTreeFromWXMCode(wxmLines);
 
-  delete wxmLines;
-
   // from here on code is identical for wxm and wxmx
   if (clearDocument)
     document->ClearDocument();
@@ -1401,6 +1509,11 @@ bool wxMaxima::OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocumen
 {
   SetStatusText(_("Opening file"), 1);
 
+  if (clearDocument)
+    DropPendingLoad();
+  else
+    FinishPendingLoad();
+
   // Show a busy cursor as long as we open a file.
   wxBusyCursor crs;
   document->Freeze();
@@ -1430,25 +1543,24 @@ bool wxMaxima::OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocumen
   // open wxmx file
   wxXmlDocument xmldoc;
 
-  wxFileSystem fs;
+  // Reads content.xml and decodes the images in parallel.
+  WXMXLoader *loader = new WXMXLoader(file);
   wxString wxmxURI = wxURI(wxT("file://") + file).BuildURI();
-  wxString filename = wxmxURI + wxT("#zip:content.xml");
-  wxFSFile *fsfile = fs.OpenFile(filename);
-  
-  if ((fsfile == NULL) || (!xmldoc.Load(*(fsfile->GetStream()),wxT("UTF-8"),wxXMLDOC_KEEP_WHITESPACE_NODES)))
+
+  if (!loader->Load(xmldoc))
   {
+    delete loader;
     document->Thaw();
-    delete fsfile;
     wxMessageBox(_("wxMaxima encountered an error loading ") + file, _("Error"),
                  wxOK | wxICON_EXCLAMATION);
     StatusMaximaBusy(waiting);
     SetStatusText(_("File could not be opened"), 1);
     return false;
   }
-  delete fsfile;
 
   // start processing the XML file
   if (xmldoc.GetRoot()->GetName() != wxT("wxMaximaDocument")) {
+    delete loader;
     document->Thaw();
     wxMessageBox(_("wxMaxima encountered an error loading ") + file, _("Error"),
                  wxOK | wxICON_EXCLAMATION);
@@ -1470,6 +1582,7 @@ bool wxMaxima::OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocumen
     int version_minor = int(10* (version - double(version_major)));
 
     if (version_major > DOCUMENT_VERSION_MAJOR) {
+      delete loader;
       document->Thaw();
       wxMessageBox(_("Document ") + file +
                    _(" was saved using a newer version of wxMaxima. Please update your wxMaxima."),
@@ -1487,20 +1600,62 @@ bool wxMaxima::OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocumen
 
   // read zoom factor
   wxString doczoom = xmldoc.GetRoot()->GetAttribute(wxT("zoom"),wxT("100"));
+  long int zoom = 100;
+  if (!(doczoom.ToLong(&zoom)))
+    zoom = 100;
+
+  // The cell sizes stored in the file are exact only if they have been
+  // measured with the zoom factor, fonts and window width we will use.
+  // Else they still are a better guess at the size of output that hasn't
+  // been parsed yet than parsing it.
+  wxXmlNode *layoutCache = NULL;
+  double zoomFactor = clearDocument ? double(zoom) / 100.0 : document->GetZoomFactor();
+  bool layoutCacheExact = document->LayoutCacheMatches(loader->GetLayoutCache(), zoomFactor);
+  if ((loader->GetLayoutCache() != NULL) &&
+      (loader->GetLayoutCache()->GetName() == wxT("layoutcache")))
+    layoutCache = loader->GetLayoutCache()->GetChildren();
+
+  // Large files are opened progressively: We only parse the cells up to the
+  // cursor position and a screen more. The rest is parsed and laid out while
+  // wxMaxima is idle.
+  bool progressive = true;
+  wxConfig::Get()->Read(wxT("progressiveLoading"), &progressive);
+  progressive = progressive && clearDocument;
 
   // Read the worksheet's contents.
-  wxXmlNode *xmlcells = xmldoc.GetRoot();
-  GroupCell *tree = CreateTreeFromXMLNode(xmlcells, wxmxURI);
+  wxXmlNode *xmlcells = xmldoc.GetRoot()->GetChildren();
+  MathParser *mp = new MathParser(wxmxURI, loader);
+  // Output cells are only created once they are needed.
+  mp->SetLazyOutput(true);
+  bool warning = true;
+  GroupCell *tree = ParseXMLCells(*mp, &xmlcells,
+                                  progressive ? MAX(ActiveCellNumber, 0) + 100 : -1,
+                                  warning, &layoutCache, layoutCacheExact);
+
+  if (xmlcells != NULL)
+  {
+    m_pendingXmlRoot = xmldoc.DetachRoot();
+    m_pendingXmlNode = xmlcells;
+    m_pendingLoader = loader;
+    m_pendingParser = mp;
+    m_pendingWarning = warning;
+    m_pendingLayoutCache = layoutCache;
+    m_pendingLayoutCacheExact = layoutCacheExact;
+  }
+  else
+  {
+    delete mp;
+    delete loader;
+  }
 
   // from here on code is identical for wxm and wxmx
   if (clearDocument) {
     document->ClearDocument();
-    long int zoom = 100;
-    if (!(doczoom.ToLong(&zoom)))
-      zoom = 100;
     document->SetZoomFactor( double(zoom) / 100.0, false); // Set zoom if opening, dont recalculate
   }
 
+  if (progressive)
+    document->ProgressiveLayout(true);
   document->InsertGroupCells(tree); // this also recalculates
 
   if (clearDocument) {
@@ -1533,32 +1688,67 @@ bool wxMaxima::OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocumen
         pos=dynamic_cast<GroupCell*>(pos->m_next);
 
     if(pos)
+    {
+      // Make sure the cell and the screen below it are laid out.
+      if (progressive)
+        m_console->ProgressiveLayout(true, pos);
       m_console->SetHCaret(pos);
+    }
   }
   StatusMaximaBusy(waiting);
   SetStatusText(_("File opened"), 1);
   return true;
 }
 
-GroupCell* wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename)
+GroupCell* wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename,
+                                           WXMXLoader *loader)
 {
-  MathParser mp(wxmxfilename);
-  GroupCell *tree = NULL;
-  GroupCell *last = NULL;
-
+  MathParser mp(wxmxfilename, loader);
   bool warning = true;
 
   if (xmlcells)
     xmlcells = xmlcells->GetChildren();
-  
-  while (xmlcells != NULL)
+
+  return ParseXMLCells(mp, &xmlcells, -1, warning);
+}
+
+GroupCell* wxMaxima::ParseXMLCells(MathParser &mp, wxXmlNode **xmlcells, long maxCells, bool &warning,
+                                   wxXmlNode **layoutCache, bool layoutCacheExact)
+{
+  GroupCell *tree = NULL;
+  GroupCell *last = NULL;
+  long cells = 0;
+
+  while ((*xmlcells != NULL) && ((maxCells < 0) || (cells < maxCells)))
   {
-    if(xmlcells->GetType() != wxXML_TEXT_NODE )
+    if((*xmlcells)->GetType() != wxXML_TEXT_NODE )
     {
-      MathCell *mc = mp.ParseTag(xmlcells, false);
+      MathCell *mc = mp.ParseTag(*xmlcells, false);
+      cells++;
+
+      // The layout cache contains one entry per cell of content.xml.
+      wxXmlNode *size = NULL;
+      if(layoutCache != NULL)
+      {
+        while((*layoutCache != NULL) && ((*layoutCache)->GetType() != wxXML_ELEMENT_NODE))
+          *layoutCache = (*layoutCache)->GetNext();
+        size = *layoutCache;
+        if(*layoutCache != NULL)
+          *layoutCache = (*layoutCache)->GetNext();
+      }
+
       if(mc != NULL)
       {
         GroupCell *cell = dynamic_cast<GroupCell*>(mc);
+
+        long width, height, center;
+        if((size != NULL) &&
+           size->GetAttribute(wxT("width"), wxT("-1")).ToLong(&width) &&
+           size->GetAttribute(wxT("height"), wxT("-1")).ToLong(&height) &&
+           size->GetAttribute(wxT("center"), wxT("-1")).ToLong(&center) &&
+           (width >= 0) && (height >= 0) &&
+           (layoutCacheExact || cell->HasLazyOutput()))
+          cell->SetCachedSize(width, height, center);
         
         if(last == NULL)
         {
@@ -1581,11 +1771,52 @@ GroupCell* wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfil
         warning = false;
       }
     }
-    xmlcells = xmlcells->GetNext();
+    *xmlcells = (*xmlcells)->GetNext();
   }
   return tree;
 }
 
+bool wxMaxima::ParsePendingCells()
+{
+  if (m_pendingXmlNode == NULL)
+    return false;
+
+  GroupCell *cells = ParseXMLCells(*m_pendingParser, &m_pendingXmlNode, 200, m_pendingWarning,
+                                   &m_pendingLayoutCache, m_pendingLayoutCacheExact);
+  if (cells != NULL)
+  {
+    // The new cells are laid out piece by piece by RecalculateStep().
+    m_console->ProgressiveLayout(true);
+    // Appending the cells to the file we have opened doesn't change it.
+    bool saved = m_console->IsSaved();
+    m_console->InsertGroupCells(cells, m_console->UpdateMLast(), NULL);
+    m_console->SetSaved(saved);
+  }
+
+  if (m_pendingXmlNode == NULL)
+  {
+    DropPendingLoad();
+    return false;
+  }
+  return true;
+}
+
+void wxMaxima::FinishPendingLoad()
+{
+  while (ParsePendingCells());
+}
+
+void wxMaxima::DropPendingLoad()
+{
+  wxDELETE(m_pendingParser);
+  wxDELETE(m_pendingLoader);
+  wxDELETE(m_pendingXmlRoot);
+  m_pendingXmlNode = NULL;
+  m_pendingWarning = true;
+  m_pendingLayoutCache = NULL;
+  m_pendingLayoutCacheExact = true;
+}
+
 /***
  * This works only for gcl by default - other lisps have different prompts.
  */
@@ -1602,15 +1833,21 @@ void wxMaxima::ReadLispError(wxString &data)
     wxString o = data.Left(end);
     ConsoleAppend(o, MC_TYPE_DEFAULT);
     ConsoleAppend(lispError, MC_TYPE_ERROR);
+    if(m_console->GetWorkingGroup() != NULL)
+      m_console->GetWorkingGroup()->ResetEvaluated();
 
     data = wxEmptyString;
 
-    bool abortOnError = false;
-    wxConfig::Get()->Read(wxT("abortOnError"), &abortOnError);
-    if(abortOnError || m_batchmode)
+    // The lisp debugger would read the commands that have been sent ahead.
+    if(m_console->m_evaluationQueue->CommandsSentAhead() > 0)
+    {
+      DiscardCommandsSentAhead(_("Maxima has entered the lisp debugger, which would read the commands that have been sent ahead. Maxima has been restarted."));
+      return;
+    }
+
+    if(m_abortOnError)
       m_console->m_evaluationQueue->Clear();
     {
-      SetBatchMode(false);
       // Inform the user that the evaluation queue is empty.
       EvaluationQueueLength(0);
       m_console->ScrollToError();
@@ -1618,6 +1855,19 @@ void wxMaxima::ReadLispError(wxString &data)
   }
 }
 
+void wxMaxima::DiscardCommandsSentAhead(wxString reason)
+{
+  DoRawConsoleAppend(reason, MC_TYPE_ERROR);
+  m_console->ScrollToError();
+
+  // Do what Maxima->Restart Maxima does.
+  m_closing = true;
+  m_console->m_evaluationQueue->Clear();
+  EvaluationQueueLength(0);
+  m_console->ResetInputPrompts();
+  StartMaxima(true);
+}
+
 #ifndef __WXMSW__
 void wxMaxima::ReadProcessOutput()
 {
@@ -1641,16 +1891,17 @@ void wxMaxima::ReadProcessOutput()
 }
 #endif
 
-void wxMaxima::SetupVariables()
+wxArrayString wxMaxima::SetupCommands(wxString promptPrefix, wxString promptSuffix)
 {
-  SendMaxima(wxT(":lisp-quiet (setf *prompt-suffix* \"") +
-             m_promptSuffix +
-             wxT("\")"));
-  SendMaxima(wxT(":lisp-quiet (setf *prompt-prefix* \"") +
-             m_promptPrefix +
-             wxT("\")"));
-  SendMaxima(wxT(":lisp-quiet (setf $in_netmath nil)"));
-  SendMaxima(wxT(":lisp-quiet (setf $show_openplot t)"));
+  wxArrayString commands;
+  commands.Add(wxT(":lisp-quiet (setf *prompt-suffix* \"") +
+               promptSuffix +
+               wxT("\")"));
+  commands.Add(wxT(":lisp-quiet (setf *prompt-prefix* \"") +
+               promptPrefix +
+               wxT("\")"));
+  commands.Add(wxT(":lisp-quiet (setf $in_netmath nil)"));
+  commands.Add(wxT(":lisp-quiet (setf $show_openplot t)"));
   
   wxConfigBase *config = wxConfig::Get();
   
@@ -1661,10 +1912,10 @@ void wxMaxima::SetupVariables()
   #endif
   
   if(wxcd) {
-    SendMaxima(wxT(":lisp-quiet (defparameter $wxchangedir t)"));
+    commands.Add(wxT(":lisp-quiet (defparameter $wxchangedir t)"));
   }
   else {
-    SendMaxima(wxT(":lisp-quiet (defparameter $wxchangedir nil)"));
+    commands.Add(wxT(":lisp-quiet (defparameter $wxchangedir nil)"));
   }
 
 #if defined (__WXMAC__)
@@ -1674,9 +1925,9 @@ void wxMaxima::SetupVariables()
 #endif
   config->Read(wxT("usepngCairo"),&usepngCairo);
   if(usepngCairo)
-    SendMaxima(wxT(":lisp-quiet (defparameter $wxplot_pngcairo t)"));
+    commands.Add(wxT(":lisp-quiet (defparameter $wxplot_pngcairo t)"));
   else
-    SendMaxima(wxT(":lisp-quiet (defparameter $wxplot_pngcairo nil)"));
+    commands.Add(wxT(":lisp-quiet (defparameter $wxplot_pngcairo nil)"));
 
   int autosubscript = 1;
   config->Read(wxT("autosubscript"), &autosubscript);
@@ -1693,31 +1944,39 @@ void wxMaxima::SetupVariables()
     subscriptval="'all";
     break;
   }
-  SendMaxima(wxT(":lisp-quiet (defparameter $wxsubscripts ") + subscriptval + wxT(")"));
+  commands.Add(wxT(":lisp-quiet (defparameter $wxsubscripts ") + subscriptval + wxT(")"));
 
   int defaultPlotWidth = 600;
   config->Read(wxT("defaultPlotWidth"), &defaultPlotWidth);
   int defaultPlotHeight = 400;
   config->Read(wxT("defaultPlotHeight"), &defaultPlotHeight);
-  SendMaxima(wxString::Format(wxT(":lisp-quiet (defparameter $wxplot_size '((mlist simp) %i %i))"),defaultPlotWidth,defaultPlotHeight));
+  commands.Add(wxString::Format(wxT(":lisp-quiet (defparameter $wxplot_size '((mlist simp) %i %i))"),defaultPlotWidth,defaultPlotHeight));
   
 #if defined (__WXMSW__)
   wxString cwd = wxGetCwd();
   cwd.Replace(wxT("\\"), wxT("/"));
-  SendMaxima(wxT(":lisp-quiet ($load \"") + cwd + wxT("/data/wxmathml\")"));
+  commands.Add(wxT(":lisp-quiet ($load \"") + cwd + wxT("/data/wxmathml\")"));
 #elif defined (__WXMAC__)
   wxString cwd = wxGetCwd();
   cwd = cwd + wxT("/") + wxT(MACPREFIX);
-  SendMaxima(wxT(":lisp-quiet ($load \"") + cwd + wxT("wxmathml\")"));
+  commands.Add(wxT(":lisp-quiet ($load \"") + cwd + wxT("wxmathml\")"));
   // check for Gnuplot.app - use it if it exists
   wxString gnuplotbin(wxT("/Applications/Gnuplot.app/Contents/Resources/bin/gnuplot"));
   if (wxFileExists(gnuplotbin))
-    SendMaxima(wxT(":lisp-quiet (setf $gnuplot_command \"") + gnuplotbin + wxT("\")"));
+    commands.Add(wxT(":lisp-quiet (setf $gnuplot_command \"") + gnuplotbin + wxT("\")"));
 #else
   wxString prefix = wxT(PREFIX);
-  SendMaxima(wxT(":lisp-quiet ($load \"") + prefix +
-             wxT("/share/wxMaxima/wxmathml\")"));
+  commands.Add(wxT(":lisp-quiet ($load \"") + prefix +
+               wxT("/share/wxMaxima/wxmathml\")"));
 #endif
+  return commands;
+}
+
+void wxMaxima::SetupVariables()
+{
+  wxArrayString commands = SetupCommands(m_promptPrefix, m_promptSuffix);
+  for (size_t i = 0; i < commands.GetCount(); i++)
+    SendMaxima(commands[i]);
 
   if (m_currentFile != wxEmptyString)
   {
@@ -1725,20 +1984,17 @@ void wxMaxima::SetupVariables()
     
     SetCWD(filename);
   }
-  if(m_batchmode)
-    m_console->AddDocumentToEvaluationQueue();
 }
 
 ///--------------------------------------------------------------------------------
 ///  Getting configuration
 ///--------------------------------------------------------------------------------
 
-wxString wxMaxima::GetCommand(bool params)
+wxString wxMaxima::MaximaPath()
 {
 #if defined (__WXMSW__)
   wxConfig *config = (wxConfig *)wxConfig::Get();
   wxString maxima = wxGetCwd();
-  wxString parameters;
 
   if (maxima.Right(8) == wxT("wxMaxima"))
     maxima.Replace(wxT("wxMaxima"), wxT("bin\\maxima.bat"));
@@ -1749,24 +2005,12 @@ wxString wxMaxima::GetCommand(bool params)
   {
     config->Read(wxT("maxima"), &maxima);
     if (!wxFileExists(maxima))
-    {
-      wxMessageBox(_("wxMaxima could not find Maxima!\n\n"
-                     "Please configure wxMaxima with 'Edit->Configure'.\n"
-                     "Then start Maxima with 'Maxima->Restart Maxima'."),
-		   _("Warning"),
-                   wxOK | wxICON_EXCLAMATION);
-      SetStatusText(_("Please configure wxMaxima with 'Edit->Configure'."));
       return wxEmptyString;
-    }
   }
-
-  config->Read(wxT("parameters"), &parameters);
-  if (params)
-    return wxT("\"") + maxima + wxT("\" ") + parameters;
   return maxima;
 #else
   wxConfig *config = (wxConfig *)wxConfig::Get();
-  wxString command, parameters;
+  wxString command;
   bool have_config = config->Read(wxT("maxima"), &command);
 
   //Fix wrong" maxima=1" paraneter in ~/.wxMaxima if upgrading from 0.7.0a
@@ -1791,11 +2035,61 @@ wxString wxMaxima::GetCommand(bool params)
   if (command.Right(4) == wxT(".app")) // if pointing to a Maxima.app
     command.Append(wxT("/Contents/Resources/maxima.sh"));
 #endif
+  return command;
+#endif
+}
 
-  config->Read(wxT("parameters"), &parameters);
-  command = wxT("\"") + command + wxT("\" ") + parameters;
+wxString wxMaxima::MaximaCommand(int port)
+{
+  wxString maxima = MaximaPath();
+  if (maxima.IsEmpty())
+    return wxEmptyString;
+
+  wxString parameters;
+  wxConfig::Get()->Read(wxT("parameters"), &parameters);
+  wxString command = wxT("\"") + maxima + wxT("\" ") + parameters;
+
+#if defined(__WXMSW__)
+  // Unless maxima has been built with clisp maxima.bat is told the port using -s.
+  wxString clisp = maxima;
+  clisp.Replace("\\bin\\maxima.bat", "\\clisp-*.*");
+  if (wxFindFirstFile(clisp, wxDIR).empty())
+  {
+    command.Append(wxString::Format(wxT(" -s %d "), port));
+    return command;
+  }
+#endif
+  command.Append(wxString::Format(wxT(" -r \":lisp (setup-client %d)\""), port));
   return command;
+}
+
+void wxMaxima::MaximaNotFound()
+{
+  wxMessageBox(_("wxMaxima could not find Maxima!\n\n"
+                 "Please configure wxMaxima with 'Edit->Configure'.\n"
+                 "Then start Maxima with 'Maxima->Restart Maxima'."),
+               _("Warning"),
+               wxOK | wxICON_EXCLAMATION);
+  SetStatusText(_("Please configure wxMaxima with 'Edit->Configure'."));
+}
+
+wxString wxMaxima::GetCommand(bool params)
+{
+  wxString maxima = MaximaPath();
+  if (maxima.IsEmpty())
+  {
+    MaximaNotFound();
+    return wxEmptyString;
+  }
+
+#if defined (__WXMSW__)
+  if (!params)
+    return maxima;
 #endif
+
+  wxString parameters;
+  wxConfig::Get()->Read(wxT("parameters"), &parameters);
+  return wxT("\"") + maxima + wxT("\" ") + parameters;
 }
 
 ///--------------------------------------------------------------------------------
@@ -2055,6 +2349,10 @@ void wxMaxima::OnIdle(wxIdleEvent& event)
   UpdateToolBar(dummy);
   UpdateSlider(dummy);
 
+  // Parse and lay out the rest of a file that is being opened progressively.
+  if(ParsePendingCells() || m_console->RecalculateStep())
+    event.RequestMore();
+
   // If we have set the flag that tells us we should update the table of
   // contents sooner or later we should do so now that wxMaxima is idle.
   if(m_console->m_scheduleUpdateToc)
@@ -2153,6 +2451,8 @@ void wxMaxima::UpdateMenus(wxUpdateUIEvent& event)
     );
   
   menubar->Enable(menu_evaluate_all_visible, m_console->GetTree() != NULL);
+  menubar->Enable(menu_evaluate_sections_parallel, m_console->GetTree() != NULL);
+  menubar->Enable(menu_evaluate_stale, m_console->GetTree() != NULL);
   menubar->Enable(ToolBar::tb_evaltillhere,
                   (m_console->GetTree() != NULL) &&
                   (m_console->CanPaste()) &&
@@ -2174,6 +2474,8 @@ void wxMaxima::UpdateMenus(wxUpdateUIEvent& event)
   }
   else
     menubar->Check(menu_show_toolbar, false);
+  menubar->Enable(menu_show_evaluation_stats, m_console->GetTree() != NULL);
+  menubar->Check(menu_show_evaluation_stats, m_console->ShowEvaluationStats());
 
   if (m_console->GetTree() != NULL)
   {
@@ -2314,6 +2616,11 @@ void wxMaxima::OpenFile(wxString file, wxString cmd)
 
 bool wxMaxima::SaveFile(bool forceSave)
 {  
+  // Don't save a file we haven't completely read yet.
+  FinishPendingLoad();
+  // Don't let an autosave overwrite what we are about to write.
+  FinishAutoSave();
+
   wxString file = m_currentFile;
   wxString fileExt=wxT("wxmx");
   int ext=0;
@@ -2457,12 +2764,11 @@ void wxMaxima::ReadStdErr()
     
     // If maxima did output something it defintively has stopped.
     // The question is now if we want to try to send it something new to evaluate.
-    bool abortOnError = false;
-    wxConfig::Get()->Read(wxT("abortOnError"), &abortOnError);
-    SetBatchMode(false);
-    if(abortOnError || m_batchmode)
+    // maxima will evaluate the commands it already has got anyway
+    // => Their output still has to go to their cells.
+    if(m_abortOnError)
     {
-      m_console->m_evaluationQueue->Clear();
+      m_console->m_evaluationQueue->ClearUnsent();
       // Inform the user that the evaluation queue is empty.
       EvaluationQueueLength(0);
       m_console->ScrollToError();
@@ -2478,11 +2784,20 @@ void wxMaxima::OnTimerEvent(wxTimerEvent& event)
   case MAXIMA_STDOUT_POLL_ID:
     ReadStdErr();
   break;
+  case OUTPUT_FLUSH_TIMER_ID:
+    if(!m_pendingOutput.empty())
+    {
+      FlushPendingOutput();
+      // More output is likely to follow => Continue collecting it.
+      m_outputFlushTimer.StartOnce(OUTPUT_FLUSH_INTERVAL);
+    }
+    ResumeSocket();
+  break;
   case KEYBOARD_INACTIVITY_TIMER_ID:
     m_console->m_keyboardInactive = true;
     if((m_autoSaveIntervalExpired) && (m_currentFile.Length() > 0) && SaveNecessary())
     {
-      SaveFile(false);
+      AutoSave();
       m_autoSaveIntervalExpired = false;
       if(m_autoSaveInterval > 10000)
         m_autoSaveTimer.StartOnce(m_autoSaveInterval);
@@ -2492,7 +2807,7 @@ void wxMaxima::OnTimerEvent(wxTimerEvent& event)
     m_autoSaveIntervalExpired = true;
     if((m_console->m_keyboardInactive) && (m_currentFile.Length() > 0) && SaveNecessary())
     {
-      SaveFile(false);
+      AutoSave();
 	
       if(m_autoSaveInterval > 10000)
         m_autoSaveTimer.StartOnce(m_autoSaveInterval);
@@ -2502,8 +2817,55 @@ void wxMaxima::OnTimerEvent(wxTimerEvent& event)
   }
 }
 
+void wxMaxima::AutoSave()
+{
+  if (m_currentFile.Right(5) != wxT(".wxmx"))
+  {
+    SaveFile(false);
+    return;
+  }
+
+  // If the last autosave still is being written there is no need for
+  // starting another one.
+  if (m_autoSaveJob != NULL)
+    return;
+
+  // Don't save a file we haven't completely read yet.
+  FinishPendingLoad();
+
+  StatusSaveStart();
+  m_autoSaveJob = m_console->SnapshotWXMX(m_currentFile, this, AUTO_SAVE_FINISHED_ID);
+  m_autoSavePool->AddJob(m_autoSaveJob);
+}
+
+void wxMaxima::OnAutoSaveFinished(wxThreadEvent& WXUNUSED(event))
+{
+  FinishAutoSave();
+}
+
+void wxMaxima::FinishAutoSave()
+{
+  if (m_autoSaveJob == NULL)
+    return;
+
+  m_autoSavePool->Wait();
+  if (m_autoSaveJob->IsOk())
+  {
+    StatusSaveFinished();
+    AddRecentDocument(m_autoSaveJob->GetFile());
+  }
+  else
+  {
+    // The snapshot has marked the worksheet as saved, which it isn't.
+    m_console->SetSaved(false);
+    StatusSaveFailed();
+  }
+  wxDELETE(m_autoSaveJob);
+}
+
 void wxMaxima::FileMenu(wxCommandEvent& event)
 {
+  FinishPendingLoad();
   wxString expr = GetDefaultEntry();
   wxString cmd;
   bool forceSave = false;
@@ -2582,7 +2944,8 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
                             file + wxT(".") + fileExt,
                             _("HTML file (*.html)|*.html|"
                               "maxima batch file (*.mac)|*.mac|"
-                              "pdfLaTeX file (*.tex)|*.tex"
+                              "pdfLaTeX file (*.tex)|*.tex|"
+                              "Evaluation times (*.csv)|*.csv"
                               ),
                             wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
     
@@ -2590,6 +2953,8 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
       fileDialog.SetFilterIndex(0);
     else if (fileExt == wxT("mac"))
       fileDialog.SetFilterIndex(1);
+    else if (fileExt == wxT("csv"))
+      fileDialog.SetFilterIndex(3);
       else
         fileDialog.SetFilterIndex(2);
     
@@ -2605,7 +2970,8 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
         int ext = fileDialog.GetFilterIndex();
         if((file.Right(5) != wxT(".html")) &&
            (file.Right(4) != wxT(".mac")) &&
-           (file.Right(4) != wxT(".tex"))
+           (file.Right(4) != wxT(".tex")) &&
+           (file.Right(4) != wxT(".csv"))
           )
         {
           switch(ext)
@@ -2619,6 +2985,9 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
           case 2:
             file += wxT(".tex");
             break;
+          case 3:
+            file += wxT(".csv");
+            break;
           default: 
             file += wxT(".html");
           }
@@ -2637,6 +3006,20 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
           else
             StatusExportFinished();
         }
+        else if (file.Right(4) == wxT(".csv"))
+        {
+          StatusExportStart();
+
+          fileExt = wxT("csv");
+          if (!m_console->ExportEvaluationStats(file))
+          {
+            wxMessageBox(_("Exporting the evaluation times failed!"), _("Error!"),
+                         wxOK);
+            StatusExportFailed();
+          }
+          else
+            StatusExportFinished();
+        }
         else if (file.Right(4) == wxT(".mac"))
         {
           StatusExportStart();
@@ -2721,6 +3104,7 @@ void wxMaxima::FileMenu(wxCommandEvent& event)
 
 void wxMaxima::EditMenu(wxCommandEvent& event)
 {
+  FinishPendingLoad();
   if (m_console->m_findDialog != NULL) {
     event.Skip();
     return;
@@ -2928,6 +3312,9 @@ void wxMaxima::EditMenu(wxCommandEvent& event)
   case menu_fullscreen:
     ShowFullScreen( !IsFullScreen() );
     break;
+  case menu_show_evaluation_stats:
+    m_console->ShowEvaluationStats(event.IsChecked());
+    break;
   case menu_remove_output:
     m_console->RemoveAllOutput();
     break;
@@ -2983,6 +3370,7 @@ void wxMaxima::EditMenu(wxCommandEvent& event)
 
 void wxMaxima::OnFind(wxFindDialogEvent& event)
 {
+  FinishPendingLoad();
   if (!m_console->FindNext(event.GetFindString(),
                            event.GetFlags() & wxFR_DOWN,
                            !(event.GetFlags() & wxFR_MATCHCASE)))
@@ -2997,6 +3385,7 @@ void wxMaxima::OnFindClose(wxFindDialogEvent& event)
 
 void wxMaxima::OnReplace(wxFindDialogEvent& event)
 {
+  FinishPendingLoad();
   m_console->Replace(event.GetFindString(),
                      event.GetReplaceString(),
                      !(event.GetFlags() & wxFR_MATCHCASE)
@@ -3012,6 +3401,7 @@ void wxMaxima::OnReplace(wxFindDialogEvent& event)
 
 void wxMaxima::OnReplaceAll(wxFindDialogEvent& event)
 {
+  FinishPendingLoad();
   int count = m_console->ReplaceAll(
     event.GetFindString(),
     event.GetReplaceString(),
@@ -3104,10 +3494,12 @@ void wxMaxima::MaximaMenu(wxCommandEvent& event)
   break;
   case menu_evaluate_all_visible:
   {
+    // Commands that have been sent ahead can only be stopped by stopping maxima.
+    bool restart = m_console->m_evaluationQueue->CommandsSentAhead() > 0;
     m_console->m_evaluationQueue->Clear();
     m_console->ResetInputPrompts();
     EvaluationQueueLength(0);
-    StartMaxima();
+    StartMaxima(restart);
     m_console->AddDocumentToEvaluationQueue();
     // Inform the user about the length of the evaluation queue.
     EvaluationQueueLength(m_console->m_evaluationQueue->Size());
@@ -3116,22 +3508,40 @@ void wxMaxima::MaximaMenu(wxCommandEvent& event)
   break;
   case menu_evaluate_all:
   {
+    // Commands that have been sent ahead can only be stopped by stopping maxima.
+    bool restart = m_console->m_evaluationQueue->CommandsSentAhead() > 0;
     m_console->m_evaluationQueue->Clear();
     m_console->ResetInputPrompts();
     EvaluationQueueLength(0);
-    StartMaxima();
+    StartMaxima(restart);
     m_console->AddEntireDocumentToEvaluationQueue();
   // Inform the user about the length of the evaluation queue.
     EvaluationQueueLength(m_console->m_evaluationQueue->Size());
     TryEvaluateNextInQueue();
   }
   break;
+  case menu_evaluate_sections_parallel:
+    m_console->EvaluateSectionsInParallel(m_currentFile);
+    break;
+  case menu_evaluate_stale:
+  {
+    // Unlike the other "evaluate all" variants this one relies on maxima
+    // keeping its state => Don't restart it.
+    bool evaluating = !m_console->m_evaluationQueue->Empty() || m_console->QuestionPending();
+    m_console->AddStaleToEvaluationQueue();
+    EvaluationQueueLength(m_console->m_evaluationQueue->Size());
+    if(!evaluating)
+      TryEvaluateNextInQueue();
+  }
+  break;
   case ToolBar::tb_evaltillhere:
   {
+    // Commands that have been sent ahead can only be stopped by stopping maxima.
+    bool restart = m_console->m_evaluationQueue->CommandsSentAhead() > 0;
     m_console->m_evaluationQueue->Clear();
     m_console->ResetInputPrompts();
     EvaluationQueueLength(0);
-    StartMaxima();
+    StartMaxima(restart);
     m_console->AddDocumentTillHereToEvaluationQueue();
     // Inform the user about the length of the evaluation queue.
     EvaluationQueueLength(m_console->m_evaluationQueue->Size());
@@ -4688,6 +5098,7 @@ void wxMaxima::OnClose(wxCloseEvent& event)
 
 void wxMaxima::PopupMenu(wxCommandEvent& event)
 {
+  FinishPendingLoad();
   wxString selection = m_console->GetString();
   switch (event.GetId())
   {
@@ -4892,7 +5303,8 @@ void wxMaxima::PopupMenu(wxCommandEvent& event)
   {
     wxString file = wxFileSelector(_("Save animation to file"), m_lastPath,
                                    wxT("animation.gif"), wxT("gif"),
-                                   _("GIF image (*.gif)|*.gif"),
+                                   _("GIF image (*.gif)|*.gif|"
+                                     "Animated PNG (*.png)|*.png"),
                                    wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
     if (file.Length())
     {
@@ -4905,6 +5317,16 @@ void wxMaxima::PopupMenu(wxCommandEvent& event)
   case MathCtrl::popid_merge_cells:
     m_console->MergeCells();
     break;
+  case MathCtrl::popid_show_spilled_output:
+  {
+    MathCell *cell = m_console->GetSelectionEnd();
+    if(cell == NULL)
+      cell = m_console->GetSelectionStart();
+    GroupCell *group = dynamic_cast<GroupCell*>(cell);
+    if(group != NULL)
+      ShowSpilledOutput(group);
+  }
+  break;
   }
 }
 
@@ -4961,6 +5383,7 @@ void wxMaxima::EditInputMenu(wxCommandEvent& event)
 // of the working group, handle it carefully.
 void wxMaxima::EvaluateEvent(wxCommandEvent& event)
 {
+  FinishPendingLoad();
   bool evaluating = !m_console->m_evaluationQueue->Empty();
   m_console->FollowEvaluation(true);
   MathCell* tmp = m_console->GetActiveCell();
@@ -5206,7 +5629,19 @@ void wxMaxima::TryEvaluateNextInQueue()
         m_xmlInspector->Add(wxT("\n\n\nMAXIMA RESPONSE:\n\n"));
       }
       
-      SendMaxima(text, true);
+      // The command might already have been sent by SendCommandsAhead().
+      if(!m_console->m_evaluationQueue->IsCommandSent())
+      {
+        SendMaxima(text, true);
+        m_console->m_evaluationQueue->CommandSent();
+        if(m_console->m_evaluationQueue->m_workingGroupChanged)
+          m_console->CellEvaluated(tmp, m_console->m_evaluationQueue->GetInput());
+      }
+      // The latency of a cell whose commands have been sent ahead starts when
+      // they have been sent, not when the cell has become the working group.
+      if(m_console->m_evaluationQueue->m_workingGroupChanged)
+        tmp->GetEvaluationStats().Start(m_console->m_evaluationQueue->GetSentTime());
+      SendCommandsAhead();
 
       // Mark the current maxima process as "no more in its initial condition".
       m_hasEvaluatedCells = true;
@@ -5226,14 +5661,11 @@ void wxMaxima::TryEvaluateNextInQueue()
       m_console->SetWorkingGroup(NULL);
       m_console->Recalculate();
       m_console->Refresh();
-      bool abortOnError = false;
-      wxConfig::Get()->Read(wxT("abortOnError"), &abortOnError);
-      SetBatchMode(false);
       // Inform the user that the evaluation queue is empty.
       EvaluationQueueLength(0);
-      if(abortOnError || m_batchmode)
+      if(m_abortOnError)
       {
-        m_console->m_evaluationQueue->Clear();
+        m_console->m_evaluationQueue->ClearUnsent();
         StatusMaximaBusy(waiting);
         m_console->ScrollToError();
       }
@@ -5253,6 +5685,36 @@ void wxMaxima::TryEvaluateNextInQueue()
   }
 }
 
+void wxMaxima::SendCommandsAhead()
+{
+  bool pipelineCommands = false;
+  wxConfig::Get()->Read(wxT("pipelineCommands"), &pipelineCommands);
+  if(!pipelineCommands || m_console->QuestionPending())
+    return;
+
+  GroupCell *cell;
+  GroupCell *checkedCell = NULL;
+  wxString command;
+  wxString input;
+  while((m_console->m_evaluationQueue->CommandsSentAhead() < MAX_COMMANDS_AHEAD) &&
+        m_console->m_evaluationQueue->PeekAhead(cell, command, input))
+  {
+    // A cell maxima would choke on is reported by TryEvaluateNextInQueue()
+    // once it is the current one.
+    if(cell != checkedCell)
+    {
+      if(GetUnmatchedParenthesisState(cell->GetEditable()->ToString()) != wxEmptyString)
+        break;
+      checkedCell = cell;
+    }
+    SendMaxima(command, true);
+    m_console->m_evaluationQueue->SentAhead();
+    // A cell counts as evaluated with the input it had when it was sent.
+    if(input != wxEmptyString)
+      m_console->CellEvaluated(cell, input);
+  }
+}
+
 void wxMaxima::InsertMenu(wxCommandEvent& event)
 {
   int type = 0;
@@ -5651,7 +6113,9 @@ EVT_MENU(mac_closeId, wxMaxima::FileMenu)
 EVT_MENU(menu_check_updates, wxMaxima::HelpMenu)
 EVT_TIMER(KEYBOARD_INACTIVITY_TIMER_ID, wxMaxima::OnTimerEvent)
 EVT_TIMER(MAXIMA_STDOUT_POLL_ID, wxMaxima::OnTimerEvent)
+EVT_TIMER(OUTPUT_FLUSH_TIMER_ID, wxMaxima::OnTimerEvent)
 EVT_TIMER(AUTO_SAVE_TIMER_ID, wxMaxima::OnTimerEvent)
+EVT_THREAD(AUTO_SAVE_FINISHED_ID, wxMaxima::OnAutoSaveFinished)
 EVT_TIMER(wxID_ANY, wxMaxima::OnTimerEvent)
 EVT_COMMAND_SCROLL(ToolBar::plot_slider_id, wxMaxima::SliderEvent)
 EVT_MENU(MathCtrl::popid_copy, wxMaxima::PopupMenu)
@@ -5872,6 +6336,8 @@ EVT_UPDATE_UI(menu_copy_as_bitmap, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(menu_copy_to_file, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(menu_evaluate, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(menu_evaluate_all, wxMaxima::UpdateMenus)
+EVT_UPDATE_UI(menu_evaluate_sections_parallel, wxMaxima::UpdateMenus)
+EVT_UPDATE_UI(menu_evaluate_stale, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(ToolBar::tb_evaltillhere, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(menu_select_all, wxMaxima::UpdateMenus)
 EVT_UPDATE_UI(menu_undo, wxMaxima::UpdateMenus)
@@ -5926,10 +6392,13 @@ EVT_MENU(MathCtrl::popid_select_all, wxMaxima::PopupMenu)
 EVT_MENU(MathCtrl::popid_comment_selection, wxMaxima::PopupMenu)
 EVT_MENU(MathCtrl::popid_divide_cell, wxMaxima::PopupMenu)
 EVT_MENU(MathCtrl::popid_evaluate, wxMaxima::PopupMenu)
+EVT_MENU(MathCtrl::popid_show_spilled_output, wxMaxima::PopupMenu)
 EVT_MENU(MathCtrl::popid_evaluate_section, wxMaxima::PopupMenu)
 EVT_MENU(MathCtrl::popid_merge_cells, wxMaxima::PopupMenu)
 EVT_MENU(menu_evaluate_all_visible, wxMaxima::MaximaMenu)
 EVT_MENU(menu_evaluate_all, wxMaxima::MaximaMenu)
+EVT_MENU(menu_evaluate_sections_parallel, wxMaxima::MaximaMenu)
+EVT_MENU(menu_evaluate_stale, wxMaxima::MaximaMenu)
 EVT_MENU(ToolBar::tb_evaltillhere, wxMaxima::MaximaMenu)
 EVT_IDLE(wxMaxima::OnIdle)
 EVT_MENU(menu_remove_output, wxMaxima::EditMenu)
@@ -5937,6 +6406,7 @@ EVT_MENU_RANGE(menu_recent_document_0, menu_recent_document_9, wxMaxima::OnRecen
 EVT_MENU(menu_insert_image, wxMaxima::InsertMenu)
 EVT_MENU_RANGE(menu_pane_hideall, menu_pane_stats, wxMaxima::ShowPane)
 EVT_MENU(menu_show_toolbar, wxMaxima::EditMenu)
+EVT_MENU(menu_show_evaluation_stats, wxMaxima::EditMenu)
 EVT_LISTBOX_DCLICK(history_ctrl_id, wxMaxima::HistoryDClick)
 EVT_LISTBOX_DCLICK(structure_ctrl_id, wxMaxima::StructureDClick)
 EVT_BUTTON(menu_stats_histogram, wxMaxima::StatsMenu)
@@ -24,6 +24,7 @@
 
 #include "wxMaximaFrame.h"
 #include "MathParser.h"
+#include "ErrorMatcher.h"
 
 #include <wx/socket.h>
 #include <wx/config.h>
@@ -32,6 +33,8 @@
 #include <wx/html/htmlwin.h>
 #include <wx/dnd.h>
 
+#include <vector>
+
 #if defined (__WXMSW__)
  #include <wx/msw/helpchm.h>
 #endif
@@ -39,6 +42,10 @@
 #include <wx/html/helpctrl.h>
 
 #define SOCKET_SIZE 1024
+//! The minimum time between two displays of text maxima has output [in milliseconds]
+#define OUTPUT_FLUSH_INTERVAL 40
+//! The number of characters wxMaxima::AppendRawOutput() collects before we stop reading from maxima
+#define MAX_PENDING_OUTPUT 65536
 #define DOCUMENT_VERSION_MAJOR 1
 /*! The part of the .wxmx format version number that appears after the dot.
   
@@ -82,7 +89,11 @@ public:
     //! The time between two auto-saves has elapsed.
     AUTO_SAVE_TIMER_ID,
     //! We look if we got new data from maxima's stdout.
-    MAXIMA_STDOUT_POLL_ID
+    MAXIMA_STDOUT_POLL_ID,
+    //! Output that has arrived faster than the screen is refreshed has to be displayed.
+    OUTPUT_FLUSH_TIMER_ID,
+    //! The id of the wxThreadEvent that tells that a background autosave has finished.
+    AUTO_SAVE_FINISHED_ID
   };
 
   /*! A timer that determines when to do the next autosave;
@@ -100,8 +111,24 @@ public:
   bool m_autoSaveIntervalExpired;
   //! Is triggered when a timer this class is responsible for requires
   void OnTimerEvent(wxTimerEvent& event);
+  /*! Saves the current file in the background
+
+    Takes a snapshot of the worksheet and leaves compressing and writing it
+    to m_autoSavePool. .wxm files are cheap to write and are saved directly.
+   */
+  void AutoSave();
+  //! Is called when the background autosave has written the file
+  void OnAutoSaveFinished(wxThreadEvent& event);
+  //! Waits for a running background autosave and reports its result
+  void FinishAutoSave();
+  //! The thread background autosaves are written by
+  WorkerPool *m_autoSavePool;
+  //! The snapshot m_autoSavePool is writing, or NULL
+  WXMXSnapshot *m_autoSaveJob;
   //! A timer that polls for output from the maxima process.
   wxTimer m_maximaStdoutPollTimer;
+  //! Determines when the text in m_pendingOutput is displayed, see AppendRawOutput()
+  wxTimer m_outputFlushTimer;
 
   /*! The interval between auto-saves (in milliseconds). 
 
@@ -121,16 +148,33 @@ public:
   {
     m_openFile = file;
   }
-  void SetBatchMode(bool batch = false)
-  {
-    m_batchmode = batch;
-  }
   void StripComments(wxString& s);
   void SendMaxima(wxString s, bool history = false);
   void OpenFile(wxString file,
                 wxString command = wxEmptyString); //!< Open a file
   bool DocumentSaved() { return m_fileSaved; }
   void LoadImage(wxString file) { m_console->OpenHCaret(file, GC_TYPE_IMAGE); }
+  /*! A human-readable presentation of eventual unmatched-parenthesis type errors
+
+    If text doesn't contain any error this function returns wxEmptyString
+   */
+  static wxString GetUnmatchedParenthesisState(wxString text);
+  /*! The commands SetupVariables() sends to maxima
+
+    Don't depend on the window => Are used by BatchRunner, too.
+   */
+  static wxArrayString SetupCommands(wxString promptPrefix, wxString promptSuffix);
+  /*! The maxima binary or script to run
+
+    Returns wxEmptyString if maxima cannot be found.
+   */
+  static wxString MaximaPath();
+  /*! The command that starts maxima and makes it connect to port
+
+    Returns wxEmptyString if maxima cannot be found. Is used by MaximaKernel,
+    too.
+   */
+  static wxString MaximaCommand(int port);
 private:
   //! On opening a new file we only need a new maxima process if the old one ever evaluated cells.
   bool m_hasEvaluatedCells;
@@ -140,19 +184,24 @@ private:
   int m_outputCellsFromCurrentCommand;
   //! The maximum number of lines per command we will display 
   int m_maxOutputCellsPerCommand;
+  //! Recognizes maxima's error messages and the ones from the "errorPatterns" config key
+  ErrorMatcher m_errorMatcher;
+  //! Do we abort the evaluation queue if maxima reports an error?
+  bool m_abortOnError;
+  //! The text chunks AppendRawOutput() hasn't displayed yet
+  std::vector<wxString> m_pendingOutput;
+  //! The number of characters in m_pendingOutput
+  long m_pendingOutputLength;
+  //! Has ClientEvent() left data in the socket since the GUI is behind?
+  bool m_socketPaused;
+  //! The cell ShowSpilledOutput() appends to. NULL means: maxima's working group.
+  GroupCell *m_outputTarget;
   //! The number of consecutive unsucessfull attempts to connect to the maxima server
   int m_unsuccessfullConnectionAttempts;
   //! The current working directory maxima's file I/O is relative to.
   wxString m_CWD;
-  //! Are we in batch mode?
-  bool m_batchmode;
   //! Can we display the "ready" prompt right now?
   bool m_ready;
-  /*! A human-readable presentation of eventual unmatched-parenthesis type errors
-
-    If text doesn't contain any error this function returns wxEmptyString
-   */
-  wxString GetUnmatchedParenthesisState(wxString text);
 protected:
   //! Is called on start and whenever the configuration changes
   void ConfigChanged();
@@ -215,11 +264,30 @@ protected:
     until we got a full line we can display.
    */
   void ClientEvent(wxSocketEvent& event);
+  //! Reads one packet from maxima's socket and processes it
+  void ReadSocket();
+  //! Reads from the socket again if ClientEvent() has stopped doing so and the GUI has caught up
+  void ResumeSocket();
 
   void ConsoleAppend(wxString s, int type);        //!< append maxima output to console
   void DoConsoleAppend(wxString s, int type,       //
                        bool newLine = true, bool bigSkip = true);
   void DoRawConsoleAppend(wxString s, int type);   //
+  //! Converts text to a list of TextCells, one per line
+  MathCell *RawOutputCells(wxString s, int type);
+  /*! Appends a line of ordinary text maxima has output
+
+    If text arrives faster than the screen is refreshed it is collected in
+    m_pendingOutput and displayed by a single MathCtrl::InsertLine() every
+    OUTPUT_FLUSH_INTERVAL milliseconds.
+   */
+  void AppendRawOutput(wxString s);
+  //! Displays the text AppendRawOutput() has collected
+  void FlushPendingOutput();
+  //! Has so much text piled up that we should stop reading from maxima?
+  bool OutputBacklogged() { return m_pendingOutputLength > MAX_PENDING_OUTPUT; }
+  //! Appends the output that exceeded the output limit to the cell it belongs to
+  void ShowSpilledOutput(GroupCell *group);
 
   /*! Spawn the "configure" menu.
 
@@ -239,6 +307,13 @@ protected:
 
   //! Try to evaluate the next command for maxima that is in the evaluation queue
   void TryEvaluateNextInQueue();
+  /*! Sends the commands that follow the current one without waiting for its prompt
+
+    Is only done if the config entry "pipelineCommands" is set. Saves a round
+    trip between wxMaxima and maxima per command: maxima reads the commands
+    from its input buffer as soon as it has finished the current one.
+   */
+  void SendCommandsAhead();
   //! Trigger execution of the evaluation queue
   void TriggerEvaluation();
   void TryUpdateInspector();
@@ -258,6 +333,8 @@ protected:
   void OnClose(wxCloseEvent& event);               //!< close wxMaxima window
   wxString GetCommand(bool params = true);         //!< returns the command to start maxima
                                                    //    (uses guessConfiguration)
+  //! Tells the user that maxima could not be found
+  void MaximaNotFound();
 
   //! Polls the stderr and stdout of maxima for input.
   void ReadStdErr();
@@ -301,6 +378,12 @@ protected:
     \todo Add detection for lisp error prefixes for more lisps.
    */
   void ReadLispError(wxString &data);
+  /*! Restarts maxima after it has read commands that were sent ahead as something else
+
+    After that nobody can tell which output belongs to which cell any more.
+    \param reason The message that tells the user what has happened
+   */
+  void DiscardCommandsSentAhead(wxString reason);
   /*! Reads autocompletion templates we get on definition of a function or variable
 
     After processing the templates they are removed from data.
@@ -337,7 +420,50 @@ protected:
   //! Opens a wxmx file
   bool OpenWXMXFile(wxString file, MathCtrl *document, bool clearDocument = true);
   //! Loads a wxmx description
-  GroupCell* CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename = wxEmptyString);
+  GroupCell* CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename = wxEmptyString,
+                                   WXMXLoader *loader = NULL);
+  /*! Parses a list of group cells from a wxmx description
+
+    \param mp The parser to use
+    \param xmlcells The first xml node to parse. Is advanced to the first node that
+           hasn't been parsed yet (or to NULL if all nodes have been parsed).
+    \param maxCells The maximum number of group cells to parse. -1 means: No limit.
+    \param warning Do we still need to warn the user if a cell cannot be parsed?
+    \param layoutCache The layout cache entry for the first xml node, or NULL if
+           there is no layout cache. Is advanced together with xmlcells.
+    \param layoutCacheExact false, if the layout cache has been measured with
+           other fonts, zoom factor or window width. Its sizes are then only
+           used for output that hasn't been parsed yet.
+   */
+  GroupCell* ParseXMLCells(MathParser &mp, wxXmlNode **xmlcells, long maxCells, bool &warning,
+                           wxXmlNode **layoutCache = NULL, bool layoutCacheExact = true);
+  /*! Appends the next chunk of cells of a progressively opened file to the worksheet
+
+    \return true, if there are still cells left that haven't been parsed.
+   */
+  bool ParsePendingCells();
+  //! Parses all cells of a progressively opened file that haven't been parsed yet
+  void FinishPendingLoad();
+  //! Forgets about the rest of a progressively opened file
+  void DropPendingLoad();
+  /*! The xml tree of a .wxmx file that is still being parsed in the background
+
+    OpenWXMXFile() only parses the cells that are needed to display the first
+    screen. The rest is parsed in chunks while wxMaxima is idle.
+  */
+  wxXmlNode *m_pendingXmlRoot;
+  //! The next cell of m_pendingXmlRoot that has to be parsed
+  wxXmlNode *m_pendingXmlNode;
+  //! The loader that holds the images of the file that is still being parsed
+  WXMXLoader *m_pendingLoader;
+  //! The parser for the file that is still being parsed
+  MathParser *m_pendingParser;
+  //! Do we still need to warn about cells from m_pendingXmlRoot we cannot parse?
+  bool m_pendingWarning;
+  //! The layout cache entry for m_pendingXmlNode, or NULL
+  wxXmlNode *m_pendingLayoutCache;
+  //! Does m_pendingLayoutCache match the current fonts, zoom factor and window width?
+  bool m_pendingLayoutCacheExact;
   /*! Saves the current file
 
     \param forceSave true means: Always ask for a file name before saving.
@@ -416,21 +542,25 @@ private:
 
 #endif
 
+class BatchSession;
+
 class MyApp : public wxApp
 {
 public:
   virtual bool OnInit();
+  virtual int OnExit();
   wxLocale m_locale;
   /*! Create a new window
 
     \param file The file name
-    \param batchmode Do we want to execute the file and save it, but halt on error?
    */
-  void NewWindow(wxString file = wxEmptyString,bool batchmode=false);
+  void NewWindow(wxString file = wxEmptyString);
   //! Is called by atExit and tries to close down the maxima process if wxMaxima has crashed.
   static void Cleanup_Static();
   //! A pointer to the currently running wxMaxima instance
   static wxMaxima *m_frame;
+  //! The files we evaluate if we have been started with --batch, or NULL
+  BatchSession *m_batchSession;
 #if defined (__WXMAC__)
   wxWindowList topLevelWindows;
   void OnFileMenu(wxCommandEvent &ev);
@@ -507,6 +507,8 @@ void wxMaximaFrame::SetupMenu()
   m_Maxima_Panes_Sub->Append(menu_fullscreen, _("Full Screen\tAlt-Enter"),
                      _("Toggle full screen editing"),
                      wxITEM_NORMAL);
+  m_Maxima_Panes_Sub->AppendCheckItem(menu_show_evaluation_stats, _("Evaluation Times"),
+                                      _("Show how long the last evaluation of each cell took"));
 
   m_MenuBar->Append(m_Maxima_Panes_Sub,_("View"));
 
@@ -519,6 +521,10 @@ void wxMaximaFrame::SetupMenu()
                      _("Evaluate all visible cells in the document"), wxITEM_NORMAL);
   m_CellMenu->Append(menu_evaluate_all, _("Evaluate All Cells\tCtrl-Shift-R"),
                      _("Evaluate all cells in the document"), wxITEM_NORMAL);
+  m_CellMenu->Append(menu_evaluate_sections_parallel, _("Evaluate Sections in Parallel"),
+                     _("Evaluate every section of the selection or of the document by a maxima process of its own"), wxITEM_NORMAL);
+  m_CellMenu->Append(menu_evaluate_stale, _("Evaluate Stale Cells"),
+                     _("Evaluate the cells that have been changed and the ones that depend on them"), wxITEM_NORMAL);
   m_CellMenu->Append(ToolBar::tb_evaltillhere, _("Evaluate Cells above this point\tCtrl-Shift-P"),
                      _("Re-evaluate all cells above the one the cursor is in"), wxITEM_NORMAL);
 
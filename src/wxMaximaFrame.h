@@ -217,6 +217,8 @@ public:
     menu_add_path,
     menu_evaluate_all_visible,
     menu_evaluate_all,
+    menu_evaluate_sections_parallel,
+    menu_evaluate_stale,
     menu_show_tip,
     menu_copy_from_console,
     menu_copy_tex_from_console,
@@ -310,6 +312,7 @@ public:
     menu_format_pagebreak,
     menu_help_tutorials,
     menu_show_toolbar,
+    menu_show_evaluation_stats,
     menu_edit_find,
     menu_history_previous,
     menu_history_next,